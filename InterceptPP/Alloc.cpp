@@ -19,25 +19,120 @@
 
 #include "InterceptPP.h"
 #include "Alloc.h"
+#include "Logging.h"
 
 namespace InterceptPP {
 
+static const char *g_tagNames[ALLOC_TAG_COUNT] = {
+    "other",
+    "events",
+    "marshallers",
+    "hooks",
+    "plugins",
+};
+
+// What AppendStatsToElement() last reported, for the rates
+static volatile LONG g_reportLock = 0;
+static AllocStats g_lastReport;
+static DWORD g_lastReportTime = 0;
+
 void *
-AllocUtils::Malloc(size_t size)
+AllocUtils::Malloc(size_t size, bool zero)
 {
-    return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size);
+    return PrivateHeap::Allocate(size, zero);
 }
 
 void *
-AllocUtils::Realloc(void *ptr, size_t new_size)
+AllocUtils::Realloc(void *ptr, size_t new_size, bool zero)
 {
-    return HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, ptr, new_size);
+    return PrivateHeap::Reallocate(ptr, new_size, zero);
 }
 
 void
 AllocUtils::Free(void *ptr)
 {
-    HeapFree(GetProcessHeap(), 0, ptr);
+    PrivateHeap::Free(ptr);
+}
+
+const char *
+AllocUtils::GetTagName(AllocTag tag)
+{
+    if (tag < 0 || tag >= ALLOC_TAG_COUNT)
+        return "unknown";
+
+    return g_tagNames[tag];
+}
+
+void
+AllocUtils::GetStats(AllocStats &stats)
+{
+    PrivateHeap::GetStats(stats);
+}
+
+void
+AllocUtils::AppendStatsToElement(Logging::Element *el)
+{
+    AllocStats stats;
+    GetStats(stats);
+
+    while (InterlockedCompareExchange(&g_reportLock, 1, 0) != 0)
+        Sleep(0);
+
+    DWORD now = GetTickCount();
+    double seconds = (g_lastReportTime != 0) ? (now - g_lastReportTime) / 1000.0 : 0.0;
+
+    Logging::Element *allocEl = new Logging::Element("allocator");
+    allocEl->AddField("accounting", (GetAccountingEnabled()) ? "true" : "false");
+    allocEl->AddField("reservedBytes", stats.reservedBytes);
+    allocEl->AddField("liveBytes", stats.total.liveBytes);
+    allocEl->AddField("peakBytes", stats.total.peakBytes);
+    allocEl->AddField("allocatedBytes", stats.total.allocatedBytes);
+    allocEl->AddField("allocations", stats.total.allocations);
+
+    for (int i = 0; i < ALLOC_TAG_COUNT; i++)
+    {
+        const PrivateHeapTagStats &tag = stats.tags[i];
+
+        Logging::Element *tagEl = new Logging::Element("tag");
+        tagEl->AddField("name", g_tagNames[i]);
+        tagEl->AddField("liveBytes", tag.liveBytes);
+        tagEl->AddField("peakBytes", tag.peakBytes);
+        tagEl->AddField("allocatedBytes", tag.allocatedBytes);
+        tagEl->AddField("allocations", tag.allocations);
+        allocEl->AppendChild(tagEl);
+    }
+
+    // Only the classes that have seen any use
+    for (unsigned int i = 0; i <= PRIVATE_HEAP_CLASS_COUNT; i++)
+    {
+        const PrivateHeapClassStats &cls = stats.classes[i];
+        if (cls.allocations == 0)
+            continue;
+
+        Logging::Element *classEl = new Logging::Element("sizeClass");
+        if (i < PRIVATE_HEAP_CLASS_COUNT)
+            classEl->AddField("size", static_cast<unsigned int>(PrivateHeap::GetClassSize(i)));
+        else
+            classEl->AddField("size", "large");
+        classEl->AddField("allocations", cls.allocations);
+        // Frees may be counted before the allocations they match
+        classEl->AddField("liveBlocks", (cls.allocations > cls.frees) ? cls.allocations - cls.frees : 0);
+
+        if (seconds > 0.0)
+        {
+            PrivateHeapCounter recent = cls.allocations - g_lastReport.classes[i].allocations;
+            classEl->AddField("allocationsPerSecond", static_cast<unsigned int>(recent / seconds));
+        }
+
+        allocEl->AppendChild(classEl);
+    }
+
+    g_lastReport = stats;
+    g_lastReportTime = now;
+
+    InterlockedExchange(&g_reportLock, 0);
+
+    el->AppendChild(allocEl);
 }
 
 } // namespace InterceptPP
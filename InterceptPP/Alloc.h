@@ -18,15 +18,70 @@
 #pragma once
 
 #include "InterceptPP.h"
+#include "PrivateHeap.h"
 
 namespace InterceptPP {
 
+namespace Logging {
+    class Element;
+}
+
+//
+// Everything Intercept++ allocates goes through here, on to PrivateHeap.
+// Memory is zeroed like HEAP_ZERO_MEMORY used to unless the caller says
+// otherwise, which it should whenever it initializes the block itself.
+//
+// Allocations are accounted to the subsystem the calling thread is busy
+// with, as set by an AllocTagScope, and BaseObject and MyAlloc going
+// through here means that covers them as well.  Accounting is on unless
+// turned off with the hookManager's allocAccounting="false".
+//
+
+typedef enum {
+    ALLOC_TAG_OTHER = 0,
+    ALLOC_TAG_EVENTS,
+    ALLOC_TAG_MARSHALLERS,
+    ALLOC_TAG_HOOKS,
+    ALLOC_TAG_PLUGINS,
+
+    ALLOC_TAG_COUNT
+} AllocTag;
+
+typedef PrivateHeapStats AllocStats;
+
 class INTERCEPTPP_API AllocUtils
 {
 public:
-    static void *Malloc(size_t size);
-    static void *Realloc(void *ptr, size_t new_size);
+    static void *Malloc(size_t size, bool zero=true);
+    static void *Realloc(void *ptr, size_t new_size, bool zero=true);
     static void Free(void *ptr);
+
+    static bool GetAccountingEnabled() { return PrivateHeap::GetAccounting(); }
+    static void SetAccountingEnabled(bool enabled) { PrivateHeap::SetAccounting(enabled); }
+
+    static const char *GetTagName(AllocTag tag);
+
+    static void GetStats(AllocStats &stats);
+
+    // Allocation rates are per second since the previous call
+    static void AppendStatsToElement(Logging::Element *el);
+};
+
+class AllocTagScope
+{
+public:
+    AllocTagScope(AllocTag tag)
+        : m_previous(PrivateHeap::SetThreadTag(tag))
+    {
+    }
+
+    ~AllocTagScope()
+    {
+        PrivateHeap::SetThreadTag(m_previous);
+    }
+
+protected:
+    unsigned int m_previous;
 };
 
 } // namespace InterceptPP
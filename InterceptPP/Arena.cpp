@@ -0,0 +1,172 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "Arena.h"
+
+namespace InterceptPP {
+
+#define ARENA_BLOCK_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+static DWORD
+GetTlsIndex()
+{
+    static volatile LONG tlsIdx = static_cast<LONG>(TLS_OUT_OF_INDEXES);
+
+    if (tlsIdx == static_cast<LONG>(TLS_OUT_OF_INDEXES))
+    {
+        DWORD newIdx = TlsAlloc();
+        if (InterlockedCompareExchange(&tlsIdx, static_cast<LONG>(newIdx), static_cast<LONG>(TLS_OUT_OF_INDEXES))
+            != static_cast<LONG>(TLS_OUT_OF_INDEXES))
+        {
+            TlsFree(newIdx);
+        }
+    }
+
+    return static_cast<DWORD>(tlsIdx);
+}
+
+Arena::Arena()
+    : m_blocks(NULL), m_pos(NULL), m_end(NULL), m_nextBlockSize(ARENA_FIRST_BLOCK_SIZE),
+      m_refCount(1), m_lock(0), m_outer(NULL), m_left(false)
+{
+}
+
+Arena::~Arena()
+{
+    ArenaBlock *block = m_blocks;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        AllocUtils::Free(block);
+        block = next;
+    }
+
+    if (m_outer != NULL)
+        m_outer->Release();
+}
+
+void
+Arena::Release()
+{
+    if (InterlockedDecrement(&m_refCount) == 0)
+        delete this;
+}
+
+void *
+Arena::Allocate(size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~static_cast<size_t>(ARENA_ALIGNMENT - 1);
+
+    // Nodes are nearly always built by one thread, so this never spins
+    // for long
+    while (InterlockedCompareExchange(&m_lock, 1, 0) != 0)
+        Sleep(0);
+
+    char *p;
+
+    if (size <= static_cast<size_t>(m_end - m_pos))
+    {
+        p = m_pos;
+        m_pos += size;
+    }
+    else if (size > m_nextBlockSize / 4)
+    {
+        // Big payloads get a block of their own, leaving the current one
+        // for the small stuff that follows
+        p = AllocateBlock(size);
+    }
+    else
+    {
+        p = AllocateBlock(m_nextBlockSize);
+        if (p != NULL)
+        {
+            m_pos = p + size;
+            m_end = p + m_nextBlockSize;
+
+            if (m_nextBlockSize < ARENA_MAX_BLOCK_SIZE)
+                m_nextBlockSize *= 2;
+        }
+    }
+
+    InterlockedExchange(&m_lock, 0);
+
+    return p;
+}
+
+char *
+Arena::AllocateBlock(size_t size)
+{
+    ArenaBlock *block = static_cast<ArenaBlock *>(AllocUtils::Malloc(ARENA_BLOCK_HEADER_SIZE + size, false));
+    if (block == NULL)
+        return NULL;
+
+    block->next = m_blocks;
+    m_blocks = block;
+
+    return reinterpret_cast<char *>(block) + ARENA_BLOCK_HEADER_SIZE;
+}
+
+Arena *
+Arena::GetCurrent()
+{
+    return static_cast<Arena *>(TlsGetValue(GetTlsIndex()));
+}
+
+void
+Arena::SetCurrent(Arena *arena)
+{
+    DWORD tlsIdx = GetTlsIndex();
+
+    Arena *prev = static_cast<Arena *>(TlsGetValue(tlsIdx));
+    if (arena != NULL)
+        arena->AddRef();
+
+    TlsSetValue(tlsIdx, arena);
+
+    if (prev != NULL)
+        prev->Release();
+}
+
+void
+Arena::Enter()
+{
+    m_outer = GetCurrent();
+    if (m_outer != NULL)
+        m_outer->AddRef();
+
+    SetCurrent(this);
+}
+
+void
+Arena::Leave()
+{
+    m_left = true;
+
+    // Left out of order, so whoever was entered on top of us skips us
+    // when they leave.  Nothing to do on a thread we weren't entered on.
+    if (GetCurrent() != this)
+        return;
+
+    Arena *arena = m_outer;
+    while (arena != NULL && arena->m_left)
+        arena = arena->m_outer;
+
+    SetCurrent(arena);
+}
+
+} // namespace InterceptPP
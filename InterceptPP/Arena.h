@@ -0,0 +1,93 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "InterceptPP.h"
+
+namespace InterceptPP {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Bump allocator for the nodes of a logged event, the user mode
+// counterpart of the driver's Event::ReserveStorage().  Building an event
+// used to take a heap allocation for every node, field and string, and
+// deleting it another free for each.
+//
+// Logging::Event creates an arena and makes it the calling thread's
+// current one until the event is submitted.  Nodes created on that thread
+// in the meantime are allocated from it, along with their fields and
+// content.  Every node holds a reference, so one that ends up attached
+// somewhere else keeps the arena alive.  All of its memory goes back to
+// the heap in one go when the last reference is released, usually when
+// the logger deletes the event after serializing it.
+//
+
+#define ARENA_ALIGNMENT            8
+#define ARENA_FIRST_BLOCK_SIZE  4096
+#define ARENA_MAX_BLOCK_SIZE   65536
+
+class INTERCEPTPP_API Arena : public BaseObject
+{
+public:
+    Arena();
+    ~Arena();
+
+    void *Allocate(size_t size);
+
+    void AddRef() { InterlockedIncrement(&m_refCount); }
+    void Release();
+
+    // The arena new nodes on the calling thread come from, or NULL for the
+    // heap.  The thread holds a reference on it.
+    static Arena *GetCurrent();
+    static void SetCurrent(Arena *arena);
+
+    // Make this the calling thread's current arena for as long as an event
+    // is being built, and go back once it is done.  Events may finish in
+    // any order: Leave() hands the thread back to the innermost arena that
+    // is still entered, so one that was left never stays current.
+    void Enter();
+    void Leave();
+
+protected:
+    typedef struct ArenaBlockTag {
+        struct ArenaBlockTag *next;
+    } ArenaBlock;
+
+    ArenaBlock *m_blocks;
+    char *m_pos;
+    char *m_end;
+    size_t m_nextBlockSize;
+
+    volatile LONG m_refCount;
+    volatile LONG m_lock;
+
+    // The arena that was current when this one was entered, referenced
+    // until this one goes away
+    Arena *m_outer;
+    volatile bool m_left;
+
+    char *AllocateBlock(size_t size);
+};
+
+#pragma warning (pop)
+
+} // namespace InterceptPP
@@ -0,0 +1,403 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "BinaryWriter.h"
+#include "Clock.h"
+#include "PayloadTable.h"
+#include "Errors.h"
+#include "Util.h"
+
+namespace InterceptPP {
+
+namespace Logging {
+
+// Room for the payloadId field and the content header, so that a payload
+// assembled past them doesn't get overwritten as they're written
+#define PAYLOAD_SCRATCH_GAP 64
+
+static DWORD
+GetTlsIndex()
+{
+    static volatile LONG tlsIdx = static_cast<LONG>(TLS_OUT_OF_INDEXES);
+
+    if (tlsIdx == static_cast<LONG>(TLS_OUT_OF_INDEXES))
+    {
+        DWORD newIdx = TlsAlloc();
+        if (InterlockedCompareExchange(&tlsIdx, static_cast<LONG>(newIdx), static_cast<LONG>(TLS_OUT_OF_INDEXES))
+            != static_cast<LONG>(TLS_OUT_OF_INDEXES))
+        {
+            TlsFree(newIdx);
+        }
+    }
+
+    return static_cast<DWORD>(tlsIdx);
+}
+
+BinaryWriter::BinaryWriter()
+    : m_logger(NULL), m_id(0)
+{
+    memset(&m_stamp, 0, sizeof(m_stamp));
+
+    Initialize();
+}
+
+BinaryWriter::BinaryWriter(Logger *logger, unsigned int id, const OString &eventType)
+    : m_logger(logger), m_id(id)
+{
+    m_stamp.timestamp = Clock::GetTicks();
+    m_stamp.threadId = GetCurrentThreadId();
+    m_stamp.reserved = 0;
+
+    Initialize();
+
+    // Same as Event
+    BeginElement("event");
+
+    Field("id", id);
+
+    Field("type", eventType);
+
+    bool stamped = logger->UsesEventStamps();
+    if (!stamped)
+    {
+        FILETIME ft;
+        GetSystemTimeAsFileTime(&ft);
+        unsigned long long stamp = (((unsigned long long) ft.dwHighDateTime) << 32) | ((unsigned long long) ft.dwLowDateTime);
+        Field("timestamp", stamp);
+    }
+
+    Field("processName", Util::Instance()->GetProcessName());
+    Field("processId", GetCurrentProcessId());
+    if (!stamped)
+        Field("threadId", m_stamp.threadId);
+}
+
+void
+BinaryWriter::Initialize()
+{
+    DWORD tlsIdx = GetTlsIndex();
+
+    // The thread's spare buffer keeps its capacity in its first bytes
+    m_data = static_cast<char *>(TlsGetValue(tlsIdx));
+    if (m_data != NULL)
+    {
+        TlsSetValue(tlsIdx, NULL);
+        m_capacity = *reinterpret_cast<unsigned int *>(m_data);
+    }
+    else
+    {
+        m_capacity = BINARY_WRITER_INITIAL_SIZE;
+        m_data = static_cast<char *>(AllocUtils::Malloc(m_capacity, false));
+    }
+
+    m_size = 0;
+    m_depth = 0;
+    m_payloadCount = 0;
+}
+
+BinaryWriter::~BinaryWriter()
+{
+    CommitPayloads(false);
+
+    DWORD tlsIdx = GetTlsIndex();
+
+    if (m_capacity <= BINARY_WRITER_MAX_CACHED_SIZE && TlsGetValue(tlsIdx) == NULL)
+    {
+        *reinterpret_cast<unsigned int *>(m_data) = m_capacity;
+        TlsSetValue(tlsIdx, m_data);
+    }
+    else
+    {
+        AllocUtils::Free(m_data);
+    }
+}
+
+void
+BinaryWriter::Submit()
+{
+    Close();
+
+    if (m_logger != NULL)
+    {
+        CommitPayloads(m_logger->SubmitRecord(m_stamp, m_data, m_size));
+        m_logger = NULL;
+    }
+}
+
+void
+BinaryWriter::Close()
+{
+    while (m_depth > 0)
+        EndElement();
+}
+
+void
+BinaryWriter::CommitPayloads(bool logged)
+{
+    if (m_payloadCount == 0)
+        return;
+
+    if (logged)
+        PayloadTable::Instance()->Commit(m_payloadIds, m_payloadCount);
+    else
+        PayloadTable::Instance()->Discard(m_payloadIds, m_payloadCount);
+
+    m_payloadCount = 0;
+}
+
+void
+BinaryWriter::BeginElement(Symbol name)
+{
+    if (m_depth > 0)
+    {
+        OpenElement &parent = m_stack[m_depth - 1];
+        if (!parent.inChildren)
+            CloseFields(false, NULL, 0, NULL, 0);
+        parent.count++;
+    }
+
+    if (m_depth == BINARY_WRITER_MAX_DEPTH)
+        throw Error("elements nested too deeply");
+
+    AppendDWord(SYMBOL_REFERENCE | name.GetId());
+
+    OpenElement &el = m_stack[m_depth++];
+    el.countOffset = m_size;
+    el.count = 0;
+    el.inChildren = false;
+
+    AppendDWord(0);
+}
+
+void
+BinaryWriter::EndElement()
+{
+    if (m_depth == 0)
+        return;
+
+    OpenElement &el = m_stack[m_depth - 1];
+    if (!el.inChildren)
+        CloseFields(false, NULL, 0, NULL, 0);
+
+    PatchDWord(el.countOffset, el.count);
+    m_depth--;
+}
+
+void
+BinaryWriter::AppendNode(Node *node)
+{
+    WriteNode(node);
+    delete node;
+}
+
+void
+BinaryWriter::WriteNode(const Node *node)
+{
+    BeginElement(Symbol(node->GetNameId()));
+
+    for (const NodeField *field = node->GetFirstField(); field != NULL; field = field->next)
+        WriteField(Symbol(field->nameId), field->value, field->valueLength);
+
+    if (node->GetContentIsRaw() || node->GetContentSize() > 0)
+        WriteContent(node->GetContentIsRaw(), node->GetContent(), node->GetContentSize(), NULL, 0);
+
+    for (const Node *child = node->GetFirstChild(); child != NULL; child = child->GetNextSibling())
+        WriteNode(child);
+
+    EndElement();
+}
+
+void
+BinaryWriter::WriteField(Symbol name, const char *value, size_t length)
+{
+    if (m_depth == 0)
+        return;
+
+    OpenElement &el = m_stack[m_depth - 1];
+    if (el.inChildren)
+        throw Error("fields must be written before content and children");
+
+    AppendDWord(SYMBOL_REFERENCE | name.GetId());
+    AppendString(value, length);
+    el.count++;
+}
+
+void
+BinaryWriter::WriteContent(bool raw, const void *head, size_t headSize, const void *tail, size_t tailSize)
+{
+    if (m_depth == 0)
+        return;
+
+    if (m_stack[m_depth - 1].inChildren)
+        throw Error("content must be written before children");
+
+    CloseFields(raw, head, headSize, tail, tailSize);
+}
+
+void
+BinaryWriter::CloseFields(bool raw, const void *head, size_t headSize, const void *tail, size_t tailSize)
+{
+    OpenElement &el = m_stack[m_depth - 1];
+
+    if (raw)
+    {
+        WriteRawContent(head, headSize, tail, tailSize);
+    }
+    else
+    {
+        PatchDWord(el.countOffset, el.count);
+
+        AppendDWord(0);
+        AppendDWord(static_cast<DWORD>(headSize + tailSize));
+        AppendBytes(head, headSize);
+        AppendBytes(tail, tailSize);
+    }
+
+    el.countOffset = m_size;
+    el.count = 0;
+    el.inChildren = true;
+
+    AppendDWord(0);
+}
+
+void
+BinaryWriter::WriteRawContent(const void *head, size_t headSize, const void *tail, size_t tailSize)
+{
+    OpenElement &el = m_stack[m_depth - 1];
+    unsigned int size = static_cast<unsigned int>(headSize + tailSize);
+
+    unsigned int threshold = PayloadTable::GetThreshold();
+    if (threshold == 0 || size < threshold)
+    {
+        PatchDWord(el.countOffset, el.count);
+
+        AppendDWord(1);
+        AppendDWord(size);
+        AppendBytes(head, headSize);
+        AppendBytes(tail, tailSize);
+
+        return;
+    }
+
+    // The payload has to be contiguous to be looked up, so the head and tail
+    // of a truncated one are put together past where it'll end up
+    unsigned int scratchOffset = 0;
+    if (tailSize > 0)
+    {
+        unsigned int start = m_size;
+        Reserve(PAYLOAD_SCRATCH_GAP + size);
+        m_size = start;
+
+        scratchOffset = start + PAYLOAD_SCRATCH_GAP;
+        memcpy(m_data + scratchOffset, head, headSize);
+        memcpy(m_data + scratchOffset + headSize, tail, tailSize);
+    }
+
+    unsigned int payloadId = 0;
+    PayloadDisposition disposition = PayloadTable::Instance()->Lookup(
+        (tailSize > 0) ? m_data + scratchOffset : head, size, payloadId);
+
+    if (disposition == PAYLOAD_FIRST)
+    {
+        if (m_payloadCount < BINARY_WRITER_MAX_PAYLOADS)
+        {
+            m_payloadIds[m_payloadCount++] = payloadId;
+        }
+        else
+        {
+            PayloadTable::Instance()->Discard(&payloadId, 1);
+            disposition = PAYLOAD_INLINE;
+        }
+    }
+
+    if (disposition != PAYLOAD_INLINE)
+        Field((disposition == PAYLOAD_FIRST) ? "payloadId" : "payloadRef", payloadId);
+
+    PatchDWord(el.countOffset, el.count);
+
+    AppendDWord(1);
+
+    if (disposition == PAYLOAD_DUPLICATE)
+    {
+        AppendDWord(0);
+    }
+    else
+    {
+        AppendDWord(size);
+
+        if (tailSize > 0)
+        {
+            // Reserve() doesn't need to grow the buffer, there's room for it
+            char *p = Reserve(size);
+            memmove(p, m_data + scratchOffset, size);
+        }
+        else
+        {
+            AppendBytes(head, size);
+        }
+    }
+}
+
+char *
+BinaryWriter::Reserve(unsigned int size)
+{
+    if (m_size + size > m_capacity)
+    {
+        unsigned int capacity = m_capacity * 2;
+        while (capacity < m_size + size)
+            capacity *= 2;
+
+        m_data = static_cast<char *>(AllocUtils::Realloc(m_data, capacity, false));
+        m_capacity = capacity;
+    }
+
+    char *p = m_data + m_size;
+    m_size += size;
+
+    return p;
+}
+
+void
+BinaryWriter::AppendDWord(DWORD dw)
+{
+    memcpy(Reserve(sizeof(dw)), &dw, sizeof(dw));
+}
+
+void
+BinaryWriter::AppendString(const void *s, size_t size)
+{
+    AppendDWord(static_cast<DWORD>(size));
+    AppendBytes(s, size);
+}
+
+void
+BinaryWriter::AppendBytes(const void *p, size_t size)
+{
+    if (size > 0)
+        memcpy(Reserve(static_cast<unsigned int>(size)), p, size);
+}
+
+void
+BinaryWriter::PatchDWord(unsigned int offset, DWORD dw)
+{
+    memcpy(m_data + offset, &dw, sizeof(dw));
+}
+
+} // namespace Logging
+
+} // namespace InterceptPP
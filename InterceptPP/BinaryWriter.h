@@ -0,0 +1,141 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "Writer.h"
+
+namespace InterceptPP {
+
+namespace Logging {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Writes straight into the agent's binary log format, one node at a time:
+//
+//   name          symbol
+//   fieldCount    DWORD
+//   fields        symbol key, string value
+//   contentIsRaw  DWORD
+//   content       string
+//   childCount    DWORD
+//   children      nodes
+//
+// Strings are a DWORD length followed by that many bytes.  Names and keys
+// are symbols (see SymbolTable), a DWORD with the top bit set:
+//
+//   0x80000000 | id                        refers to a symbol defined earlier
+//   0xC0000000 | id, DWORD length, bytes   defines the symbol and uses it
+//
+// Records produced by a BinaryWriter only ever refer to symbols, as it
+// can't know what ends up before them in the file.  The logger turns the
+// first reference to each symbol into a definition as it writes them out,
+// so the symbol table is built up incrementally as the log is read.
+//
+// The counts are filled in as elements are closed, so fields have to come
+// before the content and the content before the children.  Raw content of
+// at least PayloadTable::GetThreshold() bytes is deduplicated on the way,
+// which takes whoever hands the record to the logger to CommitPayloads()
+// with whether it got logged in full.  Until then the payloads that first
+// appear in it don't get referenced, a writer that never gets there
+// forgets them as it's destroyed.
+//
+// Every thread keeps a spare buffer around, so writing an event doesn't
+// usually allocate anything but the writer itself.
+//
+// An event's EventStamp is taken as it's created, and goes into its
+// fields unless the logger UsesEventStamps().
+//
+
+#define SYMBOL_REFERENCE          0x80000000
+#define SYMBOL_DEFINITION         0xC0000000
+
+#define BINARY_WRITER_MAX_DEPTH           64
+#define BINARY_WRITER_INITIAL_SIZE      4096
+#define BINARY_WRITER_MAX_CACHED_SIZE  16384
+#define BINARY_WRITER_MAX_PAYLOADS        16
+
+class INTERCEPTPP_API BinaryWriter : public Writer
+{
+public:
+    // Writes nodes at the top level, like a whole Event
+    BinaryWriter();
+    // Writes an event for logger, with its "event" element open
+    BinaryWriter(Logger *logger, unsigned int id, const OString &eventType);
+    virtual ~BinaryWriter();
+
+    const char *GetData() const { return m_data; }
+    unsigned int GetSize() const { return m_size; }
+    const EventStamp &GetStamp() const { return m_stamp; }
+
+    virtual unsigned int GetId() const { return m_id; }
+    virtual void Submit();
+
+    virtual void BeginElement(Symbol name);
+    virtual void EndElement();
+    virtual void AppendNode(Node *node);
+
+    void Close();
+    void CommitPayloads(bool logged);
+
+protected:
+    virtual void WriteField(Symbol name, const char *value, size_t length);
+    virtual void WriteContent(bool raw, const void *head, size_t headSize, const void *tail, size_t tailSize);
+
+    typedef struct {
+        unsigned int countOffset;
+        unsigned int count;
+        bool inChildren;
+    } OpenElement;
+
+    Logger *m_logger;
+    unsigned int m_id;
+    EventStamp m_stamp;
+
+    char *m_data;
+    unsigned int m_size;
+    unsigned int m_capacity;
+
+    OpenElement m_stack[BINARY_WRITER_MAX_DEPTH];
+    int m_depth;
+
+    // What PayloadTable gave PAYLOAD_FIRST for, past the limit they're inline
+    unsigned int m_payloadIds[BINARY_WRITER_MAX_PAYLOADS];
+    unsigned int m_payloadCount;
+
+    char *Reserve(unsigned int size);
+    void AppendDWord(DWORD dw);
+    void AppendString(const void *s, size_t size);
+    void AppendBytes(const void *p, size_t size);
+    void PatchDWord(unsigned int offset, DWORD dw);
+
+    void CloseFields(bool raw, const void *head, size_t headSize, const void *tail, size_t tailSize);
+    void WriteNode(const Node *node);
+    void WriteRawContent(const void *head, size_t headSize, const void *tail, size_t tailSize);
+
+private:
+    void Initialize();
+};
+
+#pragma warning (pop)
+
+} // namespace Logging
+
+} // namespace InterceptPP
@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "CaptureBudget.h"
+
+namespace InterceptPP {
+
+#define CAPTURE_BUDGET_UNLIMITED 0xFFFFFFFF
+
+volatile unsigned int CaptureBudget::m_maxEventBytes = 0;
+volatile unsigned int CaptureBudget::m_maxArgumentBytes = 0;
+volatile unsigned int CaptureBudget::m_sampleThreshold = 0;
+volatile unsigned int CaptureBudget::m_sampleInterval = 0;
+
+CaptureBudgetStats CaptureBudget::m_stats = { 0, 0, 0, 0 };
+volatile LONG CaptureBudget::m_statsLock = 0;
+
+CaptureBudget::CaptureBudget()
+    : m_eventRemaining((m_maxEventBytes != 0) ? m_maxEventBytes : CAPTURE_BUDGET_UNLIMITED),
+      m_argumentRemaining(CAPTURE_BUDGET_UNLIMITED)
+{
+}
+
+void
+CaptureBudget::BeginArgument()
+{
+    m_argumentRemaining = (m_maxArgumentBytes != 0) ? m_maxArgumentBytes : CAPTURE_BUDGET_UNLIMITED;
+}
+
+void
+CaptureBudget::Reserve(CaptureBudget *budget, unsigned int count, unsigned int elementSize,
+                       volatile LONG *sampleCounter, CaptureSlice &slice)
+{
+    slice.head = count;
+    slice.tail = 0;
+    slice.sampledOut = false;
+
+    if (count == 0 || elementSize == 0)
+        return;
+
+    unsigned __int64 bytes = static_cast<unsigned __int64>(count) * elementSize;
+
+    unsigned int threshold = m_sampleThreshold;
+    unsigned int interval = m_sampleInterval;
+    if (threshold != 0 && interval > 1 && bytes >= threshold && sampleCounter != NULL)
+    {
+        unsigned int seen = static_cast<unsigned int>(InterlockedIncrement(sampleCounter)) - 1;
+        if (seen % interval != 0)
+        {
+            slice.head = 0;
+            slice.sampledOut = true;
+
+            AddStats(true, bytes);
+            return;
+        }
+    }
+
+    if (budget == NULL)
+        return;
+
+    unsigned __int64 allowed = bytes;
+    if (budget->m_eventRemaining < allowed)
+        allowed = budget->m_eventRemaining;
+    if (budget->m_argumentRemaining < allowed)
+        allowed = budget->m_argumentRemaining;
+
+    unsigned int allowedCount = static_cast<unsigned int>(allowed / elementSize);
+    if (allowedCount < count)
+    {
+        slice.head = allowedCount - allowedCount / 2;
+        slice.tail = allowedCount / 2;
+
+        AddStats(false, static_cast<unsigned __int64>(count - allowedCount) * elementSize);
+    }
+
+    unsigned int charge = allowedCount * elementSize;
+    if (budget->m_eventRemaining != CAPTURE_BUDGET_UNLIMITED)
+        budget->m_eventRemaining -= charge;
+    if (budget->m_argumentRemaining != CAPTURE_BUDGET_UNLIMITED)
+        budget->m_argumentRemaining -= charge;
+}
+
+void
+CaptureBudget::WriteMarkers(Logging::Writer &writer, unsigned int count, const CaptureSlice &slice)
+{
+    if (slice.sampledOut)
+    {
+        writer.Field("sampled", "true");
+    }
+    else if (slice.head + slice.tail < count)
+    {
+        writer.Field("truncated", count - slice.head - slice.tail);
+        writer.Field("head", slice.head);
+    }
+}
+
+void
+CaptureBudget::AddStats(bool sampled, unsigned __int64 bytes)
+{
+    // Only taken for buffers that don't fit, so spinning is good enough
+    while (InterlockedCompareExchange(&m_statsLock, 1, 0) != 0)
+        Sleep(0);
+
+    if (sampled)
+    {
+        m_stats.sampledBuffers++;
+        m_stats.sampledBytes += bytes;
+    }
+    else
+    {
+        m_stats.truncatedBuffers++;
+        m_stats.truncatedBytes += bytes;
+    }
+
+    InterlockedExchange(&m_statsLock, 0);
+}
+
+void
+CaptureBudget::GetStats(CaptureBudgetStats &stats)
+{
+    while (InterlockedCompareExchange(&m_statsLock, 1, 0) != 0)
+        Sleep(0);
+
+    stats = m_stats;
+
+    InterlockedExchange(&m_statsLock, 0);
+}
+
+void
+CaptureBudget::AppendStatsToElement(Logging::Element *el)
+{
+    CaptureBudgetStats stats;
+    GetStats(stats);
+
+    Logging::Element *capEl = new Logging::Element("capture");
+    capEl->AddField("truncatedBuffers", stats.truncatedBuffers);
+    capEl->AddField("truncatedBytes", stats.truncatedBytes);
+    capEl->AddField("sampledBuffers", stats.sampledBuffers);
+    capEl->AddField("sampledBytes", stats.sampledBytes);
+    el->AppendChild(capEl);
+}
+
+} // namespace InterceptPP
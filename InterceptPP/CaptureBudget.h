@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "InterceptPP.h"
+#include "Writer.h"
+
+namespace InterceptPP {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Limits how much of a variable-length buffer (ByteArray, Array) gets
+// copied into an event.  Each FunctionCall owns a CaptureBudget spanning
+// the event it logs, both directions included, and every argument also
+// gets an allowance of its own.  Marshallers ask Reserve() how much of a
+// buffer they may copy before they touch it.  A buffer that doesn't fit
+// keeps its head and its tail, and the value is marked up with:
+//
+//   truncated  number of elements left out in the middle
+//   head       number of elements before the gap
+//
+// Buffers of at least sampleThreshold bytes can also be sampled: only one
+// in every sampleInterval of them seen at the same marshaller is captured,
+// the others are logged with their size, no data and sampled="true".
+//
+// A limit of zero means no limit, which is also the default.
+//
+
+typedef struct {
+    unsigned int head;      // elements to copy from the start
+    unsigned int tail;      // elements to copy from the end
+    bool sampledOut;
+} CaptureSlice;
+
+typedef struct {
+    unsigned __int64 truncatedBuffers;
+    unsigned __int64 truncatedBytes;
+    unsigned __int64 sampledBuffers;
+    unsigned __int64 sampledBytes;
+} CaptureBudgetStats;
+
+class INTERCEPTPP_API CaptureBudget
+{
+public:
+    CaptureBudget();
+
+    static unsigned int GetMaxEventBytes() { return m_maxEventBytes; }
+    static void SetMaxEventBytes(unsigned int size) { m_maxEventBytes = size; }
+    static unsigned int GetMaxArgumentBytes() { return m_maxArgumentBytes; }
+    static void SetMaxArgumentBytes(unsigned int size) { m_maxArgumentBytes = size; }
+    static unsigned int GetSampleThreshold() { return m_sampleThreshold; }
+    static void SetSampleThreshold(unsigned int size) { m_sampleThreshold = size; }
+    static unsigned int GetSampleInterval() { return m_sampleInterval; }
+    static void SetSampleInterval(unsigned int interval) { m_sampleInterval = interval; }
+
+    // Start the allowance for the next argument or return value
+    void BeginArgument();
+
+    //
+    // Decides how many of count elements of elementSize bytes may be
+    // copied and charges them to the budget.  sampleCounter belongs to the
+    // marshaller doing the capture.  budget may be NULL, in which case
+    // everything fits.
+    //
+    static void Reserve(CaptureBudget *budget, unsigned int count, unsigned int elementSize,
+                        volatile LONG *sampleCounter, CaptureSlice &slice);
+
+    // Adds the truncated and head (or sampled) fields for a slice
+    static void WriteMarkers(Logging::Writer &writer, unsigned int count, const CaptureSlice &slice);
+
+    static void GetStats(CaptureBudgetStats &stats);
+    static void AppendStatsToElement(Logging::Element *el);
+
+protected:
+    unsigned int m_eventRemaining;
+    unsigned int m_argumentRemaining;
+
+    static volatile unsigned int m_maxEventBytes;
+    static volatile unsigned int m_maxArgumentBytes;
+    static volatile unsigned int m_sampleThreshold;
+    static volatile unsigned int m_sampleInterval;
+
+    static CaptureBudgetStats m_stats;
+    static volatile LONG m_statsLock;
+
+    static void AddStats(bool sampled, unsigned __int64 bytes);
+};
+
+#pragma warning (pop)
+
+} // namespace InterceptPP
@@ -0,0 +1,117 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "Clock.h"
+
+namespace InterceptPP {
+
+bool Clock::m_calibrated = false;
+unsigned __int64 Clock::m_ticksPerSecond = 0;
+unsigned __int64 Clock::m_ticks = 0;
+unsigned __int64 Clock::m_fileTime = 0;
+LARGE_INTEGER Clock::m_counter;
+LARGE_INTEGER Clock::m_counterFrequency;
+
+static unsigned __int64
+GetFileTime()
+{
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return (static_cast<unsigned __int64>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+// Returns the new system time, with the counters as they were right before
+static unsigned __int64
+WaitForTimeChange(unsigned __int64 &ticks, LARGE_INTEGER &counter)
+{
+    unsigned __int64 before = GetFileTime();
+    unsigned __int64 now;
+
+    do
+    {
+        ticks = __rdtsc();
+        QueryPerformanceCounter(&counter);
+        now = GetFileTime();
+    }
+    while (now == before);
+
+    return now;
+}
+
+static unsigned __int64
+GetRate(unsigned __int64 ticks, const LARGE_INTEGER &counter, unsigned __int64 startTicks,
+        const LARGE_INTEGER &startCounter, const LARGE_INTEGER &frequency)
+{
+    if (frequency.QuadPart == 0 || counter.QuadPart <= startCounter.QuadPart)
+        return 0;
+
+    double seconds = static_cast<double>(counter.QuadPart - startCounter.QuadPart) / frequency.QuadPart;
+
+    return static_cast<unsigned __int64>(static_cast<double>(ticks - startTicks) / seconds + 0.5);
+}
+
+void
+Clock::GetCalibration(unsigned __int64 &ticksPerSecond, unsigned __int64 &ticks, unsigned __int64 &fileTime)
+{
+    if (!m_calibrated)
+        Calibrate();
+
+    ticksPerSecond = m_ticksPerSecond;
+    ticks = m_ticks;
+    fileTime = m_fileTime;
+}
+
+unsigned __int64
+Clock::MeasureTicksPerSecond()
+{
+    if (!m_calibrated)
+        Calibrate();
+
+    LARGE_INTEGER counter;
+    unsigned __int64 ticks = __rdtsc();
+    QueryPerformanceCounter(&counter);
+
+    unsigned __int64 rate = GetRate(ticks, counter, m_ticks, m_counter, m_counterFrequency);
+    return (rate != 0) ? rate : m_ticksPerSecond;
+}
+
+void
+Clock::Calibrate()
+{
+    QueryPerformanceFrequency(&m_counterFrequency);
+
+    m_fileTime = WaitForTimeChange(m_ticks, m_counter);
+
+    unsigned __int64 ticks, fileTime;
+    LARGE_INTEGER counter;
+    do
+    {
+        fileTime = WaitForTimeChange(ticks, counter);
+    }
+    while (fileTime - m_fileTime < CLOCK_CALIBRATION_TIME * 10000);
+
+    m_ticksPerSecond = GetRate(ticks, counter, m_ticks, m_counter, m_counterFrequency);
+    if (m_ticksPerSecond == 0)
+    {
+        // No performance counter, so make do with the system time
+        m_ticksPerSecond = (ticks - m_ticks) * 10000000 / (fileTime - m_fileTime);
+    }
+
+    m_calibrated = true;
+}
+
+} // namespace InterceptPP
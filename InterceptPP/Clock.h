@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "InterceptPP.h"
+#include <intrin.h>
+
+namespace InterceptPP {
+
+//
+// Timestamps events with the processor's time-stamp counter, which takes
+// a few cycles to read.  The system time costs more and only moves every
+// 10 to 16 ms, too coarse to tell how long a call took or which of two
+// threads came first.
+//
+// A log relates the counter to the system time with a calibration, see
+// LogFileHeader.  It's taken the first time it's asked for, which takes
+// a few tens of milliseconds: the counter is read right as the system
+// time moves on, and again once it has moved on by CLOCK_CALIBRATION_TIME
+// or more, and the rate is measured against QueryPerformanceCounter() in
+// between.  MeasureTicksPerSecond() does the same from the calibration
+// until now, which gets closer the longer that is.
+//
+// This takes the counter to run at a constant rate and in step across
+// processors, as it does on the processors of the last several years.
+//
+
+#define CLOCK_CALIBRATION_TIME  20  // ms
+
+class INTERCEPTPP_API Clock
+{
+public:
+    static unsigned __int64 GetTicks() { return __rdtsc(); }
+
+    // ticks is what the counter was at when the system time was fileTime.
+    // The first call mustn't race with another.
+    static void GetCalibration(unsigned __int64 &ticksPerSecond, unsigned __int64 &ticks, unsigned __int64 &fileTime);
+    static unsigned __int64 MeasureTicksPerSecond();
+
+protected:
+    static void Calibrate();
+
+    static bool m_calibrated;
+    static unsigned __int64 m_ticksPerSecond;
+    static unsigned __int64 m_ticks;
+    static unsigned __int64 m_fileTime;
+    static LARGE_INTEGER m_counter;
+    static LARGE_INTEGER m_counterFrequency;
+};
+
+} // namespace InterceptPP
@@ -47,23 +47,21 @@ ConsoleLogger::PrintNode(Node *node, int level)
 
     if (node->GetFieldCount() > 0)
     {
-        Logging::Node::FieldListConstIter iter, endIter = node->FieldsIterEnd();
-        for (iter = node->FieldsIterBegin(); iter != endIter; iter++)
+        for (const NodeField *field = node->GetFirstField(); field != NULL; field = field->next)
         {
-            cout << indentStr << "\t" << iter->first << ": " << iter->second << endl;
+            cout << indentStr << "\t" << field->name << ": " << field->value << endl;
         }
 
         cout << endl;
     }
 
-    const OString &content = node->GetContent();
-    if (content.size() > 0)
+    if (node->GetContentSize() > 0)
     {
         cout << indentStr << "\tContent:" << endl;
 
         if (!node->GetContentIsRaw())
         {
-            cout << indentStr << "\t\t" << content << endl;
+            cout << indentStr << "\t\t" << node->GetContent() << endl;
         }
         else
         {
@@ -75,11 +73,9 @@ ConsoleLogger::PrintNode(Node *node, int level)
     {
         cout << indentStr << "\tChildren:" << endl;
 
-        Logging::Node::ChildListConstIter iter, endIter = node->ChildrenIterEnd();
-
-        for (iter = node->ChildrenIterBegin(); iter != endIter; iter++)
+        for (Node *child = node->GetFirstChild(); child != NULL; child = child->GetNextSibling())
         {
-            PrintNode(*iter, level + 2);
+            PrintNode(child, level + 2);
         }
     }
 
@@ -19,6 +19,9 @@
 #include "NullLogger.h"
 #include "HookManager.h"
 #include "Util.h"
+#include "Format.h"
+#include "MemoryMap.h"
+#include "RawCapture.h"
 #include <udis86.h>
 
 #define ENABLE_BACKTRACE_SUPPORT 1
@@ -211,6 +214,38 @@ Argument::ToString (ArgumentDirection direction, bool deep, IPropertyProvider *
     return m_spec->GetMarshaller (direction)->ToString (m_data, deep, propProv);
 }
 
+void
+ArgumentSpec::CompileMarshallers ()
+{
+    if (m_marshallerIn != NULL)
+        m_programIn = Marshaller::Program::Compile (m_marshallerIn);
+
+    if (m_marshallerOut == m_marshallerIn)
+        m_programOut = m_programIn;
+    else if (m_marshallerOut != NULL)
+        m_programOut = Marshaller::Program::Compile (m_marshallerOut);
+
+    // Register the types up front so that most of them make it into the
+    // schema logged at startup
+    if (RawSchema::GetEnabled ())
+    {
+        if (m_marshallerIn != NULL)
+            m_marshallerIn->GetRawTypeId ();
+        if (m_marshallerOut != NULL)
+            m_marshallerOut->GetRawTypeId ();
+    }
+}
+
+void
+ArgumentSpec::ResolvePropertyQueries (const IPropertyResolver & resolver)
+{
+    if (m_marshallerIn != NULL)
+        m_marshallerIn->ResolvePropertyQueries (resolver);
+
+    if (m_marshallerOut != NULL && m_marshallerOut != m_marshallerIn)
+        m_marshallerOut->ResolvePropertyQueries (resolver);
+}
+
 bool
 Argument::ToInt (ArgumentDirection direction, int & result) const
 {
@@ -288,6 +323,31 @@ ArgumentListSpec::AddArgument (ArgumentSpec * arg)
     arg->SetOffset (m_size);
 
     m_size += arg->GetMarshaller (ARG_DIR_UNKNOWN)->GetSize ();
+
+    arg->CompileMarshallers ();
+
+    // Bindings may refer to arguments that come after them, and the
+    // compiled programs point at the marshallers' queries, so it's enough
+    // to resolve them all again
+    for (unsigned int i = 0; i < m_arguments.size (); i++)
+    {
+        m_arguments[i]->ResolvePropertyQueries (*this);
+    }
+}
+
+bool
+ArgumentListSpec::ResolveArgument (const OString & name, unsigned int & index) const
+{
+    for (unsigned int i = 0; i < m_arguments.size (); i++)
+    {
+        if (m_arguments[i]->GetName () == name)
+        {
+            index = i;
+            return true;
+        }
+    }
+
+    return false;
 }
 
 ArgumentList::ArgumentList(ArgumentListSpec *spec, void *data)
@@ -675,6 +735,8 @@ CARRY_ON:
 FunctionTrampoline *
 Function::OnEnterWrapper(CpuContext *cpuCtx, unsigned int *unwindSize, FunctionTrampoline *trampoline, void *btAddr, DWORD *lastError)
 {
+    AllocTagScope allocTag(ALLOC_TAG_HOOKS);
+
     // Keep track of the function call
     FunctionCall *call = new FunctionCall(this, btAddr, cpuCtx);
     call->SetCpuContextLive(cpuCtx);
@@ -726,6 +788,8 @@ Function::OnEnterWrapper(CpuContext *cpuCtx, unsigned int *unwindSize, FunctionT
         }
     }
 
+    m_spec->GetStats ().Add (call->GetCycleCounters ());
+
     delete call;
     return NULL;
 }
@@ -810,6 +874,8 @@ Function::OnLeaveWrapper(CpuContext *cpuCtx, FunctionTrampoline *trampoline, Fun
     // Do some logging
     OnLeave(call);
 
+    m_spec->GetStats ().Add (call->GetCycleCounters ());
+
     delete trampoline;
     delete call;
 }
@@ -819,30 +885,49 @@ Function::OnEnter (FunctionCall * call)
 {
     bool shouldLog = true;
 
+    CallCycleCounters & counters = call->GetCycleCounters ();
+    counters.Start ();
+
     const FunctionCallHandlerVector & handlers = m_spec->GetHandlers ();
     if (handlers.size () > 0)
     {
+        AllocTagScope allocTag (ALLOC_TAG_PLUGINS);
         FunctionCallHandlerVector::const_iterator it;
 
         for (it = handlers.begin (); it != handlers.end (); it++)
             (**it) (call, shouldLog);
     }
 
+    counters.Lap (STATS_PHASE_HANDLERS);
+
     if (shouldLog)
     {
-        Logging::Event * ev = GetLogger ()->NewEvent ("FunctionCall");
+        AllocTagScope allocTag (ALLOC_TAG_EVENTS);
+
+        Logging::Writer * writer = GetLogger ()->NewEventWriter ("FunctionCall");
 
-        Logging::TextNode * textNode = new Logging::TextNode ("name", GetFullName ());
-        ev->AppendChild (textNode);
+        writer->TextElement ("name", GetFullName ());
+        counters.Lap (STATS_PHASE_EVENT_CONSTRUCTION);
 
-        call->AppendBacktraceToElement (ev);
-        call->AppendCpuContextToElement (ev);
-        call->AppendArgumentsToElement (ev);
+        call->WriteBacktrace (*writer);
+        counters.Lap (STATS_PHASE_BACKTRACE);
+
+        call->WriteCpuContext (*writer);
+        counters.Lap (STATS_PHASE_EVENT_CONSTRUCTION);
+
+        call->WriteArguments (*writer);
+        counters.Lap (STATS_PHASE_MARSHALLING);
 
         if (call->GetShouldCarryOn ())
-            call->SetLogEvent (ev);
+        {
+            call->SetLogWriter (writer);
+        }
         else
-            ev->Submit ();
+        {
+            writer->Submit ();
+            delete writer;
+            counters.Lap (STATS_PHASE_SUBMIT);
+        }
     }
 }
 
@@ -850,31 +935,50 @@ void
 Function::OnLeave (FunctionCall * call)
 {
     bool shouldLog = true;
+
+    // Restart so that the time spent inside the original function isn't counted
+    CallCycleCounters & counters = call->GetCycleCounters ();
+    counters.Start ();
+
     const FunctionCallHandlerVector & handlers = call->GetFunction ()->GetSpec ()->GetHandlers ();
     if (handlers.size () > 0)
     {
+        AllocTagScope allocTag (ALLOC_TAG_PLUGINS);
         FunctionCallHandlerVector::const_iterator it;
 
         for (it = handlers.begin (); it != handlers.end (); it++)
             (**it) (call, shouldLog);
     }
 
+    counters.Lap (STATS_PHASE_HANDLERS);
+
+    Logging::Writer * writer = call->GetLogWriter ();
+    if (writer == NULL)
+        return;
+
+    AllocTagScope allocTag (ALLOC_TAG_EVENTS);
+
     if (shouldLog)
     {
-        Logging::Event * ev = call->GetLogEvent ();
+        call->WriteCpuContext (*writer);
+        counters.Lap (STATS_PHASE_EVENT_CONSTRUCTION);
 
-        if (ev != NULL)
-        {
-            call->AppendCpuContextToElement (ev);
-            call->AppendArgumentsToElement (ev);
-            call->AppendReturnValueToElement (ev);
-            call->AppendLastErrorToElement (ev);
+        call->WriteArguments (*writer);
+        call->WriteReturnValue (*writer);
+        counters.Lap (STATS_PHASE_MARSHALLING);
 
-            ev->Submit ();
-        }
+        call->WriteLastError (*writer);
+        counters.Lap (STATS_PHASE_EVENT_CONSTRUCTION);
+
+        writer->Submit ();
+        counters.Lap (STATS_PHASE_SUBMIT);
     }
 
-    // FIXME: free event if OnEnter started logging but OnLeave set shouldLog to false
+    // Also throws away the event if a handler decided against logging it
+    // after all
+    delete writer;
+    call->SetLogWriter (NULL);
+
     // FIXME: multiple plugins and SetUserData() is a bad idea right now
 }
 
@@ -886,6 +990,7 @@ FunctionCall::FunctionCall(Function *function, void *btAddr, CpuContext *cpuCtxE
       m_arguments(NULL),
       m_state(FUNCTION_CALL_ENTERING),
       m_shouldCarryOn(true),
+      m_logWriter(NULL),
       m_userData(NULL)
 {
     memset(&m_cpuCtxLeave, 0, sizeof(m_cpuCtxLeave));
@@ -929,52 +1034,63 @@ FunctionCall::ShouldLogArgumentDeep(const Argument * arg) const
 }
 
 void
-FunctionCall::AppendBacktraceToElement (Logging::Element * el)
+FunctionCall::WriteBacktrace (Logging::Writer & writer)
 {
 #if ENABLE_BACKTRACE_SUPPORT
-    Logging::Node * btNode = Util::Instance ()->CreateBacktraceNode (m_backtraceAddress);
-    if (btNode != NULL)
-    {
-        el->AppendChild (btNode);
-    }
+    Util::Instance ()->WriteBacktrace (writer, m_backtraceAddress);
 #endif
 }
 
 void
-FunctionCall::AppendCpuContextToElement(Logging::Element *el)
+FunctionCall::WriteCpuContext(Logging::Writer &writer)
 {
-    Logging::Element *ctxEl = new Logging::Element("cpuContext");
+    writer.BeginElement("cpuContext");
 
-    ctxEl->AddField("direction", (m_state == FUNCTION_CALL_ENTERING) ? "in" : "out");
+    writer.Field("direction", (m_state == FUNCTION_CALL_ENTERING) ? "in" : "out");
 
-    AppendCpuRegisterToElement(ctxEl, "eax", m_cpuCtxLive->eax);
-    AppendCpuRegisterToElement(ctxEl, "ebx", m_cpuCtxLive->ebx);
-    AppendCpuRegisterToElement(ctxEl, "ecx", m_cpuCtxLive->ecx);
-    AppendCpuRegisterToElement(ctxEl, "edx", m_cpuCtxLive->edx);
-    AppendCpuRegisterToElement(ctxEl, "edi", m_cpuCtxLive->edi);
-    AppendCpuRegisterToElement(ctxEl, "esi", m_cpuCtxLive->esi);
-    AppendCpuRegisterToElement(ctxEl, "ebp", m_cpuCtxLive->ebp);
-    AppendCpuRegisterToElement(ctxEl, "esp", m_cpuCtxLive->esp);
+    WriteCpuRegister(writer, "eax", m_cpuCtxLive->eax);
+    WriteCpuRegister(writer, "ebx", m_cpuCtxLive->ebx);
+    WriteCpuRegister(writer, "ecx", m_cpuCtxLive->ecx);
+    WriteCpuRegister(writer, "edx", m_cpuCtxLive->edx);
+    WriteCpuRegister(writer, "edi", m_cpuCtxLive->edi);
+    WriteCpuRegister(writer, "esi", m_cpuCtxLive->esi);
+    WriteCpuRegister(writer, "ebp", m_cpuCtxLive->ebp);
+    WriteCpuRegister(writer, "esp", m_cpuCtxLive->esp);
 
-    el->AppendChild(ctxEl);
+    writer.EndElement();
 }
 
 void
-FunctionCall::AppendCpuRegisterToElement(Logging::Element *el, const char *name, DWORD value)
+FunctionCall::WriteCpuRegister(Logging::Writer &writer, const char *name, DWORD value)
 {
-    Logging::Element *regEl = new Logging::Element("register");
-    el->AppendChild(regEl);
-    regEl->AddField("name", name);
+    writer.BeginElement("register");
+    writer.Field("name", name);
 
-    OOStringStream ss;
-    if (value != 0)
-        ss << "0x" << hex;
-    ss << value;
-    regEl->AddField("value", ss.str());
+    char buf[FORMAT_MAX_LENGTH];
+    writer.Field("value", buf, Format::Integer(buf, static_cast<int>(value), false, true) - buf);
+
+    writer.EndElement();
+}
+
+void
+FunctionCall::WriteValue(Logging::Writer &writer, const ArgumentSpec *argSpec, const Argument *arg, bool deep)
+{
+    ArgumentDirection direction = GetCurrentArgumentDirection();
+    IPropertyProvider *propProv = this;
+
+    m_captureBudget.BeginArgument();
+
+    const Marshaller::Program *program = argSpec->GetProgram(direction);
+    if (RawSchema::GetEnabled())
+        RawSchema::WriteValue(writer, argSpec->GetMarshaller(direction), arg->GetData(), deep, propProv);
+    else if (program != NULL && Marshaller::Program::GetEnabled())
+        program->Execute(writer, arg->GetData(), deep, propProv);
+    else
+        argSpec->GetMarshaller(direction)->WriteValue(writer, arg->GetData(), deep, propProv);
 }
 
 void
-FunctionCall::AppendArgumentsToElement(Logging::Element *el)
+FunctionCall::WriteArguments(Logging::Writer &writer)
 {
     FunctionSpec *spec = m_function->GetSpec();
 
@@ -991,9 +1107,8 @@ FunctionCall::AppendArgumentsToElement(Logging::Element *el)
 
         if (logIt)
         {
-            Logging::Element *argsEl = new Logging::Element("arguments");
-            el->AppendChild(argsEl);
-            argsEl->AddField("direction", (m_state == FUNCTION_CALL_ENTERING) ? "in" : "out");
+            writer.BeginElement("arguments");
+            writer.Field("direction", (m_state == FUNCTION_CALL_ENTERING) ? "in" : "out");
 
             for (unsigned int i = 0; i < args->GetCount(); i++)
             {
@@ -1003,36 +1118,46 @@ FunctionCall::AppendArgumentsToElement(Logging::Element *el)
                 {
                     ArgumentSpec * argSpec = arg->GetSpec ();
 
-                    ArgumentDirection direction = GetCurrentArgumentDirection ();
                     bool deep = ShouldLogArgumentDeep (arg);
-                    IPropertyProvider * propProv = this;
 
+                    const ArgumentLogHandlerVector & handlers = argSpec->GetLogHandlers ();
+                    if (handlers.size () == 0)
+                    {
+                        writer.BeginElement ("argument");
+                        writer.Field ("name", argSpec->GetName ());
+                        WriteValue (writer, argSpec, arg, deep);
+                        writer.EndElement ();
+
+                        continue;
+                    }
+
+                    // Log handlers work on a tree, so build one for them
                     Logging::Element * argEl = new Logging::Element ("argument");
                     argEl->AddField ("name", argSpec->GetName ());
 
                     bool handled = false;
 
-                    const ArgumentLogHandlerVector & handlers = argSpec->GetLogHandlers ();
-                    if (handlers.size () > 0)
+                    ArgumentLogHandlerVector::const_iterator it;
+                    for (it = handlers.begin (); !handled && it != handlers.end (); it++)
                     {
-                        ArgumentLogHandlerVector::const_iterator it;
-
-                        for (it = handlers.begin (); !handled && it != handlers.end (); it++)
-                        {
-                            handled = (**it) (this, args, arg, argEl);
-                        }
+                        handled = (**it) (this, args, arg, argEl);
                     }
 
                     if (!handled)
                     {
-                        Logging::Node * valueNode = argSpec->GetMarshaller (direction)->ToNode (arg->GetData (), deep, propProv);
-                        if (valueNode != NULL)
-                            argEl->AppendChild (valueNode);
+                        Logging::TreeWriter argWriter (argEl);
+                        WriteValue (argWriter, argSpec, arg, deep);
                     }
 
-                    argsEl->AppendChild (argEl);
+                    writer.AppendNode (argEl);
                 }
             }
+
+            writer.EndElement();
+
+            // Types seen for the first time must be known before this event
+            if (RawSchema::GetEnabled ())
+                RawSchema::Instance ()->LogPendingTypes ();
         }
     }
     else
@@ -1041,9 +1166,8 @@ FunctionCall::AppendArgumentsToElement(Logging::Element *el)
         if (m_state == FUNCTION_CALL_LEAVING)
             return;
 
-        Logging::Element *argsEl = new Logging::Element("arguments");
-        el->AppendChild(argsEl);
-        argsEl->AddField("direction", "in");
+        writer.BeginElement("arguments");
+        writer.Field("direction", "in");
 
         int argsSize = spec->GetArgsSize();
         if (argsSize != FUNCTION_ARGS_SIZE_UNKNOWN && argsSize % sizeof(DWORD) == 0)
@@ -1054,31 +1178,30 @@ FunctionCall::AppendArgumentsToElement(Logging::Element *el)
 
             for (unsigned int i = 0; i < argsSize / sizeof(DWORD); i++)
             {
-                Logging::Element *argElement = new Logging::Element("argument");
-                argsEl->AppendChild(argElement);
+                writer.BeginElement("argument");
 
-                OOStringStream ss;
-                ss << "arg" << (i + 1);
-                argElement->AddField("name", ss.str());
+                char buf[3 + FORMAT_MAX_LENGTH] = "arg";
+                writer.Field("name", buf, Format::Decimal(buf + 3, i + 1) - buf);
 
                 bool hex = false;
 
-                // FIXME: optimize this
-                if (args[i] > 0xFFFF && !IsBadReadPtr((void *) args[i], 1))
+                if (args[i] > 0xFFFF && MemoryMap::Instance()->IsReadable((void *) args[i], 1))
                     hex = true;
 
                 marshaller.SetFormatHex(hex);
 
-                Logging::Node *valueNode = marshaller.ToNode(&args[i], true, this);
-                if (valueNode != NULL)
-                    argElement->AppendChild(valueNode);
+                marshaller.WriteValue(writer, &args[i], true, this);
+
+                writer.EndElement();
             }
         }
+
+        writer.EndElement();
     }
 }
 
 void
-FunctionCall::AppendReturnValueToElement(Logging::Element *el)
+FunctionCall::WriteReturnValue(Logging::Writer &writer)
 {
     if (m_state != FUNCTION_CALL_LEAVING)
         return;
@@ -1087,22 +1210,34 @@ FunctionCall::AppendReturnValueToElement(Logging::Element *el)
     if (marshaller == NULL)
         return;
 
-    Logging::Element *retEl = new Logging::Element("returnValue");
-    el->AppendChild(retEl);
+    writer.BeginElement("returnValue");
 
     void *start = &(m_cpuCtxLive->eax);
-    retEl->AppendChild(marshaller->ToNode(start, true, this));
+
+    m_captureBudget.BeginArgument();
+
+    if (RawSchema::GetEnabled())
+    {
+        RawSchema::WriteValue(writer, marshaller, start, true, this);
+        RawSchema::Instance()->LogPendingTypes();
+    }
+    else
+    {
+        marshaller->WriteValue(writer, start, true, this);
+    }
+
+    writer.EndElement();
 }
 
 void
-FunctionCall::AppendLastErrorToElement (Logging::Element *el)
+FunctionCall::WriteLastError (Logging::Writer & writer)
 {
     if (m_state != FUNCTION_CALL_LEAVING)
         return;
 
-    Logging::TextNode * node = new Logging::TextNode ("lastError");
-    node->AddField ("value", GetLastError ());
-    el->AppendChild (node);
+    writer.BeginElement ("lastError");
+    writer.Field ("value", GetLastError ());
+    writer.EndElement ();
 }
 
 OString
@@ -1145,8 +1280,7 @@ FunctionCall::ToString()
                 if (i)
                     ss << ", ";
 
-                // FIXME: optimize this
-                if (args[i] > 0xFFFF && !IsBadReadPtr ((void *) args[i], 1))
+                if (args[i] > 0xFFFF && MemoryMap::Instance ()->IsReadable ((void *) args[i], 1))
                     ss << hex << "0x";
                 else
                     ss << dec;
@@ -1164,17 +1298,46 @@ FunctionCall::ToString()
 bool
 FunctionCall::QueryForProperty (const OString & query, int & result)
 {
-    const Argument * arg;
+    return QueryForProperty (PropertyQuery (query), result);
+}
+
+bool
+FunctionCall::QueryForProperty (const OString & query, unsigned int & result)
+{
+    return QueryForProperty (PropertyQuery (query), result);
+}
+
+bool
+FunctionCall::QueryForProperty (const OString & query, void *& result)
+{
+    return QueryForProperty (PropertyQuery (query), result);
+}
+
+bool
+FunctionCall::QueryForProperty (const OString & query, va_list & result)
+{
+    return QueryForProperty (PropertyQuery (query), result);
+}
+
+bool
+FunctionCall::QueryForProperty (const OString & query, OString & result)
+{
+    return QueryForProperty (PropertyQuery (query), result);
+}
+
+bool
+FunctionCall::QueryForProperty (const PropertyQuery & query, int & result)
+{
+    const Argument * arg = NULL;
     DWORD reg;
-    bool isArg, wantAddrOf;
 
-    if (!ResolveProperty (query, arg, reg, isArg, wantAddrOf))
+    if (!ResolveProperty (query, arg, reg))
         return false;
 
-    if (wantAddrOf)
+    if (query.GetWantAddressOf ())
         return false;
 
-    if (isArg)
+    if (arg != NULL)
         return arg->ToInt (GetCurrentArgumentDirection (), result);
 
     result = reg;
@@ -1182,19 +1345,18 @@ FunctionCall::QueryForProperty (const OString & query, int & result)
 }
 
 bool
-FunctionCall::QueryForProperty (const OString & query, unsigned int & result)
+FunctionCall::QueryForProperty (const PropertyQuery & query, unsigned int & result)
 {
-    const Argument * arg;
+    const Argument * arg = NULL;
     DWORD reg;
-    bool isArg, wantAddrOf;
 
-    if (!ResolveProperty (query, arg, reg, isArg, wantAddrOf))
+    if (!ResolveProperty (query, arg, reg))
         return false;
 
-    if (wantAddrOf)
+    if (query.GetWantAddressOf ())
         return false;
 
-    if (isArg)
+    if (arg != NULL)
         return arg->ToUInt (GetCurrentArgumentDirection (), result);
 
     result = reg;
@@ -1202,18 +1364,17 @@ FunctionCall::QueryForProperty (const OString & query, unsigned int & result)
 }
 
 bool
-FunctionCall::QueryForProperty (const OString & query, void *& result)
+FunctionCall::QueryForProperty (const PropertyQuery & query, void *& result)
 {
-    const Argument * arg;
+    const Argument * arg = NULL;
     DWORD reg;
-    bool isArg, wantAddrOf;
 
-    if (!ResolveProperty (query, arg, reg, isArg, wantAddrOf))
+    if (!ResolveProperty (query, arg, reg))
         return false;
 
-    if (isArg)
+    if (arg != NULL)
     {
-        if (!wantAddrOf)
+        if (!query.GetWantAddressOf ())
         {
             return arg->ToPointer (GetCurrentArgumentDirection (), result);
         }
@@ -1228,7 +1389,7 @@ FunctionCall::QueryForProperty (const OString & query, void *& result)
     }
     else
     {
-        if (wantAddrOf)
+        if (query.GetWantAddressOf ())
             return false;
 
         result = reinterpret_cast<void *> (reg);
@@ -1237,38 +1398,36 @@ FunctionCall::QueryForProperty (const OString & query, void *& result)
 }
 
 bool
-FunctionCall::QueryForProperty (const OString & query, va_list & result)
+FunctionCall::QueryForProperty (const PropertyQuery & query, va_list & result)
 {
-    const Argument * arg;
+    const Argument * arg = NULL;
     DWORD reg;
-    bool isArg, wantAddrOf;
 
-    if (!ResolveProperty (query, arg, reg, isArg, wantAddrOf))
+    if (!ResolveProperty (query, arg, reg))
         return false;
 
-    if (wantAddrOf)
+    if (query.GetWantAddressOf ())
         return false;
 
-    if (isArg)
+    if (arg != NULL)
         return arg->ToVaList (GetCurrentArgumentDirection (), result);
     else
         return false;
 }
 
 bool
-FunctionCall::QueryForProperty (const OString & query, OString & result)
+FunctionCall::QueryForProperty (const PropertyQuery & query, OString & result)
 {
-    const Argument * arg;
+    const Argument * arg = NULL;
     DWORD reg;
-    bool isArg, wantAddrOf;
 
-    if (!ResolveProperty (query, arg, reg, isArg, wantAddrOf))
+    if (!ResolveProperty (query, arg, reg))
         return false;
 
-    if (wantAddrOf)
+    if (query.GetWantAddressOf ())
         return false;
 
-    if (!isArg)
+    if (arg == NULL)
         return false;
 
     result = arg->ToString (GetCurrentArgumentDirection (), true, this);
@@ -1276,66 +1435,50 @@ FunctionCall::QueryForProperty (const OString & query, OString & result)
 }
 
 bool
-FunctionCall::ResolveProperty(const OString &query, const Argument *&arg, DWORD &reg, bool &isArgument, bool &wantAddressOf)
+FunctionCall::ResolveProperty (const PropertyQuery & query, const Argument *& arg, DWORD & reg)
 {
-    // minimum: "arg.s"
-    if (query.size() < 5)
-        return false;
-
-    int off = 0;
-    if (query[0] == '&')
+    switch (query.GetKind ())
     {
-        wantAddressOf = true;
-        off++;
-    }
-    else
-    {
-        wantAddressOf = false;
-    }
+        case PROPERTY_QUERY_ARGUMENT:
+            if (query.GetIndex () >= m_arguments->GetCount ())
+                return false;
 
-    OString propObj = query.substr(off, 4);
-    OString propArg = query.substr(off + 4);
+            arg = &(*m_arguments)[query.GetIndex ()];
+            return true;
 
-    if (propObj == "reg.")
-    {
-        if (propArg == "eax")
-            reg = m_cpuCtxLive->eax;
-        else if (propArg == "ebx")
-            reg = m_cpuCtxLive->ebx;
-        else if (propArg == "ecx")
-            reg = m_cpuCtxLive->ecx;
-        else if (propArg == "edx")
-            reg = m_cpuCtxLive->edx;
-        else if (propArg == "edi")
-            reg = m_cpuCtxLive->edi;
-        else if (propArg == "esi")
-            reg = m_cpuCtxLive->esi;
-        else if (propArg == "ebp")
-            reg = m_cpuCtxLive->ebp;
-        else if (propArg == "esp")
-            reg = m_cpuCtxLive->esp;
-        else
-            return false;
+        case PROPERTY_QUERY_ARGUMENT_NAME:
+            // Not resolved at load time, e.g. when created on the fly
+            for (unsigned int i = 0; i < m_arguments->GetCount (); i++)
+            {
+                const Argument & curArg = (*m_arguments)[i];
 
-        isArgument = false;
-        return true;
-    }
-    else if (propObj == "arg.")
-    {
-        for (unsigned int i = 0; i < m_arguments->GetCount(); i++)
-        {
-            const Argument &curArg = (*m_arguments)[i];
+                if (curArg.GetSpec ()->GetName () == query.GetArgumentName ())
+                {
+                    arg = &curArg;
+                    return true;
+                }
+            }
+            return false;
 
-            if (curArg.GetSpec()->GetName() == propArg)
+        case PROPERTY_QUERY_REGISTER:
+            switch (query.GetIndex ())
             {
-                arg = &curArg;
-                isArgument = true;
-                return true;
+                case PROPERTY_REG_EAX: reg = m_cpuCtxLive->eax; break;
+                case PROPERTY_REG_EBX: reg = m_cpuCtxLive->ebx; break;
+                case PROPERTY_REG_ECX: reg = m_cpuCtxLive->ecx; break;
+                case PROPERTY_REG_EDX: reg = m_cpuCtxLive->edx; break;
+                case PROPERTY_REG_EDI: reg = m_cpuCtxLive->edi; break;
+                case PROPERTY_REG_ESI: reg = m_cpuCtxLive->esi; break;
+                case PROPERTY_REG_EBP: reg = m_cpuCtxLive->ebp; break;
+                case PROPERTY_REG_ESP: reg = m_cpuCtxLive->esp; break;
+                default:
+                    return false;
             }
-        }
-    }
+            return true;
 
-    return false;
+        default:
+            return false;
+    }
 }
 
 } // namespace InterceptPP
@@ -20,8 +20,10 @@
 #include "InterceptPP.h"
 #include "Errors.h"
 #include "Marshallers.h"
+#include "MarshallerProgram.h"
 #include "Signature.h"
-#include "Logging.h"
+#include "Writer.h"
+#include "Stats.h"
 
 namespace InterceptPP {
 
@@ -190,12 +192,12 @@ class INTERCEPTPP_API ArgumentSpec : public BaseObject
 {
 public:
     ArgumentSpec (const OString & name, ArgumentDirection direction, BaseMarshaller * marshaller, RegisterEvalFunc shouldLogRegEval)
-        : m_name (name), m_direction (direction), m_offset (0), m_marshallerIn (marshaller), m_marshallerOut (marshaller), m_shouldLogRegEval (shouldLogRegEval)
+        : m_name (name), m_direction (direction), m_offset (0), m_marshallerIn (marshaller), m_marshallerOut (marshaller), m_programIn (NULL), m_programOut (NULL), m_shouldLogRegEval (shouldLogRegEval)
     {
     }
 
     ArgumentSpec (const OString & name, ArgumentDirection direction, BaseMarshaller * marshallerIn, BaseMarshaller * marshallerOut, RegisterEvalFunc shouldLogRegEval)
-        : m_name (name), m_direction (direction), m_offset (0), m_marshallerIn (marshallerIn), m_marshallerOut (marshallerOut), m_shouldLogRegEval (shouldLogRegEval)
+        : m_name (name), m_direction (direction), m_offset (0), m_marshallerIn (marshallerIn), m_marshallerOut (marshallerOut), m_programIn (NULL), m_programOut (NULL), m_shouldLogRegEval (shouldLogRegEval)
     {
     }
 
@@ -211,6 +213,10 @@ public:
             delete m_marshallerOut;
         }
 
+        if (m_programIn != m_programOut)
+            delete m_programOut;
+        delete m_programIn;
+
         if (m_shouldLogRegEval != NULL)
             delete[] ((BYTE *)  m_shouldLogRegEval);
     }
@@ -225,6 +231,17 @@ public:
             return (direction == ARG_DIR_IN) ? m_marshallerIn : m_marshallerOut;
     }
 
+    const Marshaller::Program * GetProgram (ArgumentDirection direction) const
+    {
+        if (direction == ARG_DIR_UNKNOWN)
+            return (m_marshallerIn != NULL) ? m_programIn : m_programOut;
+        else
+            return (direction == ARG_DIR_IN) ? m_programIn : m_programOut;
+    }
+
+    void CompileMarshallers ();
+    void ResolvePropertyQueries (const IPropertyResolver & resolver);
+
     unsigned int GetOffset() const { return m_offset; }
     void SetOffset(unsigned int offset) { m_offset = offset; }
 
@@ -249,6 +266,8 @@ protected:
     unsigned int m_offset;
     BaseMarshaller * m_marshallerIn;
     BaseMarshaller * m_marshallerOut;
+    Marshaller::Program * m_programIn;
+    Marshaller::Program * m_programOut;
 
     RegisterEvalFunc m_shouldLogRegEval;
 
@@ -277,7 +296,7 @@ protected:
     void * m_data;
 };
 
-class INTERCEPTPP_API ArgumentListSpec : public BaseObject
+class INTERCEPTPP_API ArgumentListSpec : public BaseObject, public IPropertyResolver
 {
 public:
     ArgumentListSpec();
@@ -305,6 +324,8 @@ public:
         return NULL;
     }
 
+    virtual bool ResolveArgument(const OString &name, unsigned int &index) const;
+
 protected:
     unsigned int m_size;
     typedef OVector<ArgumentSpec *>::Type ArgumentListSpecVector;
@@ -384,6 +405,8 @@ public:
     bool GetLogNestedCalls() const { return m_logNestedCalls; }
     void SetLogNestedCalls(bool logNestedCalls) { m_logNestedCalls = logNestedCalls; }
 
+    FunctionStats & GetStats () { return m_stats; }
+
 protected:
     OString m_name;
     CallingConvention m_callingConvention;
@@ -392,6 +415,7 @@ protected:
     BaseMarshaller *m_retValMarshaller;
     FunctionCallHandlerVector m_handlers;
     bool m_logNestedCalls;
+    FunctionStats m_stats;
 };
 
 class INTERCEPTPP_API Function : public BaseObject
@@ -477,18 +501,20 @@ public:
     bool GetShouldCarryOn () const { return m_shouldCarryOn; }
     void SetShouldCarryOn (bool carryOn) { m_shouldCarryOn = carryOn; }
 
-    Logging::Event * GetLogEvent () const { return m_logEvent; }
-    void SetLogEvent (Logging::Event * ev) { m_logEvent = ev; }
+    Logging::Writer * GetLogWriter () const { return m_logWriter; }
+    void SetLogWriter (Logging::Writer * writer) { m_logWriter = writer; }
 
     void *GetUserData () const { return m_userData; }
     template<typename T> T * GetUserData () const { return static_cast<T *> (m_userData); }
     void SetUserData (void *data) { m_userData = data; }
 
-    void AppendBacktraceToElement (Logging::Element * el);
-    void AppendCpuContextToElement (Logging::Element * el);
-    void AppendArgumentsToElement (Logging::Element * el);
-    void AppendReturnValueToElement (Logging::Element * el);
-    void AppendLastErrorToElement (Logging::Element * el);
+    CallCycleCounters & GetCycleCounters () { return m_cycleCounters; }
+
+    void WriteBacktrace (Logging::Writer & writer);
+    void WriteCpuContext (Logging::Writer & writer);
+    void WriteArguments (Logging::Writer & writer);
+    void WriteReturnValue (Logging::Writer & writer);
+    void WriteLastError (Logging::Writer & writer);
     OString ToString ();
 
     virtual bool QueryForProperty (const OString &query, int & result);
@@ -496,6 +522,13 @@ public:
     virtual bool QueryForProperty (const OString &query, void *& result);
     virtual bool QueryForProperty (const OString &query, va_list & result);
     virtual bool QueryForProperty (const OString &query, OString & result);
+    virtual bool QueryForProperty (const PropertyQuery &query, int & result);
+    virtual bool QueryForProperty (const PropertyQuery &query, unsigned int & result);
+    virtual bool QueryForProperty (const PropertyQuery &query, void *& result);
+    virtual bool QueryForProperty (const PropertyQuery &query, va_list & result);
+    virtual bool QueryForProperty (const PropertyQuery &query, OString & result);
+
+    virtual CaptureBudget * GetCaptureBudget () { return &m_captureBudget; }
 
 protected:
     Function * m_function;
@@ -513,15 +546,19 @@ protected:
 
     bool m_shouldCarryOn;
 
-    Logging::Event * m_logEvent;
+    Logging::Writer * m_logWriter;
     void * m_userData;
 
+    CallCycleCounters m_cycleCounters;
+    CaptureBudget m_captureBudget;
+
 private:
     bool ShouldLogArgumentDeep (const Argument * arg) const;
     inline ArgumentDirection GetCurrentArgumentDirection () const { return (m_state == FUNCTION_CALL_ENTERING) ? ARG_DIR_IN : ARG_DIR_OUT; }
-    void AppendCpuRegisterToElement (Logging::Element * el, const char * name, DWORD value);
+    void WriteCpuRegister (Logging::Writer & writer, const char * name, DWORD value);
+    void WriteValue (Logging::Writer & writer, const ArgumentSpec * argSpec, const Argument * arg, bool deep);
 
-    bool ResolveProperty (const OString & query, const Argument *& arg, DWORD & reg, bool & isArgument, bool & wantAddressOf);
+    bool ResolveProperty (const PropertyQuery & query, const Argument *& arg, DWORD & reg);
 };
 
 #pragma warning (pop)
@@ -0,0 +1,206 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "Format.h"
+
+namespace InterceptPP {
+
+static const char digitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char lowerHexDigits[] = "0123456789abcdef";
+static const char upperHexDigits[] = "0123456789ABCDEF";
+
+char *
+Format::Decimal(char *first, unsigned __int64 value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    char *p = buf + sizeof(buf);
+
+    // Do the bulk with 32-bit divisions, they're a lot cheaper on x86
+    while (value > 0xFFFFFFFF)
+    {
+        unsigned __int64 q = value / 100;
+        unsigned int r = static_cast<unsigned int>(value - q * 100);
+        p -= 2;
+        p[0] = digitPairs[r * 2];
+        p[1] = digitPairs[r * 2 + 1];
+        value = q;
+    }
+
+    unsigned int v = static_cast<unsigned int>(value);
+
+    while (v >= 100)
+    {
+        unsigned int r = v % 100;
+        v /= 100;
+        p -= 2;
+        p[0] = digitPairs[r * 2];
+        p[1] = digitPairs[r * 2 + 1];
+    }
+
+    if (v >= 10)
+    {
+        p -= 2;
+        p[0] = digitPairs[v * 2];
+        p[1] = digitPairs[v * 2 + 1];
+    }
+    else
+    {
+        *--p = static_cast<char>('0' + v);
+    }
+
+    size_t len = buf + sizeof(buf) - p;
+    memcpy(first, p, len);
+
+    return first + len;
+}
+
+char *
+Format::Decimal(char *first, __int64 value)
+{
+    if (value < 0)
+    {
+        *first++ = '-';
+        return Decimal(first, static_cast<unsigned __int64>(0) - static_cast<unsigned __int64>(value));
+    }
+
+    return Decimal(first, static_cast<unsigned __int64>(value));
+}
+
+char *
+Format::Decimal(char *first, unsigned int value)
+{
+    return Decimal(first, static_cast<unsigned __int64>(value));
+}
+
+char *
+Format::Decimal(char *first, int value)
+{
+    return Decimal(first, static_cast<__int64>(value));
+}
+
+char *
+Format::Hex(char *first, unsigned int value)
+{
+    int digits = 1;
+    while (digits < 8 && (value >> (digits * 4)) != 0)
+        digits++;
+
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        first[i] = lowerHexDigits[value & 0xF];
+        value >>= 4;
+    }
+
+    return first + digits;
+}
+
+char *
+Format::HexPrefixed(char *first, unsigned int value)
+{
+    first[0] = '0';
+    first[1] = 'x';
+
+    return Hex(first + 2, value);
+}
+
+char *
+Format::Pointer(char *first, const void *ptr)
+{
+    first[0] = '0';
+    first[1] = 'x';
+
+    DWORD_PTR value = reinterpret_cast<DWORD_PTR>(ptr);
+    const int digits = sizeof(DWORD_PTR) * 2;
+
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        first[2 + i] = upperHexDigits[value & 0xF];
+        value >>= 4;
+    }
+
+    return first + 2 + digits;
+}
+
+char *
+Format::Integer(char *first, int value, bool sign, bool hex)
+{
+    if (hex && value != 0)
+    {
+        return HexPrefixed(first, static_cast<unsigned int>(value));
+    }
+
+    if (sign)
+        return Decimal(first, value);
+    else
+        return Decimal(first, static_cast<unsigned int>(value));
+}
+
+OString
+Format::ToString(int value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    return OString(buf, Decimal(buf, value));
+}
+
+OString
+Format::ToString(unsigned int value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    return OString(buf, Decimal(buf, value));
+}
+
+OString
+Format::ToString(__int64 value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    return OString(buf, Decimal(buf, value));
+}
+
+OString
+Format::ToString(unsigned __int64 value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    return OString(buf, Decimal(buf, value));
+}
+
+OString
+Format::ToHexString(unsigned int value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    return OString(buf, Integer(buf, static_cast<int>(value), false, true));
+}
+
+OString
+Format::ToPointerString(const void *ptr)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    return OString(buf, Pointer(buf, ptr));
+}
+
+} // namespace InterceptPP
@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "InterceptPP.h"
+
+namespace InterceptPP {
+
+//
+// Allocation-free number formatting in the style of std::to_chars().
+// Each function writes into the buffer starting at first, which must have
+// room for FORMAT_MAX_LENGTH characters, and returns a pointer past the
+// last character written.  The output is not NUL-terminated.
+//
+// The results are identical to what OOStringStream produced at the call
+// sites they replace, so the log format doesn't change.
+//
+
+#define FORMAT_MAX_LENGTH 24
+
+class INTERCEPTPP_API Format
+{
+public:
+    static char *Decimal(char *first, int value);
+    static char *Decimal(char *first, unsigned int value);
+    static char *Decimal(char *first, __int64 value);
+    static char *Decimal(char *first, unsigned __int64 value);
+
+    // Lowercase, no prefix and no padding, like ss << hex << value
+    static char *Hex(char *first, unsigned int value);
+
+    // "0x" followed by Hex(), like ss << "0x" << hex << value
+    static char *HexPrefixed(char *first, unsigned int value);
+
+    // "0x" followed by ss << ptr, i.e. eight uppercase digits
+    static char *Pointer(char *first, const void *ptr);
+
+    // Integer<T>::ToString() rules: hex with a "0x" prefix unless zero,
+    // otherwise decimal as int or unsigned int
+    static char *Integer(char *first, int value, bool sign, bool hex);
+
+    static OString ToString(int value);
+    static OString ToString(unsigned int value);
+    static OString ToString(__int64 value);
+    static OString ToString(unsigned __int64 value);
+    static OString ToHexString(unsigned int value);   // Integer(value, false, true)
+    static OString ToPointerString(const void *ptr);
+};
+
+} // namespace InterceptPP
@@ -0,0 +1,201 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "FormatScanner.h"
+
+namespace InterceptPP {
+
+template <class T>
+static unsigned int
+ScanFormat(const T *format, bool wide, FormatArgKind *kinds)
+{
+    unsigned int count = 0;
+    const T *p = format;
+
+    while (*p != 0)
+    {
+        if (*p++ != '%')
+            continue;
+
+        if (*p == '%')
+        {
+            p++;
+            continue;
+        }
+
+        // Flags
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+            p++;
+
+        // Width
+        if (*p == '*')
+        {
+            if (count == FORMAT_MAX_ARGS)
+                return count;
+            kinds[count++] = FORMAT_ARG_INT32;
+            p++;
+        }
+        else
+        {
+            while (*p >= '0' && *p <= '9')
+                p++;
+        }
+
+        // Precision
+        if (*p == '.')
+        {
+            p++;
+
+            if (*p == '*')
+            {
+                if (count == FORMAT_MAX_ARGS)
+                    return count;
+                kinds[count++] = FORMAT_ARG_INT32;
+                p++;
+            }
+            else
+            {
+                while (*p >= '0' && *p <= '9')
+                    p++;
+            }
+        }
+
+        // Size prefix
+        bool isLong = false, isWide = wide, isSizeT = false, is64 = false, explicitWidth = false;
+
+        if (*p == 'h')
+        {
+            p++;
+            if (*p == 'h')
+                p++;
+            isWide = false;
+            explicitWidth = true;
+        }
+        else if (*p == 'l')
+        {
+            p++;
+            if (*p == 'l')
+            {
+                p++;
+                is64 = true;
+            }
+            else
+            {
+                isLong = true;
+            }
+        }
+        else if (*p == 'w')
+        {
+            p++;
+            isLong = true;
+        }
+        else if (*p == 'L')
+        {
+            p++;
+        }
+        else if (*p == 'I')
+        {
+            p++;
+            if (p[0] == '6' && p[1] == '4')
+            {
+                p += 2;
+                is64 = true;
+            }
+            else if (p[0] == '3' && p[1] == '2')
+            {
+                p += 2;
+            }
+            else
+            {
+                isSizeT = true;
+            }
+        }
+
+        if (isLong)
+        {
+            isWide = true;
+            explicitWidth = true;
+        }
+
+        FormatArgKind kind;
+
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                if (is64 || (isSizeT && sizeof(void *) == 8))
+                    kind = FORMAT_ARG_INT64;
+                else
+                    kind = FORMAT_ARG_INT32;
+                break;
+            case 'c':
+            case 'C':
+                kind = FORMAT_ARG_INT32;
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                kind = FORMAT_ARG_DOUBLE;
+                break;
+            case 'p':
+            case 'n':
+            case 'Z':
+                kind = FORMAT_ARG_POINTER;
+                break;
+            case 's':
+                kind = (isWide) ? FORMAT_ARG_WIDE_STRING : FORMAT_ARG_STRING;
+                break;
+            case 'S':
+                if (!explicitWidth)
+                    isWide = !wide;
+                kind = (isWide) ? FORMAT_ARG_WIDE_STRING : FORMAT_ARG_STRING;
+                break;
+            default:
+                return count;
+        }
+
+        if (count == FORMAT_MAX_ARGS)
+            return count;
+        kinds[count++] = kind;
+        p++;
+    }
+
+    return count;
+}
+
+unsigned int
+FormatScanner::Scan(const char *format, FormatArgKind *kinds)
+{
+    return ScanFormat(format, false, kinds);
+}
+
+unsigned int
+FormatScanner::Scan(const wchar_t *format, FormatArgKind *kinds)
+{
+    return ScanFormat(format, true, kinds);
+}
+
+} // namespace InterceptPP
@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <stddef.h>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+//
+// Finds the arguments a printf style format string consumes, so that the
+// format marshallers can copy the raw argument words out of the va_list
+// and leave the formatting to the reader (see RAW_KIND_FORMAT).
+//
+// Follows the MSVC CRT rules: h, l, w, ll, L, I, I32 and I64 size prefixes,
+// '*' for width and precision, and %s/%c meaning the format string's own
+// character width while %S/%C mean the other one.  %Z is kept as the
+// pointer it is.  Scanning stops after FORMAT_MAX_ARGS arguments or at a
+// conversion it doesn't know, as everything after that is guesswork.
+//
+
+#define FORMAT_MAX_ARGS 64
+
+typedef enum {
+    FORMAT_ARG_INT32 = 0,
+    FORMAT_ARG_INT64,
+    FORMAT_ARG_DOUBLE,
+    FORMAT_ARG_POINTER,
+    FORMAT_ARG_STRING,
+    FORMAT_ARG_WIDE_STRING,
+    FORMAT_ARG_NULL_STRING,     // only in raw records, never scanned
+} FormatArgKind;
+
+class INTERCEPTPP_API FormatScanner
+{
+public:
+    // Returns the number of kinds stored, at most FORMAT_MAX_ARGS
+    static unsigned int Scan(const char *format, FormatArgKind *kinds);
+    static unsigned int Scan(const wchar_t *format, FormatArgKind *kinds);
+};
+
+} // namespace InterceptPP
@@ -16,6 +16,10 @@
 //
 
 #include "HookManager.h"
+#include "RawCapture.h"
+#include "PayloadTable.h"
+#include "LzCodec.h"
+#include "LogManifest.h"
 #include "Util.h"
 
 #pragma warning( disable : 4311 4312 )
@@ -78,31 +82,57 @@ TrimString(OString & str)
     else str.erase (str.begin (), str.end ());
 }
 
+static unsigned int
+GetUIntAttribute(MSXML2::IXMLDOMNodePtr &node, const char *name)
+{
+    MSXML2::IXMLDOMNodePtr attr = node->attributes->getNamedItem(name);
+    if (attr == NULL)
+        return 0;
+
+    OString value = static_cast<bstr_t>(attr->nodeTypedValue);
+    return strtoul(value.c_str(), NULL, 0);
+}
+
+static MSXML2::IXMLDOMDocument3Ptr
+LoadDocument(const OWString &path)
+{
+    MSXML2::IXMLDOMDocument3Ptr doc;
+    HRESULT hr = doc.CreateInstance(__uuidof(MSXML2::DOMDocument60));
+    if (FAILED(hr))
+        throw ParserError("CreateInstance failed");
+
+    doc->async = VARIANT_FALSE;
+
+    if(doc->load(path.c_str()) != VARIANT_TRUE)
+        throw ParserError("IXMLDOMDocument::load() failed");
+
+    return doc;
+}
+
 // Member functions
 void
 HookManager::LoadDefinitions(const OWString &path)
 {
+    AllocTagScope allocTag(ALLOC_TAG_HOOKS);
+
     CoInitialize(NULL);
 
 #if !DEBUG
     try
     {
 #endif
-        MSXML2::IXMLDOMDocument3Ptr doc;
-        HRESULT hr = doc.CreateInstance(__uuidof(MSXML2::DOMDocument60));
-        if (FAILED(hr))
-            throw ParserError("CreateInstance failed");
-
-        doc->async = VARIANT_FALSE;
-
-        if(doc->load(path.c_str()) != VARIANT_TRUE)
-            throw ParserError("IXMLDOMDocument::load() failed");
+        MSXML2::IXMLDOMDocument3Ptr doc = LoadDocument(path);
 
         MSXML2::IXMLDOMNodeListPtr nodeList;
         MSXML2::IXMLDOMNodePtr node;
 
         // TODO: refactor this mess
 
+        node = doc->selectSingleNode("/hookManager");
+        if (node != NULL)
+            ParseSettings(node);
+        node.Release();
+
         {
             nodeList = doc->selectNodes("/hookManager/types/*");
             for (int i = 0; i < nodeList->length; i++)
@@ -199,9 +229,130 @@ HookManager::LoadDefinitions(const OWString &path)
 #endif
 }
 
+void
+HookManager::LoadSettings(const OWString &path)
+{
+    CoInitialize(NULL);
+
+#if !DEBUG
+    try
+    {
+#endif
+        MSXML2::IXMLDOMDocument3Ptr doc = LoadDocument(path);
+
+        MSXML2::IXMLDOMNodePtr node = doc->selectSingleNode("/hookManager");
+        if (node != NULL)
+            ParseSettings(node);
+        node.Release();
+
+        doc.Release();
+#if !DEBUG
+    }
+    catch (_com_error &e)
+    {
+        throw ParserError(e.ErrorMessage());
+    }
+#endif
+}
+
+void
+HookManager::ParseSettings(MSXML2::IXMLDOMNodePtr &rootNode)
+{
+    MSXML2::IXMLDOMNodePtr attr = rootNode->attributes->getNamedItem("rawCapture");
+    if (attr != NULL)
+    {
+        OString value = static_cast<bstr_t>(attr->nodeTypedValue);
+        RawSchema::SetEnabled(value == "true");
+    }
+
+    attr = rootNode->attributes->getNamedItem("allocAccounting");
+    if (attr != NULL)
+    {
+        OString value = static_cast<bstr_t>(attr->nodeTypedValue);
+        AllocUtils::SetAccountingEnabled(value != "false");
+    }
+
+    CaptureBudget::SetMaxEventBytes(GetUIntAttribute(rootNode, "maxEventBytes"));
+    CaptureBudget::SetMaxArgumentBytes(GetUIntAttribute(rootNode, "maxArgumentBytes"));
+    CaptureBudget::SetSampleThreshold(GetUIntAttribute(rootNode, "sampleThreshold"));
+    CaptureBudget::SetSampleInterval(GetUIntAttribute(rootNode, "sampleInterval"));
+
+    PayloadTable::SetThreshold(GetUIntAttribute(rootNode, "dedupThreshold"));
+    unsigned int tableBytes = GetUIntAttribute(rootNode, "dedupTableBytes");
+    if (tableBytes != 0)
+        PayloadTable::SetMaxTableBytes(tableBytes);
+
+    unsigned int queueBytes = GetUIntAttribute(rootNode, "logQueueBytes");
+    if (queueBytes != 0)
+        Logging::Logger::SetMaxQueuedBytes(queueBytes);
+
+    attr = rootNode->attributes->getNamedItem("logQueuePolicy");
+    if (attr != NULL)
+    {
+        OString value = static_cast<bstr_t>(attr->nodeTypedValue);
+        if (value == "block")
+            Logging::Logger::SetQueueFullPolicy(Logging::QUEUE_FULL_BLOCK);
+        else if (value == "drop")
+            Logging::Logger::SetQueueFullPolicy(Logging::QUEUE_FULL_DROP);
+        else if (value == "summarize")
+            Logging::Logger::SetQueueFullPolicy(Logging::QUEUE_FULL_SUMMARIZE);
+        else
+            throw ParserError("unknown logQueuePolicy");
+    }
+
+    attr = rootNode->attributes->getNamedItem("logQueueTimeout");
+    if (attr != NULL)
+        Logging::Logger::SetQueueTimeout(GetUIntAttribute(rootNode, "logQueueTimeout"));
+
+    attr = rootNode->attributes->getNamedItem("logSink");
+    if (attr != NULL)
+    {
+        OString value = static_cast<bstr_t>(attr->nodeTypedValue);
+        if (value == "file")
+            Logging::Logger::SetSink(Logging::LOG_SINK_FILE);
+        else if (value == "mapped")
+            Logging::Logger::SetSink(Logging::LOG_SINK_MAPPED);
+        else
+            throw ParserError("unknown logSink");
+    }
+
+    attr = rootNode->attributes->getNamedItem("logCompression");
+    if (attr != NULL)
+    {
+        OString value = static_cast<bstr_t>(attr->nodeTypedValue);
+        if (value == "none")
+            Logging::Logger::SetCompression(Logging::LOG_COMPRESSION_NONE);
+        else if (value == "lz")
+            Logging::Logger::SetCompression(Logging::LOG_COMPRESSION_LZ);
+        else
+            throw ParserError("unknown logCompression");
+    }
+
+    unsigned int blockSize = GetUIntAttribute(rootNode, "logBlockSize");
+    if (blockSize != 0)
+    {
+        if (blockSize < LZ_MIN_BLOCK_SIZE || blockSize > LZ_MAX_BLOCK_SIZE)
+            throw ParserError("logBlockSize out of range");
+        Logging::Logger::SetBlockSize(blockSize);
+    }
+
+    unsigned int segmentSize = GetUIntAttribute(rootNode, "logSegmentBytes");
+    if (segmentSize != 0 && segmentSize < LOG_MIN_SEGMENT_SIZE)
+        throw ParserError("logSegmentBytes too small");
+    Logging::Logger::SetSegmentSize(segmentSize);
+
+    unsigned int segmentInterval = GetUIntAttribute(rootNode, "logSegmentInterval");
+    if (segmentInterval > LOG_MAX_SEGMENT_INTERVAL)
+        throw ParserError("logSegmentInterval too long");
+    Logging::Logger::SetSegmentInterval(segmentInterval);
+    Logging::Logger::SetSegmentCount(GetUIntAttribute(rootNode, "logSegmentCount"));
+}
+
 void
 HookManager::HookFunctions ()
 {
+    AllocTagScope allocTag (ALLOC_TAG_HOOKS);
+
     VTableList::iterator vtIter;
     for (vtIter = m_vtables.begin (); vtIter != m_vtables.end (); vtIter++)
     {
@@ -313,9 +464,82 @@ HookManager::GetFunctionSpecById(const OString &id)
         return NULL;
 }
 
+void
+HookManager::GetFunctionSpecs (FunctionSpecList & result)
+{
+    FunctionSpecMap::iterator fsIter;
+    for (fsIter = m_funcSpecs.begin (); fsIter != m_funcSpecs.end (); fsIter++)
+        result.push_back (pair<OString, FunctionSpec *> (fsIter->first, fsIter->second));
+
+    VTableSpecMap::iterator vtsIter;
+    for (vtsIter = m_vtableSpecs.begin (); vtsIter != m_vtableSpecs.end (); vtsIter++)
+    {
+        VTableSpec * vtSpec = vtsIter->second;
+
+        for (unsigned int i = 0; i < vtSpec->GetMethodCount (); i++)
+        {
+            VMethodSpec & methodSpec = (*vtSpec)[i];
+
+            OString name = vtSpec->GetName () + "::" + methodSpec.GetName ();
+            result.push_back (pair<OString, FunctionSpec *> (name, &methodSpec));
+        }
+    }
+}
+
+void
+HookManager::GetFunctionStats (FunctionStatsList & result)
+{
+    FunctionStatsData data;
+
+    FunctionSpecMap::iterator fsIter;
+    for (fsIter = m_funcSpecs.begin (); fsIter != m_funcSpecs.end (); fsIter++)
+    {
+        fsIter->second->GetStats ().GetSnapshot (data);
+        if (data.calls > 0)
+            result.push_back (pair<OString, FunctionStatsData> (fsIter->first, data));
+    }
+
+    VTableSpecMap::iterator vtsIter;
+    for (vtsIter = m_vtableSpecs.begin (); vtsIter != m_vtableSpecs.end (); vtsIter++)
+    {
+        VTableSpec * vtSpec = vtsIter->second;
+
+        for (unsigned int i = 0; i < vtSpec->GetMethodCount (); i++)
+        {
+            VMethodSpec & methodSpec = (*vtSpec)[i];
+
+            methodSpec.GetStats ().GetSnapshot (data);
+            if (data.calls == 0)
+                continue;
+
+            OString name = vtSpec->GetName () + "::" + methodSpec.GetName ();
+            result.push_back (pair<OString, FunctionStatsData> (name, data));
+        }
+    }
+}
+
+void
+HookManager::ResetFunctionStats ()
+{
+    FunctionSpecMap::iterator fsIter;
+    for (fsIter = m_funcSpecs.begin (); fsIter != m_funcSpecs.end (); fsIter++)
+        fsIter->second->GetStats ().Reset ();
+
+    VTableSpecMap::iterator vtsIter;
+    for (vtsIter = m_vtableSpecs.begin (); vtsIter != m_vtableSpecs.end (); vtsIter++)
+    {
+        VTableSpec * vtSpec = vtsIter->second;
+
+        for (unsigned int i = 0; i < vtSpec->GetMethodCount (); i++)
+            (*vtSpec)[i].GetStats ().Reset ();
+    }
+}
+
 void
 HookManager::ParseTypeNode(MSXML2::IXMLDOMNodePtr &typeNode)
 {
+    AllocTagScope allocTag(ALLOC_TAG_MARSHALLERS);
+
     OString typeName = typeNode->nodeName;
     if (typeName == "structure")
     {
@@ -38,6 +38,9 @@ public:
     static HookManager *Instance();
 
     void LoadDefinitions(const OWString &path);
+    // Only applies the settings on the root element, which
+    // LoadDefinitions() does as well
+    void LoadSettings(const OWString &path);
 
     void HookFunctions ();
     void UnhookFunctions ();
@@ -54,6 +57,15 @@ public:
 
     FunctionSpec *GetFunctionSpecById(const OString &id);
 
+    // Every FunctionSpec loaded, vtable methods included, named the same
+    // way as in GetFunctionStats()
+    typedef OList<pair<OString, FunctionSpec *>>::Type FunctionSpecList;
+    void GetFunctionSpecs (FunctionSpecList & result);
+
+    typedef OList<pair<OString, FunctionStatsData>>::Type FunctionStatsList;
+    void GetFunctionStats (FunctionStatsList & result);
+    void ResetFunctionStats ();
+
 protected:
     typedef OMap<OString, FunctionSpec *>::Type FunctionSpecMap;
     typedef OMap<OString, VTableSpec *>::Type VTableSpecMap;
@@ -72,6 +84,7 @@ protected:
     FunctionList m_functions;
     VTableList m_vtables;
 
+    void ParseSettings(MSXML2::IXMLDOMNodePtr &rootNode);
     void ParseTypeNode(MSXML2::IXMLDOMNodePtr &typeNode);
     void ParseStructureNode(MSXML2::IXMLDOMNodePtr &structNode);
     bool ParseStructureFieldNode(MSXML2::IXMLDOMNodePtr &fieldNode, OString &name, int &offset, OString &typeName, PropertyList &typeProps);
@@ -0,0 +1,172 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "LogFile.h"
+#include <string.h>
+
+namespace InterceptPP {
+
+LogFileWriter::LogFileWriter(LogEncoder &encoder)
+    : m_encoder(encoder), m_file(NULL), m_offset(0), m_compressed(false),
+      m_blockSize(LZ_DEFAULT_BLOCK_SIZE), m_failed(false),
+      m_output(NULL), m_outputCapacity(0)
+{
+}
+
+LogFileWriter::~LogFileWriter()
+{
+    Close();
+    delete[] m_output;
+}
+
+bool
+LogFileWriter::Create(const MappedFileChar *path, bool compressed, unsigned int blockSize)
+{
+    Close();
+
+#ifdef _WIN32
+    m_file = _wfopen(path, L"wb");
+#else
+    m_file = fopen(path, "wb");
+#endif
+    if (m_file == NULL)
+        return false;
+
+    m_offset = 0;
+    m_compressed = compressed;
+    m_blockSize = blockSize;
+    m_failed = false;
+
+    m_encoder.Clear();
+    m_encoder.StartBlock();
+    LogIndexWriter::InitEntry(m_block, 0);
+
+    LogFileHeader header;
+    LogFormat::InitHeader(header, blockSize, compressed ? LOG_FILE_COMPRESSED : 0);
+
+    return Write(&header, sizeof(header));
+}
+
+bool
+LogFileWriter::WriteEvent(const char *data, unsigned int size)
+{
+    if (m_file == NULL || m_failed)
+        return false;
+
+    if (!m_encoder.EncodeEvent(data, size))
+        return false;
+    LogIndexWriter::AddToEntry(m_block, m_encoder.GetFrame());
+
+    if (m_encoder.GetSize() >= m_blockSize)
+        return EndBlock();
+
+    return true;
+}
+
+bool
+LogFileWriter::Close()
+{
+    if (m_file == NULL)
+        return true;
+
+    if (m_encoder.GetSize() > 0)
+        EndBlock();
+    WriteIndex(true);
+
+    LogTrailer trailer;
+    m_index.BuildTrailer(trailer);
+    Write(&trailer, sizeof(trailer));
+
+    if (fclose(m_file) != 0)
+        m_failed = true;
+    m_file = NULL;
+
+    return !m_failed;
+}
+
+bool
+LogFileWriter::EndBlock()
+{
+    const char *data = m_encoder.GetData();
+    unsigned int size = m_encoder.GetSize();
+
+    m_block.offset = m_offset;
+    m_block.size = size;
+    m_index.AddEntry(m_block);
+
+    if (m_compressed)
+        WriteCompressed(data, size);
+    else
+        Write(data, size);
+
+    m_encoder.Clear();
+    m_encoder.StartBlock();
+    LogIndexWriter::InitEntry(m_block, 0);
+
+    if (m_index.GetPendingEntries() >= LOG_INDEX_INTERVAL)
+        WriteIndex(false);
+
+    return !m_failed;
+}
+
+// With every symbol defined so far, in a block of its own if compressed
+bool
+LogFileWriter::WriteIndex(bool final)
+{
+    m_index.BeginIndex(final);
+
+    unsigned int limit = m_encoder.GetSymbolLimit();
+    for (unsigned int id = 0; id < limit; id++)
+    {
+        unsigned int length;
+        const char *name;
+        if (m_encoder.IsSymbolDefined(id) && (name = m_encoder.GetSymbolName(id, length)) != NULL)
+            m_index.AddSymbol(id, name, length);
+    }
+
+    unsigned int size;
+    const char *index = m_index.EndIndex(m_offset, size);
+
+    return m_compressed ? WriteCompressed(index, size) : Write(index, size);
+}
+
+bool
+LogFileWriter::WriteCompressed(const char *data, unsigned int size)
+{
+    unsigned int maxSize = LzCodec::GetMaxBlockSize(size);
+    if (maxSize > m_outputCapacity)
+    {
+        delete[] m_output;
+        m_output = new char[maxSize];
+        m_outputCapacity = maxSize;
+    }
+
+    return Write(m_output, m_codec.CompressBlock(data, size, m_output));
+}
+
+bool
+LogFileWriter::Write(const void *data, unsigned int size)
+{
+    if (size > 0 && fwrite(data, 1, size, m_file) != size)
+        m_failed = true;
+
+    m_offset += size;
+    return !m_failed;
+}
+
+} // namespace InterceptPP
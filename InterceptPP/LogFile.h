@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "LogIndex.h"
+#include "LzCodec.h"
+#include <stdio.h>
+
+namespace InterceptPP {
+
+//
+// Writes a version 2 log (see LogFormat.h) from events in the version 1
+// node format, cut into blocks of blockSize bytes and compressed if asked
+// to, and indexed as LogIndex.h describes.  It's the agent's BinaryLogger
+// does this for a live process, with the writing done asynchronously;
+// this is the plain version for tools and tests.
+//
+// Besides MSVC this builds on Linux so that it can be tested there.
+//
+
+class INTERCEPTPP_API LogFileWriter
+{
+public:
+    LogFileWriter(LogEncoder &encoder);
+    ~LogFileWriter();
+
+    bool Create(const MappedFileChar *path, bool compressed, unsigned int blockSize);
+    // Returns false if the event is malformed, leaving the log as it was,
+    // or if writing failed
+    bool WriteEvent(const char *data, unsigned int size);
+    // Writes the final index and the trailer
+    bool Close();
+
+    // Where the log has got to so far
+    unsigned long long GetOffset() const { return m_offset; }
+
+protected:
+    bool EndBlock();
+    bool WriteIndex(bool final);
+    bool WriteCompressed(const char *data, unsigned int size);
+    bool Write(const void *data, unsigned int size);
+
+    LogEncoder &m_encoder;
+    FILE *m_file;
+    unsigned long long m_offset;
+    bool m_compressed;
+    unsigned int m_blockSize;
+    bool m_failed;
+
+    LzCodec m_codec;
+    char *m_output;
+    unsigned int m_outputCapacity;
+
+    LogIndexWriter m_index;
+    LogIndexEntry m_block;
+};
+
+} // namespace InterceptPP
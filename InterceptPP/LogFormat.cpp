@@ -0,0 +1,1135 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "LogFormat.h"
+#include <string.h>
+
+namespace InterceptPP {
+
+// What a version 1 symbol is, see BinaryWriter.h
+#define V1_SYMBOL_KIND_MASK       0xC0000000
+#define V1_SYMBOL_REFERENCE       0x80000000
+#define V1_SYMBOL_DEFINITION      0xC0000000
+#define V1_SYMBOL_ID_MASK         0x3FFFFFFF
+
+// As deep as BinaryWriter nests elements
+#define MAX_ELEMENT_DEPTH         64
+
+// Of the string table's hash, twice as many as there are strings
+#define STRING_SLOT_COUNT         (2 * LOG_MAX_TABLE_STRINGS)
+
+// Payloads past it are left alone rather than kept track of
+#define MAX_PAYLOAD_ID            (1 << 24)
+
+// Makes room for needed elements, keeping the first count
+template <class T>
+static void
+Grow(T *&array, unsigned int count, unsigned int &capacity, unsigned int needed)
+{
+    if (needed <= capacity)
+        return;
+
+    unsigned int newCapacity = (capacity != 0) ? capacity : 64;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+
+    T *newArray = new T[newCapacity];
+    if (count > 0)
+        memcpy(newArray, array, count * sizeof(T));
+    delete[] array;
+
+    array = newArray;
+    capacity = newCapacity;
+}
+
+// Sets a bit, making room for it in bits, which is count bytes so far
+static void
+SetBit(unsigned char *&bits, unsigned int &count, unsigned int id)
+{
+    if (id / 8 >= count)
+    {
+        unsigned int newCount = (count != 0) ? count : 64;
+        while (newCount <= id / 8)
+            newCount *= 2;
+
+        unsigned char *newBits = new unsigned char[newCount];
+        memset(newBits, 0, newCount);
+        if (count > 0)
+            memcpy(newBits, bits, count);
+        delete[] bits;
+
+        bits = newBits;
+        count = newCount;
+    }
+
+    bits[id / 8] |= 1 << (id % 8);
+}
+
+static bool
+ReadDWord(const char *&p, const char *end, unsigned int &value)
+{
+    if (end - p < 4)
+        return false;
+
+    memcpy(&value, p, 4);
+    p += 4;
+    return true;
+}
+
+// A DWORD length and that many bytes
+static bool
+ReadV1String(const char *&p, const char *end, const char *&s, unsigned int &length)
+{
+    if (!ReadDWord(p, end, length) || length > static_cast<size_t>(end - p))
+        return false;
+
+    s = p;
+    p += length;
+    return true;
+}
+
+static bool
+Equals(const char *s, unsigned int length, const char *literal)
+{
+    return length == strlen(literal) && memcmp(s, literal, length) == 0;
+}
+
+// Whether s is what Format::Decimal() makes of value
+static bool
+ParseDecimal(const char *s, unsigned int length, unsigned long long &value)
+{
+    if (length == 0 || length > 20 || (s[0] == '0' && length > 1))
+        return false;
+
+    value = 0;
+    for (unsigned int i = 0; i < length; i++)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+
+        unsigned long long digit = s[i] - '0';
+        if (value > (~0ULL - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+
+    return true;
+}
+
+static int
+HexDigit(char c, bool upper)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (upper && c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (!upper && c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// "0x" followed by the digits, in lowercase and without leading zeros as
+// with Format::HexPrefixed(), or uppercase and eight of them as with
+// Format::Pointer()
+static bool
+ParseHex(const char *s, unsigned int length, bool pointer, unsigned long long &value)
+{
+    if (length < 3 || s[0] != '0' || s[1] != 'x')
+        return false;
+
+    unsigned int digits = length - 2;
+    if (pointer)
+    {
+        if (digits != 8)
+            return false;
+    }
+    else if (digits > 16 || (s[2] == '0' && digits > 1))
+    {
+        return false;
+    }
+
+    value = 0;
+    for (unsigned int i = 2; i < length; i++)
+    {
+        int digit = HexDigit(s[i], pointer);
+        if (digit < 0)
+            return false;
+        value = (value << 4) | digit;
+    }
+
+    return true;
+}
+
+static unsigned int
+FormatDecimal(char *buf, unsigned long long value)
+{
+    char digits[20];
+    unsigned int count = 0;
+    do
+    {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    while (value != 0);
+
+    for (unsigned int i = 0; i < count; i++)
+        buf[i] = digits[count - 1 - i];
+    return count;
+}
+
+static unsigned int
+FormatHex(char *buf, unsigned long long value, unsigned int minDigits, const char *alphabet)
+{
+    char digits[16];
+    unsigned int count = 0;
+    do
+    {
+        digits[count++] = alphabet[value & 0xF];
+        value >>= 4;
+    }
+    while (value != 0 || count < minDigits);
+
+    buf[0] = '0';
+    buf[1] = 'x';
+    for (unsigned int i = 0; i < count; i++)
+        buf[2 + i] = digits[count - 1 - i];
+    return 2 + count;
+}
+
+static unsigned int
+HashString(const char *s, unsigned int length)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261U;
+    for (unsigned int i = 0; i < length; i++)
+    {
+        hash ^= static_cast<unsigned char>(s[i]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+void
+LogFormat::InitHeader(LogFileHeader &header, unsigned int blockSize, unsigned int flags)
+{
+    header.magic = LOG_FILE_MAGIC;
+    header.version = LOG_FILE_VERSION;
+    header.blockSize = blockSize;
+    header.flags = flags;
+    header.ticksPerSecond = 10000000;
+    header.startTicks = 0;
+    header.startTime = 0;
+}
+
+unsigned long long
+LogFormat::GetFileTime(const LogFileHeader &header, unsigned long long timestamp)
+{
+    unsigned long long rate = header.ticksPerSecond;
+    if (rate == 0)
+        return header.startTime;
+
+    // In whole seconds first, as the ticks times 10000000 don't fit
+    bool before = timestamp < header.startTicks;
+    unsigned long long ticks = before ? header.startTicks - timestamp : timestamp - header.startTicks;
+    unsigned long long elapsed = ticks / rate * 10000000 + ticks % rate * 10000000 / rate;
+
+    return before ? header.startTime - elapsed : header.startTime + elapsed;
+}
+
+unsigned int
+LogFormat::PutVarint(char *p, unsigned long long value)
+{
+    unsigned int size = 0;
+    while (value >= 0x80)
+    {
+        p[size++] = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    p[size++] = static_cast<char>(value);
+
+    return size;
+}
+
+unsigned int
+LogFormat::GetVarintSize(unsigned long long value)
+{
+    unsigned int size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+bool
+LogFormat::GetLongVarint(const char *&p, const char *end, unsigned long long &value)
+{
+    value = 0;
+    for (unsigned int shift = 0; shift < 7 * LOG_MAX_VARINT_SIZE; shift += 7)
+    {
+        if (p == end)
+            return false;
+
+        unsigned char b = static_cast<unsigned char>(*p++);
+        if (shift == 63 && b > 1)
+            return false;
+        value |= static_cast<unsigned long long>(b & 0x7F) << shift;
+
+        if ((b & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool
+LogFormat::GetLongVarint(const char *&p, const char *end, unsigned int &value)
+{
+    unsigned long long v;
+    if (!GetLongVarint(p, end, v) || v > ~0U)
+        return false;
+
+    value = static_cast<unsigned int>(v);
+    return true;
+}
+
+const char *
+LogFormat::NextRecord(const char *&p, const char *end, LogRecordFrame &frame)
+{
+    const char *q = p;
+    unsigned int size;
+    if (!GetVarint(q, end, size) || size == 0 || size > static_cast<size_t>(end - q))
+        return NULL;
+
+    const char *recordEnd = q + size;
+    unsigned char kind = static_cast<unsigned char>(*q++);
+
+    frame.size = size - 1;
+    frame.kind = kind & LOG_RECORD_KIND_MASK;
+    frame.flags = kind & ~LOG_RECORD_KIND_MASK;
+    frame.id = 0;
+    frame.type = 0;
+    frame.threadId = 0;
+    if (frame.flags & LOG_RECORD_FLAG_BLOCK_START)
+        frame.timestamp = 0;
+
+    if (frame.kind == LOG_RECORD_EVENT)
+    {
+        unsigned long long delta;
+        if (!GetVarint(q, recordEnd, frame.id) ||
+            !GetVarint(q, recordEnd, frame.type) ||
+            !GetVarint(q, recordEnd, delta) ||
+            !GetVarint(q, recordEnd, frame.threadId))
+        {
+            return NULL;
+        }
+
+        frame.timestamp += (delta >> 1) ^ (0ULL - (delta & 1));
+        frame.size = static_cast<unsigned int>(recordEnd - q);
+    }
+
+    p = recordEnd;
+    return q;
+}
+
+const char *
+LogFormat::GetText(const LogValue &value, char *buf, unsigned int &length)
+{
+    switch (value.type)
+    {
+        case LOG_VALUE_DECIMAL:
+            length = FormatDecimal(buf, value.number);
+            return buf;
+        case LOG_VALUE_NEGATIVE_DECIMAL:
+            buf[0] = '-';
+            length = 1 + FormatDecimal(buf + 1, value.number);
+            return buf;
+        case LOG_VALUE_HEX:
+            length = FormatHex(buf, value.number, 1, "0123456789abcdef");
+            return buf;
+        case LOG_VALUE_POINTER:
+            length = FormatHex(buf, value.number, 8, "0123456789ABCDEF");
+            return buf;
+        case LOG_VALUE_BOOLEAN:
+            length = value.number ? 4 : 5;
+            return value.number ? "true" : "false";
+        default:
+            length = value.length;
+            return value.data;
+    }
+}
+
+LogEncoder::LogEncoder()
+    : m_out(NULL), m_outSize(0), m_outCapacity(0),
+      m_element(NULL), m_elementSize(0), m_elementCapacity(0),
+      m_lastTimestamp(0), m_blockStart(true), m_fieldsInFrame(0),
+      m_defined(NULL), m_definedCount(0),
+      m_newSymbols(NULL), m_newSymbolCount(0), m_newSymbolCapacity(0),
+      m_payloadIdKey(0), m_payloadRefKey(0), m_payloads(NULL), m_payloadsCount(0),
+      m_newPayloads(NULL), m_newPayloadCount(0), m_newPayloadCapacity(0),
+      m_slots(new unsigned int[STRING_SLOT_COUNT]), m_stringCount(0),
+      m_stringOffsets(new unsigned int[LOG_MAX_TABLE_STRINGS]),
+      m_stringLengths(new unsigned int[LOG_MAX_TABLE_STRINGS]),
+      m_strings(new char[LOG_MAX_TABLE_STRINGS * LOG_MAX_TABLE_STRING]), m_stringsSize(0)
+{
+    memset(&m_frame, 0, sizeof(m_frame));
+    memset(m_slots, 0, STRING_SLOT_COUNT * sizeof(unsigned int));
+}
+
+LogEncoder::~LogEncoder()
+{
+    delete[] m_out;
+    delete[] m_element;
+    delete[] m_defined;
+    delete[] m_newSymbols;
+    delete[] m_payloads;
+    delete[] m_newPayloads;
+    delete[] m_slots;
+    delete[] m_stringOffsets;
+    delete[] m_stringLengths;
+    delete[] m_strings;
+}
+
+void
+LogEncoder::StartBlock()
+{
+    m_blockStart = true;
+    m_lastTimestamp = 0;
+
+    if (m_stringCount > 0)
+        memset(m_slots, 0, STRING_SLOT_COUNT * sizeof(unsigned int));
+    m_stringCount = 0;
+    m_stringsSize = 0;
+}
+
+void
+LogEncoder::Reset()
+{
+    if (m_definedCount > 0)
+        memset(m_defined, 0, m_definedCount);
+    if (m_payloadsCount > 0)
+        memset(m_payloads, 0, m_payloadsCount);
+
+    StartBlock();
+}
+
+bool
+LogEncoder::IsSymbolDefined(unsigned int id) const
+{
+    return id / 8 < m_definedCount && (m_defined[id / 8] & (1 << (id % 8))) != 0;
+}
+
+bool
+LogEncoder::EncodeEvent(const char *data, unsigned int size)
+{
+    memset(&m_frame, 0, sizeof(m_frame));
+    return Encode(data, size, false);
+}
+
+bool
+LogEncoder::EncodeEvent(const char *data, unsigned int size, unsigned long long timestamp, unsigned int threadId)
+{
+    memset(&m_frame, 0, sizeof(m_frame));
+    m_frame.timestamp = timestamp;
+    m_frame.threadId = threadId;
+    return Encode(data, size, true);
+}
+
+bool
+LogEncoder::Encode(const char *data, unsigned int size, bool stamped)
+{
+    m_frame.kind = LOG_RECORD_EVENT;
+    m_elementSize = 0;
+    m_newSymbolCount = 0;
+    m_newPayloadCount = 0;
+
+    unsigned int stringCount = m_stringCount;
+
+    const char *p = data;
+    const char *end = data + size;
+    m_fieldsInFrame = stamped ? 2 : 3;
+    if (!FindFrameFields(p, end, m_fieldsInFrame))
+        m_fieldsInFrame = 0;
+
+    if (EncodeElement(p, end, true, 0) && p == end && EmitRecords())
+    {
+        m_lastTimestamp = m_frame.timestamp;
+        return true;
+    }
+
+    // Nothing of it was written, so whatever it defined is undefined again
+    for (unsigned int i = 0; i < m_newSymbolCount; i++)
+        m_defined[m_newSymbols[i] / 8] &= ~(1 << (m_newSymbols[i] % 8));
+    m_newSymbolCount = 0;
+    for (unsigned int i = 0; i < m_newPayloadCount; i++)
+        m_payloads[m_newPayloads[i] / 8] &= ~(1 << (m_newPayloads[i] % 8));
+    m_newPayloadCount = 0;
+
+    if (m_stringCount != stringCount)
+    {
+        m_stringCount = stringCount;
+        m_stringsSize = (stringCount > 0) ? m_stringOffsets[stringCount - 1] + m_stringLengths[stringCount - 1] : 0;
+
+        memset(m_slots, 0, STRING_SLOT_COUNT * sizeof(unsigned int));
+        for (unsigned int i = 0; i < stringCount; i++)
+        {
+            unsigned int slot;
+            FindString(m_strings + m_stringOffsets[i], m_stringLengths[i], slot);
+            m_slots[slot] = i + 1;
+        }
+    }
+
+    return false;
+}
+
+//
+// Whether the element's first fields are the id, type and timestamp of an
+// event as Logger writes them, in which case they go into the frame.
+// Without a timestamp if count is two.
+//
+bool
+LogEncoder::FindFrameFields(const char *p, const char *end, unsigned int count)
+{
+    const char *name;
+    unsigned int nameLength, fieldCount;
+    if (!PeekSymbolName(p, end, name, nameLength) || !ReadDWord(p, end, fieldCount) || fieldCount < count)
+        return false;
+
+    static const char *keys[] = { "id", "type", "timestamp" };
+    const char *values[3];
+    unsigned int lengths[3];
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const char *key;
+        unsigned int keyLength;
+        if (!PeekSymbolName(p, end, key, keyLength) || !Equals(key, keyLength, keys[i]) ||
+            !ReadV1String(p, end, values[i], lengths[i]))
+        {
+            return false;
+        }
+    }
+
+    unsigned long long id, timestamp = m_frame.timestamp;
+    if (!ParseDecimal(values[0], lengths[0], id) || id > ~0U ||
+        (count == 3 && !ParseDecimal(values[2], lengths[2], timestamp)))
+    {
+        return false;
+    }
+
+    unsigned int type = InternSymbol(values[1], lengths[1]);
+    if (type == 0 || type >= LOG_MAX_SYMBOLS)
+        return false;
+
+    m_frame.id = static_cast<unsigned int>(id);
+    m_frame.type = type;
+    m_frame.timestamp = timestamp;
+    UseSymbol(type);
+
+    return true;
+}
+
+bool
+LogEncoder::ReadSymbol(const char *&p, const char *end, unsigned int &id)
+{
+    unsigned int value;
+    if (!ReadDWord(p, end, value))
+        return false;
+
+    id = value & V1_SYMBOL_ID_MASK;
+    if (id >= LOG_MAX_SYMBOLS)
+        return false;
+
+    if ((value & V1_SYMBOL_KIND_MASK) == V1_SYMBOL_DEFINITION)
+    {
+        const char *name;
+        unsigned int length;
+        if (!ReadV1String(p, end, name, length))
+            return false;
+        OnSymbolDefinition(id, name, length);
+    }
+    else if ((value & V1_SYMBOL_KIND_MASK) != V1_SYMBOL_REFERENCE)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Like ReadSymbol(), without making anything of it
+bool
+LogEncoder::PeekSymbolName(const char *&p, const char *end, const char *&name, unsigned int &length)
+{
+    unsigned int value;
+    if (!ReadDWord(p, end, value))
+        return false;
+
+    if ((value & V1_SYMBOL_KIND_MASK) == V1_SYMBOL_DEFINITION)
+        return ReadV1String(p, end, name, length);
+    if ((value & V1_SYMBOL_KIND_MASK) != V1_SYMBOL_REFERENCE)
+        return false;
+
+    name = GetSymbolName(value & V1_SYMBOL_ID_MASK, length);
+    return name != NULL;
+}
+
+bool
+LogEncoder::EncodeElement(const char *&p, const char *end, bool top, int depth)
+{
+    if (depth == MAX_ELEMENT_DEPTH)
+        return false;
+
+    unsigned int name, fieldCount;
+    if (!ReadSymbol(p, end, name) || !ReadDWord(p, end, fieldCount))
+        return false;
+    UseSymbol(name);
+    PutVarint(name);
+
+    unsigned int skipped = top ? m_fieldsInFrame : 0;
+    PutVarint(fieldCount - skipped);
+
+    // What a payloadRef field stands for, if it's written out in full
+    const char *payload = NULL;
+    unsigned int payloadLength = 0;
+
+    for (unsigned int i = 0; i < fieldCount; i++)
+    {
+        const char *value;
+        unsigned int key, length;
+
+        if (!ReadSymbol(p, end, key) || !ReadV1String(p, end, value, length))
+            return false;
+        if (i < skipped)
+            continue;
+
+        if ((key == m_payloadIdKey || key == m_payloadRefKey) && key != 0)
+            EncodePayloadField(key, value, length, payload, payloadLength);
+
+        UseSymbol(key);
+        PutVarint(key);
+        EncodeValue(value, length);
+    }
+
+    const char *content;
+    unsigned int raw, contentLength, childCount;
+    if (!ReadDWord(p, end, raw) || raw > 1 || !ReadV1String(p, end, content, contentLength) ||
+        !ReadDWord(p, end, childCount))
+    {
+        return false;
+    }
+
+    if (payload != NULL)
+    {
+        if (raw != 1 || contentLength != 0)
+            return false;
+
+        content = payload;
+        contentLength = payloadLength;
+    }
+
+    PutVarint((static_cast<unsigned long long>(contentLength) << 1) | raw);
+    PutBytes(content, contentLength);
+    PutVarint(childCount);
+
+    for (unsigned int i = 0; i < childCount; i++)
+    {
+        if (!EncodeElement(p, end, false, depth + 1))
+            return false;
+    }
+
+    return true;
+}
+
+// Marks the payload a payloadId field defines, and turns a payloadRef to
+// one that isn't defined yet into a payloadId if it can be resolved
+void
+LogEncoder::EncodePayloadField(unsigned int &key, const char *value, unsigned int length, const char *&content, unsigned int &contentLength)
+{
+    unsigned long long id;
+    if (!ParseDecimal(value, length, id) || id >= MAX_PAYLOAD_ID)
+        return;
+
+    if (key == m_payloadRefKey)
+    {
+        if (IsPayloadDefined(static_cast<unsigned int>(id)))
+            return;
+
+        content = ResolvePayload(static_cast<unsigned int>(id), contentLength);
+        if (content == NULL)
+            return;
+
+        key = m_payloadIdKey;
+    }
+
+    DefinePayload(static_cast<unsigned int>(id));
+}
+
+void
+LogEncoder::EncodeValue(const char *s, unsigned int length)
+{
+    unsigned long long number;
+
+    if (ParseDecimal(s, length, number))
+    {
+        PutVarint(LOG_VALUE_DECIMAL);
+        PutVarint(number);
+    }
+    else if (length > 1 && s[0] == '-' && ParseDecimal(s + 1, length - 1, number) &&
+             number != 0 && number <= (1ULL << 63))
+    {
+        PutVarint(LOG_VALUE_NEGATIVE_DECIMAL);
+        PutVarint(number);
+    }
+    else if (ParseHex(s, length, false, number))
+    {
+        PutVarint(LOG_VALUE_HEX);
+        PutVarint(number);
+    }
+    else if (ParseHex(s, length, true, number))
+    {
+        PutVarint(LOG_VALUE_POINTER);
+        PutVarint(number);
+    }
+    else if (Equals(s, length, "true") || Equals(s, length, "false"))
+    {
+        PutVarint(((length == 4) ? 1 << LOG_VALUE_TYPE_BITS : 0) | LOG_VALUE_BOOLEAN);
+    }
+    else if (length == 0 || length > LOG_MAX_TABLE_STRING)
+    {
+        PutVarint((static_cast<unsigned long long>(length) << LOG_VALUE_TYPE_BITS) | LOG_VALUE_STRING);
+        PutBytes(s, length);
+    }
+    else
+    {
+        unsigned int slot;
+        unsigned int index = FindString(s, length, slot);
+        if (index != ~0U)
+        {
+            PutVarint((static_cast<unsigned long long>(index) << LOG_VALUE_TYPE_BITS) | LOG_VALUE_STRING_REFERENCE);
+            return;
+        }
+
+        unsigned int type = LOG_VALUE_STRING;
+        if (m_stringCount < LOG_MAX_TABLE_STRINGS)
+        {
+            memcpy(m_strings + m_stringsSize, s, length);
+            m_stringOffsets[m_stringCount] = m_stringsSize;
+            m_stringLengths[m_stringCount] = length;
+            m_stringsSize += length;
+            m_slots[slot] = ++m_stringCount;
+
+            type = LOG_VALUE_STRING_DEFINITION;
+        }
+
+        PutVarint((static_cast<unsigned long long>(length) << LOG_VALUE_TYPE_BITS) | type);
+        PutBytes(s, length);
+    }
+}
+
+// Returns the string's index in the table, or ~0 with the free slot for it
+unsigned int
+LogEncoder::FindString(const char *s, unsigned int length, unsigned int &slot)
+{
+    slot = HashString(s, length) & (STRING_SLOT_COUNT - 1);
+    for (;;)
+    {
+        unsigned int index = m_slots[slot];
+        if (index == 0)
+            return ~0U;
+
+        index--;
+        if (m_stringLengths[index] == length && memcmp(m_strings + m_stringOffsets[index], s, length) == 0)
+            return index;
+
+        slot = (slot + 1) & (STRING_SLOT_COUNT - 1);
+    }
+}
+
+void
+LogEncoder::UseSymbol(unsigned int id)
+{
+    if (IsSymbolDefined(id))
+        return;
+
+    SetBit(m_defined, m_definedCount, id);
+
+    Grow(m_newSymbols, m_newSymbolCount, m_newSymbolCapacity, m_newSymbolCount + 1);
+    m_newSymbols[m_newSymbolCount++] = id;
+}
+
+bool
+LogEncoder::IsPayloadDefined(unsigned int id) const
+{
+    return id / 8 < m_payloadsCount && (m_payloads[id / 8] & (1 << (id % 8))) != 0;
+}
+
+void
+LogEncoder::DefinePayload(unsigned int id)
+{
+    if (IsPayloadDefined(id))
+        return;
+
+    SetBit(m_payloads, m_payloadsCount, id);
+
+    Grow(m_newPayloads, m_newPayloadCount, m_newPayloadCapacity, m_newPayloadCount + 1);
+    m_newPayloads[m_newPayloadCount++] = id;
+}
+
+void
+LogEncoder::PutVarint(unsigned long long value)
+{
+    Grow(m_element, m_elementSize, m_elementCapacity, m_elementSize + LOG_MAX_VARINT_SIZE);
+    m_elementSize += LogFormat::PutVarint(m_element + m_elementSize, value);
+}
+
+void
+LogEncoder::PutBytes(const void *data, unsigned int length)
+{
+    if (length == 0)
+        return;
+
+    Grow(m_element, m_elementSize, m_elementCapacity, m_elementSize + length);
+    memcpy(m_element + m_elementSize, data, length);
+    m_elementSize += length;
+}
+
+// A record for every symbol the event is the first to use, and the event
+bool
+LogEncoder::EmitRecords()
+{
+    for (unsigned int i = 0; i < m_newSymbolCount; i++)
+    {
+        unsigned int length;
+        if (GetSymbolName(m_newSymbols[i], length) == NULL)
+            return false;
+    }
+
+    char body[4 * LOG_MAX_VARINT_SIZE];
+    unsigned int size;
+
+    for (unsigned int i = 0; i < m_newSymbolCount; i++)
+    {
+        unsigned int length;
+        const char *name = GetSymbolName(m_newSymbols[i], length);
+
+        size = LogFormat::PutVarint(body, m_newSymbols[i]);
+        EmitRecord(LOG_RECORD_SYMBOL, body, size, name, length);
+    }
+    m_newSymbolCount = 0;
+
+    long long delta = static_cast<long long>(m_frame.timestamp - m_lastTimestamp);
+    unsigned long long zigzag = (static_cast<unsigned long long>(delta) << 1) ^ static_cast<unsigned long long>(delta >> 63);
+
+    size = LogFormat::PutVarint(body, m_frame.id);
+    size += LogFormat::PutVarint(body + size, m_frame.type);
+    size += LogFormat::PutVarint(body + size, zigzag);
+    size += LogFormat::PutVarint(body + size, m_frame.threadId);
+
+    m_frame.flags = (m_fieldsInFrame != 0) ? LOG_RECORD_FLAG_FIELDS_IN_FRAME : 0;
+    if (m_blockStart)
+        m_frame.flags |= LOG_RECORD_FLAG_BLOCK_START;
+    m_frame.size = m_elementSize;
+
+    EmitRecord(LOG_RECORD_EVENT | m_frame.flags, body, size, m_element, m_elementSize);
+
+    return true;
+}
+
+void
+LogEncoder::EmitRecord(unsigned int kind, const char *body, unsigned int bodySize, const char *tail, unsigned int tailSize)
+{
+    if (m_blockStart)
+    {
+        kind |= LOG_RECORD_FLAG_BLOCK_START;
+        m_blockStart = false;
+    }
+
+    unsigned int size = 1 + bodySize + tailSize;
+    Grow(m_out, m_outSize, m_outCapacity, m_outSize + LOG_MAX_VARINT_SIZE + size);
+
+    m_outSize += LogFormat::PutVarint(m_out + m_outSize, size);
+    m_out[m_outSize++] = static_cast<char>(kind);
+    memcpy(m_out + m_outSize, body, bodySize);
+    m_outSize += bodySize;
+    if (tailSize > 0)
+        memcpy(m_out + m_outSize, tail, tailSize);
+    m_outSize += tailSize;
+}
+
+LogDecoder::LogDecoder()
+    : m_names(NULL), m_namesSize(0), m_namesCapacity(0),
+      m_nameOffsets(NULL), m_nameLengths(NULL), m_symbolLimit(0),
+      m_strings(new const char *[LOG_MAX_TABLE_STRINGS]),
+      m_stringLengths(new unsigned int[LOG_MAX_TABLE_STRINGS]), m_stringCount(0)
+{
+    LogFormat::InitHeader(m_header, 0, 0);
+}
+
+LogDecoder::~LogDecoder()
+{
+    delete[] m_names;
+    delete[] m_nameOffsets;
+    delete[] m_nameLengths;
+    delete[] m_strings;
+    delete[] m_stringLengths;
+}
+
+void
+LogDecoder::Reset()
+{
+    if (m_symbolLimit > 0)
+        memset(m_nameOffsets, 0, m_symbolLimit * sizeof(unsigned int));
+    m_namesSize = 0;
+
+    LogFormat::InitHeader(m_header, 0, 0);
+}
+
+bool
+LogDecoder::AddSymbol(unsigned int id, const char *name, unsigned int length)
+{
+    if (id >= LOG_MAX_SYMBOLS)
+        return false;
+
+    if (id >= m_symbolLimit)
+    {
+        unsigned int limit = (m_symbolLimit != 0) ? m_symbolLimit : 256;
+        while (limit <= id)
+            limit *= 2;
+
+        unsigned int *offsets = new unsigned int[limit];
+        unsigned int *lengths = new unsigned int[limit];
+        memset(offsets, 0, limit * sizeof(unsigned int));
+        if (m_symbolLimit > 0)
+        {
+            memcpy(offsets, m_nameOffsets, m_symbolLimit * sizeof(unsigned int));
+            memcpy(lengths, m_nameLengths, m_symbolLimit * sizeof(unsigned int));
+        }
+        delete[] m_nameOffsets;
+        delete[] m_nameLengths;
+
+        m_nameOffsets = offsets;
+        m_nameLengths = lengths;
+        m_symbolLimit = limit;
+    }
+
+    // Index records repeat what's known already
+    if (m_nameOffsets[id] != 0 && m_nameLengths[id] == length &&
+        memcmp(m_names + m_nameOffsets[id] - 1, name, length) == 0)
+    {
+        return true;
+    }
+
+    Grow(m_names, m_namesSize, m_namesCapacity, m_namesSize + length);
+    if (length > 0)
+        memcpy(m_names + m_namesSize, name, length);
+
+    m_nameOffsets[id] = m_namesSize + 1;
+    m_nameLengths[id] = length;
+    m_namesSize += length;
+
+    return true;
+}
+
+const char *
+LogDecoder::GetSymbolName(unsigned int id, unsigned int &length) const
+{
+    if (id >= m_symbolLimit || m_nameOffsets[id] == 0)
+        return NULL;
+
+    length = m_nameLengths[id];
+    return m_names + m_nameOffsets[id] - 1;
+}
+
+bool
+LogDecoder::DecodeBlock(const char *data, unsigned int size, LogVisitor &visitor)
+{
+    const char *p = data;
+    const char *end = data + size;
+    LogRecordFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    m_stringCount = 0;
+
+    while (p < end)
+    {
+        const char *body = LogFormat::NextRecord(p, end, frame);
+        if (body == NULL)
+            return false;
+
+        if (frame.flags & LOG_RECORD_FLAG_BLOCK_START)
+            m_stringCount = 0;
+
+        if (frame.kind == LOG_RECORD_SYMBOL)
+        {
+            const char *q = body;
+            const char *recordEnd = body + frame.size;
+            unsigned int id;
+            if (!LogFormat::GetVarint(q, recordEnd, id) ||
+                !AddSymbol(id, q, static_cast<unsigned int>(recordEnd - q)))
+            {
+                return false;
+            }
+        }
+        else if (frame.kind == LOG_RECORD_EVENT)
+        {
+            const char *q = body;
+            const char *recordEnd = body + frame.size;
+
+            visitor.BeginEvent(frame);
+            bool inFrame = (frame.flags & LOG_RECORD_FLAG_FIELDS_IN_FRAME) != 0;
+            if (!DecodeElement(q, recordEnd, visitor, inFrame ? &frame : NULL, 0) || q != recordEnd)
+                return false;
+            visitor.EndEvent();
+        }
+    }
+
+    return true;
+}
+
+bool
+LogDecoder::DecodeElement(const char *&p, const char *end, LogVisitor &visitor, const LogRecordFrame *frame, int depth)
+{
+    if (depth == MAX_ELEMENT_DEPTH)
+        return false;
+
+    unsigned int id, fieldCount, length;
+    const char *name;
+    if (!LogFormat::GetVarint(p, end, id) || (name = GetSymbolName(id, length)) == NULL ||
+        !LogFormat::GetVarint(p, end, fieldCount))
+    {
+        return false;
+    }
+
+    visitor.BeginElement(name, length);
+
+    if (frame != NULL)
+    {
+        const char *type = GetSymbolName(frame->type, length);
+        if (type == NULL)
+            return false;
+
+        LogValue value;
+        value.type = LOG_VALUE_DECIMAL;
+        value.number = frame->id;
+        visitor.Field("id", 2, value);
+
+        value.type = LOG_VALUE_STRING;
+        value.data = type;
+        value.length = length;
+        visitor.Field("type", 4, value);
+
+        value.type = LOG_VALUE_DECIMAL;
+        value.number = LogFormat::GetFileTime(m_header, frame->timestamp);
+        visitor.Field("timestamp", 9, value);
+
+        if (frame->threadId != 0)
+        {
+            value.number = frame->threadId;
+            visitor.Field("threadId", 8, value);
+        }
+    }
+
+    for (unsigned int i = 0; i < fieldCount; i++)
+    {
+        LogValue value;
+        const char *key;
+        unsigned int keyLength;
+        if (!LogFormat::GetVarint(p, end, id) || (key = GetSymbolName(id, keyLength)) == NULL ||
+            !DecodeValue(p, end, value))
+        {
+            return false;
+        }
+
+        visitor.Field(key, keyLength, value);
+    }
+
+    unsigned long long content;
+    unsigned int childCount;
+    if (!LogFormat::GetVarint(p, end, content) || (content >> 1) > static_cast<size_t>(end - p))
+        return false;
+
+    length = static_cast<unsigned int>(content >> 1);
+    visitor.Content((content & 1) != 0, p, length);
+    p += length;
+
+    if (!LogFormat::GetVarint(p, end, childCount))
+        return false;
+
+    for (unsigned int i = 0; i < childCount; i++)
+    {
+        if (!DecodeElement(p, end, visitor, NULL, depth + 1))
+            return false;
+    }
+
+    visitor.EndElement();
+    return true;
+}
+
+bool
+LogDecoder::DecodeValue(const char *&p, const char *end, LogValue &value)
+{
+    unsigned long long tag;
+    if (!LogFormat::GetVarint(p, end, tag))
+        return false;
+
+    value.type = static_cast<unsigned int>(tag & LOG_VALUE_TYPE_MASK);
+    unsigned long long operand = tag >> LOG_VALUE_TYPE_BITS;
+
+    switch (value.type)
+    {
+        case LOG_VALUE_STRING:
+        case LOG_VALUE_STRING_DEFINITION:
+            if (operand > static_cast<size_t>(end - p))
+                return false;
+            value.data = p;
+            value.length = static_cast<unsigned int>(operand);
+            p += value.length;
+
+            if (value.type == LOG_VALUE_STRING_DEFINITION)
+            {
+                if (m_stringCount == LOG_MAX_TABLE_STRINGS)
+                    return false;
+                m_strings[m_stringCount] = value.data;
+                m_stringLengths[m_stringCount] = value.length;
+                m_stringCount++;
+            }
+            return true;
+
+        case LOG_VALUE_STRING_REFERENCE:
+            if (operand >= m_stringCount)
+                return false;
+            value.data = m_strings[operand];
+            value.length = m_stringLengths[operand];
+            return true;
+
+        case LOG_VALUE_BOOLEAN:
+            value.number = operand;
+            return operand <= 1;
+
+        default:
+            if (operand != 0 || !LogFormat::GetVarint(p, end, value.number))
+                return false;
+            if (value.type == LOG_VALUE_POINTER && value.number > ~0U)
+                return false;
+            if (value.type == LOG_VALUE_NEGATIVE_DECIMAL && (value.number == 0 || value.number > (1ULL << 63)))
+                return false;
+            return true;
+    }
+}
+
+} // namespace InterceptPP
@@ -0,0 +1,388 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <stddef.h>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+//
+// Version 2 of the binary log format.  Version 1 spent a DWORD on every
+// count, length, symbol and flag, had field values as text only, and no
+// header to tell it apart from what comes next.
+//
+// A log starts with a LogFileHeader.  What follows is a series of
+// records, cut into LzCodec blocks if the header says the log is
+// compressed, and ends with a LogTrailer if it was closed (see
+// LogIndex.h).  Every integer is a LEB128 varint, seven bits at a time,
+// least significant first, with the top bit set on all but the last
+// byte.  A record is:
+//
+//   size          varint, of what follows
+//   kind          byte, LOG_RECORD_* and LOG_RECORD_FLAG_*
+//   ...           depending on the kind
+//
+// LOG_RECORD_SYMBOL defines a symbol (see SymbolTable.h) before the first
+// record that uses it, with its id followed by its name:
+//
+//   id            varint
+//   name          bytes, the rest of the record
+//
+// LOG_RECORD_EVENT is an event, with the id, type and timestamp that the
+// index is built from, the thread that logged it, and its element:
+//
+//   id            varint
+//   type          varint, symbol
+//   timestamp     varint, zigzagged difference from the previous event's
+//   threadId      varint, zero if not known
+//   element       see below
+//
+// Timestamps count the header's ticksPerSecond, from startTicks at
+// startTime, a FILETIME, which LogFormat::GetFileTime() works out.  The
+// agent has them from Clock, a log converted from version 1 has FILETIMEs
+// to begin with, which its header says by counting 10000000 from zero.
+//
+// With LOG_RECORD_FLAG_FIELDS_IN_FRAME the element's first fields are
+// its id, type and timestamp, the latter as a FILETIME, followed by its
+// threadId if that's in the frame.  They're left out of the element, as
+// is the case for any event the agent logs.  Elements are:
+//
+//   name          varint, symbol
+//   fieldCount    varint
+//   fields        varint symbol key and a value each
+//   content       varint length << 1 | isRaw, followed by the bytes
+//   childCount    varint
+//   children      elements
+//
+// A field value starts with a varint tag, whose low three bits are a
+// LOG_VALUE_* type.  Numbers and pointers that the agent formatted as
+// text, Format::Decimal(), HexPrefixed() and Pointer(), are stored as
+// varints instead and formatted again on the way out, which gives back
+// the same text.  So are "true" and "false".  Short strings go into a
+// table as they're first used and are referred to by index after that.
+//
+// The table, along with the timestamp an event's is relative to, starts
+// over with each block: the first record of a block has
+// LOG_RECORD_FLAG_BLOCK_START.  Only symbols are defined once per log,
+// and index records list all of them, so that any block can be decoded
+// without the ones before it.
+//
+// Besides MSVC this builds on Linux so that it can be tested there.
+//
+
+#define LOG_FILE_MAGIC                  0x324C534F  // "OSL2"
+#define LOG_FILE_VERSION                2
+#define LOG_FILE_COMPRESSED             1
+
+#define LOG_RECORD_EVENT                1
+#define LOG_RECORD_INDEX                2
+#define LOG_RECORD_SYMBOL               3
+#define LOG_RECORD_KIND_MASK            0x3F
+#define LOG_RECORD_FLAG_BLOCK_START     0x40
+#define LOG_RECORD_FLAG_FIELDS_IN_FRAME 0x80
+
+// Tag is length << 3 | type, the bytes follow
+#define LOG_VALUE_STRING                0
+// The same, and the string goes into the table
+#define LOG_VALUE_STRING_DEFINITION     1
+// Tag is index << 3 | type
+#define LOG_VALUE_STRING_REFERENCE      2
+// Tag is just the type, the value follows as a varint
+#define LOG_VALUE_DECIMAL               3
+#define LOG_VALUE_NEGATIVE_DECIMAL      4
+#define LOG_VALUE_HEX                   5
+#define LOG_VALUE_POINTER               6
+// Tag is value << 3 | type
+#define LOG_VALUE_BOOLEAN               7
+
+#define LOG_VALUE_TYPE_BITS             3
+#define LOG_VALUE_TYPE_MASK             7
+
+#define LOG_MAX_SYMBOLS                 0x100000
+#define LOG_MAX_TABLE_STRING            64
+#define LOG_MAX_TABLE_STRINGS           4096
+#define LOG_MAX_VARINT_SIZE             10
+// Of any value that isn't a string, as text
+#define LOG_MAX_VALUE_TEXT              24
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    // Before compression
+    unsigned int blockSize;
+    unsigned int flags;
+    // What the timestamps count
+    unsigned long long ticksPerSecond;
+    unsigned long long startTicks;
+    unsigned long long startTime;
+} LogFileHeader;
+
+// A record's frame, decoded.  size is what follows it.
+typedef struct {
+    unsigned int size;
+    unsigned int kind;
+    unsigned int flags;
+    unsigned int id;
+    unsigned int type;
+    unsigned int threadId;
+    unsigned long long timestamp;
+} LogRecordFrame;
+
+typedef struct {
+    unsigned int type;
+    // Of a string
+    const char *data;
+    unsigned int length;
+    // Of anything else
+    unsigned long long number;
+} LogValue;
+
+class INTERCEPTPP_API LogFormat
+{
+public:
+    // With timestamps that are FILETIMEs, flags being LOG_FILE_*
+    static void InitHeader(LogFileHeader &header, unsigned int blockSize, unsigned int flags);
+    static unsigned long long GetFileTime(const LogFileHeader &header, unsigned long long timestamp);
+
+    // Return the size written, at most LOG_MAX_VARINT_SIZE
+    static unsigned int PutVarint(char *p, unsigned long long value);
+    static unsigned int GetVarintSize(unsigned long long value);
+    // Return false if it runs past end or is too long.  Most are a single
+    // byte, which is dealt with here.
+    static bool GetVarint(const char *&p, const char *end, unsigned long long &value)
+    {
+        if (p != end && (*p & 0x80) == 0)
+        {
+            value = static_cast<unsigned char>(*p++);
+            return true;
+        }
+        return GetLongVarint(p, end, value);
+    }
+    static bool GetVarint(const char *&p, const char *end, unsigned int &value)
+    {
+        if (p != end && (*p & 0x80) == 0)
+        {
+            value = static_cast<unsigned char>(*p++);
+            return true;
+        }
+        return GetLongVarint(p, end, value);
+    }
+
+    //
+    // Reads the record at p and steps over it, returning what follows its
+    // frame, or NULL if it's incomplete or corrupt.  frame has to hold
+    // the previous record's frame, if any, as event timestamps are
+    // relative to it.
+    //
+    static const char *NextRecord(const char *&p, const char *end, LogRecordFrame &frame);
+
+    // Returns the text of a value, which is written to buf unless it's a
+    // string.  buf has to hold LOG_MAX_VALUE_TEXT bytes.
+    static const char *GetText(const LogValue &value, char *buf, unsigned int &length);
+
+protected:
+    static bool GetLongVarint(const char *&p, const char *end, unsigned long long &value);
+    static bool GetLongVarint(const char *&p, const char *end, unsigned int &value);
+};
+
+//
+// Encodes events from the version 1 format that BinaryWriter produces,
+// along with any symbols they're the first to use.  Symbols in the input
+// may be defined inline, as in a version 1 log, or only referred to, as
+// in what BinaryWriter writes, with the names coming from the subclass.
+// Records accumulate until Clear().
+//
+// Raw payloads are kept track of like symbols once SetPayloadKeys() says
+// which fields are about them: a payloadRef to one that no payloadId
+// defined since Reset() is handed to ResolvePayload(), and if the subclass
+// has its content it goes out in full under payloadId instead, so that the
+// reference can be read without what came before.
+//
+
+class INTERCEPTPP_API LogEncoder
+{
+public:
+    LogEncoder();
+    virtual ~LogEncoder();
+
+    // The string table and the timestamps start over with the next record
+    void StartBlock();
+    // Everything does, symbols get defined again, as for a new file
+    void Reset();
+
+    // Returns false if the event is malformed, leaving nothing behind
+    bool EncodeEvent(const char *data, unsigned int size);
+    // The same for one without a timestamp or threadId field, which has
+    // them here instead
+    bool EncodeEvent(const char *data, unsigned int size, unsigned long long timestamp, unsigned int threadId);
+    // Of the last event encoded
+    const LogRecordFrame &GetFrame() const { return m_frame; }
+
+    const char *GetData() const { return m_out; }
+    unsigned int GetSize() const { return m_outSize; }
+    void Clear() { m_outSize = 0; }
+
+    // Defined in the log so far
+    unsigned int GetSymbolLimit() const { return m_definedCount * 8; }
+    bool IsSymbolDefined(unsigned int id) const;
+
+    // NULL if there's no such symbol
+    virtual const char *GetSymbolName(unsigned int id, unsigned int &length) = 0;
+
+    // The symbols of the payloadId and payloadRef keys
+    void SetPayloadKeys(unsigned int idKey, unsigned int refKey) { m_payloadIdKey = idKey; m_payloadRefKey = refKey; }
+
+protected:
+    // For a symbol that isn't in the input, the event type.  Zero if
+    // there's no room for it.
+    virtual unsigned int InternSymbol(const char *name, unsigned int length) = 0;
+    // For one that the input defines inline
+    virtual void OnSymbolDefinition(unsigned int id, const char *name, unsigned int length) {}
+    // The content of a payload referred to before it's defined, NULL to
+    // leave the reference as it is.  Valid until the next call.
+    virtual const char *ResolvePayload(unsigned int id, unsigned int &length) { return NULL; }
+
+    bool Encode(const char *data, unsigned int size, bool stamped);
+    bool FindFrameFields(const char *p, const char *end, unsigned int count);
+    bool ReadSymbol(const char *&p, const char *end, unsigned int &id);
+    bool PeekSymbolName(const char *&p, const char *end, const char *&name, unsigned int &length);
+    bool EncodeElement(const char *&p, const char *end, bool top, int depth);
+    void EncodePayloadField(unsigned int &key, const char *value, unsigned int length, const char *&content, unsigned int &contentLength);
+    void EncodeValue(const char *s, unsigned int length);
+    unsigned int FindString(const char *s, unsigned int length, unsigned int &slot);
+    void UseSymbol(unsigned int id);
+    bool IsPayloadDefined(unsigned int id) const;
+    void DefinePayload(unsigned int id);
+    void PutVarint(unsigned long long value);
+    void PutBytes(const void *data, unsigned int length);
+    bool EmitRecords();
+    void EmitRecord(unsigned int kind, const char *body, unsigned int bodySize, const char *tail, unsigned int tailSize);
+
+    // The output
+    char *m_out;
+    unsigned int m_outSize;
+    unsigned int m_outCapacity;
+
+    // The element being encoded, which is only emitted once it's known
+    // which symbols it defines
+    char *m_element;
+    unsigned int m_elementSize;
+    unsigned int m_elementCapacity;
+
+    LogRecordFrame m_frame;
+    unsigned long long m_lastTimestamp;
+    bool m_blockStart;
+    // Of the element's fields, how many went into the frame
+    unsigned int m_fieldsInFrame;
+
+    unsigned char *m_defined;
+    unsigned int m_definedCount;
+    unsigned int *m_newSymbols;
+    unsigned int m_newSymbolCount;
+    unsigned int m_newSymbolCapacity;
+
+    // The same for payloads, by the symbols of their fields' keys
+    unsigned int m_payloadIdKey;
+    unsigned int m_payloadRefKey;
+    unsigned char *m_payloads;
+    unsigned int m_payloadsCount;
+    unsigned int *m_newPayloads;
+    unsigned int m_newPayloadCount;
+    unsigned int m_newPayloadCapacity;
+
+    // The string table, hashed by content, and the strings in it
+    unsigned int *m_slots;
+    unsigned int m_stringCount;
+    unsigned int *m_stringOffsets;
+    unsigned int *m_stringLengths;
+    char *m_strings;
+    unsigned int m_stringsSize;
+};
+
+//
+// Gets notified of what's in an event as LogDecoder goes through it.
+//
+
+class INTERCEPTPP_API LogVisitor
+{
+public:
+    virtual ~LogVisitor() {}
+
+    virtual void BeginEvent(const LogRecordFrame &frame) {}
+    virtual void BeginElement(const char *name, unsigned int length) = 0;
+    virtual void Field(const char *key, unsigned int keyLength, const LogValue &value) = 0;
+    // Once for every element, after its fields, even if there's none
+    virtual void Content(bool raw, const char *data, unsigned int length) = 0;
+    virtual void EndElement() = 0;
+    virtual void EndEvent() {}
+};
+
+//
+// Decodes the records of a block, keeping track of the symbols defined
+// by them, and whatever symbols it's given, like those of an index.  The
+// timestamps it turns into fields are FILETIMEs as the log's header says,
+// as if they were that already until it's given one.
+//
+
+class INTERCEPTPP_API LogDecoder
+{
+public:
+    LogDecoder();
+    ~LogDecoder();
+
+    // Forgets every symbol, and the header
+    void Reset();
+    const LogFileHeader &GetHeader() const { return m_header; }
+    void SetHeader(const LogFileHeader &header) { m_header = header; }
+    // Returns false if the id is out of range
+    bool AddSymbol(unsigned int id, const char *name, unsigned int length);
+    // NULL if there's no such symbol
+    const char *GetSymbolName(unsigned int id, unsigned int &length) const;
+
+    // Returns false if the block is corrupt, having stopped there
+    bool DecodeBlock(const char *data, unsigned int size, LogVisitor &visitor);
+
+protected:
+    bool DecodeElement(const char *&p, const char *end, LogVisitor &visitor, const LogRecordFrame *frame, int depth);
+    bool DecodeValue(const char *&p, const char *end, LogValue &value);
+
+    LogFileHeader m_header;
+
+    char *m_names;
+    unsigned int m_namesSize;
+    unsigned int m_namesCapacity;
+    // Offsets into m_names plus one, zero for ids without a symbol
+    unsigned int *m_nameOffsets;
+    unsigned int *m_nameLengths;
+    unsigned int m_symbolLimit;
+
+    // The block's string table, pointing into the block
+    const char **m_strings;
+    unsigned int *m_stringLengths;
+    unsigned int m_stringCount;
+};
+
+} // namespace InterceptPP
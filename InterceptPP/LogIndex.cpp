@@ -0,0 +1,637 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "LogIndex.h"
+#include "LzCodec.h"
+#include <string.h>
+
+namespace InterceptPP {
+
+// Bytes of records per block in an index that's rebuilt
+#define REBUILT_BLOCK_SIZE  LZ_DEFAULT_BLOCK_SIZE
+
+// Makes room for needed elements, keeping the first count
+template <class T>
+static void
+Grow(T *&array, unsigned int count, unsigned int &capacity, unsigned int needed)
+{
+    if (needed <= capacity)
+        return;
+
+    unsigned int newCapacity = (capacity != 0) ? capacity : 64;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+
+    T *newArray = new T[newCapacity];
+    if (count > 0)
+        memcpy(newArray, array, count * sizeof(T));
+    delete[] array;
+
+    array = newArray;
+    capacity = newCapacity;
+}
+
+LogIndexWriter::LogIndexWriter()
+    : m_entries(NULL), m_count(0), m_capacity(0), m_indexed(0),
+      m_data(NULL), m_size(0), m_dataCapacity(0), m_final(false), m_symbolCount(0),
+      m_lastIndex(LOG_INDEX_NONE)
+{
+}
+
+LogIndexWriter::~LogIndexWriter()
+{
+    delete[] m_entries;
+    delete[] m_data;
+}
+
+void
+LogIndexWriter::InitEntry(LogIndexEntry &entry, unsigned long long offset)
+{
+    entry.offset = offset;
+    entry.minTime = ~0ULL;
+    entry.maxTime = 0;
+    entry.minId = ~0U;
+    entry.maxId = 0;
+    entry.events = 0;
+    entry.size = 0;
+}
+
+void
+LogIndexWriter::AddToEntry(LogIndexEntry &entry, const LogRecordFrame &frame)
+{
+    if (frame.kind != LOG_RECORD_EVENT)
+        return;
+
+    if (frame.id < entry.minId)
+        entry.minId = frame.id;
+    if (frame.id > entry.maxId)
+        entry.maxId = frame.id;
+    if (frame.timestamp < entry.minTime)
+        entry.minTime = frame.timestamp;
+    if (frame.timestamp > entry.maxTime)
+        entry.maxTime = frame.timestamp;
+
+    entry.events++;
+}
+
+void
+LogIndexWriter::AddEntry(const LogIndexEntry &entry)
+{
+    Grow(m_entries, m_count, m_capacity, m_count + 1);
+    m_entries[m_count++] = entry;
+}
+
+void
+LogIndexWriter::GetTotals(LogIndexEntry &totals) const
+{
+    InitEntry(totals, (m_count > 0) ? m_entries[0].offset : 0);
+
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        const LogIndexEntry &entry = m_entries[i];
+
+        if (entry.minId < totals.minId)
+            totals.minId = entry.minId;
+        if (entry.maxId > totals.maxId)
+            totals.maxId = entry.maxId;
+        if (entry.minTime < totals.minTime)
+            totals.minTime = entry.minTime;
+        if (entry.maxTime > totals.maxTime)
+            totals.maxTime = entry.maxTime;
+
+        totals.events += entry.events;
+        totals.size += entry.size;
+    }
+}
+
+void
+LogIndexWriter::Reset()
+{
+    m_count = 0;
+    m_indexed = 0;
+    m_lastIndex = LOG_INDEX_NONE;
+}
+
+// Room for the record's size and kind in front of the header
+#define INDEX_PREFIX_SIZE   (LOG_MAX_VARINT_SIZE + 1)
+
+void
+LogIndexWriter::BeginIndex(bool final)
+{
+    m_final = final;
+    m_symbolCount = 0;
+    m_size = 0;
+
+    unsigned int first = final ? 0 : m_indexed;
+
+    // Both are filled in by EndIndex()
+    char prefix[INDEX_PREFIX_SIZE];
+    memset(prefix, 0, sizeof(prefix));
+    Append(prefix, sizeof(prefix));
+
+    LogIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    Append(&header, sizeof(header));
+
+    Append(m_entries + first, (m_count - first) * sizeof(LogIndexEntry));
+}
+
+void
+LogIndexWriter::AddSymbol(unsigned int id, const char *name, unsigned int length)
+{
+    Append(&id, sizeof(id));
+    Append(&length, sizeof(length));
+    Append(name, length);
+
+    m_symbolCount++;
+}
+
+const char *
+LogIndexWriter::EndIndex(unsigned long long offset, unsigned int &size)
+{
+    unsigned int first = m_final ? 0 : m_indexed;
+
+    LogIndexHeader header;
+    header.previous = m_lastIndex;
+    header.entryCount = m_count - first;
+    header.symbolCount = m_symbolCount;
+    header.flags = m_final ? LOG_INDEX_FINAL : 0;
+    header.reserved = 0;
+    memcpy(m_data + INDEX_PREFIX_SIZE, &header, sizeof(header));
+
+    // The size and kind go right in front of it
+    unsigned int recordSize = 1 + m_size - INDEX_PREFIX_SIZE;
+    unsigned int start = INDEX_PREFIX_SIZE - 1 - LogFormat::GetVarintSize(recordSize);
+    LogFormat::PutVarint(m_data + start, recordSize);
+    m_data[INDEX_PREFIX_SIZE - 1] = LOG_RECORD_INDEX;
+
+    m_indexed = m_count;
+    m_lastIndex = offset;
+
+    size = m_size - start;
+    return m_data + start;
+}
+
+void
+LogIndexWriter::BuildTrailer(LogTrailer &trailer) const
+{
+    trailer.indexOffset = m_lastIndex;
+    trailer.reserved = 0;
+    trailer.magic = LOG_TRAILER_MAGIC;
+}
+
+void
+LogIndexWriter::Append(const void *data, unsigned int size)
+{
+    Grow(m_data, m_size, m_dataCapacity, m_size + size);
+    if (size > 0)
+        memcpy(m_data + m_size, data, size);
+    m_size += size;
+}
+
+LogIndexReader::LogIndexReader()
+    : m_data(NULL), m_fileSize(0), m_compressed(false), m_complete(false),
+      m_entries(NULL), m_count(0), m_capacity(0),
+      m_maxIds(NULL), m_minIds(NULL), m_maxTimes(NULL), m_minTimes(NULL),
+      m_block(NULL), m_blockCapacity(0)
+{
+}
+
+LogIndexReader::~LogIndexReader()
+{
+    Close();
+}
+
+bool
+LogIndexReader::Open(const MappedFileChar *path)
+{
+    Close();
+
+    if (!m_file.Open(path))
+        return false;
+
+    m_fileSize = m_file.GetSize();
+    if (m_fileSize == 0 || m_fileSize != static_cast<size_t>(m_fileSize))
+    {
+        Close();
+        return false;
+    }
+
+    m_data = static_cast<const char *>(m_file.Map(0, static_cast<size_t>(m_fileSize)));
+    if (m_data == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    LogFileHeader header;
+    if (m_fileSize < sizeof(header))
+    {
+        Close();
+        return false;
+    }
+
+    memcpy(&header, m_data, sizeof(header));
+    if (header.magic != LOG_FILE_MAGIC || header.version != LOG_FILE_VERSION)
+    {
+        Close();
+        return false;
+    }
+    m_compressed = (header.flags & LOG_FILE_COMPRESSED) != 0;
+    m_decoder.SetHeader(header);
+
+    if (m_fileSize >= sizeof(header) + sizeof(LogTrailer))
+    {
+        LogTrailer trailer;
+        memcpy(&trailer, m_data + m_fileSize - sizeof(trailer), sizeof(trailer));
+
+        if (trailer.magic == LOG_TRAILER_MAGIC)
+            m_complete = LoadIndex(trailer.indexOffset);
+    }
+
+    if (!m_complete)
+        Rebuild();
+    Summarize();
+
+    return true;
+}
+
+void
+LogIndexReader::Close()
+{
+    if (m_data != NULL)
+        MappedFile::Unmap(const_cast<char *>(m_data), static_cast<size_t>(m_fileSize));
+    m_data = NULL;
+    m_file.Close();
+
+    m_fileSize = 0;
+    m_compressed = false;
+    m_complete = false;
+
+    delete[] m_entries;
+    delete[] m_maxIds;
+    delete[] m_minIds;
+    delete[] m_maxTimes;
+    delete[] m_minTimes;
+    m_entries = NULL;
+    m_maxIds = m_minIds = NULL;
+    m_maxTimes = m_minTimes = NULL;
+    m_count = m_capacity = 0;
+
+    m_decoder.Reset();
+
+    delete[] m_block;
+    m_block = NULL;
+    m_blockCapacity = 0;
+}
+
+void
+LogIndexReader::FindId(unsigned int id, unsigned int &first, unsigned int &last) const
+{
+    // The first block with an id at least this big up to here, and the
+    // first one with nothing that small from there on
+    unsigned int lo = 0, hi = m_count;
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (m_maxIds[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    first = lo;
+
+    hi = m_count;
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (m_minIds[mid] <= id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    last = lo;
+}
+
+void
+LogIndexReader::FindTime(unsigned long long timestamp, unsigned int &first, unsigned int &last) const
+{
+    unsigned int lo = 0, hi = m_count;
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (m_maxTimes[mid] < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    first = lo;
+
+    hi = m_count;
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (m_minTimes[mid] <= timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    last = lo;
+}
+
+const char *
+LogIndexReader::ReadBlock(unsigned int index, unsigned int &size)
+{
+    if (index >= m_count)
+        return NULL;
+
+    const LogIndexEntry &entry = m_entries[index];
+    if (entry.offset >= m_fileSize)
+        return NULL;
+    unsigned long long left = m_fileSize - entry.offset;
+    const char *p = m_data + entry.offset;
+
+    if (!m_compressed)
+    {
+        if (entry.size > left)
+            return NULL;
+
+        size = entry.size;
+        return p;
+    }
+
+    LzBlockHeader header;
+    if (left < sizeof(header))
+        return NULL;
+    memcpy(&header, p, sizeof(header));
+
+    if (header.storedSize > left - sizeof(header) || header.rawSize != entry.size)
+        return NULL;
+
+    Grow(m_block, 0, m_blockCapacity, header.rawSize);
+    if (LzCodec::DecompressBlock(&header, p + sizeof(header), m_block, header.rawSize) !=
+        static_cast<int>(header.rawSize))
+    {
+        return NULL;
+    }
+
+    size = header.rawSize;
+    return m_block;
+}
+
+bool
+LogIndexReader::LoadIndex(unsigned long long offset)
+{
+    if (offset >= m_fileSize)
+        return false;
+
+    const char *p = m_data + offset;
+    unsigned long long left = m_fileSize - offset;
+    unsigned int size;
+
+    if (m_compressed)
+    {
+        LzBlockHeader header;
+        if (left < sizeof(header))
+            return false;
+        memcpy(&header, p, sizeof(header));
+
+        if (header.storedSize > left - sizeof(header))
+            return false;
+
+        Grow(m_block, 0, m_blockCapacity, header.rawSize);
+        if (LzCodec::DecompressBlock(&header, p + sizeof(header), m_block, header.rawSize) !=
+            static_cast<int>(header.rawSize))
+        {
+            return false;
+        }
+
+        p = m_block;
+        size = header.rawSize;
+    }
+    else
+    {
+        size = (left < ~0U) ? static_cast<unsigned int>(left) : ~0U;
+    }
+
+    LogRecordFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    const char *data = LogFormat::NextRecord(p, p + size, frame);
+    if (data == NULL || frame.kind != LOG_RECORD_INDEX)
+        return false;
+
+    return ParseIndex(data, frame.size, true);
+}
+
+bool
+LogIndexReader::ParseIndex(const char *data, unsigned int size, bool final)
+{
+    LogIndexHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+
+    if (final && (header.flags & LOG_INDEX_FINAL) == 0)
+        return false;
+
+    unsigned int pos = sizeof(header);
+    if (header.entryCount > (size - pos) / sizeof(LogIndexEntry))
+        return false;
+
+    const char *entries = data + pos;
+    pos += header.entryCount * sizeof(LogIndexEntry);
+
+    // The symbols are checked before anything is kept
+    unsigned int symbols = pos;
+    for (unsigned int i = 0; i < header.symbolCount; i++)
+    {
+        unsigned int id, length;
+        if (size - pos < sizeof(id) + sizeof(length))
+            return false;
+        memcpy(&id, data + pos, sizeof(id));
+        memcpy(&length, data + pos + sizeof(id), sizeof(length));
+        pos += sizeof(id) + sizeof(length);
+
+        if (length > size - pos || id >= LOG_MAX_SYMBOLS)
+            return false;
+        pos += length;
+    }
+
+    if (final)
+    {
+        for (unsigned int i = 0; i < header.entryCount; i++)
+        {
+            LogIndexEntry entry;
+            memcpy(&entry, entries + i * sizeof(LogIndexEntry), sizeof(entry));
+            AddEntry(entry);
+        }
+    }
+
+    pos = symbols;
+    for (unsigned int i = 0; i < header.symbolCount; i++)
+    {
+        unsigned int id, length;
+        memcpy(&id, data + pos, sizeof(id));
+        memcpy(&length, data + pos + sizeof(id), sizeof(length));
+        pos += sizeof(id) + sizeof(length);
+
+        m_decoder.AddSymbol(id, data + pos, length);
+        pos += length;
+    }
+
+    return true;
+}
+
+//
+// For a log that wasn't closed: the blocks are those of a compressed log,
+// and REBUILT_BLOCK_SIZE bytes or so of records otherwise, cut where the
+// writer started a block.  Symbols are taken from the index records and
+// symbol records there are.
+//
+void
+LogIndexReader::Rebuild()
+{
+    delete[] m_entries;
+    m_entries = NULL;
+    m_count = m_capacity = 0;
+
+    if (m_compressed)
+    {
+        unsigned long long offset = sizeof(LogFileHeader);
+
+        while (m_fileSize - offset >= sizeof(LzBlockHeader))
+        {
+            LzBlockHeader header;
+            memcpy(&header, m_data + offset, sizeof(header));
+            if (header.storedSize > m_fileSize - offset - sizeof(header))
+                break;
+
+            Grow(m_block, 0, m_blockCapacity, header.rawSize);
+            if (LzCodec::DecompressBlock(&header, m_data + offset + sizeof(header), m_block, header.rawSize) !=
+                static_cast<int>(header.rawSize))
+            {
+                break;
+            }
+
+            LogIndexEntry entry;
+            LogIndexWriter::InitEntry(entry, offset);
+            entry.size = header.rawSize;
+
+            const char *p = m_block;
+            const char *end = m_block + header.rawSize;
+            LogRecordFrame frame;
+            memset(&frame, 0, sizeof(frame));
+            const char *data;
+            while ((data = LogFormat::NextRecord(p, end, frame)) != NULL)
+            {
+                AddRecord(frame, data);
+                LogIndexWriter::AddToEntry(entry, frame);
+            }
+
+            if (entry.events > 0)
+                AddEntry(entry);
+
+            offset += LzCodec::GetBlockSize(header.storedSize);
+        }
+
+        return;
+    }
+
+    LogIndexEntry entry;
+    LogIndexWriter::InitEntry(entry, sizeof(LogFileHeader));
+
+    const char *p = m_data + sizeof(LogFileHeader);
+    const char *end = m_data + m_fileSize;
+    LogRecordFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    const char *record = p;
+    const char *data;
+    while ((data = LogFormat::NextRecord(p, end, frame)) != NULL)
+    {
+        if ((frame.flags & LOG_RECORD_FLAG_BLOCK_START) != 0 &&
+            record - m_data - entry.offset >= REBUILT_BLOCK_SIZE)
+        {
+            entry.size = static_cast<unsigned int>(record - m_data - entry.offset);
+            AddEntry(entry);
+            LogIndexWriter::InitEntry(entry, record - m_data);
+        }
+
+        AddRecord(frame, data);
+        LogIndexWriter::AddToEntry(entry, frame);
+        record = p;
+    }
+
+    entry.size = static_cast<unsigned int>(record - m_data - entry.offset);
+
+    if (entry.events > 0)
+        AddEntry(entry);
+}
+
+// Keeps the symbols it defines
+void
+LogIndexReader::AddRecord(const LogRecordFrame &frame, const char *data)
+{
+    if (frame.kind == LOG_RECORD_INDEX)
+    {
+        ParseIndex(data, frame.size, false);
+    }
+    else if (frame.kind == LOG_RECORD_SYMBOL)
+    {
+        const char *end = data + frame.size;
+        unsigned int id;
+        if (LogFormat::GetVarint(data, end, id))
+            m_decoder.AddSymbol(id, data, static_cast<unsigned int>(end - data));
+    }
+}
+
+void
+LogIndexReader::AddEntry(const LogIndexEntry &entry)
+{
+    Grow(m_entries, m_count, m_capacity, m_count + 1);
+    m_entries[m_count++] = entry;
+}
+
+void
+LogIndexReader::Summarize()
+{
+    if (m_count == 0)
+        return;
+
+    m_maxIds = new unsigned int[m_count];
+    m_minIds = new unsigned int[m_count];
+    m_maxTimes = new unsigned long long[m_count];
+    m_minTimes = new unsigned long long[m_count];
+
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        const LogIndexEntry &entry = m_entries[i];
+
+        m_maxIds[i] = (i > 0 && m_maxIds[i - 1] > entry.maxId) ? m_maxIds[i - 1] : entry.maxId;
+        m_maxTimes[i] = (i > 0 && m_maxTimes[i - 1] > entry.maxTime) ? m_maxTimes[i - 1] : entry.maxTime;
+    }
+
+    for (unsigned int i = m_count; i-- > 0;)
+    {
+        const LogIndexEntry &entry = m_entries[i];
+
+        m_minIds[i] = (i + 1 < m_count && m_minIds[i + 1] < entry.minId) ? m_minIds[i + 1] : entry.minId;
+        m_minTimes[i] = (i + 1 < m_count && m_minTimes[i + 1] < entry.minTime) ? m_minTimes[i + 1] : entry.minTime;
+    }
+}
+
+} // namespace InterceptPP
@@ -0,0 +1,211 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "LogFormat.h"
+#include "MappedFile.h"
+
+namespace InterceptPP {
+
+//
+// Lets readers find their way around a binary log without parsing it from
+// the start.  Every record in the file starts with its size, its kind,
+// and for an event, its id, type and timestamp (see LogFormat.h), so that
+// a reader can step from one record to the next without looking inside.
+// The records are cut into blocks on record boundaries, which are the
+// LzCodec blocks in a compressed log.  Every LOG_INDEX_INTERVAL blocks or
+// so the writer adds an index record listing the blocks written since the
+// previous one: where each starts in the file, and the ranges of ids and
+// timestamps of the events in it.  Index records also carry the name of
+// every symbol there is, so that a block can be read without the ones
+// before it.
+//
+// An index record is a LOG_RECORD_INDEX record holding:
+//
+//   header        LogIndexHeader
+//   entries       LogIndexEntry each
+//   symbols       DWORD id, DWORD length, bytes each
+//
+// When the log is closed, a final index listing every block is written,
+// followed by a LogTrailer pointing at it, which is what the file ends
+// with, outside of any block.  LogIndexReader loads that, or failing
+// that, as with a log that wasn't closed, builds the index itself from
+// the records.
+//
+// As events are written in the order they're submitted, ids and
+// timestamps ascend through the file, but not strictly.  So the reader
+// keeps the running maximum of the upper ends of the ranges, and the
+// running minimum, going backwards, of their lower ends.  Both ascend, and
+// a binary search of each narrows a lookup down to the blocks that can
+// hold what's looked for.
+//
+// Besides MSVC this builds on Linux so that it can be tested there.
+//
+
+#define LOG_INDEX_FINAL       1
+#define LOG_INDEX_NONE        0xFFFFFFFFFFFFFFFFULL
+
+#define LOG_TRAILER_MAGIC     0x58494C4F  // "OLIX"
+
+#define LOG_INDEX_INTERVAL    64
+
+typedef struct {
+    // Of the previous index record, or LOG_INDEX_NONE
+    unsigned long long previous;
+    unsigned int entryCount;
+    unsigned int symbolCount;
+    unsigned int flags;
+    unsigned int reserved;
+} LogIndexHeader;
+
+// offset is where the block starts in the file, its LzBlockHeader in a
+// compressed log, and size how many bytes of records it holds
+typedef struct {
+    unsigned long long offset;
+    unsigned long long minTime;
+    unsigned long long maxTime;
+    unsigned int minId;
+    unsigned int maxId;
+    unsigned int events;
+    unsigned int size;
+} LogIndexEntry;
+
+typedef struct {
+    unsigned long long indexOffset;
+    unsigned int reserved;
+    unsigned int magic;
+} LogTrailer;
+
+class INTERCEPTPP_API LogIndexWriter
+{
+public:
+    LogIndexWriter();
+    ~LogIndexWriter();
+
+    static void InitEntry(LogIndexEntry &entry, unsigned long long offset);
+    static void AddToEntry(LogIndexEntry &entry, const LogRecordFrame &frame);
+
+    void AddEntry(const LogIndexEntry &entry);
+    // Added since the last index record
+    unsigned int GetPendingEntries() const { return m_count - m_indexed; }
+    // The ranges of every entry added, and the events and bytes in them
+    void GetTotals(LogIndexEntry &totals) const;
+    // Forgets every entry, for the next file
+    void Reset();
+
+    //
+    // Builds an index record of the entries added since the last one, or
+    // of all of them if final, with the symbols added in between.  offset
+    // is where it's going to be in the file.  The record stays valid until
+    // the next call.
+    //
+    void BeginIndex(bool final);
+    void AddSymbol(unsigned int id, const char *name, unsigned int length);
+    const char *EndIndex(unsigned long long offset, unsigned int &size);
+
+    // What to end the file with, pointing at the last index record
+    void BuildTrailer(LogTrailer &trailer) const;
+
+protected:
+    void Append(const void *data, unsigned int size);
+
+    LogIndexEntry *m_entries;
+    unsigned int m_count;
+    unsigned int m_capacity;
+    unsigned int m_indexed;
+
+    char *m_data;
+    unsigned int m_size;
+    unsigned int m_dataCapacity;
+    bool m_final;
+    unsigned int m_symbolCount;
+
+    unsigned long long m_lastIndex;
+};
+
+//
+// Finds blocks in a log by event id or time.  The whole file is mapped.
+//
+
+class INTERCEPTPP_API LogIndexReader
+{
+public:
+    LogIndexReader();
+    ~LogIndexReader();
+
+    bool Open(const MappedFileChar *path);
+    void Close();
+
+    bool IsCompressed() const { return m_compressed; }
+    // Has what the timestamps count
+    const LogFileHeader &GetHeader() const { return m_decoder.GetHeader(); }
+    // Whether the index was read from the file rather than rebuilt
+    bool IsComplete() const { return m_complete; }
+
+    unsigned int GetBlockCount() const { return m_count; }
+    const LogIndexEntry &GetBlock(unsigned int index) const { return m_entries[index]; }
+
+    //
+    // Narrows a lookup down to the blocks from first up to last.  None of
+    // the others can hold an event with that id or timestamp, and none of
+    // those before first one with a later one either.
+    //
+    void FindId(unsigned int id, unsigned int &first, unsigned int &last) const;
+    void FindTime(unsigned long long timestamp, unsigned int &first, unsigned int &last) const;
+
+    // Returns the records of a block, decompressed if need be, or NULL if
+    // it's corrupt.  They stay valid until the next call, and can be
+    // stepped through with LogFormat::NextRecord().
+    const char *ReadBlock(unsigned int index, unsigned int &size);
+
+    // Knows the symbols of the index records read, to decode blocks with
+    LogDecoder &GetDecoder() { return m_decoder; }
+    // NULL if the symbol isn't in any of them
+    const char *GetSymbolName(unsigned int id, unsigned int &length) const { return m_decoder.GetSymbolName(id, length); }
+
+protected:
+    bool LoadIndex(unsigned long long offset);
+    bool ParseIndex(const char *data, unsigned int size, bool final);
+    void Rebuild();
+    void AddRecord(const LogRecordFrame &frame, const char *data);
+    void AddEntry(const LogIndexEntry &entry);
+    void Summarize();
+
+    MappedFile m_file;
+    const char *m_data;
+    unsigned long long m_fileSize;
+    bool m_compressed;
+    bool m_complete;
+
+    LogIndexEntry *m_entries;
+    unsigned int m_count;
+    unsigned int m_capacity;
+    // The running maxima and the minima going backwards
+    unsigned int *m_maxIds;
+    unsigned int *m_minIds;
+    unsigned long long *m_maxTimes;
+    unsigned long long *m_minTimes;
+
+    LogDecoder m_decoder;
+
+    char *m_block;
+    unsigned int m_blockCapacity;
+};
+
+} // namespace InterceptPP
@@ -0,0 +1,211 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+#include "LogManifest.h"
+#include <string.h>
+
+namespace InterceptPP {
+
+LogManifest::LogManifest()
+    : m_segments(NULL), m_count(0), m_capacity(0),
+      m_data(NULL), m_dataCapacity(0)
+{
+}
+
+LogManifest::~LogManifest()
+{
+    delete[] m_segments;
+    delete[] m_data;
+}
+
+void
+LogManifest::Clear()
+{
+    m_count = 0;
+}
+
+LogSegmentEntry &
+LogManifest::AddSegment(unsigned int sequence, unsigned long long openTime)
+{
+    Grow(m_count + 1);
+
+    LogSegmentEntry &segment = m_segments[m_count++];
+    memset(&segment, 0, sizeof(segment));
+    segment.openTime = openTime;
+    segment.minTime = ~0ULL;
+    segment.minId = ~0U;
+    segment.sequence = sequence;
+    segment.flags = LOG_SEGMENT_OPEN;
+
+    return segment;
+}
+
+void
+LogManifest::CloseSegment(LogSegmentEntry &segment, const LogIndexEntry &totals,
+                          const LogFileHeader &header, unsigned long long size)
+{
+    segment.minId = totals.minId;
+    segment.maxId = totals.maxId;
+    segment.events = totals.events;
+    segment.size = size;
+    segment.flags &= ~LOG_SEGMENT_OPEN;
+
+    if (totals.events != 0)
+    {
+        segment.minTime = LogFormat::GetFileTime(header, totals.minTime);
+        segment.maxTime = LogFormat::GetFileTime(header, totals.maxTime);
+    }
+}
+
+const char *
+LogManifest::Build(unsigned int &size)
+{
+    size = sizeof(LogManifestHeader) + m_count * sizeof(LogSegmentEntry);
+    if (size > m_dataCapacity)
+    {
+        delete[] m_data;
+        m_data = new char[size];
+        m_dataCapacity = size;
+    }
+
+    LogManifestHeader header;
+    header.magic = LOG_MANIFEST_MAGIC;
+    header.version = LOG_MANIFEST_VERSION;
+    header.segmentCount = m_count;
+    header.reserved = 0;
+
+    memcpy(m_data, &header, sizeof(header));
+    if (m_count > 0)
+        memcpy(m_data + sizeof(header), m_segments, m_count * sizeof(LogSegmentEntry));
+
+    return m_data;
+}
+
+bool
+LogManifest::Parse(const char *data, unsigned int size)
+{
+    Clear();
+
+    LogManifestHeader header;
+    if (size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != LOG_MANIFEST_MAGIC || header.version != LOG_MANIFEST_VERSION)
+        return false;
+
+    if ((size - sizeof(header)) / sizeof(LogSegmentEntry) != header.segmentCount ||
+        (size - sizeof(header)) % sizeof(LogSegmentEntry) != 0)
+    {
+        return false;
+    }
+
+    Grow(header.segmentCount);
+    if (header.segmentCount > 0)
+        memcpy(m_segments, data + sizeof(header), header.segmentCount * sizeof(LogSegmentEntry));
+    m_count = header.segmentCount;
+
+    return true;
+}
+
+bool
+LogManifest::Load(const MappedFileChar *path)
+{
+    Clear();
+
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+
+    unsigned long long fileSize = file.GetSize();
+    if (fileSize < sizeof(LogManifestHeader) || fileSize != static_cast<unsigned int>(fileSize))
+        return false;
+
+    size_t size = static_cast<size_t>(fileSize);
+    const char *data = static_cast<const char *>(file.Map(0, size));
+    if (data == NULL)
+        return false;
+
+    bool success = Parse(data, static_cast<unsigned int>(size));
+    MappedFile::Unmap(const_cast<char *>(data), size);
+
+    return success;
+}
+
+void
+LogManifest::FindId(unsigned int id, unsigned int &first, unsigned int &last) const
+{
+    first = last = 0;
+
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        const LogSegmentEntry &segment = m_segments[i];
+        AddMatch(i, segment.minId <= id && id <= segment.maxId, first, last);
+    }
+}
+
+void
+LogManifest::FindTime(unsigned long long fileTime, unsigned int &first, unsigned int &last) const
+{
+    first = last = 0;
+
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        const LogSegmentEntry &segment = m_segments[i];
+        AddMatch(i, segment.minTime <= fileTime && fileTime <= segment.maxTime, first, last);
+    }
+}
+
+void
+LogManifest::Grow(unsigned int needed)
+{
+    if (needed <= m_capacity)
+        return;
+
+    unsigned int capacity = (m_capacity != 0) ? m_capacity : 16;
+    while (capacity < needed)
+        capacity *= 2;
+
+    LogSegmentEntry *segments = new LogSegmentEntry[capacity];
+    if (m_count > 0)
+        memcpy(segments, m_segments, m_count * sizeof(LogSegmentEntry));
+    delete[] m_segments;
+
+    m_segments = segments;
+    m_capacity = capacity;
+}
+
+// Widens first and last to take in the segment if it may hold what's
+// looked for
+void
+LogManifest::AddMatch(unsigned int index, bool match, unsigned int &first, unsigned int &last) const
+{
+    const LogSegmentEntry &segment = m_segments[index];
+
+    if ((segment.flags & LOG_SEGMENT_DELETED) != 0)
+        return;
+    if (!match && (segment.flags & LOG_SEGMENT_OPEN) == 0)
+        return;
+
+    if (first == last)
+        first = index;
+    last = index + 1;
+}
+
+} // namespace InterceptPP
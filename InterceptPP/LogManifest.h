@@ -0,0 +1,125 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "LogIndex.h"
+
+namespace InterceptPP {
+
+//
+// Lists the segments of a log that's written in several files, so that a
+// capture that runs for days can be cut into pieces of a size or a span
+// of time, and the oldest ones removed to keep the disk from filling up.
+// For a log <name>.log, segment n is <name>.<n>.log, with n counting up
+// from 1 in five digits or more, and the manifest is <name>.manifest.
+// Each segment is a log of its own, as LogFormat.h describes, that can be
+// read without the others.
+//
+// The manifest is a LogManifestHeader followed by a LogSegmentEntry for
+// each segment, oldest first.  The writer replaces it as a whole each
+// time a segment is opened or closed.  A segment that's still open, or
+// was never closed because the process died, has no ranges yet:
+// LogIndexReader can tell what's in it.  One that was removed to keep
+// the window stays listed, so that a reader knows what's missing.
+//
+// Besides MSVC this builds on Linux so that it can be tested there.
+//
+
+#define LOG_MANIFEST_MAGIC      0x4D4C534F  // "OSLM"
+#define LOG_MANIFEST_VERSION    1
+
+#define LOG_SEGMENT_OPEN        1
+#define LOG_SEGMENT_DELETED     2
+
+// Smaller segments would hardly hold a write buffer each
+#define LOG_MIN_SEGMENT_SIZE    (1024 * 1024)
+
+// Longest interval, in seconds, that can be timed with GetTickCount(),
+// about 49.7 days
+#define LOG_MAX_SEGMENT_INTERVAL    (0xFFFFFFFF / 1000)
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int segmentCount;
+    unsigned int reserved;
+} LogManifestHeader;
+
+// All times are FILETIMEs, minTime and maxTime those of the events in it
+typedef struct {
+    unsigned long long openTime;
+    unsigned long long minTime;
+    unsigned long long maxTime;
+    // Of the file once it's closed
+    unsigned long long size;
+    unsigned int sequence;
+    unsigned int flags;
+    unsigned int minId;
+    unsigned int maxId;
+    unsigned int events;
+    unsigned int reserved;
+} LogSegmentEntry;
+
+class INTERCEPTPP_API LogManifest
+{
+public:
+    LogManifest();
+    ~LogManifest();
+
+    void Clear();
+
+    // Open and with no ranges.  The entry stays valid until the next call.
+    LogSegmentEntry &AddSegment(unsigned int sequence, unsigned long long openTime);
+    unsigned int GetSegmentCount() const { return m_count; }
+    LogSegmentEntry &GetSegment(unsigned int index) { return m_segments[index]; }
+    const LogSegmentEntry &GetSegment(unsigned int index) const { return m_segments[index]; }
+
+    // Closes a segment with the totals of its index, see
+    // LogIndexWriter::GetTotals(), turning its timestamps into FILETIMEs
+    // with the header it ended up with
+    static void CloseSegment(LogSegmentEntry &segment, const LogIndexEntry &totals,
+                             const LogFileHeader &header, unsigned long long size);
+
+    // What to write to the file, which stays valid until the next call
+    const char *Build(unsigned int &size);
+    bool Parse(const char *data, unsigned int size);
+    bool Load(const MappedFileChar *path);
+
+    //
+    // Narrows a lookup down to the segments from first up to last, which
+    // takes in any that are open as they may hold anything.  Those that
+    // were deleted are left out.  first and last are equal if none of the
+    // segments can hold it.
+    //
+    void FindId(unsigned int id, unsigned int &first, unsigned int &last) const;
+    void FindTime(unsigned long long fileTime, unsigned int &first, unsigned int &last) const;
+
+protected:
+    void Grow(unsigned int needed);
+    void AddMatch(unsigned int index, bool match, unsigned int &first, unsigned int &last) const;
+
+    LogSegmentEntry *m_segments;
+    unsigned int m_count;
+    unsigned int m_capacity;
+
+    char *m_data;
+    unsigned int m_dataCapacity;
+};
+
+} // namespace InterceptPP
@@ -16,7 +16,12 @@
 //
 
 #include "Logging.h"
+#include "Writer.h"
+#include "Clock.h"
 #include "Util.h"
+#include "Format.h"
+#include "LzCodec.h"
+#include "Errors.h"
 #include <strsafe.h>
 
 #pragma warning( disable : 4311 4312 )
@@ -25,6 +30,18 @@ namespace InterceptPP {
 
 namespace Logging {
 
+#define DEFAULT_MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
+volatile unsigned int Logger::m_maxQueuedBytes = DEFAULT_MAX_QUEUED_BYTES;
+volatile QueueFullPolicy Logger::m_queueFullPolicy = QUEUE_FULL_BLOCK;
+volatile DWORD Logger::m_queueTimeout = INFINITE;
+volatile LogSink Logger::m_sink = LOG_SINK_FILE;
+volatile LogCompression Logger::m_compression = LOG_COMPRESSION_NONE;
+volatile unsigned int Logger::m_blockSize = LZ_DEFAULT_BLOCK_SIZE;
+volatile unsigned int Logger::m_segmentSize = 0;
+volatile DWORD Logger::m_segmentInterval = 0;
+volatile unsigned int Logger::m_segmentCount = 0;
+
 void
 Logger::LogDebug(const char *format, ...)
 {
@@ -69,6 +86,12 @@ Logger::LogError(const char *format, ...)
     va_end(args);
 }
 
+Writer *
+Logger::NewEventWriter(const OString &eventType)
+{
+    return new TreeWriter(NewEvent(eventType));
+}
+
 #define LOG_BUFFER_SIZE 2048
 
 void
@@ -82,111 +105,288 @@ Logger::LogMessage(const char *type, const char *format, va_list args)
     ev->Submit();
 }
 
-Node::Node(const OString &name)
-    : m_name(name), m_contentIsRaw(false)
+// Room in front of every node for the arena it was allocated from, keeping
+// the node itself aligned
+#define NODE_HEADER_SIZE 8
+
+static char emptyString[1] = { '\0' };
+
+void *
+Node::operator new(size_t size)
+{
+    Arena *arena = Arena::GetCurrent();
+    void *block;
+
+    if (arena != NULL)
+    {
+        block = arena->Allocate(NODE_HEADER_SIZE + size);
+        arena->AddRef();
+    }
+    else
+    {
+        block = AllocUtils::Malloc(NODE_HEADER_SIZE + size, false);
+    }
+
+    if (block == NULL)
+    {
+        if (arena != NULL)
+            arena->Release();
+
+        throw Error("out of memory");
+    }
+
+    *static_cast<Arena **>(block) = arena;
+
+    return static_cast<char *>(block) + NODE_HEADER_SIZE;
+}
+
+void
+Node::operator delete(void *p)
+{
+    if (p == NULL)
+        return;
+
+    void *block = static_cast<char *>(p) - NODE_HEADER_SIZE;
+    Arena *arena = *static_cast<Arena **>(block);
+
+    if (arena != NULL)
+        arena->Release();
+    else
+        AllocUtils::Free(block);
+}
+
+Node::Node(Symbol name)
+    : m_arena(Arena::GetCurrent())
 {
+    if (m_arena != NULL)
+        m_arena->AddRef();
+
+    Initialize(name);
+}
+
+Node::Node(Symbol name, Arena *arena)
+    : m_arena(arena)
+{
+    Initialize(name);
+}
+
+void
+Node::Initialize(Symbol name)
+{
+    m_nameId = name.GetId();
+
+    m_contentIsRaw = false;
+    m_content = emptyString;
+    m_contentSize = 0;
+
+    m_firstField = NULL;
+    m_lastField = NULL;
+    m_fieldCount = 0;
+
+    m_firstChild = NULL;
+    m_lastChild = NULL;
+    m_nextSibling = NULL;
+    m_childCount = 0;
 }
 
 Node::~Node()
 {
-    ChildListConstIter iter, endIter = m_children.end();
-    for (iter = m_children.begin(); iter != endIter; iter++)
+    Node *child = m_firstChild;
+    while (child != NULL)
+    {
+        Node *next = child->m_nextSibling;
+        delete child;
+        child = next;
+    }
+
+    if (m_arena != NULL)
     {
-        delete *iter;
+        // Everything else goes with the arena
+        m_arena->Release();
+        return;
     }
+
+    NodeField *field = m_firstField;
+    while (field != NULL)
+    {
+        NodeField *next = field->next;
+        Free(field);
+        field = next;
+    }
+
+    if (m_content != emptyString)
+        Free(m_content);
+}
+
+void *
+Node::Allocate(size_t size)
+{
+    if (m_arena != NULL)
+        return m_arena->Allocate(size);
+    else
+        return AllocUtils::Malloc(size, false);
 }
 
 void
-Node::AddField(const OString &name, const OString &value)
+Node::Free(void *p)
 {
-    m_fields.push_back(pair<OString, OString>(name, value));
+    if (m_arena == NULL)
+        AllocUtils::Free(p);
 }
 
 void
-Node::AddField(const OString &name, int value)
+Node::AddField(Symbol name, const char *value, size_t valueLength)
 {
-    OOStringStream ss;
-    ss << value;
-    AddField(name, ss.str());
+    // One allocation holding the field and its value
+    NodeField *field = static_cast<NodeField *>(Allocate(sizeof(NodeField) + valueLength + 1));
+    if (field == NULL)
+        throw Error("out of memory");
+
+    char *valueCopy = reinterpret_cast<char *>(field + 1);
+    memcpy(valueCopy, value, valueLength);
+    valueCopy[valueLength] = '\0';
+
+    field->next = NULL;
+    field->nameId = name.GetId();
+    field->name = name.GetName();
+    field->nameLength = name.GetLength();
+    field->value = valueCopy;
+    field->valueLength = static_cast<unsigned int>(valueLength);
+
+    if (m_lastField != NULL)
+        m_lastField->next = field;
+    else
+        m_firstField = field;
+    m_lastField = field;
+    m_fieldCount++;
 }
 
 void
-Node::AddField(const OString &name, unsigned int value)
+Node::AddField(Symbol name, const OString &value)
 {
-    OOStringStream ss;
-    ss << value;
-    AddField(name, ss.str());
+    AddField(name, value.data(), value.size());
 }
 
 void
-Node::AddField(const OString &name, unsigned long value)
+Node::AddField(Symbol name, int value)
 {
-    OOStringStream ss;
-    ss << value;
-    AddField(name, ss.str());
+    char buf[FORMAT_MAX_LENGTH];
+    AddField(name, buf, Format::Decimal(buf, value) - buf);
 }
 
 void
-Node::AddField(const OString &name, unsigned long long value)
+Node::AddField(Symbol name, unsigned int value)
 {
-    OOStringStream ss;
-    ss << value;
-    AddField(name, ss.str());
+    char buf[FORMAT_MAX_LENGTH];
+    AddField(name, buf, Format::Decimal(buf, value) - buf);
+}
+
+void
+Node::AddField(Symbol name, unsigned long value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    AddField(name, buf, Format::Decimal(buf, static_cast<unsigned int>(value)) - buf);
+}
+
+void
+Node::AddField(Symbol name, unsigned long long value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    AddField(name, buf, Format::Decimal(buf, static_cast<unsigned __int64>(value)) - buf);
 }
 
-TextNode::TextNode(const OString &name, const OString &text)
+void
+Node::SetContent(const void *head, size_t headSize, const void *tail, size_t tailSize, bool terminate)
+{
+    if (m_content != emptyString)
+        Free(m_content);
+
+    size_t size = headSize + tailSize;
+    if (size == 0)
+    {
+        m_content = emptyString;
+        m_contentSize = 0;
+        return;
+    }
+
+    char *content = static_cast<char *>(Allocate(size + ((terminate) ? 1 : 0)));
+    if (content == NULL)
+    {
+        m_content = emptyString;
+        m_contentSize = 0;
+        throw Error("out of memory");
+    }
+
+    m_content = content;
+    memcpy(m_content, head, headSize);
+    if (tailSize > 0)
+        memcpy(m_content + headSize, tail, tailSize);
+    if (terminate)
+        m_content[size] = '\0';
+
+    m_contentSize = static_cast<unsigned int>(size);
+}
+
+void
+Node::AppendChildNode(Node *node)
+{
+    if (m_lastChild != NULL)
+        m_lastChild->m_nextSibling = node;
+    else
+        m_firstChild = node;
+    m_lastChild = node;
+    m_childCount++;
+}
+
+TextNode::TextNode(Symbol name, const OString &text)
     : Node(name)
 {
-    m_content = text;
+    SetText(text);
 }
 
-TextNode::TextNode(const OString &name, const char *text)
+TextNode::TextNode(Symbol name, const char *text)
     : Node(name)
 {
-    m_content = text;
+    SetContent(text, strlen(text), NULL, 0, true);
 }
 
-TextNode::TextNode(const OString &name, void *pointer)
+TextNode::TextNode(Symbol name, void *pointer)
     : Node(name)
 {
-    OOStringStream ss;
-    ss << "0x" << hex << reinterpret_cast<DWORD>(pointer);
-    m_content = ss.str();
+    char buf[FORMAT_MAX_LENGTH];
+    SetContent(buf, Format::HexPrefixed(buf, reinterpret_cast<DWORD>(pointer)) - buf, NULL, 0, true);
 }
 
-TextNode::TextNode(const OString &name, int value)
+TextNode::TextNode(Symbol name, int value)
     : Node(name)
 {
-    OOStringStream ss;
-    ss << value;
-    m_content = ss.str();
+    char buf[FORMAT_MAX_LENGTH];
+    SetContent(buf, Format::Decimal(buf, value) - buf, NULL, 0, true);
 }
 
-TextNode::TextNode(const OString &name, DWORD value)
+TextNode::TextNode(Symbol name, DWORD value)
     : Node(name)
 {
-    OOStringStream ss;
-    ss << value;
-    m_content = ss.str();
+    char buf[FORMAT_MAX_LENGTH];
+    SetContent(buf, Format::Decimal(buf, static_cast<unsigned int>(value)) - buf, NULL, 0, true);
 }
 
-TextNode::TextNode(const OString &name, __int64 value)
+TextNode::TextNode(Symbol name, __int64 value)
     : Node(name)
 {
-    OOStringStream ss;
-    ss << value;
-    m_content = ss.str();
+    char buf[FORMAT_MAX_LENGTH];
+    SetContent(buf, Format::Decimal(buf, value) - buf, NULL, 0, true);
 }
 
-TextNode::TextNode(const OString &name, float value)
+TextNode::TextNode(Symbol name, float value)
     : Node(name)
 {
     OOStringStream ss;
     ss << value;
-    m_content = ss.str();
+    SetText(ss.str());
 }
 
-DataNode::DataNode(const OString &name)
+DataNode::DataNode(Symbol name)
     : Node(name)
 {
     m_contentIsRaw = true;
@@ -195,31 +395,79 @@ DataNode::DataNode(const OString &name)
 void
 DataNode::SetData(const OString &data)
 {
-    m_content = data;
+    SetContent(data.data(), data.size(), NULL, 0, false);
 }
 
 void
 DataNode::SetData(const void *buf, int size)
 {
-    m_content.resize(size);
-    memcpy(const_cast<char *>(m_content.data()), buf, size);
+    SetContent(buf, size, NULL, 0, false);
+}
+
+void
+DataNode::SetData(const void *head, int headSize, const void *tail, int tailSize)
+{
+    SetContent(head, headSize, tail, tailSize, false);
 }
 
 Event::Event(Logger *logger, unsigned int id, const OString &eventType)
-    : Element("event"), m_logger(logger), m_id(id)
+    : Element("event", new Arena()), m_logger(logger), m_id(id), m_building(true)
+{
+    m_stamp.timestamp = Clock::GetTicks();
+    m_stamp.threadId = GetCurrentThreadId();
+    m_stamp.reserved = 0;
+
+    m_arena->Enter();
+
+    // The destructor doesn't run if we throw, so leave the arena here
+    try
+    {
+        AddField("id", id);
+
+        AddField("type", eventType);
+
+        bool stamped = logger->UsesEventStamps();
+        if (!stamped)
+        {
+            FILETIME ft;
+            GetSystemTimeAsFileTime(&ft);
+            unsigned long long stamp = (((unsigned long long) ft.dwHighDateTime) << 32) | ((unsigned long long) ft.dwLowDateTime);
+            AddField("timestamp", stamp);
+        }
+
+        AddField("processName", Util::Instance()->GetProcessName());
+        AddField("processId", GetCurrentProcessId());
+        if (!stamped)
+            AddField("threadId", m_stamp.threadId);
+    }
+    catch (Error &)
+    {
+        FinishBuilding();
+        throw;
+    }
+}
+
+Event::~Event()
 {
-    AddField("id", id);
+    FinishBuilding();
+}
 
-    AddField("type", eventType);
+void
+Event::Submit()
+{
+    FinishBuilding();
+
+    m_logger->SubmitEvent(this);
+}
 
-    FILETIME ft;
-    GetSystemTimeAsFileTime(&ft);
-    unsigned long long stamp = (((unsigned long long) ft.dwHighDateTime) << 32) | ((unsigned long long) ft.dwLowDateTime);
-    AddField("timestamp", stamp);
+void
+Event::FinishBuilding()
+{
+    if (!m_building)
+        return;
+    m_building = false;
 
-    AddField("processName", Util::Instance()->GetProcessName());
-    AddField("processId", GetCurrentProcessId());
-    AddField("threadId", GetCurrentThreadId());
+    m_arena->Leave();
 }
 
 } // namespace Logging
@@ -18,6 +18,8 @@
 #pragma once
 
 #include "InterceptPP.h"
+#include "Arena.h"
+#include "SymbolTable.h"
 
 namespace InterceptPP {
 
@@ -27,6 +29,76 @@ namespace Logging {
 #pragma warning (disable: 4251)
 
 class INTERCEPTPP_API Event;
+class INTERCEPTPP_API Writer;
+
+//
+// What a logger does with an event once it has maxQueuedBytes waiting to
+// be written:
+//
+//   block      the submitting thread waits for room, and drops the event
+//              if there still isn't any after the timeout
+//   drop       the event is dropped right away
+//   summarize  until the backlog is down to half of the limit, events are
+//              cut down to their fields and marked up with summary="true",
+//              and dropped if even that doesn't fit
+//
+// Loggers that queue events log how many each thread lost as a LogGap
+// event.  The limit is set with the hookManager's logQueueBytes,
+// logQueuePolicy and logQueueTimeout (milliseconds, default INFINITE).
+//
+
+typedef enum {
+    QUEUE_FULL_BLOCK = 0,
+    QUEUE_FULL_DROP,
+    QUEUE_FULL_SUMMARIZE
+} QueueFullPolicy;
+
+//
+// Where the agent's logger puts events: with "file" a logging thread of
+// its own writes them out, with "mapped" each thread writes its events
+// straight into the file through a mapping of it, see MappedLog.  Set
+// with the hookManager's logSink.
+//
+
+typedef enum {
+    LOG_SINK_FILE = 0,
+    LOG_SINK_MAPPED
+} LogSink;
+
+//
+// With logCompression="lz" the file sink compresses what it writes in
+// blocks of about logBlockSize bytes (64 to 256 KB) on a thread of its
+// own, see LzCodec.  The mapped sink doesn't compress.
+//
+
+typedef enum {
+    LOG_COMPRESSION_NONE = 0,
+    LOG_COMPRESSION_LZ
+} LogCompression;
+
+//
+// With logSegmentBytes or logSegmentInterval (seconds) the file sink
+// writes the log in segments, going on to the next one once the current
+// one holds about that many bytes or has been open that long, and lists
+// them in a manifest, see LogManifest.  With logSegmentCount it only keeps
+// that many of the newest.  All three are 0 for no limit by default.  The
+// mapped sink writes one file.
+//
+
+//
+// When an event was made, in Clock ticks, and on which thread.  Events go
+// to most loggers with these as their timestamp and threadId fields, the
+// former a FILETIME.  Loggers that UsesEventStamps() get them as they are
+// instead, through SubmitRecord(), Event::GetStamp() or
+// BinaryWriter::GetStamp(), which spares every event the system time and
+// formatting both as text.
+//
+
+typedef struct {
+    unsigned __int64 timestamp;
+    DWORD threadId;
+    DWORD reserved;
+} EventStamp;
 
 class INTERCEPTPP_API Logger : public BaseObject
 {
@@ -36,98 +108,193 @@ public:
     virtual Event *NewEvent(const OString &eventType) = 0;
     virtual void SubmitEvent(Event *ev) = 0;
 
+    // Streaming alternative to NewEvent(), see Writer.  By default it
+    // builds an Event, loggers with a binary format write it out directly
+    // and get it back through SubmitRecord(), which returns whether the
+    // record was logged as it is rather than dropped or summarized.
+    virtual Writer *NewEventWriter(const OString &eventType);
+    virtual bool SubmitRecord(const EventStamp &stamp, const char *data, unsigned int size) { return false; }
+
+    virtual bool UsesEventStamps() const { return false; }
+
     void LogDebug(const char *format, ...);
     void LogInfo(const char *format, ...);
     void LogWarning(const char *format, ...);
     void LogError(const char *format, ...);
 
+    static unsigned int GetMaxQueuedBytes() { return m_maxQueuedBytes; }
+    static void SetMaxQueuedBytes(unsigned int size) { m_maxQueuedBytes = size; }
+    static QueueFullPolicy GetQueueFullPolicy() { return m_queueFullPolicy; }
+    static void SetQueueFullPolicy(QueueFullPolicy policy) { m_queueFullPolicy = policy; }
+    static DWORD GetQueueTimeout() { return m_queueTimeout; }
+    static void SetQueueTimeout(DWORD timeout) { m_queueTimeout = timeout; }
+    static LogSink GetSink() { return m_sink; }
+    static void SetSink(LogSink sink) { m_sink = sink; }
+    static LogCompression GetCompression() { return m_compression; }
+    static void SetCompression(LogCompression compression) { m_compression = compression; }
+    static unsigned int GetBlockSize() { return m_blockSize; }
+    static void SetBlockSize(unsigned int size) { m_blockSize = size; }
+    static unsigned int GetSegmentSize() { return m_segmentSize; }
+    static void SetSegmentSize(unsigned int size) { m_segmentSize = size; }
+    static DWORD GetSegmentInterval() { return m_segmentInterval; }
+    static void SetSegmentInterval(DWORD seconds) { m_segmentInterval = seconds; }
+    static unsigned int GetSegmentCount() { return m_segmentCount; }
+    static void SetSegmentCount(unsigned int count) { m_segmentCount = count; }
+
 protected:
+    static volatile unsigned int m_maxQueuedBytes;
+    static volatile QueueFullPolicy m_queueFullPolicy;
+    static volatile DWORD m_queueTimeout;
+    static volatile LogSink m_sink;
+    static volatile LogCompression m_compression;
+    static volatile unsigned int m_blockSize;
+    static volatile unsigned int m_segmentSize;
+    static volatile DWORD m_segmentInterval;
+    static volatile unsigned int m_segmentCount;
+
     void LogMessage(const char *type, const char *format, va_list args);
 };
 
+typedef struct NodeFieldTag {
+    struct NodeFieldTag *next;
+    SymbolId nameId;
+    const char *name;
+    unsigned int nameLength;
+    const char *value;
+    unsigned int valueLength;
+} NodeField;
+
+//
+// Names and field names are interned, see SymbolTable.  Field values and
+// text content are NUL-terminated copies; raw content isn't terminated.
+// Nodes created while an event is being built are allocated from its Arena
+// together with all of their strings, otherwise everything comes from the
+// heap.
+//
 class INTERCEPTPP_API Node : public BaseObject
 {
-public:
-    typedef OList<pair<OString, OString>>::Type FieldList;
-    typedef FieldList::const_iterator FieldListConstIter;
+    friend class TreeWriter;
 
-    typedef OList<Node *>::Type ChildList;
-    typedef ChildList::const_iterator ChildListConstIter;
+public:
+    Node(Symbol name);
+    virtual ~Node();
 
-    Node(const OString &name);
-    ~Node();
+    void *operator new(size_t size);
+    void operator delete(void *p);
 
-    const OString &GetName() const { return m_name; }
+    SymbolId GetNameId() const { return m_nameId; }
+    const char *GetName() const { return SymbolTable::GetName(m_nameId); }
+    unsigned int GetNameLength() const { return SymbolTable::GetLength(m_nameId); }
 
     bool GetContentIsRaw() const { return m_contentIsRaw; }
-    const OString &GetContent() const { return m_content; }
+    const char *GetContent() const { return m_content; }
+    unsigned int GetContentSize() const { return m_contentSize; }
 
-    unsigned int GetFieldCount() const { return static_cast<unsigned int>(m_fields.size()); }
-    FieldListConstIter FieldsIterBegin() const { return m_fields.begin(); }
-    FieldListConstIter FieldsIterEnd() const { return m_fields.end(); }
-    void AddField(const OString &name, const OString &value);
-    void AddField(const OString &name, int value);
-    void AddField(const OString &name, unsigned int value);
-    void AddField(const OString &name, unsigned long value);
-    void AddField(const OString &name, unsigned long long value);
+    unsigned int GetFieldCount() const { return m_fieldCount; }
+    const NodeField *GetFirstField() const { return m_firstField; }
+    void AddField(Symbol name, const OString &value);
+    void AddField(Symbol name, int value);
+    void AddField(Symbol name, unsigned int value);
+    void AddField(Symbol name, unsigned long value);
+    void AddField(Symbol name, unsigned long long value);
 
-    unsigned int GetChildCount() const { return static_cast<unsigned int>(m_children.size()); }
-    ChildListConstIter ChildrenIterBegin() const { return m_children.begin(); }
-    ChildListConstIter ChildrenIterEnd() const { return m_children.end(); }
+    unsigned int GetChildCount() const { return m_childCount; }
+    Node *GetFirstChild() const { return m_firstChild; }
+    Node *GetNextSibling() const { return m_nextSibling; }
 
 protected:
-    OString m_name;
+    Node(Symbol name, Arena *arena);
+
+    Arena *m_arena;
+
+    SymbolId m_nameId;
+
     bool m_contentIsRaw;
-    OString m_content;
-    FieldList m_fields;
-    ChildList m_children;
+    char *m_content;
+    unsigned int m_contentSize;
+
+    NodeField *m_firstField;
+    NodeField *m_lastField;
+    unsigned int m_fieldCount;
+
+    Node *m_firstChild;
+    Node *m_lastChild;
+    Node *m_nextSibling;
+    unsigned int m_childCount;
+
+    void *Allocate(size_t size);
+    void Free(void *p);
+    void AddField(Symbol name, const char *value, size_t valueLength);
+    void SetContent(const void *head, size_t headSize, const void *tail, size_t tailSize, bool terminate);
+    void AppendChildNode(Node *node);
+
+private:
+    void Initialize(Symbol name);
 };
 
 class INTERCEPTPP_API Element : public Node
 {
 public:
-    Element(const OString &name)
+    Element(Symbol name)
         : Node(name)
     {}
 
-    void AppendChild(Node *node) { m_children.push_back(node); }
+    void AppendChild(Node *node) { AppendChildNode(node); }
+
+protected:
+    Element(Symbol name, Arena *arena)
+        : Node(name, arena)
+    {}
 };
 
 class INTERCEPTPP_API TextNode : public Node
 {
 public:
-    TextNode(const OString &name, const OString &text="");
-    TextNode(const OString &name, const char *text);
-    TextNode(const OString &name, void *pointer);
-    TextNode(const OString &name, int value);
-    TextNode(const OString &name, DWORD value);
-    TextNode(const OString &name, __int64 value);
-    TextNode(const OString &name, float value);
-
-    void SetText(const OString &text) { m_content = text; }
+    TextNode(Symbol name, const OString &text="");
+    TextNode(Symbol name, const char *text);
+    TextNode(Symbol name, void *pointer);
+    TextNode(Symbol name, int value);
+    TextNode(Symbol name, DWORD value);
+    TextNode(Symbol name, __int64 value);
+    TextNode(Symbol name, float value);
+
+    void SetText(const OString &text) { SetContent(text.data(), text.size(), NULL, 0, true); }
 };
 
 class INTERCEPTPP_API DataNode : public Node
 {
 public:
-    DataNode(const OString &name);
+    DataNode(Symbol name);
 
     void SetData(const OString &data);
     void SetData(const void *buf, int size);
+    void SetData(const void *head, int headSize, const void *tail, int tailSize);
 };
 
+//
+// An event gets an Arena of its own, which stays the current one for the
+// calling thread until Submit().  Events created meanwhile, like the
+// Schema events logged in the middle of a FunctionCall, nest.
+//
 class INTERCEPTPP_API Event : public Element
 {
 public:
     Event(Logger *logger, unsigned int id, const OString &eventType);
+    virtual ~Event();
 
     unsigned int GetId() const { return m_id; }
+    const EventStamp &GetStamp() const { return m_stamp; }
 
-    void Submit() { m_logger->SubmitEvent(this); }
+    void Submit();
 
 protected:
     Logger *m_logger;
     unsigned int m_id;
+    EventStamp m_stamp;
+
+    bool m_building;
+
+    void FinishBuilding();
 };
 
 #pragma warning (pop)
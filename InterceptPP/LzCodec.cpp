@@ -0,0 +1,291 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "LzCodec.h"
+#include <string.h>
+
+namespace InterceptPP {
+
+#define MIN_MATCH   4
+#define MAX_OFFSET  65535
+
+typedef unsigned char Byte;
+
+static inline unsigned int
+Read32(const Byte *p)
+{
+    unsigned int value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline unsigned int
+Hash(unsigned int value)
+{
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// What's left of a length once its nibble is 15
+static inline bool
+PutLength(Byte *&op, const Byte *oend, unsigned int length)
+{
+    while (length >= 255)
+    {
+        if (op >= oend)
+            return false;
+        *op++ = 255;
+        length -= 255;
+    }
+
+    if (op >= oend)
+        return false;
+    *op++ = static_cast<Byte>(length);
+
+    return true;
+}
+
+static inline bool
+GetLength(const Byte *&ip, const Byte *iend, unsigned int &length)
+{
+    Byte b;
+    do
+    {
+        if (ip >= iend || length > 0x7FFFFFFF)
+            return false;
+        b = *ip++;
+        length += b;
+    }
+    while (b == 255);
+
+    return true;
+}
+
+// A matchLength of 0 makes it the last sequence
+static bool
+PutSequence(Byte *&op, const Byte *oend, const Byte *literals, unsigned int literalCount,
+            unsigned int offset, unsigned int matchLength)
+{
+    if (op >= oend)
+        return false;
+
+    Byte *token = op++;
+    *token = static_cast<Byte>(((literalCount >= 15) ? 15 : literalCount) << 4);
+
+    if (literalCount >= 15 && !PutLength(op, oend, literalCount - 15))
+        return false;
+
+    if (static_cast<unsigned int>(oend - op) < literalCount)
+        return false;
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+
+    if (matchLength == 0)
+        return true;
+
+    if (oend - op < 2)
+        return false;
+    op[0] = static_cast<Byte>(offset);
+    op[1] = static_cast<Byte>(offset >> 8);
+    op += 2;
+
+    unsigned int length = matchLength - MIN_MATCH;
+    *token |= static_cast<Byte>((length >= 15) ? 15 : length);
+
+    return length < 15 || PutLength(op, oend, length - 15);
+}
+
+unsigned int
+LzCodec::Compress(const void *src, unsigned int size, void *dst, unsigned int capacity)
+{
+    const Byte *base = static_cast<const Byte *>(src);
+    const Byte *end = base + size;
+    const Byte *ip = base;
+    const Byte *anchor = base;
+
+    Byte *op = static_cast<Byte *>(dst);
+    const Byte *oend = op + capacity;
+
+    memset(m_table, 0, sizeof(m_table));
+
+    if (size >= MIN_MATCH)
+    {
+        const Byte *limit = end - MIN_MATCH;
+        unsigned int misses = 0;
+
+        while (ip <= limit)
+        {
+            unsigned int sequence = Read32(ip);
+            unsigned int hash = Hash(sequence);
+            unsigned int candidate = m_table[hash];
+            m_table[hash] = static_cast<unsigned int>(ip - base) + 1;
+
+            const Byte *match = (candidate != 0) ? base + candidate - 1 : NULL;
+            if (match == NULL || ip - match > MAX_OFFSET || Read32(match) != sequence)
+            {
+                // Skip through what doesn't compress faster and faster
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+
+            unsigned int length = MIN_MATCH;
+            while (ip + length < end && match[length] == ip[length])
+                length++;
+
+            if (!PutSequence(op, oend, anchor, static_cast<unsigned int>(ip - anchor),
+                             static_cast<unsigned int>(ip - match), length))
+            {
+                return 0;
+            }
+
+            ip += length;
+            anchor = ip;
+            misses = 0;
+
+            // Makes up for not hashing what the match covered
+            if (ip - 2 <= limit)
+                m_table[Hash(Read32(ip - 2))] = static_cast<unsigned int>(ip - 2 - base) + 1;
+        }
+    }
+
+    if (!PutSequence(op, oend, anchor, static_cast<unsigned int>(end - anchor), 0, 0))
+        return 0;
+
+    return static_cast<unsigned int>(op - static_cast<Byte *>(dst));
+}
+
+unsigned int
+LzCodec::CompressBlock(const void *src, unsigned int size, void *dst)
+{
+    LzBlockHeader *header = static_cast<LzBlockHeader *>(dst);
+    Byte *data = reinterpret_cast<Byte *>(header + 1);
+
+    // Only worth it if it ends up smaller
+    unsigned int storedSize = (size > 0) ? Compress(src, size, data, size - 1) : 0;
+    if (storedSize == 0)
+        return StoreBlock(src, size, dst);
+
+    header->rawSize = size;
+    header->storedSize = storedSize;
+
+    unsigned int blockSize = GetBlockSize(storedSize);
+    memset(data + storedSize, 0, blockSize - sizeof(LzBlockHeader) - storedSize);
+
+    return blockSize;
+}
+
+unsigned int
+LzCodec::StoreBlock(const void *src, unsigned int size, void *dst)
+{
+    LzBlockHeader *header = static_cast<LzBlockHeader *>(dst);
+    Byte *data = reinterpret_cast<Byte *>(header + 1);
+
+    memcpy(data, src, size);
+
+    header->rawSize = size;
+    header->storedSize = size;
+
+    unsigned int blockSize = GetBlockSize(size);
+    memset(data + size, 0, blockSize - sizeof(LzBlockHeader) - size);
+
+    return blockSize;
+}
+
+int
+LzCodec::Decompress(const void *src, unsigned int size, void *dst, unsigned int capacity)
+{
+    const Byte *ip = static_cast<const Byte *>(src);
+    const Byte *iend = ip + size;
+
+    Byte *start = static_cast<Byte *>(dst);
+    Byte *op = start;
+    const Byte *oend = op + capacity;
+
+    while (ip < iend)
+    {
+        unsigned int token = *ip++;
+
+        unsigned int literalCount = token >> 4;
+        if (literalCount == 15 && !GetLength(ip, iend, literalCount))
+            return -1;
+
+        if (static_cast<unsigned int>(iend - ip) < literalCount ||
+            static_cast<unsigned int>(oend - op) < literalCount)
+        {
+            return -1;
+        }
+        memcpy(op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+
+        if (ip == iend)
+            return static_cast<int>(op - start);
+
+        if (iend - ip < 2)
+            return -1;
+        unsigned int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > static_cast<unsigned int>(op - start))
+            return -1;
+
+        unsigned int length = token & 15;
+        if (length == 15 && !GetLength(ip, iend, length))
+            return -1;
+        length += MIN_MATCH;
+
+        if (static_cast<unsigned int>(oend - op) < length)
+            return -1;
+
+        const Byte *match = op - offset;
+        if (offset >= length)
+        {
+            memcpy(op, match, length);
+            op += length;
+        }
+        else
+        {
+            // Overlaps what it's copying, repeating the last offset bytes
+            for (unsigned int i = 0; i < length; i++)
+                *op++ = *match++;
+        }
+    }
+
+    // Ends with a sequence of literals
+    return -1;
+}
+
+int
+LzCodec::DecompressBlock(const LzBlockHeader *header, const void *data, void *dst, unsigned int capacity)
+{
+    if (header->rawSize > capacity || header->storedSize > header->rawSize)
+        return -1;
+
+    if (header->storedSize == header->rawSize)
+    {
+        memcpy(dst, data, header->rawSize);
+        return static_cast<int>(header->rawSize);
+    }
+
+    int size = Decompress(data, header->storedSize, dst, header->rawSize);
+    if (size != static_cast<int>(header->rawSize))
+        return -1;
+
+    return size;
+}
+
+} // namespace InterceptPP
@@ -0,0 +1,103 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <stddef.h>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+//
+// A small LZ77 codec in the spirit of LZ4, fast rather than thorough.
+// Compressed data is a series of sequences, each a token byte holding the
+// literal count and match length in its two nibbles, more length bytes
+// when a nibble is 15, the literals, and a 16-bit offset back to where
+// the match is copied from.  The last sequence has literals only.
+//
+// Compressed logs are cut into blocks that are compressed on their own,
+// each with an LzBlockHeader in front of it.  They start with a
+// LogFileHeader (see LogFormat.h), or an LzFileHeader in version 1 of the
+// format.  A block that doesn't get any smaller is stored as is.
+// Blocks are padded to a multiple of LZ_BLOCK_ALIGNMENT bytes.
+// Blocks start and end on record boundaries, so any of them can be
+// decompressed and read without the others, given the symbols defined
+// before it, which the index records carry (see LogIndex.h).
+//
+// Besides MSVC this builds on Linux so that it can be tested there.
+//
+
+#define LZ_FILE_MAGIC         0x5A4C534F  // "OSLZ"
+#define LZ_FILE_VERSION       1
+#define LZ_MIN_BLOCK_SIZE     (64 * 1024)
+#define LZ_MAX_BLOCK_SIZE     (256 * 1024)
+#define LZ_DEFAULT_BLOCK_SIZE (128 * 1024)
+#define LZ_BLOCK_ALIGNMENT    4
+
+#define LZ_HASH_BITS          14
+#define LZ_HASH_SIZE          (1 << LZ_HASH_BITS)
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int blockSize;
+    unsigned int reserved;
+} LzFileHeader;
+
+// storedSize equals rawSize if the block is stored as is
+typedef struct {
+    unsigned int rawSize;
+    unsigned int storedSize;
+} LzBlockHeader;
+
+class INTERCEPTPP_API LzCodec
+{
+public:
+    static unsigned int GetMaxCompressedSize(unsigned int size) { return size + size / 255 + 16; }
+    static unsigned int GetMaxBlockSize(unsigned int size) { return GetBlockSize(size); }
+    // Of a block with storedSize bytes of data, header and padding included
+    static unsigned int GetBlockSize(unsigned int storedSize)
+    {
+        return (sizeof(LzBlockHeader) + storedSize + LZ_BLOCK_ALIGNMENT - 1) & ~(LZ_BLOCK_ALIGNMENT - 1);
+    }
+
+    // Returns the compressed size, or 0 if it takes more than capacity
+    unsigned int Compress(const void *src, unsigned int size, void *dst, unsigned int capacity);
+    // Writes the header, the block and its padding, returning the size of
+    // all three.  dst has to hold GetMaxBlockSize(size) bytes.
+    unsigned int CompressBlock(const void *src, unsigned int size, void *dst);
+    // The same, with the block stored as is
+    static unsigned int StoreBlock(const void *src, unsigned int size, void *dst);
+
+    // Return the decompressed size, or -1 if the data is corrupt or
+    // takes more than capacity
+    static int Decompress(const void *src, unsigned int size, void *dst, unsigned int capacity);
+    static int DecompressBlock(const LzBlockHeader *header, const void *data, void *dst, unsigned int capacity);
+
+protected:
+    // Where each hash of 4 bytes was last seen, plus one
+    unsigned int m_table[LZ_HASH_SIZE];
+};
+
+} // namespace InterceptPP
@@ -0,0 +1,220 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "MappedFile.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace InterceptPP {
+
+MappedFile::MappedFile()
+    : m_writable(false),
+#ifdef _WIN32
+      m_handle(INVALID_HANDLE_VALUE)
+#else
+      m_fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool
+MappedFile::Create(const MappedFileChar *path)
+{
+    Close();
+
+    m_handle = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    m_writable = true;
+
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+bool
+MappedFile::Open(const MappedFileChar *path)
+{
+    Close();
+
+    m_handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    m_writable = false;
+
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+void
+MappedFile::Close()
+{
+    if (m_handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_handle);
+        m_handle = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool
+MappedFile::IsOpen() const
+{
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+unsigned long long
+MappedFile::GetSize() const
+{
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_handle, &size))
+        return 0;
+
+    return size.QuadPart;
+}
+
+bool
+MappedFile::SetSize(unsigned long long size)
+{
+    LARGE_INTEGER pos;
+    pos.QuadPart = size;
+
+    return SetFilePointerEx(m_handle, pos, NULL, FILE_BEGIN) && SetEndOfFile(m_handle);
+}
+
+void *
+MappedFile::Map(unsigned long long offset, size_t size)
+{
+    // A section as big as the view's end grows the file to it.  The view
+    // keeps the section alive after its handle is closed.
+    unsigned long long end = offset + size;
+    HANDLE section = CreateFileMapping(m_handle, NULL, (m_writable) ? PAGE_READWRITE : PAGE_READONLY,
+                                       static_cast<DWORD>(end >> 32), static_cast<DWORD>(end), NULL);
+    if (section == NULL)
+        return NULL;
+
+    void *p = MapViewOfFile(section, (m_writable) ? FILE_MAP_WRITE : FILE_MAP_READ,
+                            static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), size);
+
+    CloseHandle(section);
+
+    return p;
+}
+
+void
+MappedFile::Unmap(void *p, size_t size)
+{
+    UnmapViewOfFile(p);
+}
+
+size_t
+MappedFile::GetGranularity()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return info.dwAllocationGranularity;
+}
+
+#else
+
+bool
+MappedFile::Create(const MappedFileChar *path)
+{
+    Close();
+
+    m_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    m_writable = true;
+
+    return m_fd != -1;
+}
+
+bool
+MappedFile::Open(const MappedFileChar *path)
+{
+    Close();
+
+    m_fd = open(path, O_RDONLY);
+    m_writable = false;
+
+    return m_fd != -1;
+}
+
+void
+MappedFile::Close()
+{
+    if (m_fd != -1)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool
+MappedFile::IsOpen() const
+{
+    return m_fd != -1;
+}
+
+unsigned long long
+MappedFile::GetSize() const
+{
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+        return 0;
+
+    return st.st_size;
+}
+
+bool
+MappedFile::SetSize(unsigned long long size)
+{
+    return ftruncate(m_fd, size) == 0;
+}
+
+void *
+MappedFile::Map(unsigned long long offset, size_t size)
+{
+    if (m_writable && GetSize() < offset + size && !SetSize(offset + size))
+        return NULL;
+
+    void *p = mmap(NULL, size, (m_writable) ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_fd, offset);
+
+    return (p != MAP_FAILED) ? p : NULL;
+}
+
+void
+MappedFile::Unmap(void *p, size_t size)
+{
+    munmap(p, size);
+}
+
+size_t
+MappedFile::GetGranularity()
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+#endif
+
+} // namespace InterceptPP
@@ -0,0 +1,81 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <stddef.h>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+//
+// A file that is accessed by mapping pieces of it into memory, with
+// CreateFileMapping()/MapViewOfFile() on Win32 and mmap() elsewhere.
+// Mapping past the end of a file opened for writing grows it, and the
+// views stay valid until unmapped, even after Close().  Not thread-safe,
+// the caller has to make sure only one thread at a time calls Map().
+//
+// Besides MSVC this builds on Linux so that it can be tested there.
+//
+
+#ifdef _WIN32
+typedef wchar_t MappedFileChar;
+#else
+typedef char MappedFileChar;
+#endif
+
+class INTERCEPTPP_API MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Creates the file, or empties it if it's already there
+    bool Create(const MappedFileChar *path);
+    // Opens an existing file for reading
+    bool Open(const MappedFileChar *path);
+    void Close();
+
+    bool IsOpen() const;
+    unsigned long long GetSize() const;
+    // Only while nothing is mapped on Win32
+    bool SetSize(unsigned long long size);
+
+    // offset has to be a multiple of GetGranularity().  Returns NULL on
+    // failure.
+    void *Map(unsigned long long offset, size_t size);
+    static void Unmap(void *p, size_t size);
+
+    static size_t GetGranularity();
+
+protected:
+    bool m_writable;
+#ifdef _WIN32
+    HANDLE m_handle;
+#else
+    int m_fd;
+#endif
+};
+
+} // namespace InterceptPP
@@ -0,0 +1,513 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "MappedLog.h"
+#include <string.h>
+#ifndef _WIN32
+#include <sched.h>
+#endif
+
+namespace InterceptPP {
+
+struct MappedLogExtentTag {
+    char *base;
+    unsigned long long offset;
+    // Bytes handed out, which runs past the end once the extent is full
+    volatile long used;
+    // Producers between looking at the extent and committing to it
+    volatile long writers;
+    volatile long retired;
+    volatile long unmapped;
+    MappedLogExtent *next;
+};
+
+#define COMMIT_KEY  0xC0DEC0DE
+#define PADDING_KEY 0x9ADD1296
+
+static inline unsigned int
+GetEntrySize(unsigned int size)
+{
+    return (sizeof(MappedRecordHeader) + size + MAPPED_LOG_ALIGNMENT - 1) & ~(MAPPED_LOG_ALIGNMENT - 1);
+}
+
+//
+// The few things that differ between Win32 and the rest
+//
+
+#ifdef _WIN32
+
+// Volatile accesses come with acquire and release semantics with MSVC
+static inline MappedLogExtent *
+LoadAcquire(MappedLogExtent * volatile const *p)
+{
+    return *p;
+}
+
+static inline void
+StoreRelease(MappedLogExtent * volatile *p, MappedLogExtent *value)
+{
+    *p = value;
+}
+
+static inline void
+StoreRelease(volatile unsigned int *p, unsigned int value)
+{
+    *p = value;
+}
+
+static inline long
+AtomicRead(const volatile long *p)
+{
+    return *p;
+}
+
+static inline long
+AtomicAdd(volatile long *p, long value)
+{
+    return InterlockedExchangeAdd(p, value);
+}
+
+static inline long
+AtomicIncrement(volatile long *p)
+{
+    return InterlockedIncrement(p);
+}
+
+static inline long
+AtomicDecrement(volatile long *p)
+{
+    return InterlockedDecrement(p);
+}
+
+static inline long
+AtomicCompareExchange(volatile long *p, long value, long comparand)
+{
+    return InterlockedCompareExchange(p, value, comparand);
+}
+
+static inline void
+Yield()
+{
+    Sleep(0);
+}
+
+#else
+
+static inline MappedLogExtent *
+LoadAcquire(MappedLogExtent * volatile const *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+StoreRelease(MappedLogExtent * volatile *p, MappedLogExtent *value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline void
+StoreRelease(volatile unsigned int *p, unsigned int value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline long
+AtomicRead(const volatile long *p)
+{
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline long
+AtomicAdd(volatile long *p, long value)
+{
+    return __sync_fetch_and_add(p, value);
+}
+
+static inline long
+AtomicIncrement(volatile long *p)
+{
+    return __sync_add_and_fetch(p, 1);
+}
+
+static inline long
+AtomicDecrement(volatile long *p)
+{
+    return __sync_sub_and_fetch(p, 1);
+}
+
+static inline long
+AtomicCompareExchange(volatile long *p, long value, long comparand)
+{
+    return __sync_val_compare_and_swap(p, comparand, value);
+}
+
+static inline void
+Yield()
+{
+    sched_yield();
+}
+
+#endif
+
+MappedLog::MappedLog()
+    : m_extentSize(0), m_current(NULL), m_extents(NULL)
+{
+}
+
+MappedLog::~MappedLog()
+{
+    Close();
+}
+
+bool
+MappedLog::Create(const MappedFileChar *path, unsigned int extentSize)
+{
+    Close();
+
+    unsigned int granularity = static_cast<unsigned int>(MappedFile::GetGranularity());
+    if (extentSize > MAPPED_LOG_MAX_EXTENT_SIZE)
+        extentSize = MAPPED_LOG_MAX_EXTENT_SIZE;
+    m_extentSize = (extentSize + granularity - 1) / granularity * granularity;
+
+    if (!m_file.Create(path))
+        return false;
+
+    MappedLogExtent *first = MapExtent(0);
+    if (first == NULL)
+    {
+        m_file.Close();
+        return false;
+    }
+
+    MappedLogHeader *header = reinterpret_cast<MappedLogHeader *>(first->base);
+    header->magic = MAPPED_LOG_MAGIC;
+    header->version = MAPPED_LOG_VERSION;
+    header->extentSize = m_extentSize;
+    header->reserved = 0;
+    first->used = sizeof(MappedLogHeader);
+
+    StoreRelease(&m_current, first);
+
+    return true;
+}
+
+void
+MappedLog::Close()
+{
+    if (!m_file.IsOpen())
+        return;
+
+    unsigned long long end = 0;
+    MappedLogExtent *current = m_current;
+    if (current != NULL)
+    {
+        unsigned long used = static_cast<unsigned long>(current->used);
+        end = current->offset + ((used < m_extentSize) ? used : m_extentSize);
+    }
+    m_current = NULL;
+
+    while (m_extents != NULL)
+    {
+        MappedLogExtent *extent = m_extents;
+        m_extents = extent->next;
+
+        if (!extent->unmapped)
+            MappedFile::Unmap(extent->base, m_extentSize);
+        delete extent;
+    }
+
+    // A failure to grow leaves the file as it is
+    if (current != NULL)
+        m_file.SetSize(end);
+
+    m_file.Close();
+}
+
+unsigned int
+MappedLog::GetMaxRecordSize() const
+{
+    // Fits at the start of any extent, even the first one
+    return m_extentSize - sizeof(MappedLogHeader) - sizeof(MappedRecordHeader);
+}
+
+void *
+MappedLog::Reserve(unsigned int size, MappedLogReservation &reservation)
+{
+    if (size > GetMaxRecordSize())
+        return NULL;
+
+    long entrySize = GetEntrySize(size);
+
+    while (true)
+    {
+        MappedLogExtent *extent = LoadAcquire(&m_current);
+        if (extent == NULL)
+            return NULL;
+
+        // Once the extent is retired it may be unmapped any moment, unless
+        // we were counted as writing before that
+        AtomicIncrement(&extent->writers);
+        if (AtomicRead(&extent->retired))
+        {
+            if (AtomicDecrement(&extent->writers) == 0)
+                ReleaseExtent(extent);
+            Yield();
+            continue;
+        }
+
+        long offset = AtomicAdd(&extent->used, entrySize);
+        if (offset + entrySize <= static_cast<long>(m_extentSize))
+        {
+            MappedRecordHeader *header = reinterpret_cast<MappedRecordHeader *>(extent->base + offset);
+            header->size = size;
+
+            reservation.extent = extent;
+            reservation.header = header;
+
+            return header + 1;
+        }
+
+        if (offset <= static_cast<long>(m_extentSize))
+        {
+            // Ours is the reservation that ran past the end, so it's up to
+            // us to pad the rest and move everyone on to the next extent
+            if (offset < static_cast<long>(m_extentSize))
+            {
+                MappedRecordHeader *header = reinterpret_cast<MappedRecordHeader *>(extent->base + offset);
+                header->size = m_extentSize - offset - sizeof(MappedRecordHeader);
+                StoreRelease(&header->commit, header->size ^ PADDING_KEY);
+            }
+
+            AtomicDecrement(&extent->writers);
+            SwitchExtent(extent);
+        }
+        else
+        {
+            if (AtomicDecrement(&extent->writers) == 0 && AtomicRead(&extent->retired))
+                ReleaseExtent(extent);
+            while (LoadAcquire(&m_current) == extent)
+                Yield();
+        }
+    }
+}
+
+void
+MappedLog::Commit(MappedLogReservation &reservation)
+{
+    MappedRecordHeader *header = reservation.header;
+    MappedLogExtent *extent = reservation.extent;
+
+    StoreRelease(&header->commit, header->size ^ COMMIT_KEY);
+
+    if (AtomicDecrement(&extent->writers) == 0 && AtomicRead(&extent->retired))
+        ReleaseExtent(extent);
+}
+
+MappedLogExtent *
+MappedLog::MapExtent(unsigned long long offset)
+{
+    void *base = m_file.Map(offset, m_extentSize);
+    if (base == NULL)
+        return NULL;
+
+    MappedLogExtent *extent = new MappedLogExtent;
+    extent->base = static_cast<char *>(base);
+    extent->offset = offset;
+    extent->used = 0;
+    extent->writers = 0;
+    extent->retired = 0;
+    extent->unmapped = 0;
+
+    // Only ever called by one thread at a time
+    extent->next = m_extents;
+    m_extents = extent;
+
+    return extent;
+}
+
+void
+MappedLog::SwitchExtent(MappedLogExtent *full)
+{
+    // Leaves m_current NULL if the file couldn't grow, which the waiting
+    // producers give up on
+    MappedLogExtent *extent = MapExtent(full->offset + m_extentSize);
+    StoreRelease(&m_current, extent);
+
+    // Interlocked so that it can't pass the load below, and a producer
+    // that's done with it either sees it or is seen to be done
+    AtomicIncrement(&full->retired);
+    if (AtomicRead(&full->writers) == 0)
+        ReleaseExtent(full);
+}
+
+void
+MappedLog::ReleaseExtent(MappedLogExtent *extent)
+{
+    // Producers that count themselves as writing from now on find it
+    // retired and back off without touching it
+    if (AtomicRead(&extent->writers) == 0 && AtomicCompareExchange(&extent->unmapped, 1, 0) == 0)
+        MappedFile::Unmap(extent->base, m_extentSize);
+}
+
+MappedLogReader::MappedLogReader()
+    : m_fileSize(0), m_extentSize(0), m_extent(NULL), m_extentOffset(0), m_extentLength(0), m_pos(0),
+      m_tornRecords(0), m_holes(0)
+{
+}
+
+MappedLogReader::~MappedLogReader()
+{
+    Close();
+}
+
+bool
+MappedLogReader::Open(const MappedFileChar *path)
+{
+    Close();
+
+    if (!m_file.Open(path))
+        return false;
+
+    m_fileSize = m_file.GetSize();
+    if (m_fileSize < sizeof(MappedLogHeader))
+    {
+        Close();
+        return false;
+    }
+
+    MappedLogHeader header;
+    void *p = m_file.Map(0, sizeof(header));
+    if (p == NULL)
+    {
+        Close();
+        return false;
+    }
+    memcpy(&header, p, sizeof(header));
+    MappedFile::Unmap(p, sizeof(header));
+
+    if (header.magic != MAPPED_LOG_MAGIC || header.version != MAPPED_LOG_VERSION ||
+        header.extentSize < sizeof(MappedLogHeader) || header.extentSize > MAPPED_LOG_MAX_EXTENT_SIZE)
+    {
+        Close();
+        return false;
+    }
+    m_extentSize = header.extentSize;
+
+    if (!MapExtent(0))
+    {
+        Close();
+        return false;
+    }
+    m_pos = sizeof(MappedLogHeader);
+
+    return true;
+}
+
+void
+MappedLogReader::Close()
+{
+    UnmapExtent();
+    m_file.Close();
+}
+
+const void *
+MappedLogReader::Next(unsigned int &size)
+{
+    while (m_extent != NULL)
+    {
+        if (m_extentLength - m_pos < sizeof(MappedRecordHeader))
+        {
+            if (!MapExtent(m_extentOffset + m_extentSize))
+                return NULL;
+            continue;
+        }
+
+        const MappedRecordHeader *header = reinterpret_cast<const MappedRecordHeader *>(m_extent + m_pos);
+
+        if (header->size == 0 && header->commit == 0)
+        {
+            // Either what's left of the extent was never written to, or
+            // someone died before writing their record's size.  Records
+            // following theirs have a header that isn't all zeros.
+            unsigned int pos = m_pos + sizeof(MappedRecordHeader);
+            while (pos + sizeof(MappedRecordHeader) <= m_extentLength)
+            {
+                header = reinterpret_cast<const MappedRecordHeader *>(m_extent + pos);
+                if (header->size != 0 || header->commit != 0)
+                    break;
+                pos += sizeof(MappedRecordHeader);
+            }
+
+            if (pos + sizeof(MappedRecordHeader) <= m_extentLength)
+                m_holes++;
+            m_pos = pos;
+            continue;
+        }
+
+        unsigned int entrySize = GetEntrySize(header->size);
+        if (header->size > m_extentLength || entrySize > m_extentLength - m_pos)
+        {
+            // Not something we wrote, so there's no telling where the
+            // next record starts
+            m_pos = m_extentLength;
+            continue;
+        }
+        m_pos += entrySize;
+
+        if (header->commit == (header->size ^ COMMIT_KEY))
+        {
+            size = header->size;
+            return header + 1;
+        }
+        else if (header->commit != (header->size ^ PADDING_KEY))
+        {
+            m_tornRecords++;
+        }
+    }
+
+    return NULL;
+}
+
+bool
+MappedLogReader::MapExtent(unsigned long long offset)
+{
+    UnmapExtent();
+
+    if (offset >= m_fileSize)
+        return false;
+
+    unsigned long long left = m_fileSize - offset;
+    m_extentLength = (left < m_extentSize) ? static_cast<unsigned int>(left) : m_extentSize;
+    m_extent = static_cast<const char *>(m_file.Map(offset, m_extentLength));
+    m_extentOffset = offset;
+    m_pos = 0;
+
+    return m_extent != NULL;
+}
+
+void
+MappedLogReader::UnmapExtent()
+{
+    if (m_extent != NULL)
+    {
+        MappedFile::Unmap(const_cast<char *>(m_extent), m_extentLength);
+        m_extent = NULL;
+    }
+}
+
+} // namespace InterceptPP
@@ -0,0 +1,150 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "MappedFile.h"
+
+namespace InterceptPP {
+
+//
+// A log file that producers write straight into through a shared mapping,
+// without a lock and without a thread of its own doing the I/O.  The file
+// grows in extents of a fixed size, each mapped on its own; a producer
+// reserves room for a record by bumping the current extent's fill
+// position with a single atomic add, copies the record in and commits it.
+// Whoever's reservation runs past the end of the extent pads what's left
+// of it and maps the next one, the others wait for that and try again.
+// Extents nobody writes to anymore are unmapped.
+//
+// Records are 8-byte aligned and preceded by their size and a commit
+// marker derived from it, stored last with release semantics.  The
+// mapping is the file's page cache, so everything committed before the
+// process dies ends up in the file, and a reader can tell committed
+// records from reserved ones that never were: MappedLogReader skips the
+// latter along with the padding, and the zeros of a reservation that
+// didn't even get its size written.
+//
+// Close() trims the file down to what was used, a file that wasn't closed
+// is as long as its last extent.
+//
+// Besides MSVC this builds on Linux so that it can be tested there.
+//
+
+#define MAPPED_LOG_MAGIC                0x474C534F  // "OSLG"
+#define MAPPED_LOG_VERSION              1
+#define MAPPED_LOG_ALIGNMENT            8
+#define MAPPED_LOG_DEFAULT_EXTENT_SIZE  (16 * 1024 * 1024)
+#define MAPPED_LOG_MAX_EXTENT_SIZE      (256 * 1024 * 1024)
+
+// At the start of the file
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int extentSize;
+    unsigned int reserved;
+} MappedLogHeader;
+
+// In front of every record
+typedef struct {
+    unsigned int size;
+    volatile unsigned int commit;
+} MappedRecordHeader;
+
+typedef struct MappedLogExtentTag MappedLogExtent;
+
+typedef struct {
+    MappedLogExtent *extent;
+    MappedRecordHeader *header;
+} MappedLogReservation;
+
+class INTERCEPTPP_API MappedLog
+{
+public:
+    MappedLog();
+    ~MappedLog();
+
+    // extentSize is rounded up to MappedFile::GetGranularity()
+    bool Create(const MappedFileChar *path, unsigned int extentSize = MAPPED_LOG_DEFAULT_EXTENT_SIZE);
+    // Nobody may be writing anymore
+    void Close();
+
+    unsigned int GetExtentSize() const { return m_extentSize; }
+    unsigned int GetMaxRecordSize() const;
+
+    //
+    // Returns where to write a record of size bytes, or NULL if it's
+    // bigger than GetMaxRecordSize(), the file couldn't grow or isn't
+    // open.  Every reservation has to be committed, the sooner the
+    // better, as the extent it's in stays mapped until then.
+    //
+    void *Reserve(unsigned int size, MappedLogReservation &reservation);
+    void Commit(MappedLogReservation &reservation);
+
+protected:
+    MappedLogExtent *MapExtent(unsigned long long offset);
+    void SwitchExtent(MappedLogExtent *full);
+    void ReleaseExtent(MappedLogExtent *extent);
+
+    MappedFile m_file;
+    unsigned int m_extentSize;
+
+    MappedLogExtent * volatile m_current;
+    // Every extent mapped so far, so that Close() can free them
+    MappedLogExtent *m_extents;
+};
+
+//
+// Reads the records back from a file, whether it was closed or not.
+//
+
+class INTERCEPTPP_API MappedLogReader
+{
+public:
+    MappedLogReader();
+    ~MappedLogReader();
+
+    bool Open(const MappedFileChar *path);
+    void Close();
+
+    // Returns the next committed record, or NULL at the end of the file
+    const void *Next(unsigned int &size);
+
+    // Records reserved and never committed, and holes left by
+    // reservations that didn't get that far
+    unsigned int GetTornRecords() const { return m_tornRecords; }
+    unsigned int GetHoles() const { return m_holes; }
+
+protected:
+    bool MapExtent(unsigned long long offset);
+    void UnmapExtent();
+
+    MappedFile m_file;
+    unsigned long long m_fileSize;
+    unsigned int m_extentSize;
+
+    const char *m_extent;
+    unsigned long long m_extentOffset;
+    unsigned int m_extentLength;
+    unsigned int m_pos;
+
+    unsigned int m_tornRecords;
+    unsigned int m_holes;
+};
+
+} // namespace InterceptPP
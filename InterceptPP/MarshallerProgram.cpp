@@ -0,0 +1,338 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "MarshallerProgram.h"
+#include "Format.h"
+
+namespace InterceptPP {
+
+namespace Marshaller {
+
+typedef struct {
+    int intValue;
+    unsigned int uintValue;
+    bool valid;
+} ProgramSlot;
+
+typedef struct {
+    unsigned char *base;
+    unsigned int remaining;
+    unsigned int tail;      // elements after the gap left by CaptureBudget
+    unsigned int skipped;   // elements in the gap
+} ProgramFrame;
+
+volatile bool Program::m_enabled = true;
+
+Instruction::Instruction(Opcode op, const CompileContext &ctx)
+    : op(op),
+      flags((ctx.runtimeDeep) ? INSN_FLAG_RUNTIME_DEEP : 0),
+      offset(ctx.offset),
+      width(0),
+      count(0),
+      slot(-1),
+      target(0),
+      marshaller(NULL),
+      binding(NULL)
+{
+}
+
+int
+CompileContext::GetSlot(const OString &propName) const
+{
+    if (overrides == NULL)
+        return -1;
+
+    SlotMap::const_iterator iter = overrides->find(propName);
+    if (iter == overrides->end())
+        return -1;
+
+    return iter->second;
+}
+
+Program *
+Program::Compile(const BaseMarshaller *marshaller)
+{
+    AllocTagScope allocTag(ALLOC_TAG_MARSHALLERS);
+
+    Program *prog = new Program();
+
+    CompileContext ctx;
+    if (!marshaller->Compile(*prog, ctx))
+    {
+        delete prog;
+        return NULL;
+    }
+
+    return prog;
+}
+
+unsigned int
+Program::Emit(const Instruction &insn)
+{
+    m_code.push_back(insn);
+    return static_cast<unsigned int>(m_code.size() - 1);
+}
+
+int
+Program::AllocateSlot()
+{
+    if (m_slotCount >= PROGRAM_MAX_SLOTS)
+        return -1;
+
+    return m_slotCount++;
+}
+
+void
+Program::Execute(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv) const
+{
+    ProgramFrame frames[PROGRAM_MAX_DEPTH];
+    int frameDepth = 0;
+
+    ProgramSlot slots[PROGRAM_MAX_SLOTS] = {};
+
+    unsigned char *base = static_cast<unsigned char *>(start);
+
+    CaptureBudget *budget = (propProv != NULL) ? propProv->GetCaptureBudget() : NULL;
+
+    char buf[FORMAT_MAX_LENGTH];
+
+    unsigned int pc = 0;
+    unsigned int end = static_cast<unsigned int>(m_code.size());
+
+    while (pc < end)
+    {
+        const Instruction &insn = m_code[pc];
+        unsigned char *p = base + insn.offset;
+        bool insnDeep = ((insn.flags & INSN_FLAG_RUNTIME_DEEP) != 0) ? deep : true;
+
+        switch (insn.op)
+        {
+            case OP_CALL:
+            {
+                insn.marshaller->WriteValue(writer, p, insnDeep, propProv);
+                break;
+            }
+            case OP_VALUE:
+            {
+                writer.BeginElement("value");
+                writer.Field("type", insn.name);
+                if ((insn.flags & INSN_FLAG_SUBTYPE) != 0)
+                    writer.Field("subType", insn.subName);
+
+                bool toStringDeep = ((insn.flags & INSN_FLAG_TOSTRING_DEEP) != 0) ? insnDeep : false;
+                writer.Field("value", insn.marshaller->ToString(p, toStringDeep, propProv));
+
+                writer.EndElement();
+                break;
+            }
+            case OP_INTEGER:
+            {
+                writer.BeginElement("value");
+                writer.Field("type", insn.name);
+                writer.Field("value", buf, Format::Integer(buf, insn.layout.Read(p), insn.layout.sign, insn.layout.hex) - buf);
+                writer.EndElement();
+                break;
+            }
+            case OP_POINTER:
+            {
+                void *ptr = *reinterpret_cast<void **>(p);
+
+                writer.BeginElement("value");
+                writer.Field("type", insn.name);
+                if (ptr != NULL)
+                    writer.Field("value", buf, Format::Pointer(buf, ptr) - buf);
+                else
+                    writer.Field("value", "NULL");
+
+                if (ptr == NULL || !insnDeep)
+                {
+                    writer.EndElement();
+
+                    pc = insn.target;
+                    continue;
+                }
+
+                frames[frameDepth].base = base;
+                frames[frameDepth].remaining = 0;
+                frames[frameDepth].tail = 0;
+                frames[frameDepth].skipped = 0;
+                frameDepth++;
+
+                base = static_cast<unsigned char *>(ptr);
+                break;
+            }
+            case OP_POINTER_END:
+            {
+                writer.EndElement();
+                base = frames[--frameDepth].base;
+                break;
+            }
+            case OP_STRUCT:
+            {
+                writer.BeginElement("value");
+                writer.Field("type", "Struct");
+                writer.Field("subType", insn.name);
+                break;
+            }
+            case OP_FIELD:
+            {
+                writer.BeginElement("field");
+                writer.Field("name", insn.name);
+                break;
+            }
+            case OP_END:
+            {
+                writer.EndElement();
+                break;
+            }
+            case OP_LOAD:
+            {
+                ProgramSlot &s = slots[insn.slot];
+                insn.layout.ReadPropertyValue(p, s.intValue, s.uintValue);
+                s.valid = true;
+                break;
+            }
+            case OP_LOAD_TEXT:
+            {
+                ProgramSlot &s = slots[insn.slot];
+                OString text = insn.marshaller->ToString(p, true, propProv);
+
+                char *endPtr = NULL;
+                s.intValue = strtol(text.c_str(), &endPtr, 0);
+                s.valid = (endPtr != text.c_str());
+                s.uintValue = strtoul(text.c_str(), NULL, 0);
+                break;
+            }
+            case OP_ARRAY:
+            {
+                unsigned int elCount = insn.count;
+
+                if (elCount == 0)
+                {
+                    if (insn.slot >= 0 && slots[insn.slot].valid)
+                        elCount = slots[insn.slot].uintValue;
+                    else if ((insn.flags & INSN_FLAG_BINDING) != 0)
+                        propProv->QueryForProperty(*insn.binding, elCount);
+                }
+
+                if (elCount == 0)
+                {
+                    pc = insn.target;
+                    continue;
+                }
+
+                writer.BeginElement("value");
+                writer.Field("type", "Array");
+                writer.Field("elementType", insn.name);
+                writer.Field("elementCount", elCount);
+
+                const Array *array = static_cast<const Array *>(insn.marshaller);
+                CaptureSlice slice;
+                CaptureBudget::Reserve(budget, elCount, insn.width, array->GetSampleCounter(), slice);
+                CaptureBudget::WriteMarkers(writer, elCount, slice);
+
+                if (slice.head + slice.tail == 0)
+                {
+                    writer.EndElement();
+
+                    pc = insn.target;
+                    continue;
+                }
+
+                frames[frameDepth].base = base;
+                frames[frameDepth].remaining = slice.head + slice.tail;
+                frames[frameDepth].tail = slice.tail;
+                frames[frameDepth].skipped = elCount - slice.head - slice.tail;
+                frameDepth++;
+
+                base = p;
+                break;
+            }
+            case OP_ARRAY_NEXT:
+            {
+                ProgramFrame &frame = frames[frameDepth - 1];
+
+                if (--frame.remaining > 0)
+                {
+                    base += insn.width;
+                    if (frame.remaining == frame.tail)
+                        base += frame.skipped * insn.width;
+
+                    pc = insn.target;
+                    continue;
+                }
+
+                base = frame.base;
+                frameDepth--;
+                writer.EndElement();
+                break;
+            }
+            case OP_BYTES:
+            {
+                int size = insn.count;
+
+                if (size <= 0)
+                {
+                    if (insn.slot >= 0 && slots[insn.slot].valid)
+                    {
+                        size = slots[insn.slot].intValue;
+                    }
+                    else if ((insn.flags & INSN_FLAG_BINDING) != 0)
+                    {
+                        if (!propProv->QueryForProperty(*insn.binding, size))
+                            propProv->QueryForProperty(*insn.binding, reinterpret_cast<unsigned int &> (size));
+                    }
+                }
+
+                if (size > 0)
+                {
+                    writer.BeginElement("value");
+                    writer.Field("type", "ByteArray");
+                    writer.Field("size", size);
+
+                    const ByteArray *byteArray = static_cast<const ByteArray *>(insn.marshaller);
+                    CaptureSlice slice;
+                    CaptureBudget::Reserve(budget, size, 1, byteArray->GetSampleCounter(), slice);
+                    CaptureBudget::WriteMarkers(writer, size, slice);
+
+                    const char *data = reinterpret_cast<const char *>(p);
+                    writer.Data(data, slice.head, data + size - slice.tail, slice.tail);
+
+                    writer.EndElement();
+                }
+
+                break;
+            }
+        }
+
+        pc++;
+    }
+}
+
+Logging::Node *
+Program::Execute(void *start, bool deep, IPropertyProvider *propProv) const
+{
+    Logging::TreeWriter writer;
+    Execute(writer, start, deep, propProv);
+
+    return writer.GetRoot();
+}
+
+} // namespace Marshaller
+
+} // namespace InterceptPP
@@ -0,0 +1,134 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "Marshallers.h"
+
+namespace InterceptPP {
+
+namespace Marshaller {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// A Program is a BaseMarshaller tree flattened into a sequence of
+// instructions at definition load time.  Offsets into structures are
+// pre-added, field bindings are resolved to slot indexes, and property
+// bindings are looked up once, so that executing it is a single
+// loop instead of a recursive walk through virtual WriteValue() calls.
+//
+// Every marshaller shipped with Intercept++ knows how to compile itself;
+// anything else is emitted as OP_CALL and falls back to WriteValue().
+//
+
+#define PROGRAM_MAX_DEPTH  32
+#define PROGRAM_MAX_SLOTS  32
+
+typedef enum {
+    OP_CALL = 0,        // marshaller->WriteValue()
+    OP_VALUE,           // <value type="name" [subType="subName"] value="marshaller->ToString()"/>
+    OP_INTEGER,         // <value type="name" value="..."/> read and formatted inline
+    OP_POINTER,         // <value type="name" value="0x..."> and descend into the pointee
+    OP_POINTER_END,
+    OP_STRUCT,          // <value type="Struct" subType="name">
+    OP_FIELD,           // <field name="name">
+    OP_END,             // closes OP_STRUCT and OP_FIELD
+    OP_LOAD,            // read an integer into a slot
+    OP_LOAD_TEXT,       // read marshaller->ToString() into a slot
+    OP_ARRAY,           // <value type="Array" ...> and loop over the elements
+    OP_ARRAY_NEXT,
+    OP_BYTES,           // <value type="ByteArray" size="...">...</value>
+} Opcode;
+
+#define INSN_FLAG_RUNTIME_DEEP   1  // honor the deep flag passed to Execute(), otherwise always deep
+#define INSN_FLAG_SUBTYPE        2
+#define INSN_FLAG_TOSTRING_DEEP  4  // pass the deep flag on to ToString(), otherwise false
+#define INSN_FLAG_BINDING        8  // query the property named by binding if there's no value
+
+class INTERCEPTPP_API Instruction
+{
+public:
+    Instruction(Opcode op, const CompileContext &ctx);
+
+    Opcode op;
+    unsigned int flags;
+    unsigned int offset;
+    unsigned int width;
+    int count;
+    int slot;
+    unsigned int target;
+    IntegerLayout layout;
+    const BaseMarshaller *marshaller;
+    OString name;
+    OString subName;
+    const PropertyQuery *binding;   // owned by the marshaller, which may resolve it after compiling
+};
+
+class INTERCEPTPP_API CompileContext
+{
+public:
+    typedef OMap<OString, int>::Type SlotMap;
+
+    CompileContext()
+        : offset(0), runtimeDeep(true), overrides(NULL), depth(0)
+    {}
+
+    int GetSlot(const OString &propName) const;
+
+    unsigned int offset;
+    bool runtimeDeep;
+    const SlotMap *overrides;
+    unsigned int depth;
+};
+
+class INTERCEPTPP_API Program : public BaseObject
+{
+public:
+    Program()
+        : m_slotCount(0)
+    {}
+
+    static Program *Compile(const BaseMarshaller *marshaller);
+
+    static bool GetEnabled() { return m_enabled; }
+    static void SetEnabled(bool enabled) { m_enabled = enabled; }
+
+    unsigned int Emit(const Instruction &insn);
+    Instruction &operator[](unsigned int index) { return m_code[index]; }
+    unsigned int GetLength() const { return static_cast<unsigned int>(m_code.size()); }
+
+    int AllocateSlot();
+
+    void Execute(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv) const;
+    Logging::Node *Execute(void *start, bool deep, IPropertyProvider *propProv) const;
+
+protected:
+    typedef OVector<Instruction>::Type InstructionVector;
+    InstructionVector m_code;
+    int m_slotCount;
+
+    static volatile bool m_enabled;
+};
+
+#pragma warning (pop)
+
+} // namespace Marshaller
+
+} // namespace InterceptPP
@@ -16,112 +16,260 @@
 //
 
 #include "Marshallers.h"
+#include "MarshallerProgram.h"
+#include "RawCapture.h"
+#include "Format.h"
+#include "FormatScanner.h"
+#include "Utf8.h"
+#include <limits.h>
 
 namespace InterceptPP {
 
+int
+IntegerLayout::Read(const void *start) const
+{
+    const unsigned char *p = static_cast<const unsigned char *>(start);
+
+    switch (width)
+    {
+        case 1:
+            return (signExtend) ? *reinterpret_cast<const signed char *>(p) : *p;
+        case 2:
+        {
+            unsigned short v = *reinterpret_cast<const unsigned short *>(p);
+            if (byteSwap)
+                v = _byteswap_ushort(v);
+            return (signExtend) ? static_cast<short>(v) : v;
+        }
+        default:
+        {
+            unsigned int v = *reinterpret_cast<const unsigned int *>(p);
+            if (byteSwap)
+                v = _byteswap_ulong(v);
+            return static_cast<int>(v);
+        }
+    }
+}
+
+void
+IntegerLayout::ReadPropertyValue(const void *start, int &intValue, unsigned int &uintValue) const
+{
+    int v = Read(start);
+
+    uintValue = static_cast<unsigned int>(v);
+
+    // Hex and unsigned values that don't fit would make strtol() saturate
+    if (sign && (!hex || v == 0))
+        intValue = v;
+    else
+        intValue = (uintValue > INT_MAX) ? INT_MAX : v;
+}
+
 void
-PropertyOverrides::Add(const OString &propName, const OString &value)
+PropertyOverrides::Add(const OString &propName, int intValue, unsigned int uintValue)
 {
-    m_overrides[propName] = value;
+    Entry *entry = const_cast<Entry *>(Find(propName));
+    if (entry == NULL)
+    {
+        if (m_count == PROPERTY_OVERRIDES_MAX)
+            return;
+
+        entry = &m_entries[m_count++];
+        entry->name = &propName;
+    }
+
+    entry->intValue = intValue;
+    entry->uintValue = uintValue;
 }
 
 bool
 PropertyOverrides::Contains(const OString &propName) const
 {
-    return m_overrides.find(propName) != m_overrides.end();
+    return Find(propName) != NULL;
 }
 
 bool
-PropertyOverrides::GetValue(const OString &propName, OString &value) const
+PropertyOverrides::GetValue(const OString &propName, int &value) const
 {
-    OverridesMap::const_iterator it = m_overrides.find(propName);
-    if (it == m_overrides.end())
+    const Entry *entry = Find(propName);
+    if (entry == NULL)
         return false;
 
-    value = it->second;
+    value = entry->intValue;
     return true;
 }
 
 bool
-PropertyOverrides::GetValue(const OString &propName, int &value) const
+PropertyOverrides::GetValue(const OString &propName, unsigned int &value) const
 {
-    OverridesMap::const_iterator it = m_overrides.find(propName);
-    if (it == m_overrides.end())
-        return false;
-
-    const OString &s = it->second;
-    char *endPtr = NULL;
-    int iVal = strtol(s.c_str(), &endPtr, 0);
-    if (endPtr == s.c_str())
+    const Entry *entry = Find(propName);
+    if (entry == NULL)
         return false;
 
-    value = iVal;
+    value = entry->uintValue;
     return true;
 }
 
-bool
-PropertyOverrides::GetValue(const OString &propName, unsigned int &value) const
+PropertyQuery::PropertyQuery(const OString &text)
+    : m_text(text), m_kind(PROPERTY_QUERY_OTHER), m_wantAddressOf(false), m_index(0)
 {
-    OverridesMap::const_iterator it = m_overrides.find(propName);
-    if (it == m_overrides.end())
-        return false;
+    // minimum: "arg.s"
+    if (text.size() < 5)
+    {
+        if (text.size() == 0)
+            m_kind = PROPERTY_QUERY_NONE;
+        return;
+    }
 
-    const OString &s = it->second;
-    char *endPtr = NULL;
-    unsigned int iVal = strtoul(s.c_str(), &endPtr, 0);
-    if (endPtr == s.c_str())
-        return false;
+    int off = 0;
+    if (text[0] == '&')
+    {
+        m_wantAddressOf = true;
+        off++;
+    }
 
-    value = iVal;
-    return true;
+    OString propObj = text.substr(off, 4);
+    OString propArg = text.substr(off + 4);
+
+    if (propObj == "reg.")
+    {
+        static const char *regNames[] = { "eax", "ebx", "ecx", "edx", "edi", "esi", "ebp", "esp" };
+
+        for (unsigned int i = 0; i < sizeof(regNames) / sizeof(regNames[0]); i++)
+        {
+            if (propArg == regNames[i])
+            {
+                m_kind = PROPERTY_QUERY_REGISTER;
+                m_index = i;
+                break;
+            }
+        }
+    }
+    else if (propObj == "arg.")
+    {
+        m_kind = PROPERTY_QUERY_ARGUMENT_NAME;
+        m_argName = propArg;
+    }
+}
+
+void
+PropertyQuery::Resolve(const IPropertyResolver &resolver)
+{
+    if (m_kind != PROPERTY_QUERY_ARGUMENT_NAME)
+        return;
+
+    unsigned int index;
+    if (resolver.ResolveArgument(m_argName, index))
+    {
+        m_kind = PROPERTY_QUERY_ARGUMENT;
+        m_index = index;
+    }
+}
+
+const PropertyOverrides::Entry *
+PropertyOverrides::Find(const OString &propName) const
+{
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        if (*m_entries[i].name == propName)
+            return &m_entries[i];
+    }
+
+    return NULL;
 }
 
 BaseMarshaller::BaseMarshaller(const OString &typeName)
-    : m_typeName(typeName)
+    : m_typeName(typeName), m_rawTypeId(0)
+{
+}
+
+BaseMarshaller::BaseMarshaller(const BaseMarshaller &m)
+    : m_typeName(m.m_typeName), m_rawTypeId(0)
+{
+    // Properties are usually set on the copy, so it gets its own type id
+}
+
+void
+BaseMarshaller::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.BeginElement("value");
+    writer.Field("type", m_typeName);
+    writer.Field("value", ToString(start, false, propProv));
+    writer.EndElement();
+}
+
+Logging::Node *
+BaseMarshaller::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
+    Logging::TreeWriter writer;
+    WriteValue(writer, start, deep, propProv, overrides);
+
+    return writer.GetRoot();
 }
 
 bool
-BaseMarshaller::HasPropertyBinding(const OString &propName) const
+BaseMarshaller::Compile(Marshaller::Program &prog, const Marshaller::CompileContext &ctx) const
+{
+    // We don't know which overrides a foreign marshaller consumes, so leave
+    // those to the tree walker
+    if (ctx.overrides != NULL)
+        return false;
+
+    Marshaller::Instruction insn(Marshaller::OP_CALL, ctx);
+    insn.marshaller = this;
+    prog.Emit(insn);
+
+    return true;
+}
+
+unsigned short
+BaseMarshaller::GetRawTypeId() const
 {
-    return (m_propBindings.find(propName) != m_propBindings.end());
+    if (m_rawTypeId == 0)
+        m_rawTypeId = RawSchema::Instance()->Register(this);
+
+    return m_rawTypeId;
 }
 
-const OString &
-BaseMarshaller::GetPropertyBinding(const OString &propName) const
+void
+BaseMarshaller::DescribeRaw(RawTypeDescription &desc) const
 {
-    PropBindingsMap::const_iterator iter = m_propBindings.find(propName);
-    return iter->second;
+    desc.kind = RAW_KIND_TEXT;
+    desc.name = m_typeName;
 }
 
 void
-BaseMarshaller::SetPropertyBindings(const char *firstPropName, ...)
+BaseMarshaller::WriteRaw(RawWriter &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    va_list args;
-    va_start(args, firstPropName);
+    unsigned short typeId = GetRawTypeId();
 
-    const char *propName = firstPropName;
-    while (propName != NULL)
+    // The schema is full, fall back to text
+    if (typeId == 0)
     {
-        const char *propValue = va_arg(args, const char *);
-
-        m_propBindings[propName] = propValue;
-
-        propName = va_arg(args, const char *);
+        writer.WriteTypeId(0);
+        writer.WriteText(ToString(start, false, propProv));
+        return;
     }
 
-    va_end(args);
+    CaptureRaw(writer, typeId, start, deep, propProv, overrides);
 }
 
-Logging::Node *
-BaseMarshaller::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+void
+BaseMarshaller::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    Logging::Element *el = new Logging::Element("value");
+    writer.WriteTypeId(typeId);
+    writer.WriteText(ToString(start, false, propProv));
+}
 
-    el->AddField("type", m_typeName);
-    el->AddField("value", ToString(start, false, propProv));
+bool
+BaseMarshaller::CompileValue(Marshaller::Program &prog, const Marshaller::CompileContext &ctx) const
+{
+    Marshaller::Instruction insn(Marshaller::OP_VALUE, ctx);
+    insn.marshaller = this;
+    insn.name = m_typeName;
+    prog.Emit(insn);
 
-    return el;
+    return true;
 }
 
 namespace Marshaller {
@@ -206,6 +354,8 @@ Factory::UnregisterMarshaller(const OString &name)
 BaseMarshaller *
 Factory::CreateMarshaller(const OString &name)
 {
+    AllocTagScope allocTag(ALLOC_TAG_MARSHALLERS);
+
     if (m_marshallers.find(name) != m_marshallers.end())
         return m_marshallers[name](name);
     else
@@ -213,21 +363,30 @@ Factory::CreateMarshaller(const OString &name)
 }
 
 Dynamic::Dynamic()
-    : BaseMarshaller("Dynamic")
+    : BaseMarshaller("Dynamic"), m_resolver(NULL)
 {
     m_fallback = new Int32();
+    InitializeCriticalSection(&m_cacheLock);
 }
 
 Dynamic::Dynamic(const Dynamic &d)
-    : BaseMarshaller(d)
+    : BaseMarshaller(d), m_resolver(NULL)
 {
     m_nameBase = d.m_nameBase;
     m_nameSuffix = d.m_nameSuffix;
     m_fallback = d.m_fallback->Clone();
+    InitializeCriticalSection(&m_cacheLock);
 }
 
 Dynamic::~Dynamic()
 {
+    for (MarshallerCache::iterator iter = m_cache.begin(); iter != m_cache.end(); iter++)
+    {
+        delete iter->second;
+    }
+
+    DeleteCriticalSection(&m_cacheLock);
+
     delete m_fallback;
 }
 
@@ -236,7 +395,7 @@ Dynamic::SetProperty(const OString &name, const OString &value)
 {
     if (name == "typeNameBase")
     {
-        m_nameBase = value;
+        m_nameBase = PropertyQuery(value);
     }
     else if (name == "typeNameSuffix")
     {
@@ -259,19 +418,17 @@ Dynamic::SetProperty(const OString &name, const OString &value)
     return true;
 }
 
-Logging::Node *
-Dynamic::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+void
+Dynamic::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    Logging::Element *el = new Logging::Element("value");
-
     OString subTypeName;
     OString value = ToStringInternal(start, false, propProv, overrides, &subTypeName);
 
-    el->AddField("type", m_typeName);
-    el->AddField("subType", subTypeName);
-    el->AddField("value", value);
-
-    return el;
+    writer.BeginElement("value");
+    writer.Field("type", m_typeName);
+    writer.Field("subType", subTypeName);
+    writer.Field("value", value);
+    writer.EndElement();
 }
 
 OString
@@ -283,29 +440,37 @@ Dynamic::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyO
 OString
 Dynamic::ToStringInternal(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides, OString *lastSubTypeName) const
 {
-    BaseMarshaller *marshaller = CreateMarshaller(propProv);
+    const BaseMarshaller *marshaller = GetMarshaller(propProv);
     if (marshaller == NULL)
+        marshaller = m_fallback;
+
+    if (lastSubTypeName != NULL)
+        *lastSubTypeName = marshaller->GetName();
+
+    return marshaller->ToString(start, deep, propProv, overrides);
+}
+
+void
+Dynamic::ResolvePropertyQueries(const IPropertyResolver &resolver)
+{
+    m_nameBase.Resolve(resolver);
+    m_fallback->ResolvePropertyQueries(resolver);
+
+    EnterCriticalSection(&m_cacheLock);
+
+    m_resolver = &resolver;
+    for (MarshallerCache::iterator iter = m_cache.begin(); iter != m_cache.end(); iter++)
     {
-        if (lastSubTypeName != NULL)
-            *lastSubTypeName = m_fallback->GetName();
-        return m_fallback->ToString(start, deep, propProv, overrides);
-    }
-    else
-    {
-        if (lastSubTypeName != NULL)
-            *lastSubTypeName = marshaller->GetName();
+        iter->second->ResolvePropertyQueries(resolver);
     }
 
-    OString result = marshaller->ToString(start, deep, propProv, overrides);
-    delete marshaller;
-
-    return result;
+    LeaveCriticalSection(&m_cacheLock);
 }
 
-BaseMarshaller *
-Dynamic::CreateMarshaller(IPropertyProvider *propProv) const
+const BaseMarshaller *
+Dynamic::GetMarshaller(IPropertyProvider *propProv) const
 {
-    if (m_nameBase.size() == 0)
+    if (!m_nameBase.IsSet())
         return NULL;
 
     OString s;
@@ -314,7 +479,67 @@ Dynamic::CreateMarshaller(IPropertyProvider *propProv) const
 
     s += m_nameSuffix;
 
-    return Factory::Instance()->CreateMarshaller(s);
+    BaseMarshaller *marshaller = NULL;
+
+    EnterCriticalSection(&m_cacheLock);
+
+    MarshallerCache::const_iterator iter = m_cache.find(s);
+    if (iter != m_cache.end())
+    {
+        marshaller = iter->second;
+    }
+    else
+    {
+        marshaller = Factory::Instance()->CreateMarshaller(s);
+        if (marshaller != NULL)
+        {
+            if (m_resolver != NULL)
+                marshaller->ResolvePropertyQueries(*m_resolver);
+
+            m_cache[s] = marshaller;
+        }
+    }
+
+    LeaveCriticalSection(&m_cacheLock);
+
+    return marshaller;
+}
+
+bool
+Dynamic::Compile(Program &prog, const CompileContext &ctx) const
+{
+    // The overrides are only passed on to the sub-marshaller's ToString(),
+    // which none of ours look at
+    Instruction insn(OP_CALL, ctx);
+    insn.marshaller = this;
+    prog.Emit(insn);
+
+    return true;
+}
+
+void
+Dynamic::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_DYNAMIC;
+    desc.name = m_typeName;
+}
+
+void
+Dynamic::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    const BaseMarshaller *marshaller = GetMarshaller(propProv);
+    if (marshaller == NULL)
+        marshaller = m_fallback;
+
+    writer.WriteTypeId(typeId);
+    writer.WriteTypeId(marshaller->GetRawTypeId());
+
+    // ToNode() only looks at the value shallowly, so only the inline types
+    // are safe to capture raw
+    if (marshaller->IsRawInline())
+        writer.WriteBytes(start, marshaller->GetSize());
+    else
+        writer.WriteText(marshaller->ToString(start, false, propProv, overrides));
 }
 
 Pointer::Pointer(BaseMarshaller *type, const OString &ptrTypeName)
@@ -343,56 +568,50 @@ Pointer::SetProperty(const OString &name, const OString &value)
     return m_type->SetProperty(name, value);
 }
 
-Logging::Node *
-Pointer::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+void
+Pointer::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
     void **ptr = static_cast<void **>(start);
 
-    Logging::Element *el = new Logging::Element("value");
+    writer.BeginElement("value");
 
-    el->AddField("type", m_typeName);
+    writer.Field("type", m_typeName);
 
-    OOStringStream ss;
     if (*ptr != NULL)
-        ss << hex << "0x" << *ptr;
+    {
+        char buf[FORMAT_MAX_LENGTH];
+        writer.Field("value", buf, Format::Pointer(buf, *ptr) - buf);
+    }
     else
-        ss << "NULL";
-
-    el->AddField("value", ss.str());
-
-    if (*ptr != NULL && deep)
     {
-        Logging::Node *node = m_type->ToNode(*ptr, true, propProv, overrides);
-        if (node != NULL)
-            el->AppendChild(node);
+        writer.Field("value", "NULL");
     }
 
-    return el;
+    if (*ptr != NULL && deep)
+        m_type->WriteValue(writer, *ptr, true, propProv, overrides);
+
+    writer.EndElement();
 }
 
 OString
 Pointer::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    OOStringStream ss;
-
     void **ptr = static_cast<void **>(start);
     if (*ptr != NULL)
     {
         if (deep)
         {
-            ss << m_type->ToString(*ptr, true, propProv, overrides);
+            return m_type->ToString(*ptr, true, propProv, overrides);
         }
         else
         {
-            ss << "0x" << *ptr;
+            return Format::ToPointerString(*ptr);
         }
     }
     else
     {
-        ss << "NULL";
+        return "NULL";
     }
-
-    return ss.str();
 }
 
 bool
@@ -423,14 +642,65 @@ Pointer::ToPointer (void * start, void *& result) const
     return true;
 }
 
-Logging::Node *
-VaList::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+void
+Pointer::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_POINTER;
+    desc.name = m_typeName;
+    desc.size = sizeof(void *);
+
+    if (m_type != NULL)
+        desc.elementTypeId = m_type->GetRawTypeId();
+}
+
+void
+Pointer::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    void **ptr = static_cast<void **>(start);
+    bool hasPointee = (*ptr != NULL && deep && m_type != NULL);
+
+    writer.WriteTypeId(typeId);
+    writer.WriteBytes(ptr, sizeof(void *));
+    writer.WriteByte(hasPointee);
+
+    if (hasPointee)
+        m_type->WriteRaw(writer, *ptr, true, propProv, overrides);
+}
+
+bool
+Pointer::Compile(Program &prog, const CompileContext &ctx) const
 {
-    Logging::Element *el = new Logging::Element("value");
-    el->AddField("type", m_typeName);
-    el->AddField("value", ToString(start, deep, propProv));
+    if (ctx.depth >= PROGRAM_MAX_DEPTH)
+        return false;
+
+    Instruction insn(OP_POINTER, ctx);
+    insn.name = m_typeName;
+    unsigned int insnIndex = prog.Emit(insn);
+
+    if (m_type != NULL)
+    {
+        CompileContext typeCtx(ctx);
+        typeCtx.offset = 0;
+        typeCtx.runtimeDeep = false;
+        typeCtx.depth++;
+
+        if (!m_type->Compile(prog, typeCtx))
+            return false;
+    }
 
-    return el;
+    prog.Emit(Instruction(OP_POINTER_END, ctx));
+    prog[insnIndex].target = prog.GetLength();
+
+    return true;
+}
+
+void
+VaList::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.BeginElement("value");
+    writer.Field("type", m_typeName);
+    writer.Field("value", ToString(start, deep, propProv));
+    writer.EndElement();
 }
 
 OString
@@ -438,13 +708,10 @@ VaList::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOv
 {
     void **ptr = static_cast<void **>(start);
 
-    OOStringStream ss;
     if (*ptr != NULL)
-        ss << hex << "0x" << *ptr;
+        return Format::ToPointerString(*ptr);
     else
-        ss << "NULL";
-
-    return ss.str();
+        return "NULL";
 }
 
 bool
@@ -487,24 +754,12 @@ Integer<T>::SetProperty(const OString &name, const OString &value)
 template <class T> OString
 Integer<T>::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    OOStringStream ss;
+    char buf[FORMAT_MAX_LENGTH];
 
     int v;
     ToInt(start, v);
 
-    if (m_hex && v != 0)
-        ss << "0x" << hex;
-    else
-        ss << dec;
-
-    T i = v;
-
-    if (m_sign)
-        ss << static_cast<int>(i);
-    else
-        ss << static_cast<unsigned int>(i);
-
-    return ss.str();
+    return OString(buf, Format::Integer(buf, v, m_sign, m_hex));
 }
 
 template <class T> bool
@@ -529,6 +784,59 @@ Integer<T>::ToUInt(void *start, unsigned int &result) const
     return true;
 }
 
+template <class T> bool
+Integer<T>::GetIntegerLayout(IntegerLayout &layout) const
+{
+    layout.width = sizeof(T);
+    layout.signExtend = numeric_limits<T>::is_signed;
+    layout.sign = m_sign;
+    layout.hex = m_hex;
+
+    // Not all widths implement ToLittleEndian()
+    layout.byteSwap = m_bigEndian && ToLittleEndian(static_cast<T>(1)) != static_cast<T>(1);
+
+    return true;
+}
+
+template <class T> bool
+Integer<T>::Compile(Program &prog, const CompileContext &ctx) const
+{
+    Instruction insn(OP_INTEGER, ctx);
+    GetIntegerLayout(insn.layout);
+    insn.name = m_typeName;
+    prog.Emit(insn);
+
+    return true;
+}
+
+template <class T> void
+Integer<T>::DescribeRaw(RawTypeDescription &desc) const
+{
+    IntegerLayout layout;
+    GetIntegerLayout(layout);
+
+    desc.kind = RAW_KIND_INTEGER;
+    desc.name = m_typeName;
+    desc.size = layout.width;
+    desc.flags = RAW_TYPE_FLAG_INLINE;
+
+    if (layout.signExtend)
+        desc.flags |= RAW_TYPE_FLAG_SIGN_EXTEND;
+    if (layout.sign)
+        desc.flags |= RAW_TYPE_FLAG_SIGNED;
+    if (layout.hex)
+        desc.flags |= RAW_TYPE_FLAG_HEX;
+    if (layout.byteSwap)
+        desc.flags |= RAW_TYPE_FLAG_BYTESWAP;
+}
+
+template <class T> void
+Integer<T>::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.WriteTypeId(typeId);
+    writer.WriteBytes(start, sizeof(T));
+}
+
 Boolean::Boolean()
     : BaseMarshaller("Boolean"), m_marshaller(new UInt8()), m_trueStr("true"), m_falseStr("false")
 {
@@ -589,27 +897,46 @@ Boolean::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyO
     return (value) ? m_trueStr : m_falseStr;
 }
 
+void
+Boolean::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_BOOLEAN;
+    desc.name = m_typeName;
+    desc.size = m_marshaller->GetSize();
+    desc.flags = RAW_TYPE_FLAG_INLINE;
+    desc.elementTypeId = m_marshaller->GetRawTypeId();
+    desc.trueStr = m_trueStr;
+    desc.falseStr = m_falseStr;
+}
+
+void
+Boolean::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.WriteTypeId(typeId);
+    writer.WriteBytes(start, m_marshaller->GetSize());
+}
+
 Array::Array()
-    : BaseMarshaller("Array"), m_elType(new UInt8()), m_elCount(0)
+    : BaseMarshaller("Array"), m_elType(new UInt8()), m_elCount(0), m_sampleCounter(0)
 {
 }
 
 Array::Array(BaseMarshaller *elType, unsigned int elCount)
-    : BaseMarshaller("Array"), m_elType(elType), m_elCount(elCount)
+    : BaseMarshaller("Array"), m_elType(elType), m_elCount(elCount), m_sampleCounter(0)
 {
 }
 
 Array::Array(BaseMarshaller *elType, const OString &elCountPropertyBinding)
-    : BaseMarshaller("Array"), m_elType(elType), m_elCount(0)
+    : BaseMarshaller("Array"), m_elType(elType), m_elCount(0), m_elCountBinding(elCountPropertyBinding), m_sampleCounter(0)
 {
-    SetPropertyBinding("elementCount", elCountPropertyBinding);
 }
 
 Array::Array(const Array &a)
-    : BaseMarshaller(a)
+    : BaseMarshaller(a), m_sampleCounter(0)
 {
     m_elType = a.m_elType->Clone();
     m_elCount = a.m_elCount;
+    m_elCountBinding = a.m_elCountBinding;
 }
 
 Array::~Array()
@@ -635,7 +962,7 @@ Array::SetProperty(const OString &name, const OString &value)
         unsigned int iVal = strtoul(value.c_str(), &endPtr, 0);
         if (endPtr == value.c_str())
         {
-            SetPropertyBinding("elementCount", value);
+            m_elCountBinding = PropertyQuery(value);
         }
         else
         {
@@ -650,14 +977,21 @@ Array::SetProperty(const OString &name, const OString &value)
     return true;
 }
 
+void
+Array::ResolvePropertyQueries(const IPropertyResolver &resolver)
+{
+    m_elCountBinding.Resolve(resolver);
+    m_elType->ResolvePropertyQueries(resolver);
+}
+
 unsigned int
 Array::GetSize() const
 {
     return m_elType->GetSize() * m_elCount;
 }
 
-Logging::Node *
-Array::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+unsigned int
+Array::GetElementCount(IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
     unsigned int elCount = m_elCount;
 
@@ -665,38 +999,49 @@ Array::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverr
     {
         if (overrides == NULL || !overrides->GetValue("elementCount", elCount))
         {
-            if (HasPropertyBinding("elementCount"))
+            if (m_elCountBinding.IsSet())
             {
-                propProv->QueryForProperty(GetPropertyBinding("elementCount"), elCount);
+                propProv->QueryForProperty(m_elCountBinding, elCount);
             }
         }
     }
 
-    Logging::Element *node = NULL;
+    return elCount;
+}
+
+void
+Array::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    unsigned int elCount = GetElementCount(propProv, overrides);
+    if (elCount == 0)
+        return;
 
-    if (elCount > 0)
-    {
-        node = new Logging::Element("value");
-        node->AddField("type", "Array");
-        node->AddField("elementType", m_elType->GetName());
+    writer.BeginElement("value");
+    writer.Field("type", "Array");
+    writer.Field("elementType", m_elType->GetName());
 
-        OOStringStream ss;
-        ss << elCount;
-        node->AddField("elementCount", ss.str());
+    writer.Field("elementCount", elCount);
 
-        unsigned char *p = static_cast<unsigned char *>(start);
-        unsigned int elSize = m_elType->GetSize();
+    unsigned char *p = static_cast<unsigned char *>(start);
+    unsigned int elSize = m_elType->GetSize();
 
-        for (unsigned int i = 0; i < elCount; i++)
-        {
-            Logging::Node *child = m_elType->ToNode(p, deep, propProv, overrides);
-            node->AppendChild(child);
+    CaptureSlice slice;
+    CaptureBudget::Reserve((propProv != NULL) ? propProv->GetCaptureBudget() : NULL,
+                           elCount, elSize, &m_sampleCounter, slice);
+    CaptureBudget::WriteMarkers(writer, elCount, slice);
 
-            p += elSize;
-        }
+    for (unsigned int i = 0; i < slice.head + slice.tail; i++)
+    {
+        // Skip over the elements left out between head and tail
+        if (i == slice.head)
+            p += (elCount - slice.head - slice.tail) * elSize;
+
+        m_elType->WriteValue(writer, p, deep, propProv, overrides);
+
+        p += elSize;
     }
 
-    return node;
+    writer.EndElement();
 }
 
 OString
@@ -705,30 +1050,109 @@ Array::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOve
     return "[Array]";
 }
 
-ByteArray::ByteArray(int size)
-    : BaseMarshaller("ByteArray"), m_size(size)
-{
-}
-
-ByteArray::ByteArray(const OString &sizePropertyBinding)
-    : BaseMarshaller("ByteArray"), m_size(0)
-{
-    SetPropertyBinding("size", sizePropertyBinding);
-}
-
 bool
-ByteArray::SetProperty(const OString &name, const OString &value)
+Array::Compile(Program &prog, const CompileContext &ctx) const
 {
-    if (name != "size")
+    if (ctx.depth >= PROGRAM_MAX_DEPTH)
         return false;
 
-    char *endPtr = NULL;
-    int iVal = strtol(value.c_str(), &endPtr, 0);
-    if (endPtr == value.c_str())
+    Instruction insn(OP_ARRAY, ctx);
+    insn.marshaller = this;
+    insn.name = m_elType->GetName();
+    insn.width = m_elType->GetSize();
+    insn.count = m_elCount;
+    insn.slot = ctx.GetSlot("elementCount");
+    if (m_elCountBinding.IsSet())
     {
-        SetPropertyBinding("size", value);
+        insn.flags |= INSN_FLAG_BINDING;
+        insn.binding = &m_elCountBinding;
     }
-    else
+    unsigned int insnIndex = prog.Emit(insn);
+
+    CompileContext elCtx(ctx);
+    elCtx.offset = 0;
+    elCtx.depth++;
+
+    unsigned int bodyStart = prog.GetLength();
+    if (!m_elType->Compile(prog, elCtx))
+        return false;
+
+    Instruction next(OP_ARRAY_NEXT, ctx);
+    next.width = m_elType->GetSize();
+    next.target = bodyStart;
+    prog.Emit(next);
+
+    prog[insnIndex].target = prog.GetLength();
+
+    return true;
+}
+
+void
+Array::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_ARRAY;
+    desc.name = "Array";
+    desc.size = m_elType->GetSize();
+    desc.elementTypeId = m_elType->GetRawTypeId();
+}
+
+void
+Array::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    unsigned int elCount = GetElementCount(propProv, overrides);
+    unsigned int elSize = m_elType->GetSize();
+
+    CaptureSlice slice;
+    CaptureBudget::Reserve((propProv != NULL) ? propProv->GetCaptureBudget() : NULL,
+                           elCount, elSize, &m_sampleCounter, slice);
+
+    writer.WriteTypeId(typeId);
+    writer.WriteCount(elCount, slice);
+
+    unsigned char *p = static_cast<unsigned char *>(start);
+    unsigned char *tail = p + (elCount - slice.tail) * elSize;
+
+    if (m_elType->IsRawInline())
+    {
+        writer.WriteBytes(p, slice.head * elSize);
+        writer.WriteBytes(tail, slice.tail * elSize);
+        return;
+    }
+
+    for (unsigned int i = 0; i < slice.head + slice.tail; i++)
+    {
+        if (i == slice.head)
+            p = tail;
+
+        m_elType->WriteRaw(writer, p, deep, propProv, overrides);
+
+        p += elSize;
+    }
+}
+
+ByteArray::ByteArray(int size)
+    : BaseMarshaller("ByteArray"), m_size(size), m_sampleCounter(0)
+{
+}
+
+ByteArray::ByteArray(const OString &sizePropertyBinding)
+    : BaseMarshaller("ByteArray"), m_size(0), m_sizeBinding(sizePropertyBinding), m_sampleCounter(0)
+{
+}
+
+bool
+ByteArray::SetProperty(const OString &name, const OString &value)
+{
+    if (name != "size")
+        return false;
+
+    char *endPtr = NULL;
+    int iVal = strtol(value.c_str(), &endPtr, 0);
+    if (endPtr == value.c_str())
+    {
+        m_sizeBinding = PropertyQuery(value);
+    }
+    else
     {
         m_size = iVal;
     }
@@ -736,8 +1160,8 @@ ByteArray::SetProperty(const OString &name, const OString &value)
     return true;
 }
 
-Logging::Node *
-ByteArray::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+int
+ByteArray::GetByteCount(IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
     int size = m_size;
 
@@ -745,29 +1169,38 @@ ByteArray::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyO
     {
         if (overrides == NULL || !overrides->GetValue("size", size))
         {
-            if (HasPropertyBinding("size"))
+            if (m_sizeBinding.IsSet())
             {
-                if (!propProv->QueryForProperty(GetPropertyBinding("size"), size))
-                    propProv->QueryForProperty(GetPropertyBinding("size"), reinterpret_cast<unsigned int &> (size));
+                if (!propProv->QueryForProperty(m_sizeBinding, size))
+                    propProv->QueryForProperty(m_sizeBinding, reinterpret_cast<unsigned int &> (size));
             }
         }
     }
 
-    Logging::DataNode *node = NULL;
-    
-    if (size > 0)
-    {
-        node = new Logging::DataNode("value");
-        node->AddField("type", "ByteArray");
+    return size;
+}
 
-        OOStringStream ss;
-        ss << size;
-        node->AddField("size", ss.str());
+void
+ByteArray::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    int size = GetByteCount(propProv, overrides);
+    if (size <= 0)
+        return;
 
-        node->SetData(start, size);
-    }
+    writer.BeginElement("value");
+    writer.Field("type", "ByteArray");
 
-    return node;
+    writer.Field("size", size);
+
+    CaptureSlice slice;
+    CaptureBudget::Reserve((propProv != NULL) ? propProv->GetCaptureBudget() : NULL,
+                           size, 1, &m_sampleCounter, slice);
+    CaptureBudget::WriteMarkers(writer, size, slice);
+
+    const char *p = static_cast<const char *>(start);
+    writer.Data(p, slice.head, p + size - slice.tail, slice.tail);
+
+    writer.EndElement();
 }
 
 OString
@@ -776,150 +1209,368 @@ ByteArray::ToString(void *start, bool deep, IPropertyProvider *propProv, Propert
     return "[ByteArray]";
 }
 
+bool
+ByteArray::Compile(Program &prog, const CompileContext &ctx) const
+{
+    Instruction insn(OP_BYTES, ctx);
+    insn.marshaller = this;
+    insn.count = m_size;
+    insn.slot = ctx.GetSlot("size");
+    if (m_sizeBinding.IsSet())
+    {
+        insn.flags |= INSN_FLAG_BINDING;
+        insn.binding = &m_sizeBinding;
+    }
+    prog.Emit(insn);
+
+    return true;
+}
+
+void
+ByteArray::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_BYTE_ARRAY;
+    desc.name = m_typeName;
+}
+
+void
+ByteArray::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    int size = GetByteCount(propProv, overrides);
+    if (size < 0)
+        size = 0;
+
+    CaptureSlice slice;
+    CaptureBudget::Reserve((propProv != NULL) ? propProv->GetCaptureBudget() : NULL,
+                           size, 1, &m_sampleCounter, slice);
+
+    writer.WriteTypeId(typeId);
+    writer.WriteCount(size, slice);
+
+    const char *p = static_cast<const char *>(start);
+    writer.WriteBytes(p, slice.head);
+    writer.WriteBytes(p + size - slice.tail, slice.tail);
+}
+
 OString
 AsciiString::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    OOStringStream ss;
-
     const char *strPtr = static_cast<const char *>(start);
 
     return strPtr;
 }
 
-bool
-AsciiFormatString::SetProperty(const OString &name, const OString &value)
+void
+AsciiString::DescribeRaw(RawTypeDescription &desc) const
 {
-    if (name == "vaList" || name == "vaStart")
-    {
-        SetPropertyBinding(name, value);
-        return true;
-    }
+    desc.kind = RAW_KIND_STRING;
+    desc.name = m_typeName;
+    desc.size = m_elementSize;
+}
 
-    return false;
+void
+AsciiString::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    const char *strPtr = static_cast<const char *>(start);
+    DWORD size = static_cast<DWORD>(strlen(strPtr));
+
+    writer.WriteTypeId(typeId);
+    writer.WriteDWord(size);
+    writer.WriteBytes(strPtr, size);
 }
 
-OString
-AsciiFormatString::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+bool
+AsciiFormatString::SetProperty(const OString &name, const OString &value)
 {
-    OOStringStream ss;
+    if (name == "vaList")
+        m_vaListBinding = PropertyQuery(value);
+    else if (name == "vaStart")
+        m_vaStartBinding = PropertyQuery(value);
+    else
+        return false;
 
-    CHAR *fmtPtr = static_cast<CHAR *>(start);
+    return true;
+}
 
-    bool success = false;
-    va_list args;
+void
+AsciiFormatString::ResolvePropertyQueries(const IPropertyResolver &resolver)
+{
+    m_vaListBinding.Resolve(resolver);
+    m_vaStartBinding.Resolve(resolver);
+}
 
-    if (HasPropertyBinding("vaList"))
+// Finds the arguments of a format string through its vaList or vaStart binding
+static bool
+QueryFormatArguments(IPropertyProvider *propProv, const PropertyQuery &vaListBinding,
+                     const PropertyQuery &vaStartBinding, va_list &args)
+{
+    if (vaListBinding.IsSet())
     {
-        success = propProv->QueryForProperty(GetPropertyBinding("vaList"), args);
+        return propProv->QueryForProperty(vaListBinding, args);
     }
-    else if (HasPropertyBinding("vaStart"))
+    else if (vaStartBinding.IsSet())
     {
-        CHAR **start;
+        void **start;
 
-        if (propProv->QueryForProperty(GetPropertyBinding("vaStart"), reinterpret_cast<void *&>(start)))
+        if (propProv->QueryForProperty(vaStartBinding, reinterpret_cast<void *&>(start)))
         {
             va_start(args, *start);
-            success = true;
+            return true;
         }
     }
 
-    CHAR buf[2048], *p;
+    return false;
+}
+
+template <class T>
+static void
+WriteFormatStringArgument(RawWriter &writer, FormatArgKind kind, const T *str, CaptureBudget *budget)
+{
+    unsigned int length = 0;
+    while (str[length] != 0)
+        length++;
+
+    CaptureSlice slice;
+    CaptureBudget::Reserve(budget, length, sizeof(T), NULL, slice);
 
-    if (success)
+    writer.WriteByte(static_cast<unsigned char>(kind));
+    writer.WriteCount(length, slice);
+    writer.WriteBytes(str, slice.head * sizeof(T));
+    writer.WriteBytes(str + length - slice.tail, slice.tail * sizeof(T));
+}
+
+//
+// Writes a RAW_KIND_FORMAT record: the format string and the raw words of
+// the arguments it refers to, leaving the formatting to the reader.  The
+// characters of %s arguments are charged to the argument's capture budget.
+//
+template <class T>
+static void
+WriteFormatRecord(RawWriter &writer, unsigned short typeId, const T *fmtPtr, bool haveArgs, va_list args,
+                  IPropertyProvider *propProv)
+{
+    size_t length = 0;
+    while (fmtPtr[length] != 0)
+        length++;
+
+    DWORD size = static_cast<DWORD>(length * sizeof(T));
+
+    writer.WriteTypeId(typeId);
+    writer.WriteDWord(size);
+    writer.WriteBytes(fmtPtr, size);
+
+    if (!haveArgs)
     {
-        vsprintf(buf, fmtPtr, args);
-        buf[2047] = '\0';
-        p = buf;
+        writer.WriteByte(RAW_FORMAT_NO_ARGS);
+        return;
     }
-    else
+
+    FormatArgKind kinds[FORMAT_MAX_ARGS];
+    unsigned int count = FormatScanner::Scan(fmtPtr, kinds);
+
+    writer.WriteByte(static_cast<unsigned char>(count));
+
+    CaptureBudget *budget = (propProv != NULL) ? propProv->GetCaptureBudget() : NULL;
+
+    for (unsigned int i = 0; i < count; i++)
     {
-        p = fmtPtr;
+        switch (kinds[i])
+        {
+            case FORMAT_ARG_INT32:
+            {
+                int value = va_arg(args, int);
+                writer.WriteByte(FORMAT_ARG_INT32);
+                writer.WriteBytes(&value, sizeof(value));
+                break;
+            }
+            case FORMAT_ARG_INT64:
+            {
+                __int64 value = va_arg(args, __int64);
+                writer.WriteByte(FORMAT_ARG_INT64);
+                writer.WriteBytes(&value, sizeof(value));
+                break;
+            }
+            case FORMAT_ARG_DOUBLE:
+            {
+                double value = va_arg(args, double);
+                writer.WriteByte(FORMAT_ARG_DOUBLE);
+                writer.WriteBytes(&value, sizeof(value));
+                break;
+            }
+            case FORMAT_ARG_POINTER:
+            {
+                unsigned __int64 value = reinterpret_cast<DWORD_PTR>(va_arg(args, void *));
+                writer.WriteByte(FORMAT_ARG_POINTER);
+                writer.WriteBytes(&value, sizeof(value));
+                break;
+            }
+            case FORMAT_ARG_STRING:
+            case FORMAT_ARG_WIDE_STRING:
+            {
+                const void *str = va_arg(args, const void *);
+
+                if (str == NULL)
+                    writer.WriteByte(FORMAT_ARG_NULL_STRING);
+                else if (kinds[i] == FORMAT_ARG_STRING)
+                    WriteFormatStringArgument(writer, kinds[i], static_cast<const CHAR *>(str), budget);
+                else
+                    WriteFormatStringArgument(writer, kinds[i], static_cast<const WCHAR *>(str), budget);
+
+                break;
+            }
+        }
     }
+}
+
+OString
+AsciiFormatString::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    CHAR *fmtPtr = static_cast<CHAR *>(start);
 
-    return p;
+    va_list args;
+    if (!QueryFormatArguments(propProv, m_vaListBinding, m_vaStartBinding, args))
+        return fmtPtr;
+
+    CHAR buf[2048];
+
+    // Cut long output short rather than overflow
+    int len = _vsnprintf(buf, sizeof(buf) - 1, fmtPtr, args);
+    buf[sizeof(buf) - 1] = '\0';
+
+    return OString(buf, (len >= 0) ? len : strlen(buf));
+}
+
+void
+AsciiFormatString::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_FORMAT;
+    desc.name = m_typeName;
+    desc.size = m_elementSize;
+}
+
+void
+AsciiFormatString::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    va_list args;
+    bool haveArgs = QueryFormatArguments(propProv, m_vaListBinding, m_vaStartBinding, args);
+
+    WriteFormatRecord(writer, typeId, static_cast<const CHAR *>(start), haveArgs, args, propProv);
+}
+
+// Length of a UnicodeString, not looking further than a fixed length
+// when the marshaller has one.
+static size_t
+GetBoundedLength(const WCHAR *str, int length)
+{
+    if (length < 0)
+        return wcslen(str);
+
+    size_t i = 0;
+    while (i < static_cast<size_t>(length) && str[i] != L'\0')
+        i++;
+
+    return i;
+}
+
+static OString
+Utf16ToUtf8(const WCHAR *str, size_t count)
+{
+    const Utf16Char *src = reinterpret_cast<const Utf16Char *>(str);
+    size_t maxLen = Utf8::GetMaxLength(count);
+    char stackBuf[1024];
+
+    // Short strings are transcoded on the stack and copied out once, so
+    // that the result isn't left holding three bytes per unit.
+    if (maxLen <= sizeof(stackBuf))
+        return OString(stackBuf, Utf8::FromUtf16(src, count, stackBuf));
+
+    OString result;
+    result.resize(maxLen);
+    result.resize(Utf8::FromUtf16(src, count, const_cast<char *>(result.data())));
+
+    return result;
 }
 
 OString
 UnicodeString::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    OOStringStream ss;
-
     const WCHAR *strPtr = static_cast<const WCHAR *>(start);
 
-    int size = WideCharToMultiByte(CP_UTF8, 0, strPtr, -1, NULL, 0, NULL, NULL);
-    OString result;
-    result.resize(size);
+    return Utf16ToUtf8(strPtr, GetBoundedLength(strPtr, m_length));
+}
 
-    WideCharToMultiByte(CP_UTF8, 0, strPtr, -1, const_cast<char *>(result.data()),
-                        static_cast<int>(result.size()), NULL, NULL);
+void
+UnicodeString::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_STRING;
+    desc.name = m_typeName;
+    desc.size = m_elementSize;
+}
 
-    // Discard the NUL byte
-    result.resize(size - 1);
+void
+UnicodeString::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    const WCHAR *strPtr = static_cast<const WCHAR *>(start);
+    DWORD size = static_cast<DWORD>(GetBoundedLength(strPtr, m_length) * sizeof(WCHAR));
 
-    return result;
+    writer.WriteTypeId(typeId);
+    writer.WriteDWord(size);
+    writer.WriteBytes(strPtr, size);
 }
 
 bool
 UnicodeFormatString::SetProperty(const OString &name, const OString &value)
 {
-    if (name == "vaList" || name == "vaStart")
-    {
-        SetPropertyBinding(name, value);
-        return true;
-    }
+    if (name == "vaList")
+        m_vaListBinding = PropertyQuery(value);
+    else if (name == "vaStart")
+        m_vaStartBinding = PropertyQuery(value);
+    else
+        return false;
 
-    return false;
+    return true;
+}
+
+void
+UnicodeFormatString::ResolvePropertyQueries(const IPropertyResolver &resolver)
+{
+    m_vaListBinding.Resolve(resolver);
+    m_vaStartBinding.Resolve(resolver);
 }
 
 OString
 UnicodeFormatString::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    OOStringStream ss;
-
     WCHAR *fmtPtr = static_cast<WCHAR *>(start);
 
-    bool success = false;
     va_list args;
+    if (!QueryFormatArguments(propProv, m_vaListBinding, m_vaStartBinding, args))
+        return Utf16ToUtf8(fmtPtr, GetBoundedLength(fmtPtr, m_length));
 
-    if (HasPropertyBinding("vaList"))
-    {
-        success = propProv->QueryForProperty(GetPropertyBinding("vaList"), args);
-    }
-    else if (HasPropertyBinding("vaStart"))
-    {
-        WCHAR **start;
-
-        if (propProv->QueryForProperty(GetPropertyBinding("vaStart"), reinterpret_cast<void *&>(start)))
-        {
-            va_start(args, *start);
-            success = true;
-        }
-    }
-
-    WCHAR buf[2048], *p;
+    WCHAR buf[2048];
 
-    if (success)
-    {
-        vswprintf(buf, sizeof(buf), fmtPtr, args);
-        buf[2047] = '\0';
-        p = buf;
-    }
-    else
-    {
-        p = fmtPtr;
-    }
+    // Cut long output short rather than overflow
+    int len = _vsnwprintf(buf, 2047, fmtPtr, args);
+    buf[2047] = L'\0';
 
-    int size = WideCharToMultiByte(CP_UTF8, 0, p, -1, NULL, 0, NULL, NULL);
-    OString result;
-    result.resize(size);
+    return Utf16ToUtf8(buf, (len >= 0) ? len : wcslen(buf));
+}
 
-    WideCharToMultiByte(CP_UTF8, 0, p, -1, const_cast<char *>(result.data()),
-                        static_cast<int>(result.size()), NULL, NULL);
+void
+UnicodeFormatString::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_FORMAT;
+    desc.name = m_typeName;
+    desc.size = m_elementSize;
+}
 
-    // Discard the NUL byte
-    result.resize(size - 1);
+void
+UnicodeFormatString::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    va_list args;
+    bool haveArgs = QueryFormatArguments(propProv, m_vaListBinding, m_vaStartBinding, args);
 
-    return result;
+    WriteFormatRecord(writer, typeId, static_cast<const WCHAR *>(start), haveArgs, args, propProv);
 }
 
 Enumeration::Enumeration(const char *name, BaseMarshaller *marshaller, const char *firstName, ...)
@@ -979,16 +1630,14 @@ Enumeration::AddMember(const OString &name, DWORD value)
     return result;
 }
 
-Logging::Node *
-Enumeration::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+void
+Enumeration::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    Logging::Element *el = new Logging::Element("value");
-
-    el->AddField("type", "Enum");
-    el->AddField("subType", m_typeName);
-    el->AddField("value", ToString(start, deep, propProv, overrides));
-
-    return el;
+    writer.BeginElement("value");
+    writer.Field("type", "Enum");
+    writer.Field("subType", m_typeName);
+    writer.Field("value", ToString(start, deep, propProv, overrides));
+    writer.EndElement();
 }
 
 OString
@@ -1008,6 +1657,41 @@ Enumeration::ToString(void *start, bool deep, IPropertyProvider *propProv, Prope
     }
 }
 
+bool
+Enumeration::Compile(Program &prog, const CompileContext &ctx) const
+{
+    Instruction insn(OP_VALUE, ctx);
+    insn.flags |= INSN_FLAG_SUBTYPE | INSN_FLAG_TOSTRING_DEEP;
+    insn.marshaller = this;
+    insn.name = "Enum";
+    insn.subName = m_typeName;
+    prog.Emit(insn);
+
+    return true;
+}
+
+void
+Enumeration::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_ENUM;
+    desc.name = m_typeName;
+    desc.size = m_marshaller->GetSize();
+    desc.flags = RAW_TYPE_FLAG_INLINE;
+    desc.elementTypeId = m_marshaller->GetRawTypeId();
+
+    for (OMap<DWORD, OString>::Type::const_iterator it = m_defs.begin(); it != m_defs.end(); it++)
+    {
+        desc.members.push_back(*it);
+    }
+}
+
+void
+Enumeration::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.WriteTypeId(typeId);
+    writer.WriteBytes(start, m_marshaller->GetSize());
+}
+
 Structure::Structure(const char *name, const char *firstFieldName, ...)
     : BaseMarshaller(name), m_size(0)
 {
@@ -1034,6 +1718,7 @@ Structure::Structure(const Structure &s)
     }
 
     m_bindings = s.m_bindings;
+    ResolveBindings();
 }
 
 Structure::~Structure()
@@ -1065,24 +1750,23 @@ Structure::AddField(StructureField *field)
     m_fieldIndexes[field->GetName()] = static_cast<unsigned int>(m_fields.size());
     m_fields.push_back(field);
     m_size += field->GetMarshaller()->GetSize();
+
+    // A binding may refer to a field that's added after it
+    if (m_bindings.size() > 0)
+        ResolveBindings();
 }
 
 void
 Structure::BindFieldTypePropertyToField(const OString &fieldName, const OString &propName, const OString &srcFieldName)
 {
     m_bindings.push_back(FieldTypePropertyBinding(fieldName, propName, srcFieldName));
+    ResolveBindings();
 }
 
-PropertyOverrides **
-Structure::GetFieldOverrides(void *start, IPropertyProvider *propProv) const
+void
+Structure::ResolveBindings()
 {
-    PropertyOverrides **fieldOverrides = NULL;
-
-    if (m_bindings.size() == 0)
-        return NULL;
-
-    fieldOverrides = new PropertyOverrides *[m_fields.size()];
-    memset(fieldOverrides, 0, sizeof(PropertyOverrides *) * m_fields.size());
+    m_resolvedBindings.clear();
 
     for (FieldBindingsVector::const_iterator it = m_bindings.begin(); it != m_bindings.end(); it++)
     {
@@ -1091,78 +1775,217 @@ Structure::GetFieldOverrides(void *start, IPropertyProvider *propProv) const
         if (idxIter == m_fieldIndexes.end() || srcIdxIter == m_fieldIndexes.end())
             continue;
 
-        unsigned int idx = idxIter->second;
-        unsigned int srcIdx = srcIdxIter->second;
+        m_resolvedBindings.push_back(ResolvedFieldBinding(idxIter->second, it->GetPropertyName(), m_fields[srcIdxIter->second]));
+    }
+}
 
-        PropertyOverrides *po = fieldOverrides[idx];
-        if (po == NULL)
-        {
-            po = new PropertyOverrides();
-            fieldOverrides[idx] = po;
-        }
+void
+Structure::GetFieldOverrides(unsigned int fieldIndex, void *start, IPropertyProvider *propProv, PropertyOverrides &overrides) const
+{
+    for (ResolvedBindingsVector::const_iterator it = m_resolvedBindings.begin(); it != m_resolvedBindings.end(); it++)
+    {
+        if (it->fieldIndex == fieldIndex)
+            it->ReadPropertyValue(start, propProv, overrides);
+    }
+}
+
+void
+Structure::WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.BeginElement("value");
+
+    writer.Field("type", "Struct");
+    writer.Field("subType", m_typeName);
+
+    for (unsigned int i = 0; i < m_fields.size(); i++)
+    {
+        const StructureField *field = m_fields[i];
+
+        void *fieldPtr = reinterpret_cast<char *>(start) + field->GetOffset();
+
+        writer.BeginElement("field");
+        writer.Field("name", field->GetName());
+
+        PropertyOverrides po;
+        if (m_resolvedBindings.size() > 0)
+            GetFieldOverrides(i, start, propProv, po);
 
-        StructureField *srcField = m_fields[srcIdx];
+        field->GetMarshaller()->WriteValue(writer, fieldPtr, true, propProv, (po.GetCount() > 0) ? &po : NULL);
 
-        void *p = reinterpret_cast<char *>(start) + srcField->GetOffset();
-        OString val = srcField->GetMarshaller()->ToString(p, true, propProv);
-        po->Add(it->GetPropertyName(), val);
+        writer.EndElement();
     }
 
-    return fieldOverrides;
+    writer.EndElement();
 }
 
-void
-Structure::FreeFieldOverrides(PropertyOverrides **fieldOverrides) const
+OString
+Structure::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    if (fieldOverrides != NULL)
-        delete[] fieldOverrides;
+    return "[Structure]";
 }
 
-Logging::Node *
-Structure::ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+bool
+Structure::Compile(Program &prog, const CompileContext &ctx) const
 {
-    PropertyOverrides **fieldOverrides = GetFieldOverrides(start, propProv);
+    if (ctx.depth + 1 >= PROGRAM_MAX_DEPTH)
+        return false;
+
+    Instruction insn(OP_STRUCT, ctx);
+    insn.name = m_typeName;
+    prog.Emit(insn);
+
+    // Load the bound fields into slots up front
+    OVector<CompileContext::SlotMap>::Type fieldSlots(m_fields.size());
+
+    for (ResolvedBindingsVector::const_iterator it = m_resolvedBindings.begin(); it != m_resolvedBindings.end(); it++)
+    {
+        int slot = prog.AllocateSlot();
+        if (slot < 0)
+            return false;
+
+        CompileContext srcCtx(ctx);
+        srcCtx.offset = ctx.offset + it->srcOffset;
 
-    Logging::Element *structElement = new Logging::Element("value");
+        Instruction load((it->srcIsInteger) ? OP_LOAD : OP_LOAD_TEXT, srcCtx);
+        load.layout = it->srcLayout;
+        load.marshaller = it->srcMarshaller;
+        load.slot = slot;
+        prog.Emit(load);
 
-    structElement->AddField("type", "Struct");
-    structElement->AddField("subType", m_typeName);
+        fieldSlots[it->fieldIndex][it->propName] = slot;
+    }
 
     for (unsigned int i = 0; i < m_fields.size(); i++)
     {
         const StructureField *field = m_fields[i];
 
-        void *fieldPtr = reinterpret_cast<char *>(start) + field->GetOffset();
+        Instruction fieldInsn(OP_FIELD, ctx);
+        fieldInsn.name = field->GetName();
+        prog.Emit(fieldInsn);
 
-        Logging::Element *fieldElement = new Logging::Element("field");
-        structElement->AppendChild(fieldElement);
+        CompileContext fieldCtx;
+        fieldCtx.offset = ctx.offset + field->GetOffset();
+        fieldCtx.runtimeDeep = false;
+        fieldCtx.overrides = (fieldSlots[i].size() > 0) ? &fieldSlots[i] : NULL;
+        fieldCtx.depth = ctx.depth + 2;
 
-        fieldElement->AddField("name", field->GetName());
+        if (!field->GetMarshaller()->Compile(prog, fieldCtx))
+            return false;
 
-        PropertyOverrides *po = NULL;
-        if (fieldOverrides != NULL)
-        {
-            po = fieldOverrides[i];
-        }
+        prog.Emit(Instruction(OP_END, ctx));
+    }
 
-        Logging::Node *valueNode = field->GetMarshaller()->ToNode(fieldPtr, true, propProv, po);
+    prog.Emit(Instruction(OP_END, ctx));
 
-        if (po != NULL)
-            delete po;
+    return true;
+}
 
-        if (valueNode != NULL)
-            fieldElement->AppendChild(valueNode);
+unsigned int
+Structure::GetRawSize() const
+{
+    unsigned int size = m_size;
+
+    for (FieldsVector::const_iterator it = m_fields.begin(); it != m_fields.end(); it++)
+    {
+        unsigned int end = (*it)->GetOffset() + (*it)->GetMarshaller()->GetSize();
+        if (end > size)
+            size = end;
     }
 
-    FreeFieldOverrides(fieldOverrides);
+    return size;
+}
 
-    return structElement;
+bool
+Structure::IsRawInline() const
+{
+    // Inside arrays the elements are m_size bytes apart
+    if (GetRawSize() != m_size)
+        return false;
+
+    for (FieldsVector::const_iterator it = m_fields.begin(); it != m_fields.end(); it++)
+    {
+        if (!(*it)->GetMarshaller()->IsRawInline())
+            return false;
+    }
+
+    return true;
 }
 
-OString
-Structure::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+void
+Structure::DescribeRaw(RawTypeDescription &desc) const
 {
-    return "[Structure]";
+    desc.kind = RAW_KIND_STRUCT;
+    desc.name = m_typeName;
+    desc.size = GetRawSize();
+
+    if (IsRawInline())
+        desc.flags = RAW_TYPE_FLAG_INLINE;
+
+    for (FieldsVector::const_iterator it = m_fields.begin(); it != m_fields.end(); it++)
+    {
+        const StructureField *field = *it;
+        desc.fields.push_back(RawTypeField(field->GetName(), field->GetOffset(), field->GetMarshaller()->GetRawTypeId()));
+    }
+}
+
+void
+Structure::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.WriteTypeId(typeId);
+    writer.WriteBytes(start, GetRawSize());
+
+    for (unsigned int i = 0; i < m_fields.size(); i++)
+    {
+        const StructureField *field = m_fields[i];
+        const BaseMarshaller *marshaller = field->GetMarshaller();
+
+        if (marshaller->IsRawInline())
+            continue;
+
+        void *fieldPtr = reinterpret_cast<char *>(start) + field->GetOffset();
+
+        PropertyOverrides po;
+        if (m_resolvedBindings.size() > 0)
+            GetFieldOverrides(i, start, propProv, po);
+
+        marshaller->WriteRaw(writer, fieldPtr, true, propProv, (po.GetCount() > 0) ? &po : NULL);
+    }
+}
+
+ResolvedFieldBinding::ResolvedFieldBinding(unsigned int fieldIndex, const OString &propName, const StructureField *srcField)
+    : fieldIndex(fieldIndex),
+      propName(propName),
+      srcOffset(srcField->GetOffset()),
+      srcMarshaller(srcField->GetMarshaller())
+{
+    srcIsInteger = srcMarshaller->GetIntegerLayout(srcLayout);
+}
+
+void
+ResolvedFieldBinding::ReadPropertyValue(void *start, IPropertyProvider *propProv, PropertyOverrides &overrides) const
+{
+    void *p = reinterpret_cast<char *>(start) + srcOffset;
+
+    int intValue;
+    unsigned int uintValue;
+
+    if (srcIsInteger)
+    {
+        srcLayout.ReadPropertyValue(p, intValue, uintValue);
+    }
+    else
+    {
+        OString val = srcMarshaller->ToString(p, true, propProv);
+
+        char *endPtr = NULL;
+        intValue = strtol(val.c_str(), &endPtr, 0);
+        if (endPtr == val.c_str())
+            return;
+
+        uintValue = strtoul(val.c_str(), NULL, 0);
+    }
+
+    overrides.Add(propName, intValue, uintValue);
 }
 
 StructurePtr::StructurePtr(const char *firstFieldName, ...)
@@ -1178,16 +2001,35 @@ StructurePtr::StructurePtr(const char *firstFieldName, ...)
 OString
 Ipv4InAddr::ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
 {
-    OOStringStream ss;
+    char buf[4 * 4];
+    char *p = buf;
 
     const unsigned char *addr = reinterpret_cast<const unsigned char *>(start);
 
-    ss << (DWORD) addr[0] << "."
-       << (DWORD) addr[1] << "."
-       << (DWORD) addr[2] << "."
-       << (DWORD) addr[3];
+    for (int i = 0; i < 4; i++)
+    {
+        if (i > 0)
+            *p++ = '.';
+        p = Format::Decimal(p, static_cast<unsigned int>(addr[i]));
+    }
+
+    return OString(buf, p);
+}
+
+void
+Ipv4InAddr::DescribeRaw(RawTypeDescription &desc) const
+{
+    desc.kind = RAW_KIND_IPV4_ADDR;
+    desc.name = m_typeName;
+    desc.size = sizeof(DWORD);
+    desc.flags = RAW_TYPE_FLAG_INLINE;
+}
 
-    return ss.str();
+void
+Ipv4InAddr::CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const
+{
+    writer.WriteTypeId(typeId);
+    writer.WriteBytes(start, sizeof(DWORD));
 }
 
 } // namespace Marshaller
@@ -18,12 +18,79 @@
 #pragma once
 
 #include "Logging.h"
+#include "Writer.h"
+#include "CaptureBudget.h"
 
 namespace InterceptPP {
 
 #pragma warning (push)
 #pragma warning (disable: 4251)
 
+class RawTypeDescription;
+class RawWriter;
+
+namespace Marshaller {
+    class Program;
+    class CompileContext;
+}
+
+class INTERCEPTPP_API IPropertyResolver
+{
+public:
+    virtual bool ResolveArgument(const OString &name, unsigned int &index) const = 0;
+};
+
+typedef enum {
+    PROPERTY_QUERY_NONE = 0,
+    PROPERTY_QUERY_ARGUMENT_NAME,   // "arg.name" not looked up yet
+    PROPERTY_QUERY_ARGUMENT,
+    PROPERTY_QUERY_REGISTER,
+    PROPERTY_QUERY_OTHER,           // only the text is meaningful
+} PropertyQueryKind;
+
+typedef enum {
+    PROPERTY_REG_EAX = 0,
+    PROPERTY_REG_EBX,
+    PROPERTY_REG_ECX,
+    PROPERTY_REG_EDX,
+    PROPERTY_REG_EDI,
+    PROPERTY_REG_ESI,
+    PROPERTY_REG_EBP,
+    PROPERTY_REG_ESP,
+} PropertyRegister;
+
+//
+// A property binding like "arg.nCount" or "&reg.eax", parsed when it's set
+// and resolved to an argument index once the argument list it belongs to
+// is known, so that answering it doesn't involve any string comparisons.
+//
+class INTERCEPTPP_API PropertyQuery
+{
+public:
+    PropertyQuery()
+        : m_kind(PROPERTY_QUERY_NONE), m_wantAddressOf(false), m_index(0)
+    {}
+    explicit PropertyQuery(const OString &text);
+
+    bool IsSet() const { return m_kind != PROPERTY_QUERY_NONE; }
+    const OString &GetText() const { return m_text; }
+    PropertyQueryKind GetKind() const { return m_kind; }
+    bool GetWantAddressOf() const { return m_wantAddressOf; }
+
+    // Argument index or PropertyRegister, depending on the kind
+    unsigned int GetIndex() const { return m_index; }
+    const OString &GetArgumentName() const { return m_argName; }
+
+    void Resolve(const IPropertyResolver &resolver);
+
+protected:
+    OString m_text;
+    OString m_argName;
+    PropertyQueryKind m_kind;
+    bool m_wantAddressOf;
+    unsigned int m_index;
+};
+
 class INTERCEPTPP_API IPropertyProvider
 {
 public:
@@ -32,50 +99,114 @@ public:
     virtual bool QueryForProperty(const OString &query, void *&result) = 0;
     virtual bool QueryForProperty(const OString &query, va_list &result) = 0;
     virtual bool QueryForProperty(const OString &query, OString &result) = 0;
+
+    // Pre-parsed queries, providers that don't know better just use the text
+    virtual bool QueryForProperty(const PropertyQuery &query, int &result) { return QueryForProperty(query.GetText(), result); }
+    virtual bool QueryForProperty(const PropertyQuery &query, unsigned int &result) { return QueryForProperty(query.GetText(), result); }
+    virtual bool QueryForProperty(const PropertyQuery &query, void *&result) { return QueryForProperty(query.GetText(), result); }
+    virtual bool QueryForProperty(const PropertyQuery &query, va_list &result) { return QueryForProperty(query.GetText(), result); }
+    virtual bool QueryForProperty(const PropertyQuery &query, OString &result) { return QueryForProperty(query.GetText(), result); }
+
+    // The budget that buffers captured for this provider are charged to
+    virtual CaptureBudget *GetCaptureBudget() { return NULL; }
 };
 
-class INTERCEPTPP_API PropertyOverrides : public BaseObject
+//
+// How an integer field is laid out in memory, so that it can be read
+// directly without going through its marshaller.
+//
+class INTERCEPTPP_API IntegerLayout
 {
 public:
-    void Add(const OString &propName, const OString &value);
+    IntegerLayout()
+        : width(0), signExtend(false), sign(false), hex(false), byteSwap(false)
+    {}
+
+    int Read(const void *start) const;
+
+    // Same values as formatting with ToString() and parsing back with strtol()/strtoul()
+    void ReadPropertyValue(const void *start, int &intValue, unsigned int &uintValue) const;
+
+    unsigned int width;
+    bool signExtend;
+    bool sign;
+    bool hex;
+    bool byteSwap;
+};
+
+#define PROPERTY_OVERRIDES_MAX 8
+
+//
+// Property values bound to a structure field for the duration of one
+// ToNode() call.  Fixed size so that it lives on the stack, and the names
+// point into the structure's resolved bindings.
+//
+class INTERCEPTPP_API PropertyOverrides
+{
+public:
+    PropertyOverrides()
+        : m_count(0)
+    {}
+
+    void Add(const OString &propName, int intValue, unsigned int uintValue);
     bool Contains(const OString &propName) const;
-    bool GetValue(const OString &propName, OString &value) const;
     bool GetValue(const OString &propName, int &value) const;
     bool GetValue(const OString &propName, unsigned int &value) const;
 
+    unsigned int GetCount() const { return m_count; }
+
 protected:
-    typedef OMap<OString, OString>::Type OverridesMap;
-    OverridesMap m_overrides;
+    typedef struct {
+        const OString *name;
+        int intValue;
+        unsigned int uintValue;
+    } Entry;
+
+    Entry m_entries[PROPERTY_OVERRIDES_MAX];
+    unsigned int m_count;
+
+    const Entry *Find(const OString &propName) const;
 };
 
 class INTERCEPTPP_API BaseMarshaller : public BaseObject
 {
 public:
     BaseMarshaller(const OString &typeName);
+    BaseMarshaller(const BaseMarshaller &m);
     virtual ~BaseMarshaller() {};
 
     virtual BaseMarshaller *Clone() const { return NULL; }
 
     virtual bool SetProperty(const OString &name, const OString &value) { return false; }
 
-    bool HasPropertyBinding(const OString &propName) const;
-    const OString &GetPropertyBinding(const OString &propName) const;
-    void SetPropertyBinding(const OString &propName, const OString &value) { m_propBindings[propName] = value; }
-    void SetPropertyBindings(const char *firstPropName, ...);
+    // Look up the argument names referred to by property bindings
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver) {}
 
     virtual const OString &GetName() const { return m_typeName; }
     virtual unsigned int GetSize() const = 0;
+    // Writes the value as a "value" element, ToNode() builds a tree out of it
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const = 0;
     virtual bool ToInt(void *start, int &result) const { return false; }
     virtual bool ToUInt(void *start, unsigned int &result) const { return false; }
     virtual bool ToPointer(void *start, void *&result) const { return false; }
     virtual bool ToVaList(void *start, va_list &result) const { return false; }
+    virtual bool GetIntegerLayout(IntegerLayout &layout) const { return false; }
+
+    virtual bool Compile(Marshaller::Program &prog, const Marshaller::CompileContext &ctx) const;
+
+    unsigned short GetRawTypeId() const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+    virtual bool IsRawInline() const { return false; }
+    void WriteRaw(RawWriter &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
 
 protected:
     OString m_typeName;
-    typedef OMap<OString, OString>::Type PropBindingsMap;
-    PropBindingsMap m_propBindings;
+    mutable unsigned short m_rawTypeId;
+
+    bool CompileValue(Marshaller::Program &prog, const Marshaller::CompileContext &ctx) const;
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 namespace Marshaller {
@@ -111,18 +242,31 @@ public:
     virtual BaseMarshaller *Clone() const { return new Dynamic(*this); }
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver);
 
     virtual unsigned int GetSize() const { return m_fallback->GetSize(); }
-    virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
 protected:
-    OString m_nameBase;
+    PropertyQuery m_nameBase;
     OString m_nameSuffix;
     BaseMarshaller *m_fallback;
 
+    // Sub-marshallers created later on are resolved against this
+    const IPropertyResolver *m_resolver;
+
+    // Sub-marshallers are stateless, so we only create one per resolved type name
+    typedef OMap<OString, BaseMarshaller *>::Type MarshallerCache;
+    mutable MarshallerCache m_cache;
+    mutable CRITICAL_SECTION m_cacheLock;
+
     OString ToStringInternal(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides, OString *lastSubTypeName) const;
-    BaseMarshaller *CreateMarshaller(IPropertyProvider *propProv) const;
+    const BaseMarshaller *GetMarshaller(IPropertyProvider *propProv) const;
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API Pointer : public BaseMarshaller
@@ -135,16 +279,22 @@ public:
     virtual BaseMarshaller *Clone() const { return new Pointer(*this); }
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver) { if (m_type != NULL) m_type->ResolvePropertyQueries(resolver); }
 
     virtual unsigned int GetSize() const { return sizeof(void *); }
-    virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual bool ToInt(void *start, int &result) const;
     virtual bool ToUInt(void *start, unsigned int &result) const;
     virtual bool ToPointer(void *start, void *&result) const;
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
 protected:
     BaseMarshaller *m_type;
+
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API VaList : public BaseMarshaller
@@ -157,9 +307,11 @@ public:
     virtual BaseMarshaller *Clone() const { return new VaList(*this); }
 
     virtual unsigned int GetSize() const { return sizeof(va_list); }
-    virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual bool ToVaList(void *start, va_list &result) const;
+
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const { return CompileValue(prog, ctx); }
 };
 
 template <class T>
@@ -179,6 +331,11 @@ public:
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual bool ToInt(void *start, int &result) const;
     virtual bool ToUInt(void *start, unsigned int &result) const;
+    virtual bool GetIntegerLayout(IntegerLayout &layout) const;
+
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+    virtual bool IsRawInline() const { return true; }
 
     bool GetFormatHex() const { return m_hex; }
     void SetFormatHex(bool hex) { m_hex = hex; }
@@ -189,6 +346,8 @@ protected:
     bool m_hex;
 
     virtual T ToLittleEndian(T i) const { return i; }
+
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API UInt8 : public Integer<unsigned char>
@@ -322,16 +481,23 @@ public:
     virtual BaseMarshaller *Clone() const { return new Boolean(*this); }
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver) { m_marshaller->ResolvePropertyQueries(resolver); }
 
     virtual unsigned int GetSize() const { return m_marshaller->GetSize(); }
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual bool ToInt(void *start, int &result) const { return m_marshaller->ToInt(start, result); }
     virtual bool ToUInt(void *start, unsigned int &result) const { return m_marshaller->ToUInt(start, result); }
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const { return CompileValue(prog, ctx); }
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+    virtual bool IsRawInline() const { return true; }
+
 protected:
     BaseMarshaller *m_marshaller;
     OString m_trueStr;
     OString m_falseStr;
+
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API CPPBool : public Boolean
@@ -369,14 +535,25 @@ public:
     virtual BaseMarshaller *Clone() const { return new Array(*this); }
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver);
 
     virtual unsigned int GetSize() const;
-    virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
+    volatile LONG *GetSampleCounter() const { return &m_sampleCounter; }
+
 protected:
     BaseMarshaller *m_elType;
     unsigned int m_elCount;
+    PropertyQuery m_elCountBinding;
+    mutable volatile LONG m_sampleCounter;
+
+    unsigned int GetElementCount(IPropertyProvider *propProv, PropertyOverrides *overrides) const;
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API ArrayPtr : public Pointer
@@ -402,13 +579,24 @@ public:
     ByteArray(const OString &sizePropertyBinding);
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver) { m_sizeBinding.Resolve(resolver); }
 
     virtual unsigned int GetSize() const { return m_size; }
-    virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
+    volatile LONG *GetSampleCounter() const { return &m_sampleCounter; }
+
 protected:
     int m_size;
+    PropertyQuery m_sizeBinding;
+    mutable volatile LONG m_sampleCounter;
+
+    int GetByteCount(IPropertyProvider *propProv, PropertyOverrides *overrides) const;
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API ByteArrayPtr : public Pointer
@@ -434,6 +622,8 @@ public:
 
     virtual unsigned int GetSize() const { return m_elementSize * (m_length + 1); }
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const { return CompileValue(prog, ctx); }
+
 protected:
     unsigned int m_elementSize;
     int m_length;
@@ -447,6 +637,10 @@ public:
     {}
 
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
+protected:
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API AsciiStringPtr : public Pointer
@@ -465,8 +659,16 @@ public:
     {}
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver);
 
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
+protected:
+    PropertyQuery m_vaListBinding;
+    PropertyQuery m_vaStartBinding;
+
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API AsciiFormatStringPtr : public Pointer
@@ -485,6 +687,10 @@ public:
     {}
 
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
+protected:
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API UnicodeStringPtr : public Pointer
@@ -503,8 +709,16 @@ public:
     {}
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver);
 
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+
+protected:
+    PropertyQuery m_vaListBinding;
+    PropertyQuery m_vaStartBinding;
+
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API UnicodeFormatStringPtr : public Pointer
@@ -524,20 +738,27 @@ public:
     virtual BaseMarshaller *Clone() const { return new Enumeration(*this); }
 
     virtual bool SetProperty(const OString &name, const OString &value);
+    virtual void ResolvePropertyQueries(const IPropertyResolver &resolver) { m_marshaller->ResolvePropertyQueries(resolver); }
 
     bool AddMember(const OString &name, DWORD value);
     unsigned int GetMemberCount() const { return static_cast<unsigned int>(m_defs.size()); }
 
     virtual unsigned int GetSize() const { return m_marshaller->GetSize(); }
-    virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual bool ToInt(void *start, int &result) const { return m_marshaller->ToInt(start, result); }
     virtual bool ToUInt(void *start, unsigned int &result) const { return m_marshaller->ToUInt(start, result); }
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+    virtual bool IsRawInline() const { return true; }
+
 protected:
     OMap<DWORD, OString>::Type m_defs;
 
     BaseMarshaller *m_marshaller;
+
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API StructureField : public BaseObject
@@ -550,6 +771,7 @@ public:
     const OString &GetName() const { return m_name; }
     DWORD GetOffset() const { return m_offset; }
     const BaseMarshaller *GetMarshaller() const { return m_marshaller; }
+    BaseMarshaller *GetMarshaller() { return m_marshaller; }
 
 protected:
     OString m_name;
@@ -574,6 +796,25 @@ protected:
     OString m_srcFieldName;
 };
 
+//
+// A FieldTypePropertyBinding with the field names resolved to indexes,
+// and the source field to an IntegerLayout when it's an integer.
+//
+class INTERCEPTPP_API ResolvedFieldBinding
+{
+public:
+    ResolvedFieldBinding(unsigned int fieldIndex, const OString &propName, const StructureField *srcField);
+
+    void ReadPropertyValue(void *start, IPropertyProvider *propProv, PropertyOverrides &overrides) const;
+
+    unsigned int fieldIndex;
+    OString propName;
+    DWORD srcOffset;
+    const BaseMarshaller *srcMarshaller;
+    bool srcIsInteger;
+    IntegerLayout srcLayout;
+};
+
 class INTERCEPTPP_API Structure : public BaseMarshaller
 {
 public:
@@ -589,22 +830,30 @@ public:
     void BindFieldTypePropertyToField(const OString &fieldName, const OString &propName, const OString &srcFieldName);
 
     virtual unsigned int GetSize() const { return m_size; }
-    virtual Logging::Node *ToNode(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+    virtual void WriteValue(Logging::Writer &writer, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
 
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const;
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+    virtual bool IsRawInline() const;
+
 protected:
     typedef OVector<StructureField *>::Type FieldsVector;
     typedef OMap<OString, unsigned int>::Type FieldIndexesMap;
     typedef OVector<FieldTypePropertyBinding>::Type FieldBindingsVector;
+    typedef OVector<ResolvedFieldBinding>::Type ResolvedBindingsVector;
 
     unsigned int m_size;
     FieldsVector m_fields;
     FieldIndexesMap m_fieldIndexes;
     FieldBindingsVector m_bindings;
+    ResolvedBindingsVector m_resolvedBindings;
  
     void Initialize(const char *firstFieldName, va_list args);
-    PropertyOverrides **GetFieldOverrides(void *start, IPropertyProvider *propProv) const;
-    void FreeFieldOverrides(PropertyOverrides **fieldOverrides) const;
+    void ResolveBindings();
+    void GetFieldOverrides(unsigned int fieldIndex, void *start, IPropertyProvider *propProv, PropertyOverrides &overrides) const;
+    unsigned int GetRawSize() const;
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 class INTERCEPTPP_API StructurePtr : public Pointer
@@ -622,6 +871,13 @@ public:
 
     virtual unsigned int GetSize() const { return sizeof(DWORD); }
     virtual OString ToString(void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides=NULL) const;
+
+    virtual bool Compile(Program &prog, const CompileContext &ctx) const { return CompileValue(prog, ctx); }
+    virtual void DescribeRaw(RawTypeDescription &desc) const;
+    virtual bool IsRawInline() const { return true; }
+
+protected:
+    virtual void CaptureRaw(RawWriter &writer, unsigned short typeId, void *start, bool deep, IPropertyProvider *propProv, PropertyOverrides *overrides) const;
 };
 
 } // namespace Marshaller
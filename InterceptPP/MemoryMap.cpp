@@ -0,0 +1,320 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "MemoryMap.h"
+#ifndef _WIN32
+#include <stdio.h>
+#include <string.h>
+#endif
+
+namespace InterceptPP {
+
+MemoryMap *
+MemoryMap::Instance()
+{
+    static MemoryMap *map = NULL;
+
+    if (map == NULL)
+        map = new MemoryMap();
+
+    return map;
+}
+
+MemoryMap::MemoryMap()
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&m_cs);
+#else
+    pthread_mutex_init(&m_mutex, NULL);
+#endif
+}
+
+void
+MemoryMap::Lock()
+{
+#ifdef _WIN32
+    EnterCriticalSection(&m_cs);
+#else
+    pthread_mutex_lock(&m_mutex);
+#endif
+}
+
+void
+MemoryMap::Unlock()
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&m_cs);
+#else
+    pthread_mutex_unlock(&m_mutex);
+#endif
+}
+
+bool
+MemoryMap::IsReadable(const void *address, size_t size)
+{
+    return GetReadableSize(address, size) == size;
+}
+
+size_t
+MemoryMap::GetReadableSize(const void *address, size_t maxSize)
+{
+    size_t start = reinterpret_cast<size_t>(address);
+    size_t end = start + maxSize;
+    if (end < start)
+        end = static_cast<size_t>(-1);
+
+    if (start == end)
+        return 0;
+
+    Lock();
+
+    size_t result = 0;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        result = 0;
+
+        int i = FindLocked(start);
+        if (i < static_cast<int>(m_regions.size()) && m_regions[i].start <= start)
+        {
+            result = ((m_regions[i].end < end) ? m_regions[i].end : end) - start;
+        }
+
+        if (start + result == end || attempt == 1)
+            break;
+
+        // Not known to be readable, so ask the OS before saying no
+        QueryLocked(start + result, end);
+    }
+
+    Unlock();
+
+    return result;
+}
+
+void
+MemoryMap::Invalidate(const void *address, size_t size)
+{
+    size_t start = reinterpret_cast<size_t>(address);
+    size_t end = start + size;
+    if (end < start)
+        end = static_cast<size_t>(-1);
+
+    Lock();
+
+    if (size == 0)
+    {
+        int i = FindLocked(start);
+        if (i < static_cast<int>(m_regions.size()) && m_regions[i].start <= start)
+        {
+            start = m_regions[i].start;
+            end = m_regions[i].end;
+        }
+    }
+
+    if (start < end)
+        QueryLocked(start, end);
+
+    Unlock();
+}
+
+void
+MemoryMap::Refresh()
+{
+    Lock();
+
+    m_regions.clear();
+    QueryLocked(0, static_cast<size_t>(-1));
+
+    Unlock();
+}
+
+unsigned int
+MemoryMap::GetRegionCount()
+{
+    Lock();
+    unsigned int count = static_cast<unsigned int>(m_regions.size());
+    Unlock();
+
+    return count;
+}
+
+//
+// Returns the index of the first region ending after address, which is the
+// one containing it if any.
+//
+int
+MemoryMap::FindLocked(size_t address)
+{
+    int low = 0;
+    int high = static_cast<int>(m_regions.size());
+
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if (m_regions[mid].end <= address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+void
+MemoryMap::AddLocked(const MemoryRegion &region)
+{
+    if (region.start >= region.end)
+        return;
+
+    // Merge with every region overlapping or touching the new one
+    int first = (region.start > 0) ? FindLocked(region.start - 1) : 0;
+    int last = first;
+
+    MemoryRegion merged = region;
+
+    while (last < static_cast<int>(m_regions.size()) && m_regions[last].start <= region.end)
+    {
+        if (m_regions[last].start < merged.start)
+            merged.start = m_regions[last].start;
+        if (m_regions[last].end > merged.end)
+            merged.end = m_regions[last].end;
+
+        last++;
+    }
+
+    m_regions.erase(m_regions.begin() + first, m_regions.begin() + last);
+    m_regions.insert(m_regions.begin() + first, merged);
+}
+
+void
+MemoryMap::RemoveLocked(size_t start, size_t end)
+{
+    int first = FindLocked(start);
+    int last = first;
+
+    while (last < static_cast<int>(m_regions.size()) && m_regions[last].start < end)
+        last++;
+
+    if (first == last)
+        return;
+
+    MemoryRegion head, tail;
+    head.start = m_regions[first].start;
+    head.end = start;
+    tail.start = end;
+    tail.end = m_regions[last - 1].end;
+
+    m_regions.erase(m_regions.begin() + first, m_regions.begin() + last);
+
+    if (tail.start < tail.end)
+        m_regions.insert(m_regions.begin() + first, tail);
+    if (head.start < head.end)
+        m_regions.insert(m_regions.begin() + first, head);
+}
+
+void
+MemoryMap::QueryLocked(size_t start, size_t end)
+{
+    MemoryRegionList regions;
+    QueryReadableRegions(start, end, regions);
+
+    RemoveLocked(start, end);
+
+    for (unsigned int i = 0; i < regions.size(); i++)
+        AddLocked(regions[i]);
+}
+
+#ifdef _WIN32
+
+#define PAGE_READABLE_MASK (PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY | \
+                            PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+
+void
+MemoryMap::QueryReadableRegions(size_t start, size_t end, MemoryRegionList &regions)
+{
+    size_t address = start;
+
+    while (address < end)
+    {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (VirtualQuery(reinterpret_cast<LPCVOID>(address), &mbi, sizeof(mbi)) != sizeof(mbi))
+            break;
+
+        MemoryRegion region;
+        region.start = reinterpret_cast<size_t>(mbi.BaseAddress);
+        region.end = region.start + mbi.RegionSize;
+        if (region.end <= address)
+            break;
+
+        if (mbi.State == MEM_COMMIT &&
+            (mbi.Protect & (PAGE_GUARD | PAGE_NOACCESS)) == 0 &&
+            (mbi.Protect & PAGE_READABLE_MASK) != 0)
+        {
+            regions.push_back(region);
+        }
+
+        address = region.end;
+    }
+}
+
+#else
+
+void
+MemoryMap::QueryReadableRegions(size_t start, size_t end, MemoryRegionList &regions)
+{
+    FILE *f = fopen("/proc/self/maps", "r");
+    if (f == NULL)
+        return;
+
+    char line[512];
+    bool lineStart = true;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        bool parse = lineStart;
+        lineStart = (strchr(line, '\n') != NULL);
+        if (!parse)
+            continue;
+
+        unsigned long low, high;
+        char perms[5];
+        if (sscanf(line, "%lx-%lx %4s", &low, &high, perms) != 3)
+            continue;
+
+        if (high <= start)
+            continue;
+        if (low >= end)
+            break;
+
+        if (perms[0] == 'r')
+        {
+            MemoryRegion region;
+            region.start = low;
+            region.end = high;
+            regions.push_back(region);
+        }
+    }
+
+    fclose(f);
+}
+
+#endif
+
+} // namespace InterceptPP
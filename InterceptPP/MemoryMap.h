@@ -0,0 +1,118 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <pthread.h>
+#include <stddef.h>
+#include <vector>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Cached map of the readable parts of the address space, answering
+// "is [p, p + n) readable" with a binary search instead of probing with
+// IsBadReadPtr(), which takes an access violation for every bad pointer
+// and can swallow the guard page of another thread's stack.
+//
+// The map only holds regions that were readable when last queried, merged
+// into disjoint sorted ranges.  A lookup that misses queries the address
+// again before answering no, so fresh allocations are picked up lazily.
+// Frees have to be reported through Invalidate() so that cached ranges
+// don't outlive the memory behind them; Util does this for module loads
+// and unloads, VirtualFree() and UnmapViewOfFile().  Protection changes
+// aren't tracked, as the engine itself calls VirtualProtect() for every
+// call it intercepts.
+//
+// A "no" is therefore reliable but a "yes" may be stale: heap decommits go
+// through ntdll without ever reaching VirtualFree(), and a free is only
+// reported once it has returned.  Use the map to skip pointers cheaply,
+// and still guard the reads it lets through (see Util::WriteBacktrace()).
+//
+// The Win32 backend uses VirtualQuery(), elsewhere /proc/self/maps is
+// parsed so that the lookup logic can be tested on Linux.
+//
+
+typedef struct {
+    size_t start;
+    size_t end;     // exclusive
+} MemoryRegion;
+
+#ifdef _WIN32
+typedef OVector<MemoryRegion>::Type MemoryRegionList;
+#else
+typedef std::vector<MemoryRegion> MemoryRegionList;
+#endif
+
+class INTERCEPTPP_API MemoryMap
+#ifdef _WIN32
+    : public BaseObject
+#endif
+{
+public:
+    static MemoryMap *Instance();
+
+    bool IsReadable(const void *address, size_t size);
+
+    // Number of bytes readable from address onwards, at most maxSize
+    size_t GetReadableSize(const void *address, size_t maxSize);
+
+    // Drop everything cached for [address, address + size) and query it
+    // again.  A size of zero means the cached range containing address.
+    void Invalidate(const void *address, size_t size);
+
+    // Rescan the whole address space
+    void Refresh();
+
+    unsigned int GetRegionCount();
+
+protected:
+    MemoryMap();
+
+    void Lock();
+    void Unlock();
+
+    int FindLocked(size_t address);
+    void AddLocked(const MemoryRegion &region);
+    void RemoveLocked(size_t start, size_t end);
+    void QueryLocked(size_t start, size_t end);
+
+    static void QueryReadableRegions(size_t start, size_t end, MemoryRegionList &regions);
+
+#ifdef _WIN32
+    CRITICAL_SECTION m_cs;
+#else
+    pthread_mutex_t m_mutex;
+#endif
+
+    MemoryRegionList m_regions;
+};
+
+#pragma warning (pop)
+
+} // namespace InterceptPP
@@ -0,0 +1,250 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "PayloadTable.h"
+#include "Format.h"
+
+namespace InterceptPP {
+
+#define PAYLOAD_HASH_SEED 0x9747b28c
+
+volatile unsigned int PayloadTable::m_threshold = 0;
+volatile unsigned int PayloadTable::m_maxTableBytes = 16 * 1024 * 1024;
+
+PayloadTable *
+PayloadTable::Instance()
+{
+    static PayloadTable *table = NULL;
+
+    if (table == NULL)
+        table = new PayloadTable();
+
+    return table;
+}
+
+PayloadTable::PayloadTable()
+    : m_nextId(1)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    InitializeCriticalSection(&m_lock);
+}
+
+PayloadTable::~PayloadTable()
+{
+    DeleteCriticalSection(&m_lock);
+}
+
+PayloadDisposition
+PayloadTable::Lookup(const void *payload, unsigned int size, unsigned int &id)
+{
+    unsigned int threshold = m_threshold;
+    if (threshold == 0 || size < threshold)
+        return PAYLOAD_INLINE;
+
+    unsigned __int64 hash = Hash(payload, size);
+
+    PayloadDisposition result = PAYLOAD_INLINE;
+
+    EnterCriticalSection(&m_lock);
+
+    m_stats.payloads++;
+    m_stats.payloadBytes += size;
+
+    EntryMap::const_iterator iter = m_entries.find(hash);
+    if (iter != m_entries.end())
+    {
+        // A collision just means that this one doesn't get deduplicated,
+        // and so does a first record that isn't in the log yet
+        if (iter->second.logged && iter->second.data.size() == size && memcmp(iter->second.data.data(), payload, size) == 0)
+        {
+            id = iter->second.id;
+            result = PAYLOAD_DUPLICATE;
+
+            m_stats.duplicates++;
+            m_stats.duplicateBytes += size;
+        }
+    }
+    else if (m_stats.tableBytes <= m_maxTableBytes && size <= m_maxTableBytes - m_stats.tableBytes)
+    {
+        Entry &entry = m_entries[hash];
+        entry.id = m_nextId++;
+        entry.logged = false;
+        entry.data.assign(static_cast<const char *>(payload), size);
+        m_ids[entry.id] = hash;
+
+        id = entry.id;
+        result = PAYLOAD_FIRST;
+
+        m_stats.tableEntries++;
+        m_stats.tableBytes += size;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return result;
+}
+
+void
+PayloadTable::Commit(const unsigned int *ids, unsigned int count)
+{
+    EnterCriticalSection(&m_lock);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        IdMap::const_iterator iter = m_ids.find(ids[i]);
+        if (iter != m_ids.end())
+            m_entries[iter->second].logged = true;
+    }
+
+    LeaveCriticalSection(&m_lock);
+}
+
+void
+PayloadTable::Discard(const unsigned int *ids, unsigned int count)
+{
+    EnterCriticalSection(&m_lock);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        IdMap::iterator iter = m_ids.find(ids[i]);
+        if (iter == m_ids.end())
+            continue;
+
+        EntryMap::iterator entry = m_entries.find(iter->second);
+        if (entry->second.logged)
+            continue;
+
+        m_stats.tableEntries--;
+        m_stats.tableBytes -= static_cast<unsigned int>(entry->second.data.size());
+        m_entries.erase(entry);
+        m_ids.erase(iter);
+    }
+
+    LeaveCriticalSection(&m_lock);
+}
+
+bool
+PayloadTable::GetPayload(unsigned int id, OString &payload)
+{
+    bool found = false;
+
+    EnterCriticalSection(&m_lock);
+
+    IdMap::const_iterator iter = m_ids.find(id);
+    if (iter != m_ids.end())
+    {
+        const Entry &entry = m_entries[iter->second];
+        if (entry.logged)
+        {
+            payload = entry.data;
+            found = true;
+        }
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    return found;
+}
+
+unsigned __int64
+PayloadTable::Hash(const void *data, unsigned int size)
+{
+    const unsigned int m = 0x5bd1e995;
+    const int r = 24;
+
+    unsigned int h1 = PAYLOAD_HASH_SEED ^ size;
+    unsigned int h2 = 0;
+
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    unsigned int k1, k2;
+
+    while (size >= 8)
+    {
+        memcpy(&k1, p, sizeof(k1));
+        k1 *= m; k1 ^= k1 >> r; k1 *= m;
+        h1 *= m; h1 ^= k1;
+
+        memcpy(&k2, p + 4, sizeof(k2));
+        k2 *= m; k2 ^= k2 >> r; k2 *= m;
+        h2 *= m; h2 ^= k2;
+
+        p += 8;
+        size -= 8;
+    }
+
+    if (size >= 4)
+    {
+        memcpy(&k1, p, sizeof(k1));
+        k1 *= m; k1 ^= k1 >> r; k1 *= m;
+        h1 *= m; h1 ^= k1;
+
+        p += 4;
+        size -= 4;
+    }
+
+    switch (size)
+    {
+        case 3: h2 ^= p[2] << 16;
+        case 2: h2 ^= p[1] << 8;
+        case 1: h2 ^= p[0];
+                h2 *= m;
+    }
+
+    h1 ^= h2 >> 18; h1 *= m;
+    h2 ^= h1 >> 22; h2 *= m;
+    h1 ^= h2 >> 17; h1 *= m;
+    h2 ^= h1 >> 19; h2 *= m;
+
+    return (static_cast<unsigned __int64>(h1) << 32) | h2;
+}
+
+void
+PayloadTable::GetStats(PayloadTableStats &stats)
+{
+    EnterCriticalSection(&m_lock);
+    stats = m_stats;
+    LeaveCriticalSection(&m_lock);
+}
+
+void
+PayloadTable::AppendStatsToElement(Logging::Element *el)
+{
+    PayloadTableStats stats;
+    GetStats(stats);
+
+    Logging::Element *payloadsEl = new Logging::Element("payloads");
+    payloadsEl->AddField("payloads", stats.payloads);
+    payloadsEl->AddField("payloadBytes", stats.payloadBytes);
+    payloadsEl->AddField("duplicates", stats.duplicates);
+    payloadsEl->AddField("duplicateBytes", stats.duplicateBytes);
+    payloadsEl->AddField("tableEntries", stats.tableEntries);
+    payloadsEl->AddField("tableBytes", stats.tableBytes);
+
+    // Bytes looked up per byte written, with two decimals
+    unsigned __int64 written = stats.payloadBytes - stats.duplicateBytes;
+    unsigned __int64 ratio = (written != 0) ? (stats.payloadBytes * 100) / written : 100;
+    char buf[FORMAT_MAX_LENGTH];
+    OString ratioStr(buf, Format::Decimal(buf, ratio / 100));
+    ratioStr += (ratio % 100 < 10) ? ".0" : ".";
+    ratioStr.append(buf, Format::Decimal(buf, static_cast<unsigned int>(ratio % 100)));
+    payloadsEl->AddField("dedupRatio", ratioStr);
+
+    el->AppendChild(payloadsEl);
+}
+
+} // namespace InterceptPP
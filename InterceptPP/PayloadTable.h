@@ -0,0 +1,117 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "InterceptPP.h"
+#include "Logging.h"
+
+namespace InterceptPP {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Content-addressed store for the raw payloads (DataNode contents) that
+// end up in the log.  Applications tend to send the same buffers over and
+// over, so a logger looks up every payload of at least threshold bytes
+// before writing it out:
+//
+//   PAYLOAD_FIRST      write it in full, tagged with payloadId="N"
+//   PAYLOAD_DUPLICATE  write it without content, tagged with payloadRef="N"
+//   PAYLOAD_INLINE     write it as-is
+//
+// Readers expand the references, see oSpy.SharpDumpLib/PayloadTable.cs.
+//
+// A payload only gets referenced once the record that carries it in full
+// made it into the log: the writer Commit()s the ids it got PAYLOAD_FIRST
+// for after the logger took the record, or Discard()s them if it dropped
+// or summarized it.  Until then lookups of it give PAYLOAD_INLINE.
+//
+// Payloads are hashed with MurmurHash64B, which is quick on 32-bit x86,
+// and a copy of each is kept around so that a hash collision can't turn
+// into a wrong reference.  Once maxTableBytes worth of payloads are in the
+// table new ones are written inline, the ones already in it keep being
+// deduplicated.  A threshold of zero turns it off, which is the default.
+//
+
+typedef enum {
+    PAYLOAD_INLINE = 0,
+    PAYLOAD_FIRST,
+    PAYLOAD_DUPLICATE,
+} PayloadDisposition;
+
+typedef struct {
+    unsigned __int64 payloads;          // looked up, i.e. at least threshold bytes
+    unsigned __int64 payloadBytes;
+    unsigned __int64 duplicates;
+    unsigned __int64 duplicateBytes;
+    unsigned int tableEntries;
+    unsigned int tableBytes;
+} PayloadTableStats;
+
+class INTERCEPTPP_API PayloadTable : public BaseObject
+{
+public:
+    static PayloadTable *Instance();
+
+    PayloadTable();
+    ~PayloadTable();
+
+    static unsigned int GetThreshold() { return m_threshold; }
+    static void SetThreshold(unsigned int size) { m_threshold = size; }
+    static unsigned int GetMaxTableBytes() { return m_maxTableBytes; }
+    static void SetMaxTableBytes(unsigned int size) { m_maxTableBytes = size; }
+
+    // id is only set for PAYLOAD_FIRST and PAYLOAD_DUPLICATE
+    PayloadDisposition Lookup(const void *payload, unsigned int size, unsigned int &id);
+    PayloadDisposition Lookup(const OString &payload, unsigned int &id) { return Lookup(payload.data(), static_cast<unsigned int>(payload.size()), id); }
+    void Commit(const unsigned int *ids, unsigned int count);
+    void Discard(const unsigned int *ids, unsigned int count);
+
+    // Of one that made it into the log, for a logger to write it in full
+    // again where what came before can't be relied upon
+    bool GetPayload(unsigned int id, OString &payload);
+
+    static unsigned __int64 Hash(const void *data, unsigned int size);
+
+    void GetStats(PayloadTableStats &stats);
+    void AppendStatsToElement(Logging::Element *el);
+
+protected:
+    typedef struct {
+        unsigned int id;
+        bool logged;
+        OString data;
+    } Entry;
+
+    typedef OMap<unsigned __int64, Entry>::Type EntryMap;
+    typedef OMap<unsigned int, unsigned __int64>::Type IdMap;
+    EntryMap m_entries;
+    IdMap m_ids;
+    unsigned int m_nextId;
+    PayloadTableStats m_stats;
+    CRITICAL_SECTION m_lock;
+
+    static volatile unsigned int m_threshold;
+    static volatile unsigned int m_maxTableBytes;
+};
+
+#pragma warning (pop)
+
+} // namespace InterceptPP
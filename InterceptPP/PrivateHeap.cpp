@@ -0,0 +1,761 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "PrivateHeap.h"
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+namespace InterceptPP {
+
+typedef struct {
+    unsigned short sizeClass;
+    unsigned short tag;
+    size_t size;
+} BlockHeader;
+
+#define LARGE_BLOCK     0xFFFF  // sizeClass of large blocks
+#define UNTRACKED       0xFFFF  // tag of blocks allocated with accounting off
+#define LARGE_STATS     PRIVATE_HEAP_CLASS_COUNT
+
+// Free blocks are linked through their first bytes
+typedef struct {
+    void *head;
+    unsigned int count;
+} FreeList;
+
+// Counted by the thread since it last folded them into heapStats
+typedef struct {
+    ptrdiff_t bytes[PRIVATE_HEAP_TAG_COUNT];
+    size_t allocatedBytes[PRIVATE_HEAP_TAG_COUNT];
+    unsigned int allocations[PRIVATE_HEAP_TAG_COUNT];
+    unsigned int classAllocations[PRIVATE_HEAP_CLASS_COUNT + 1];
+    unsigned int classFrees[PRIVATE_HEAP_CLASS_COUNT + 1];
+    unsigned int operations;
+} PendingStats;
+
+typedef struct ThreadCacheTag {
+    FreeList lists[PRIVATE_HEAP_CLASS_COUNT];
+    unsigned int tag;
+    PendingStats pending;
+#ifdef _WIN32
+    HANDLE thread;
+    struct ThreadCacheTag *next;
+#endif
+} ThreadCache;
+
+typedef volatile long SpinLock;
+
+typedef struct {
+    SpinLock lock;
+    void *head;
+    char *spanPos;
+    char *spanEnd;
+} CentralList;
+
+static CentralList centralLists[PRIVATE_HEAP_CLASS_COUNT];
+
+static PrivateHeapStats heapStats;
+static SpinLock statsLock = 0;
+
+volatile bool PrivateHeap::m_accounting = true;
+
+static void ReleaseCache(ThreadCache *cache);
+
+//
+// The few things that differ between Win32 and the rest
+//
+
+#ifdef _WIN32
+
+static inline void
+AcquireLock(SpinLock *lock)
+{
+    while (InterlockedCompareExchange(lock, 1, 0) != 0)
+        Sleep(0);
+}
+
+static inline void
+ReleaseLock(SpinLock *lock)
+{
+    InterlockedExchange(lock, 0);
+}
+
+static void *
+ReservePages(size_t size)
+{
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static void
+ReleasePages(void *p, size_t size)
+{
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+static DWORD
+GetTlsIndex()
+{
+    static volatile LONG tlsIdx = static_cast<LONG>(TLS_OUT_OF_INDEXES);
+
+    if (tlsIdx == static_cast<LONG>(TLS_OUT_OF_INDEXES))
+    {
+        DWORD newIdx = TlsAlloc();
+        if (InterlockedCompareExchange(&tlsIdx, static_cast<LONG>(newIdx), static_cast<LONG>(TLS_OUT_OF_INDEXES))
+            != static_cast<LONG>(TLS_OUT_OF_INDEXES))
+        {
+            TlsFree(newIdx);
+        }
+    }
+
+    return static_cast<DWORD>(tlsIdx);
+}
+
+static inline ThreadCache *
+GetCurrentCache()
+{
+    return static_cast<ThreadCache *>(TlsGetValue(GetTlsIndex()));
+}
+
+static inline void
+SetCurrentCache(ThreadCache *cache)
+{
+    TlsSetValue(GetTlsIndex(), cache);
+}
+
+//
+// There's no telling when a thread exits without DLL_THREAD_DETACH, which
+// the agent turns off, so every cache is kept on a list along with a
+// handle to its thread, and the ones whose thread is gone are handed back
+// whenever a new one is added.
+//
+
+static ThreadCache *registeredCaches = NULL;
+static SpinLock registeredCachesLock = 0;
+
+static void
+RegisterCache(ThreadCache *cache)
+{
+    cache->thread = OpenThread(SYNCHRONIZE, FALSE, GetCurrentThreadId());
+
+    AcquireLock(&registeredCachesLock);
+
+    ThreadCache **link = &registeredCaches;
+    while (*link != NULL)
+    {
+        ThreadCache *cur = *link;
+
+        if (cur->thread != NULL && WaitForSingleObject(cur->thread, 0) == WAIT_OBJECT_0)
+        {
+            *link = cur->next;
+            ReleaseCache(cur);
+        }
+        else
+        {
+            link = &cur->next;
+        }
+    }
+
+    cache->next = registeredCaches;
+    registeredCaches = cache;
+
+    ReleaseLock(&registeredCachesLock);
+}
+
+static void
+UnregisterCache(ThreadCache *cache)
+{
+    AcquireLock(&registeredCachesLock);
+
+    for (ThreadCache **link = &registeredCaches; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == cache)
+        {
+            *link = cache->next;
+            break;
+        }
+    }
+
+    ReleaseLock(&registeredCachesLock);
+}
+
+#else
+
+static inline void
+AcquireLock(SpinLock *lock)
+{
+    while (__sync_val_compare_and_swap(lock, 0, 1) != 0)
+        sched_yield();
+}
+
+static inline void
+ReleaseLock(SpinLock *lock)
+{
+    __sync_lock_release(lock);
+}
+
+static void *
+ReservePages(size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (p != MAP_FAILED) ? p : NULL;
+}
+
+static void
+ReleasePages(void *p, size_t size)
+{
+    munmap(p, size);
+}
+
+static __thread ThreadCache *currentCache = NULL;
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+OnThreadExit(void *cache)
+{
+    currentCache = NULL;
+    ReleaseCache(static_cast<ThreadCache *>(cache));
+}
+
+static void
+CreateCacheKey()
+{
+    pthread_key_create(&cacheKey, OnThreadExit);
+}
+
+static inline ThreadCache *
+GetCurrentCache()
+{
+    return currentCache;
+}
+
+static inline void
+SetCurrentCache(ThreadCache *cache)
+{
+    currentCache = cache;
+}
+
+static void
+RegisterCache(ThreadCache *cache)
+{
+    pthread_once(&cacheKeyOnce, CreateCacheKey);
+    pthread_setspecific(cacheKey, cache);
+}
+
+static void
+UnregisterCache(ThreadCache *cache)
+{
+    pthread_setspecific(cacheKey, NULL);
+}
+
+#endif
+
+//
+// Size classes
+//
+
+static inline size_t
+RoundUp(size_t size, size_t granularity)
+{
+    return (size + granularity - 1) & ~(granularity - 1);
+}
+
+static inline size_t
+GetSpanSize(size_t classSize)
+{
+    // Big enough for a few blocks of the largest classes
+    size_t size = RoundUp(classSize * 8, PRIVATE_HEAP_SPAN_SIZE);
+    return (size > PRIVATE_HEAP_SPAN_SIZE) ? size : PRIVATE_HEAP_SPAN_SIZE;
+}
+
+static inline unsigned int
+GetCacheLimit(size_t classSize)
+{
+    unsigned int limit = static_cast<unsigned int>(PRIVATE_HEAP_CACHE_SIZE / classSize);
+    return (limit > 2) ? limit : 2;
+}
+
+static inline void *&
+NextBlock(void *block)
+{
+    return *static_cast<void **>(block);
+}
+
+static inline void
+PushBlock(FreeList &list, void *block)
+{
+    NextBlock(block) = list.head;
+    list.head = block;
+    list.count++;
+}
+
+//
+// Accounting
+//
+
+static inline void
+UpdatePeak(PrivateHeapTagStats &stats)
+{
+    // Frees may be folded before the allocations they match, which makes
+    // liveBytes wrap around for a while
+    if ((stats.liveBytes >> 63) == 0 && stats.liveBytes > stats.peakBytes)
+        stats.peakBytes = stats.liveBytes;
+}
+
+static void
+FoldStats(PendingStats &pending)
+{
+    AcquireLock(&statsLock);
+
+    for (unsigned int i = 0; i < PRIVATE_HEAP_TAG_COUNT; i++)
+    {
+        if (pending.bytes[i] == 0 && pending.allocations[i] == 0)
+            continue;
+
+        PrivateHeapTagStats &tag = heapStats.tags[i];
+        tag.liveBytes += pending.bytes[i];
+        tag.allocatedBytes += pending.allocatedBytes[i];
+        tag.allocations += pending.allocations[i];
+        UpdatePeak(tag);
+
+        heapStats.total.liveBytes += pending.bytes[i];
+        heapStats.total.allocatedBytes += pending.allocatedBytes[i];
+        heapStats.total.allocations += pending.allocations[i];
+    }
+
+    UpdatePeak(heapStats.total);
+
+    for (unsigned int i = 0; i <= PRIVATE_HEAP_CLASS_COUNT; i++)
+    {
+        heapStats.classes[i].allocations += pending.classAllocations[i];
+        heapStats.classes[i].frees += pending.classFrees[i];
+    }
+
+    ReleaseLock(&statsLock);
+
+    memset(&pending, 0, sizeof(pending));
+}
+
+static inline void
+CountAllocation(ThreadCache *cache, BlockHeader *header, unsigned int statsClass, size_t bytes)
+{
+    if (cache == NULL || !PrivateHeap::GetAccounting())
+    {
+        header->tag = UNTRACKED;
+        return;
+    }
+
+    unsigned int tag = cache->tag;
+    header->tag = static_cast<unsigned short>(tag);
+
+    PendingStats &pending = cache->pending;
+    pending.bytes[tag] += static_cast<ptrdiff_t>(bytes);
+    pending.allocatedBytes[tag] += bytes;
+    pending.allocations[tag]++;
+    pending.classAllocations[statsClass]++;
+
+    if (++pending.operations >= PRIVATE_HEAP_STATS_BATCH || pending.bytes[tag] >= PRIVATE_HEAP_STATS_SLACK)
+        FoldStats(pending);
+}
+
+static inline void
+CountFree(ThreadCache *cache, const BlockHeader *header, unsigned int statsClass, size_t bytes)
+{
+    unsigned int tag = header->tag;
+    if (tag == UNTRACKED)
+        return;
+
+    if (cache == NULL)
+    {
+        PendingStats pending;
+        memset(&pending, 0, sizeof(pending));
+        pending.bytes[tag] = -static_cast<ptrdiff_t>(bytes);
+        pending.classFrees[statsClass] = 1;
+        FoldStats(pending);
+        return;
+    }
+
+    PendingStats &pending = cache->pending;
+    pending.bytes[tag] -= static_cast<ptrdiff_t>(bytes);
+    pending.classFrees[statsClass]++;
+
+    if (++pending.operations >= PRIVATE_HEAP_STATS_BATCH || pending.bytes[tag] <= -PRIVATE_HEAP_STATS_SLACK)
+        FoldStats(pending);
+}
+
+static void
+CountReserved(size_t bytes, bool released)
+{
+    AcquireLock(&statsLock);
+
+    if (!released)
+        heapStats.reservedBytes += bytes;
+    else
+        heapStats.reservedBytes -= bytes;
+
+    ReleaseLock(&statsLock);
+}
+
+//
+// The shared lists
+//
+
+static unsigned int
+FetchBlocks(unsigned int sizeClass, FreeList &list, unsigned int count)
+{
+    CentralList &central = centralLists[sizeClass];
+    size_t classSize = PrivateHeap::GetClassSize(sizeClass);
+    unsigned int fetched = 0;
+
+    AcquireLock(&central.lock);
+
+    while (fetched < count && central.head != NULL)
+    {
+        void *block = central.head;
+        central.head = NextBlock(block);
+        PushBlock(list, block);
+        fetched++;
+    }
+
+    while (fetched < count)
+    {
+        if (static_cast<size_t>(central.spanEnd - central.spanPos) < classSize)
+        {
+            size_t spanSize = GetSpanSize(classSize);
+            char *span = static_cast<char *>(ReservePages(spanSize));
+            if (span == NULL)
+                break;
+
+            CountReserved(spanSize, false);
+
+            central.spanPos = span;
+            central.spanEnd = span + spanSize;
+        }
+
+        PushBlock(list, central.spanPos);
+        central.spanPos += classSize;
+        fetched++;
+    }
+
+    ReleaseLock(&central.lock);
+
+    return fetched;
+}
+
+static void
+ReturnBlocks(unsigned int sizeClass, FreeList &list, unsigned int count)
+{
+    if (count == 0)
+        return;
+
+    // Unlink them first, so that the lock is only held for the splice
+    void *first = list.head;
+    void *last = first;
+    for (unsigned int i = 1; i < count; i++)
+        last = NextBlock(last);
+
+    list.head = NextBlock(last);
+    list.count -= count;
+
+    CentralList &central = centralLists[sizeClass];
+
+    AcquireLock(&central.lock);
+    NextBlock(last) = central.head;
+    central.head = first;
+    ReleaseLock(&central.lock);
+}
+
+static ThreadCache *
+CreateCache()
+{
+    unsigned int sizeClass = PrivateHeap::GetSizeClass(sizeof(ThreadCache));
+
+    FreeList list = { NULL, 0 };
+    if (FetchBlocks(sizeClass, list, 1) == 0)
+        return NULL;
+
+    ThreadCache *cache = static_cast<ThreadCache *>(list.head);
+    memset(cache, 0, sizeof(ThreadCache));
+
+    // Before registering it, as that might end up allocating
+    SetCurrentCache(cache);
+    RegisterCache(cache);
+
+    return cache;
+}
+
+static void
+ReleaseCache(ThreadCache *cache)
+{
+    FoldStats(cache->pending);
+
+    for (unsigned int i = 0; i < PRIVATE_HEAP_CLASS_COUNT; i++)
+        ReturnBlocks(i, cache->lists[i], cache->lists[i].count);
+
+#ifdef _WIN32
+    if (cache->thread != NULL)
+        CloseHandle(cache->thread);
+#endif
+
+    FreeList list = { NULL, 0 };
+    PushBlock(list, cache);
+    ReturnBlocks(PrivateHeap::GetSizeClass(sizeof(ThreadCache)), list, 1);
+}
+
+static inline size_t
+GetLargeBlockBytes(size_t size)
+{
+    return RoundUp(size + sizeof(BlockHeader), PRIVATE_HEAP_SPAN_SIZE);
+}
+
+unsigned int
+PrivateHeap::GetSizeClass(size_t size)
+{
+    if (size <= 128)
+        return (size != 0) ? static_cast<unsigned int>((size - 1) / 16) : 0;
+    else if (size > PRIVATE_HEAP_MAX_SMALL_SIZE)
+        return PRIVATE_HEAP_LARGE;
+
+    // Four classes between each power of two and the next
+    size_t rest = size - 1;
+    unsigned int bit = 7;
+    while ((rest >> (bit + 1)) != 0)
+        bit++;
+
+    return 8 + (bit - 7) * 4 + static_cast<unsigned int>((rest >> (bit - 2)) & 3);
+}
+
+size_t
+PrivateHeap::GetClassSize(unsigned int sizeClass)
+{
+    if (sizeClass < 8)
+        return (sizeClass + 1) * 16;
+
+    unsigned int group = (sizeClass - 8) / 4;
+    unsigned int step = (sizeClass - 8) % 4;
+
+    return static_cast<size_t>(5 + step) << (group + 5);
+}
+
+void *
+PrivateHeap::Allocate(size_t size, bool zero)
+{
+    size_t total = size + sizeof(BlockHeader);
+    if (total < size)
+        return NULL;
+
+    BlockHeader *header;
+    unsigned int sizeClass = GetSizeClass(total);
+
+    ThreadCache *cache = GetCurrentCache();
+    if (cache == NULL)
+        cache = CreateCache();
+
+    if (sizeClass != PRIVATE_HEAP_LARGE)
+    {
+        FreeList spare = { NULL, 0 };
+        FreeList &list = (cache != NULL) ? cache->lists[sizeClass] : spare;
+
+        if (list.head == NULL)
+        {
+            size_t classSize = GetClassSize(sizeClass);
+            unsigned int batch = (cache != NULL) ? (GetCacheLimit(classSize) + 1) / 2 : 1;
+
+            if (FetchBlocks(sizeClass, list, batch) == 0)
+                return NULL;
+        }
+
+        header = static_cast<BlockHeader *>(list.head);
+        list.head = NextBlock(header);
+        list.count--;
+
+        header->sizeClass = static_cast<unsigned short>(sizeClass);
+        CountAllocation(cache, header, sizeClass, GetClassSize(sizeClass));
+    }
+    else
+    {
+        size_t bytes = GetLargeBlockBytes(size);
+
+        // Fresh pages are zeroed already
+        header = static_cast<BlockHeader *>(ReservePages(bytes));
+        if (header == NULL)
+            return NULL;
+
+        zero = false;
+
+        CountReserved(bytes, false);
+
+        header->sizeClass = LARGE_BLOCK;
+        CountAllocation(cache, header, LARGE_STATS, bytes);
+    }
+
+    header->size = size;
+
+    void *p = header + 1;
+    if (zero)
+        memset(p, 0, size);
+
+    return p;
+}
+
+void *
+PrivateHeap::Reallocate(void *ptr, size_t size, bool zero)
+{
+    if (ptr == NULL)
+        return Allocate(size, zero);
+
+    BlockHeader *header = static_cast<BlockHeader *>(ptr) - 1;
+    size_t oldSize = header->size;
+
+    // Large blocks have to stay the same number of pages, or Free() would
+    // release the wrong amount
+    bool fits;
+    if (header->sizeClass != LARGE_BLOCK)
+        fits = size <= GetClassSize(header->sizeClass) - sizeof(BlockHeader);
+    else
+        fits = GetLargeBlockBytes(size) == GetLargeBlockBytes(oldSize);
+
+    if (fits)
+    {
+        if (zero && size > oldSize)
+            memset(static_cast<char *>(ptr) + oldSize, 0, size - oldSize);
+
+        header->size = size;
+
+        return ptr;
+    }
+
+    void *newPtr = Allocate(size, false);
+    if (newPtr == NULL)
+        return NULL;
+
+    // Shrinking a large block lands here too, so only copy what still fits
+    memcpy(newPtr, ptr, (size < oldSize) ? size : oldSize);
+    if (zero && size > oldSize)
+        memset(static_cast<char *>(newPtr) + oldSize, 0, size - oldSize);
+
+    Free(ptr);
+
+    return newPtr;
+}
+
+void
+PrivateHeap::Free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    BlockHeader *header = static_cast<BlockHeader *>(ptr) - 1;
+
+    if (header->sizeClass == LARGE_BLOCK)
+    {
+        size_t bytes = GetLargeBlockBytes(header->size);
+
+        CountFree(GetCurrentCache(), header, LARGE_STATS, bytes);
+
+        ReleasePages(header, bytes);
+        CountReserved(bytes, true);
+
+        return;
+    }
+
+    unsigned int sizeClass = header->sizeClass;
+
+    ThreadCache *cache = GetCurrentCache();
+    if (cache == NULL)
+        cache = CreateCache();
+
+    CountFree(cache, header, sizeClass, GetClassSize(sizeClass));
+
+    if (cache == NULL)
+    {
+        FreeList list = { NULL, 0 };
+        PushBlock(list, header);
+        ReturnBlocks(sizeClass, list, 1);
+        return;
+    }
+
+    FreeList &list = cache->lists[sizeClass];
+    PushBlock(list, header);
+
+    unsigned int limit = GetCacheLimit(GetClassSize(sizeClass));
+    if (list.count > limit)
+        ReturnBlocks(sizeClass, list, (limit + 1) / 2);
+}
+
+size_t
+PrivateHeap::GetSize(const void *ptr)
+{
+    return (static_cast<const BlockHeader *>(ptr) - 1)->size;
+}
+
+unsigned int
+PrivateHeap::SetThreadTag(unsigned int tag)
+{
+    ThreadCache *cache = GetCurrentCache();
+    if (cache == NULL)
+        cache = CreateCache();
+
+    if (cache == NULL)
+        return 0;
+
+    unsigned int previous = cache->tag;
+    cache->tag = (tag < PRIVATE_HEAP_TAG_COUNT) ? tag : 0;
+
+    return previous;
+}
+
+void
+PrivateHeap::GetStats(PrivateHeapStats &stats)
+{
+    // The caller's own counters are easily brought up to date
+    ThreadCache *cache = GetCurrentCache();
+    if (cache != NULL)
+        FoldStats(cache->pending);
+
+    AcquireLock(&statsLock);
+    stats = heapStats;
+    ReleaseLock(&statsLock);
+
+    if ((stats.total.liveBytes >> 63) != 0)
+        stats.total.liveBytes = 0;
+
+    for (unsigned int i = 0; i < PRIVATE_HEAP_TAG_COUNT; i++)
+    {
+        if ((stats.tags[i].liveBytes >> 63) != 0)
+            stats.tags[i].liveBytes = 0;
+    }
+}
+
+void
+PrivateHeap::ReleaseThreadCache()
+{
+    ThreadCache *cache = GetCurrentCache();
+    if (cache == NULL)
+        return;
+
+    SetCurrentCache(NULL);
+    UnregisterCache(cache);
+    ReleaseCache(cache);
+}
+
+} // namespace InterceptPP
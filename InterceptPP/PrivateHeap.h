@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <stddef.h>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+//
+// The allocator behind AllocUtils, and through it BaseObject and MyAlloc.
+// It used to be HeapAlloc() on the process heap, which meant contending
+// for the application's heap lock from inside its own API calls and
+// zeroing every block whether it was needed or not.
+//
+// Requests of up to PRIVATE_HEAP_MAX_SMALL_SIZE bytes, header included,
+// are rounded up to one of PRIVATE_HEAP_CLASS_COUNT size classes: steps of
+// 16 bytes up to 128, then four classes per power of two.  Every thread
+// keeps a short free list per class, so the common case takes no lock at
+// all.  When a list runs empty it's refilled with a batch from a shared
+// list for the class, which in turn carves up spans of pages reserved
+// from the OS just for us; when it grows too long half of it goes back.
+// Anything bigger gets pages of its own.  Blocks can be freed by any
+// thread, they simply end up in that thread's cache.
+//
+// Caches of threads that have exited are handed back when the next thread
+// sets one up (on Linux right away, by the thread key's destructor).
+//
+// Every block also remembers the tag its thread had set when it was
+// allocated, so that what's live can be accounted per subsystem.  The
+// counters are kept per thread and only folded into the shared ones every
+// PRIVATE_HEAP_STATS_BATCH operations, or sooner when a thread's live
+// bytes for a tag have moved by PRIVATE_HEAP_STATS_SLACK, which keeps the
+// cost down to a few additions.  GetStats() is therefore behind by up to
+// that much per thread, and the peaks are those seen when folding.  Bytes
+// are what the blocks take up, header and rounding included.
+//
+// Besides MSVC this builds on Linux, on top of mmap() and pthreads, so
+// that it can be benchmarked there.
+//
+
+#define PRIVATE_HEAP_CLASS_COUNT        40
+#define PRIVATE_HEAP_MAX_SMALL_SIZE  32768
+#define PRIVATE_HEAP_SPAN_SIZE       65536  // at least, and the granularity of large blocks
+#define PRIVATE_HEAP_CACHE_SIZE      16384  // bytes a thread keeps around per class, roughly
+
+#define PRIVATE_HEAP_LARGE      0xFFFFFFFF  // GetSizeClass() for sizes without a class
+
+#define PRIVATE_HEAP_TAG_COUNT           8
+#define PRIVATE_HEAP_STATS_BATCH       256
+#define PRIVATE_HEAP_STATS_SLACK     65536
+
+#ifdef _WIN32
+typedef unsigned __int64 PrivateHeapCounter;
+#else
+typedef unsigned long long PrivateHeapCounter;
+#endif
+
+typedef struct {
+    PrivateHeapCounter liveBytes;
+    PrivateHeapCounter peakBytes;
+    PrivateHeapCounter allocatedBytes;
+    PrivateHeapCounter allocations;
+} PrivateHeapTagStats;
+
+typedef struct {
+    PrivateHeapCounter allocations;
+    PrivateHeapCounter frees;
+} PrivateHeapClassStats;
+
+typedef struct {
+    PrivateHeapTagStats total;
+    PrivateHeapTagStats tags[PRIVATE_HEAP_TAG_COUNT];
+    // The last one is for large blocks
+    PrivateHeapClassStats classes[PRIVATE_HEAP_CLASS_COUNT + 1];
+    // Pages taken from the OS, cached and free blocks included
+    PrivateHeapCounter reservedBytes;
+} PrivateHeapStats;
+
+class INTERCEPTPP_API PrivateHeap
+{
+public:
+    // Blocks are aligned like the header, which is two pointers wide.  The
+    // contents are left alone unless zero is set.
+    static void *Allocate(size_t size, bool zero);
+    // With zero set, the bytes past the old size are zeroed
+    static void *Reallocate(void *ptr, size_t size, bool zero);
+    static void Free(void *ptr);
+
+    // What the block was last allocated or reallocated with
+    static size_t GetSize(const void *ptr);
+
+    // Hands the calling thread's cached blocks back to the shared lists,
+    // for threads that are about to exit
+    static void ReleaseThreadCache();
+
+    // Tags the calling thread's allocations from now on, returns the
+    // previous tag
+    static unsigned int SetThreadTag(unsigned int tag);
+
+    // Blocks allocated while accounting is off aren't counted, not even
+    // when they are freed after it's been turned back on
+    static bool GetAccounting() { return m_accounting; }
+    static void SetAccounting(bool enabled) { m_accounting = enabled; }
+
+    static void GetStats(PrivateHeapStats &stats);
+
+    // The class for a block of size bytes, header included
+    static unsigned int GetSizeClass(size_t size);
+    static size_t GetClassSize(unsigned int sizeClass);
+
+protected:
+    static volatile bool m_accounting;
+};
+
+} // namespace InterceptPP
@@ -0,0 +1,251 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "RawCapture.h"
+#include "Core.h"
+#include "Format.h"
+
+namespace InterceptPP {
+
+volatile bool RawSchema::m_enabled = false;
+
+RawSchema *
+RawSchema::Instance()
+{
+    static RawSchema *schema = NULL;
+
+    if (schema == NULL)
+        schema = new RawSchema();
+
+    return schema;
+}
+
+RawSchema::RawSchema()
+    : m_loggedCount(0), m_pendingCount(0)
+{
+    InitializeCriticalSection(&m_cs);
+}
+
+RawSchema::~RawSchema()
+{
+    DeleteCriticalSection(&m_cs);
+}
+
+unsigned short
+RawSchema::Register(const BaseMarshaller *marshaller)
+{
+    // Describing a composite type registers its children, so this must
+    // happen outside the lock
+    RawTypeDescription desc;
+    marshaller->DescribeRaw(desc);
+
+    OString key = desc.GetKey();
+    unsigned short id = 0;
+
+    EnterCriticalSection(&m_cs);
+
+    TypeKeyMap::const_iterator iter = m_typeIds.find(key);
+    if (iter != m_typeIds.end())
+    {
+        id = iter->second;
+    }
+    else if (m_types.size() < 0xFFFF)
+    {
+        m_types.push_back(desc);
+        id = static_cast<unsigned short>(m_types.size());
+        m_typeIds[key] = id;
+
+        InterlockedIncrement(&m_pendingCount);
+    }
+
+    LeaveCriticalSection(&m_cs);
+
+    return id;
+}
+
+void
+RawSchema::LogPendingTypes()
+{
+    if (m_pendingCount == 0)
+        return;
+
+    EnterCriticalSection(&m_cs);
+
+    Logging::Element *schemaEl = ToElement(m_loggedCount);
+
+    m_loggedCount = static_cast<unsigned int>(m_types.size());
+    m_pendingCount = 0;
+
+    LeaveCriticalSection(&m_cs);
+
+    Logging::Event *ev = GetLogger()->NewEvent("Schema");
+    ev->AppendChild(schemaEl);
+    ev->Submit();
+}
+
+Logging::Element *
+RawSchema::ToElement()
+{
+    EnterCriticalSection(&m_cs);
+    Logging::Element *schemaEl = ToElement(0);
+    LeaveCriticalSection(&m_cs);
+
+    return schemaEl;
+}
+
+// The types from first on, with m_cs held
+Logging::Element *
+RawSchema::ToElement(unsigned int first)
+{
+    Logging::Element *schemaEl = new Logging::Element("schema");
+    schemaEl->AddField("version", RAW_SCHEMA_VERSION);
+
+    for (unsigned int i = first; i < m_types.size(); i++)
+    {
+        schemaEl->AppendChild(m_types[i].ToElement(static_cast<unsigned short>(i + 1)));
+    }
+
+    return schemaEl;
+}
+
+void
+RawSchema::WriteValue(Logging::Writer &writer, const BaseMarshaller *marshaller, void *start, bool deep, IPropertyProvider *propProv)
+{
+    RawWriter raw;
+    marshaller->WriteRaw(raw, start, deep, propProv);
+
+    const OString &data = raw.GetData();
+
+    writer.BeginElement("rawValue");
+    writer.Data(data.data(), data.size());
+    writer.EndElement();
+}
+
+OString
+RawTypeDescription::GetKey() const
+{
+    // Everything that ends up in the schema, so that two marshallers share
+    // a type id only when the reader can't tell them apart
+    OString key;
+    char buf[FORMAT_MAX_LENGTH];
+
+    key.append(buf, Format::Decimal(buf, static_cast<unsigned int>(kind)));
+    key += ':';
+    key += name;
+    key += ':';
+    key.append(buf, Format::Decimal(buf, size));
+    key += ':';
+    key.append(buf, Format::Decimal(buf, flags));
+    key += ':';
+    key.append(buf, Format::Decimal(buf, static_cast<unsigned int>(elementTypeId)));
+
+    for (OVector<RawTypeField>::Type::const_iterator it = fields.begin(); it != fields.end(); it++)
+    {
+        key += "|f:";
+        key += it->name;
+        key += ':';
+        key.append(buf, Format::Decimal(buf, static_cast<unsigned int>(it->offset)));
+        key += ':';
+        key.append(buf, Format::Decimal(buf, static_cast<unsigned int>(it->typeId)));
+    }
+
+    for (OVector<pair<DWORD, OString>>::Type::const_iterator it = members.begin(); it != members.end(); it++)
+    {
+        key += "|m:";
+        key.append(buf, Format::Decimal(buf, static_cast<unsigned int>(it->first)));
+        key += ':';
+        key += it->second;
+    }
+
+    if (kind == RAW_KIND_BOOLEAN)
+    {
+        key += "|b:";
+        key += trueStr;
+        key += ':';
+        key += falseStr;
+    }
+
+    return key;
+}
+
+Logging::Element *
+RawTypeDescription::ToElement(unsigned short id) const
+{
+    Logging::Element *el = new Logging::Element("type");
+
+    el->AddField("id", static_cast<unsigned int>(id));
+    el->AddField("kind", static_cast<unsigned int>(kind));
+    el->AddField("name", name);
+    el->AddField("size", size);
+    el->AddField("flags", flags);
+
+    if (elementTypeId != 0)
+        el->AddField("elementType", static_cast<unsigned int>(elementTypeId));
+
+    if (kind == RAW_KIND_BOOLEAN)
+    {
+        el->AddField("true", trueStr);
+        el->AddField("false", falseStr);
+    }
+
+    for (OVector<RawTypeField>::Type::const_iterator it = fields.begin(); it != fields.end(); it++)
+    {
+        Logging::Element *fieldEl = new Logging::Element("field");
+        fieldEl->AddField("name", it->name);
+        fieldEl->AddField("offset", static_cast<unsigned int>(it->offset));
+        fieldEl->AddField("type", static_cast<unsigned int>(it->typeId));
+        el->AppendChild(fieldEl);
+    }
+
+    for (OVector<pair<DWORD, OString>>::Type::const_iterator it = members.begin(); it != members.end(); it++)
+    {
+        Logging::Element *memberEl = new Logging::Element("member");
+        memberEl->AddField("name", it->second);
+        memberEl->AddField("value", static_cast<unsigned int>(it->first));
+        el->AppendChild(memberEl);
+    }
+
+    return el;
+}
+
+void
+RawWriter::WriteText(const OString &s)
+{
+    WriteDWord(static_cast<DWORD>(s.size()));
+    m_buf.append(s);
+}
+
+void
+RawWriter::WriteCount(unsigned int count, const CaptureSlice &slice)
+{
+    if (slice.sampledOut)
+    {
+        WriteDWord(count | RAW_COUNT_SAMPLED);
+    }
+    else if (slice.head + slice.tail < count)
+    {
+        WriteDWord(count | RAW_COUNT_TRUNCATED);
+        WriteDWord(slice.head);
+        WriteDWord(slice.tail);
+    }
+    else
+    {
+        WriteDWord(count);
+    }
+}
+
+} // namespace InterceptPP
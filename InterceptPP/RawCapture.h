@@ -0,0 +1,187 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "Marshallers.h"
+
+namespace InterceptPP {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Raw capture mode: instead of formatting each argument to text inside the
+// monitored process, marshallers write compact records of raw bytes tagged
+// with a type id.  The type ids refer to a schema, logged as "Schema" events
+// once at log start and again whenever a type is first seen later on, and
+// the reader uses it to build the same value trees that ToNode() would.
+//
+// Every record starts with the WORD type id, followed by:
+//
+//   RAW_KIND_TEXT        DWORD length, text formatted by the agent
+//   RAW_KIND_INTEGER     size bytes
+//   RAW_KIND_BOOLEAN     size bytes, decoded through elementType
+//   RAW_KIND_ENUM        size bytes, decoded through elementType
+//   RAW_KIND_IPV4_ADDR   size bytes
+//   RAW_KIND_POINTER     size bytes, BYTE hasPointee, [pointee record]
+//   RAW_KIND_ARRAY       count, count * size bytes if the element type
+//                        is flagged inline, otherwise count element records
+//   RAW_KIND_BYTE_ARRAY  count, count bytes
+//   RAW_KIND_STRUCT      size bytes, one record per field not flagged inline
+//   RAW_KIND_STRING      DWORD length in bytes, the string without its terminator
+//   RAW_KIND_DYNAMIC     WORD id of the type it resolved to, followed by its
+//                        raw bytes if that type is flagged inline, otherwise
+//                        DWORD length and its shallow ToString() text
+//   RAW_KIND_FORMAT      DWORD length in bytes, the format string without its
+//                        terminator, BYTE argument count or RAW_FORMAT_NO_ARGS
+//                        if the va_list couldn't be found, then per argument
+//                        a BYTE FormatArgKind followed by 4 bytes for INT32,
+//                        8 bytes for INT64, DOUBLE and POINTER, or a count
+//                        and that many characters for STRING and WIDE_STRING
+//
+// A type's size is the number of raw bytes in its records, except for
+// arrays where it's the distance between two elements.  All values are
+// little endian.
+//
+// Counts are a DWORD.  If CaptureBudget cut the buffer short the count has
+// RAW_COUNT_TRUNCATED set and is followed by DWORD head and DWORD tail, and
+// only those elements are present.  RAW_COUNT_SAMPLED means that none are.
+// The characters of a format record's string arguments are counted the
+// same way.
+//
+
+#define RAW_SCHEMA_VERSION 3
+
+#define RAW_COUNT_TRUNCATED  0x80000000
+#define RAW_COUNT_SAMPLED    0x40000000
+#define RAW_COUNT_MASK       0x3FFFFFFF
+
+#define RAW_FORMAT_NO_ARGS   0xFF
+
+typedef enum {
+    RAW_KIND_TEXT = 0,
+    RAW_KIND_INTEGER,
+    RAW_KIND_BOOLEAN,
+    RAW_KIND_ENUM,
+    RAW_KIND_IPV4_ADDR,
+    RAW_KIND_POINTER,
+    RAW_KIND_ARRAY,
+    RAW_KIND_BYTE_ARRAY,
+    RAW_KIND_STRUCT,
+    RAW_KIND_STRING,
+    RAW_KIND_DYNAMIC,
+    RAW_KIND_FORMAT,
+} RawKind;
+
+#define RAW_TYPE_FLAG_INLINE       1  // fully described by its raw bytes
+#define RAW_TYPE_FLAG_SIGN_EXTEND  2
+#define RAW_TYPE_FLAG_SIGNED       4
+#define RAW_TYPE_FLAG_HEX          8
+#define RAW_TYPE_FLAG_BYTESWAP    16
+
+class INTERCEPTPP_API RawTypeField
+{
+public:
+    RawTypeField(const OString &name, DWORD offset, unsigned short typeId)
+        : name(name), offset(offset), typeId(typeId)
+    {}
+
+    OString name;
+    DWORD offset;
+    unsigned short typeId;
+};
+
+class INTERCEPTPP_API RawTypeDescription
+{
+public:
+    RawTypeDescription()
+        : kind(RAW_KIND_TEXT), size(0), flags(0), elementTypeId(0)
+    {}
+
+    OString GetKey() const;
+    Logging::Element *ToElement(unsigned short id) const;
+
+    RawKind kind;
+    OString name;
+    unsigned int size;
+    unsigned int flags;
+    unsigned short elementTypeId;
+
+    OVector<RawTypeField>::Type fields;
+    OVector<pair<DWORD, OString>>::Type members;
+    OString trueStr;
+    OString falseStr;
+};
+
+class INTERCEPTPP_API RawWriter
+{
+public:
+    void WriteTypeId(unsigned short id) { m_buf.append(reinterpret_cast<const char *>(&id), sizeof(id)); }
+    void WriteByte(unsigned char b) { m_buf.push_back(static_cast<char>(b)); }
+    void WriteDWord(DWORD dw) { m_buf.append(reinterpret_cast<const char *>(&dw), sizeof(dw)); }
+    void WriteBytes(const void *buf, size_t size) { m_buf.append(static_cast<const char *>(buf), size); }
+    void WriteText(const OString &s);
+    void WriteCount(unsigned int count, const CaptureSlice &slice);
+
+    const OString &GetData() const { return m_buf; }
+
+protected:
+    OString m_buf;
+};
+
+class INTERCEPTPP_API RawSchema : public BaseObject
+{
+public:
+    static RawSchema *Instance();
+
+    RawSchema();
+    ~RawSchema();
+
+    static bool GetEnabled() { return m_enabled; }
+    static void SetEnabled(bool enabled) { m_enabled = enabled; }
+
+    unsigned short Register(const BaseMarshaller *marshaller);
+    unsigned int GetTypeCount() const { return static_cast<unsigned int>(m_types.size()); }
+
+    // Logs the types registered since the last call as a "Schema" event
+    bool HasPendingTypes() const { return m_pendingCount != 0; }
+    void LogPendingTypes();
+    // All of them, for a log that starts over, like a new segment
+    Logging::Element *ToElement();
+
+    // Writes the raw bytes of a value as a "rawValue" element
+    static void WriteValue(Logging::Writer &writer, const BaseMarshaller *marshaller, void *start, bool deep, IPropertyProvider *propProv);
+
+protected:
+    CRITICAL_SECTION m_cs;
+
+    Logging::Element *ToElement(unsigned int first);
+
+    typedef OMap<OString, unsigned short>::Type TypeKeyMap;
+    TypeKeyMap m_typeIds;
+    OVector<RawTypeDescription>::Type m_types;
+    unsigned int m_loggedCount;
+    volatile LONG m_pendingCount;
+
+    static volatile bool m_enabled;
+};
+
+#pragma warning (pop)
+
+} // namespace InterceptPP
@@ -0,0 +1,180 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "RecordRing.h"
+#include <string.h>
+
+namespace InterceptPP {
+
+typedef struct {
+    unsigned int size;
+    unsigned int tag;
+} RecordHeader;
+
+#define PADDING_SIZE 0xFFFFFFFF
+
+#ifdef _WIN32
+
+// Volatile accesses come with acquire and release semantics with MSVC
+static inline unsigned int
+LoadAcquire(const volatile unsigned int *p)
+{
+    return *p;
+}
+
+static inline void
+StoreRelease(volatile unsigned int *p, unsigned int value)
+{
+    *p = value;
+}
+
+#else
+
+static inline unsigned int
+LoadAcquire(const volatile unsigned int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+StoreRelease(volatile unsigned int *p, unsigned int value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+#endif
+
+static inline unsigned int
+GetEntrySize(unsigned int size)
+{
+    return (sizeof(RecordHeader) + size + RECORD_RING_ALIGNMENT - 1) & ~(RECORD_RING_ALIGNMENT - 1);
+}
+
+RecordRing::RecordRing(void *buffer, unsigned int capacity)
+    : m_buffer(static_cast<char *>(buffer)), m_capacity(capacity),
+      m_head(0), m_tail(0), m_peekedSize(0)
+{
+}
+
+unsigned int
+RecordRing::GetMaxRecordSize() const
+{
+    // Whatever the padding in front of it, this always fits once the
+    // consumer has caught up
+    return m_capacity / 2 - sizeof(RecordHeader);
+}
+
+unsigned int
+RecordRing::GetUsed() const
+{
+    return LoadAcquire(&m_head) - LoadAcquire(&m_tail);
+}
+
+bool
+RecordRing::HasRoomFor(unsigned int size) const
+{
+    if (size > GetMaxRecordSize())
+        return false;
+
+    // Room only ever grows behind the producer's back
+    unsigned int entrySize = GetEntrySize(size);
+    unsigned int head = m_head;
+    unsigned int toEnd = m_capacity - (head & (m_capacity - 1));
+    unsigned int needed = (entrySize <= toEnd) ? entrySize : toEnd + entrySize;
+
+    return m_capacity - (head - LoadAcquire(&m_tail)) >= needed;
+}
+
+bool
+RecordRing::Write(unsigned int tag, const void *data, unsigned int size)
+{
+    return Write(tag, NULL, 0, data, size);
+}
+
+bool
+RecordRing::Write(unsigned int tag, const void *head, unsigned int headSize, const void *tail, unsigned int tailSize)
+{
+    unsigned int size = headSize + tailSize;
+    if (!HasRoomFor(size))
+        return false;
+
+    unsigned int entrySize = GetEntrySize(size);
+    unsigned int position = m_head;
+    unsigned int offset = position & (m_capacity - 1);
+    unsigned int toEnd = m_capacity - offset;
+
+    RecordHeader *header;
+
+    if (entrySize > toEnd)
+    {
+        header = reinterpret_cast<RecordHeader *>(m_buffer + offset);
+        header->size = PADDING_SIZE;
+        header->tag = 0;
+
+        position += toEnd;
+        offset = 0;
+    }
+
+    header = reinterpret_cast<RecordHeader *>(m_buffer + offset);
+    header->size = size;
+    header->tag = tag;
+    if (headSize > 0)
+        memcpy(header + 1, head, headSize);
+    memcpy(reinterpret_cast<char *>(header + 1) + headSize, tail, tailSize);
+
+    StoreRelease(&m_head, position + entrySize);
+
+    return true;
+}
+
+const void *
+RecordRing::Peek(unsigned int &tag, unsigned int &size)
+{
+    unsigned int tail = m_tail;
+    unsigned int head = LoadAcquire(&m_head);
+
+    if (tail == head)
+        return NULL;
+
+    unsigned int offset = tail & (m_capacity - 1);
+    const RecordHeader *header = reinterpret_cast<const RecordHeader *>(m_buffer + offset);
+
+    if (header->size == PADDING_SIZE)
+    {
+        // There's always a record after it
+        tail += m_capacity - offset;
+        StoreRelease(&m_tail, tail);
+
+        header = reinterpret_cast<const RecordHeader *>(m_buffer);
+    }
+
+    tag = header->tag;
+    size = header->size;
+    m_peekedSize = GetEntrySize(size);
+
+    return header + 1;
+}
+
+void
+RecordRing::Consume()
+{
+    StoreRelease(&m_tail, m_tail + m_peekedSize);
+    m_peekedSize = 0;
+}
+
+} // namespace InterceptPP
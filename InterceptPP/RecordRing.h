@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <stddef.h>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+//
+// A ring of variable-sized records with a single producer and a single
+// consumer, neither of which ever waits for the other or takes a lock.
+// Each record gets a header with its size and a tag for the caller, and
+// is laid out contiguously, so a record that doesn't fit before the end
+// of the buffer is preceded by padding up to it.  That's also why records
+// can't be bigger than GetMaxRecordSize(), about half the capacity.
+//
+// The memory is the caller's, which keeps this usable with any allocator.
+//
+// Besides MSVC this builds on Linux so that it can be benchmarked there.
+//
+
+#define RECORD_RING_ALIGNMENT    8
+
+class INTERCEPTPP_API RecordRing
+{
+public:
+    // capacity has to be a power of two, and buffer aligned like a record
+    RecordRing(void *buffer, unsigned int capacity);
+
+    void *GetBuffer() const { return m_buffer; }
+    unsigned int GetCapacity() const { return m_capacity; }
+    unsigned int GetMaxRecordSize() const;
+    // Bytes written and not yet consumed, headers and padding included
+    unsigned int GetUsed() const;
+
+    // For the producer.  Returns false if there isn't room at the moment.
+    bool Write(unsigned int tag, const void *data, unsigned int size);
+    // The same for a record that's in two pieces
+    bool Write(unsigned int tag, const void *head, unsigned int headSize, const void *tail, unsigned int tailSize);
+    // Once this returns true, so does the next Write() of that size
+    bool HasRoomFor(unsigned int size) const;
+
+    //
+    // For the consumer.  Returns the oldest record, or NULL if there is
+    // none, which stays where it is until Consume() is called.
+    //
+    const void *Peek(unsigned int &tag, unsigned int &size);
+    void Consume();
+
+protected:
+    char *m_buffer;
+    unsigned int m_capacity;
+
+    // The positions run freely, and are kept on cache lines of their own
+    // as each of them is written by one side and read by the other
+    char m_padding1[64];
+    volatile unsigned int m_head;
+    char m_padding2[64];
+    volatile unsigned int m_tail;
+    unsigned int m_peekedSize;
+    char m_padding3[64];
+};
+
+} // namespace InterceptPP
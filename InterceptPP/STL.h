@@ -112,16 +112,10 @@ public:
     // allocate but don't initialize num elements of type T
     pointer allocate (size_type num, const void* = 0)
     {
-        pointer ret (NULL);
-
-        try
-        {
-            ret = static_cast<pointer>(operator new(num * sizeof(T)));
-        }
-        catch (bad_alloc &)
-        {
+        // Containers initialize what they use, so skip the zeroing
+        pointer ret = static_cast<pointer>(AllocUtils::Malloc(num * sizeof(T), false));
+        if (ret == NULL)
             exit(1);
-        }
 
         return ret;
     }
@@ -150,8 +144,7 @@ public:
     // deallocate storage p of deleted elements
     void deallocate (pointer p, size_type num)
     {
-        // print message and deallocate memory with delete
-        operator delete(static_cast<void*>(p));
+        AllocUtils::Free(p);
     }
 };
 
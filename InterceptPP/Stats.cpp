@@ -0,0 +1,145 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "Stats.h"
+#include "HookManager.h"
+#include "CaptureBudget.h"
+#include "PayloadTable.h"
+
+namespace InterceptPP {
+
+volatile bool Stats::m_enabled = true;
+
+static const char * g_phaseNames[STATS_PHASE_COUNT] = {
+    "handlers",
+    "marshalling",
+    "backtrace",
+    "eventConstruction",
+    "submit",
+};
+
+void
+CallCycleCounters::Start ()
+{
+    m_last = (Stats::GetEnabled ()) ? Stats::ReadCycleCounter () : 0;
+}
+
+void
+CallCycleCounters::Lap (StatsPhase phase)
+{
+    if (m_last == 0)
+        return;
+
+    unsigned __int64 now = Stats::ReadCycleCounter ();
+    m_cycles[phase] += now - m_last;
+    m_last = now;
+}
+
+void
+FunctionStats::Add (const CallCycleCounters & counters)
+{
+    if (!counters.GetIsRunning ())
+        return;
+
+    const unsigned __int64 * cycles = counters.GetCycles ();
+
+    Lock ();
+
+    m_data.calls++;
+    for (int i = 0; i < STATS_PHASE_COUNT; i++)
+        m_data.cycles[i] += cycles[i];
+
+    Unlock ();
+}
+
+void
+FunctionStats::GetSnapshot (FunctionStatsData & data) const
+{
+    Lock ();
+    data = m_data;
+    Unlock ();
+}
+
+void
+FunctionStats::Reset ()
+{
+    Lock ();
+    memset (&m_data, 0, sizeof (m_data));
+    Unlock ();
+}
+
+void
+FunctionStats::Lock () const
+{
+    // The lock is only ever held for a handful of instructions, so spinning
+    // beats a CRITICAL_SECTION here, and keeps the object copyable.
+    while (InterlockedCompareExchange (&m_lock, 1, 0) != 0)
+        Sleep (0);
+}
+
+void
+FunctionStats::Unlock () const
+{
+    InterlockedExchange (&m_lock, 0);
+}
+
+const char *
+Stats::GetPhaseName (StatsPhase phase)
+{
+    if (phase < 0 || phase >= STATS_PHASE_COUNT)
+        return "unknown";
+
+    return g_phaseNames[phase];
+}
+
+void
+Stats::AppendToElement (Logging::Element * el)
+{
+    HookManager::FunctionStatsList stats;
+    HookManager::Instance ()->GetFunctionStats (stats);
+
+    unsigned __int64 totals[STATS_PHASE_COUNT];
+    memset (totals, 0, sizeof (totals));
+
+    HookManager::FunctionStatsList::const_iterator iter;
+    for (iter = stats.begin (); iter != stats.end (); iter++)
+    {
+        const FunctionStatsData & data = iter->second;
+
+        Logging::Element * funcEl = new Logging::Element ("function");
+        funcEl->AddField ("name", iter->first);
+        funcEl->AddField ("calls", data.calls);
+
+        for (int i = 0; i < STATS_PHASE_COUNT; i++)
+        {
+            funcEl->AddField (g_phaseNames[i], data.cycles[i]);
+            totals[i] += data.cycles[i];
+        }
+
+        el->AppendChild (funcEl);
+    }
+
+    for (int i = 0; i < STATS_PHASE_COUNT; i++)
+        el->AddField (g_phaseNames[i], totals[i]);
+
+    CaptureBudget::AppendStatsToElement (el);
+    PayloadTable::Instance ()->AppendStatsToElement (el);
+    AllocUtils::AppendStatsToElement (el);
+}
+
+} // namespace InterceptPP
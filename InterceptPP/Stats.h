@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "InterceptPP.h"
+#include "Logging.h"
+#include <intrin.h>
+
+namespace InterceptPP {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+typedef enum {
+    STATS_PHASE_HANDLERS = 0,
+    STATS_PHASE_MARSHALLING,
+    STATS_PHASE_BACKTRACE,
+    STATS_PHASE_EVENT_CONSTRUCTION,
+    STATS_PHASE_SUBMIT,
+
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+typedef struct {
+    unsigned __int64 calls;
+    unsigned __int64 cycles[STATS_PHASE_COUNT];
+} FunctionStatsData;
+
+//
+// Cycle counters for a single function call.  These are only ever touched
+// by the thread making the call, and are folded into the FunctionSpec's
+// FunctionStats once the call is done.
+//
+class INTERCEPTPP_API CallCycleCounters
+{
+public:
+    CallCycleCounters ()
+        : m_last (0)
+    {
+        memset (m_cycles, 0, sizeof (m_cycles));
+    }
+
+    void Start ();
+    void Lap (StatsPhase phase);
+
+    bool GetIsRunning () const { return m_last != 0; }
+    const unsigned __int64 * GetCycles () const { return m_cycles; }
+
+protected:
+    unsigned __int64 m_last;
+    unsigned __int64 m_cycles[STATS_PHASE_COUNT];
+};
+
+//
+// Aggregated counters for a FunctionSpec.  Kept copyable as VMethodSpec
+// objects live by value inside VTableSpec.
+//
+class INTERCEPTPP_API FunctionStats
+{
+public:
+    FunctionStats ()
+        : m_lock (0)
+    {
+        memset (&m_data, 0, sizeof (m_data));
+    }
+
+    void Add (const CallCycleCounters & counters);
+    void GetSnapshot (FunctionStatsData & data) const;
+    void Reset ();
+
+protected:
+    mutable volatile LONG m_lock;
+    FunctionStatsData m_data;
+
+    void Lock () const;
+    void Unlock () const;
+};
+
+class INTERCEPTPP_API Stats
+{
+public:
+    static bool GetEnabled () { return m_enabled; }
+    static void SetEnabled (bool enabled) { m_enabled = enabled; }
+
+    static unsigned __int64 ReadCycleCounter () { return __rdtsc (); }
+
+    static const char * GetPhaseName (StatsPhase phase);
+
+    static void AppendToElement (Logging::Element * el);
+
+protected:
+    static volatile bool m_enabled;
+};
+
+#pragma warning (pop)
+
+} // namespace InterceptPP
@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "SymbolTable.h"
+#include "Errors.h"
+
+namespace InterceptPP {
+
+namespace Logging {
+
+SymbolTable::Entry SymbolTable::m_entries[SYMBOL_TABLE_MAX_SYMBOLS] = { { "", 0 } };
+volatile LONG SymbolTable::m_slots[SYMBOL_TABLE_HASH_SIZE];
+volatile LONG SymbolTable::m_count = 1;
+volatile LONG SymbolTable::m_lock = 0;
+
+SymbolId
+SymbolTable::Intern(const char *name, size_t length)
+{
+    if (length == 0)
+        return 0;
+
+    unsigned int slot;
+    SymbolId id = Find(name, length, slot);
+    if (id != 0)
+        return id;
+
+    while (InterlockedCompareExchange(&m_lock, 1, 0) != 0)
+        Sleep(0);
+
+    // Somebody else might have added it while we were waiting
+    id = Find(name, length, slot);
+    if (id == 0)
+    {
+        if (m_count == SYMBOL_TABLE_MAX_SYMBOLS)
+        {
+            InterlockedExchange(&m_lock, 0);
+            throw Error("symbol table is full");
+        }
+
+        char *copy = static_cast<char *>(AllocUtils::Malloc(length + 1, false));
+        memcpy(copy, name, length);
+        copy[length] = '\0';
+
+        id = m_count;
+        m_entries[id].name = copy;
+        m_entries[id].length = static_cast<unsigned int>(length);
+
+        // Publish the entry only once it's filled in, readers don't lock
+        InterlockedExchange(&m_count, id + 1);
+        InterlockedExchange(&m_slots[slot], id);
+    }
+
+    InterlockedExchange(&m_lock, 0);
+
+    return id;
+}
+
+unsigned int
+SymbolTable::Hash(const char *name, size_t length)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261U;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+SymbolId
+SymbolTable::Find(const char *name, size_t length, unsigned int &slot)
+{
+    // The hash table has room for twice as many symbols as there can be,
+    // so linear probing always ends at a free slot
+    slot = Hash(name, length) & (SYMBOL_TABLE_HASH_SIZE - 1);
+
+    for (;;)
+    {
+        SymbolId id = static_cast<SymbolId>(m_slots[slot]);
+        if (id == 0)
+            return 0;
+
+        const Entry &entry = m_entries[id];
+        if (entry.length == length && memcmp(entry.name, name, length) == 0)
+            return id;
+
+        slot = (slot + 1) & (SYMBOL_TABLE_HASH_SIZE - 1);
+    }
+}
+
+} // namespace Logging
+
+} // namespace InterceptPP
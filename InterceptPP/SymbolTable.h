@@ -0,0 +1,105 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "InterceptPP.h"
+
+namespace InterceptPP {
+
+namespace Logging {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Process-wide table of interned node names and field keys.  There are
+// only a few hundred distinct ones, "argument", "value", "type" and so on,
+// yet every node used to carry its own copy of each, and the logger wrote
+// all of them out again for every event.  Nodes now hold a SymbolId, and
+// BinarySerializer writes a name in full only the first time it appears in
+// a log.
+//
+// Symbols are never removed, so the name returned for an id stays valid
+// for the lifetime of the process.  Looking up an existing symbol takes no
+// lock; adding one takes a spinlock.  Id 0 is the empty name.
+//
+
+typedef unsigned int SymbolId;
+
+#define SYMBOL_TABLE_MAX_SYMBOLS  8192
+#define SYMBOL_TABLE_HASH_SIZE   16384
+
+class INTERCEPTPP_API SymbolTable
+{
+public:
+    static SymbolId Intern(const char *name, size_t length);
+    static SymbolId Intern(const OString &name) { return Intern(name.data(), name.size()); }
+
+    static const char *GetName(SymbolId id) { return m_entries[id].name; }
+    static unsigned int GetLength(SymbolId id) { return m_entries[id].length; }
+
+    static unsigned int GetCount() { return m_count; }
+
+protected:
+    typedef struct {
+        const char *name;
+        unsigned int length;
+    } Entry;
+
+    static Entry m_entries[SYMBOL_TABLE_MAX_SYMBOLS];
+    static volatile LONG m_slots[SYMBOL_TABLE_HASH_SIZE];
+    static volatile LONG m_count;
+    static volatile LONG m_lock;
+
+    static unsigned int Hash(const char *name, size_t length);
+    static SymbolId Find(const char *name, size_t length, unsigned int &slot);
+};
+
+//
+// What node names and field keys are passed as, so that call sites can
+// keep passing string literals and OStrings.
+//
+class INTERCEPTPP_API Symbol
+{
+public:
+    Symbol(const char *name)
+        : m_id(SymbolTable::Intern(name, strlen(name)))
+    {}
+
+    Symbol(const OString &name)
+        : m_id(SymbolTable::Intern(name))
+    {}
+
+    explicit Symbol(SymbolId id)
+        : m_id(id)
+    {}
+
+    SymbolId GetId() const { return m_id; }
+    const char *GetName() const { return SymbolTable::GetName(m_id); }
+    unsigned int GetLength() const { return SymbolTable::GetLength(m_id); }
+
+protected:
+    SymbolId m_id;
+};
+
+#pragma warning (pop)
+
+} // namespace Logging
+
+} // namespace InterceptPP
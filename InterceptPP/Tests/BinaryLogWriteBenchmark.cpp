@@ -0,0 +1,260 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//
+// Writes the same stream of events to a file twice: once the way
+// BinaryLogger used to, serializing each one into a string of its own
+// and handing it to the file with a write of its own, and once the way
+// it does now, appending them to one buffer that is reused and written
+// out each time it holds WRITE_BUFFER_SIZE bytes.  Reads the file back
+// after each run to check that nothing went missing.  Besides MSVC this
+// builds on Linux:
+//
+//   g++ -O2 BinaryLogWriteBenchmark.cpp
+//
+
+#define EVENT_COUNT       300000
+#define WRITE_BUFFER_SIZE (1024 * 1024)
+#define MAX_EVENT_SIZE    4096
+
+static const char *fileName = "BinaryLogWriteBenchmark.tmp";
+
+#ifdef _WIN32
+
+typedef HANDLE FileHandle;
+
+static FileHandle
+OpenFile()
+{
+    return CreateFileA(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+static bool
+WriteToFile(FileHandle file, const void *data, unsigned int size)
+{
+    DWORD written;
+    return WriteFile(file, data, size, &written, NULL) && written == size;
+}
+
+static void
+CloseFile(FileHandle file)
+{
+    CloseHandle(file);
+}
+
+static double
+GetSeconds()
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+#else
+
+typedef int FileHandle;
+
+static FileHandle
+OpenFile()
+{
+    return open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+static bool
+WriteToFile(FileHandle file, const void *data, unsigned int size)
+{
+    return write(file, data, size) == static_cast<ssize_t>(size);
+}
+
+static void
+CloseFile(FileHandle file)
+{
+    close(file);
+}
+
+static double
+GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+#endif
+
+static int failures = 0;
+
+static inline unsigned int
+EventSize(unsigned int seq)
+{
+    // Mostly small events, now and then one with a buffer in it
+    unsigned int r = seq * 2654435761U;
+    return ((r & 15) != 0) ? 64 + (r >> 8) % 448 : 512 + (r >> 8) % 3584;
+}
+
+static inline void
+SerializeEvent(char *p, unsigned int seq, unsigned int size)
+{
+    memcpy(p, &seq, sizeof(seq));
+    for (unsigned int i = sizeof(seq); i < size; i++)
+        p[i] = static_cast<char>(seq + i);
+}
+
+static void
+CheckFile(const char *what, unsigned long long expectedBytes)
+{
+    FILE *f = fopen(fileName, "rb");
+    if (f == NULL)
+    {
+        cout << what << ": could not reopen the file" << endl;
+        failures++;
+        return;
+    }
+
+    char event[MAX_EVENT_SIZE];
+    unsigned long long bytes = 0;
+    unsigned int seq;
+
+    for (seq = 0; seq < EVENT_COUNT; seq++)
+    {
+        unsigned int size = EventSize(seq);
+        if (fread(event, 1, size, f) != size)
+            break;
+
+        unsigned int storedSeq;
+        memcpy(&storedSeq, event, sizeof(storedSeq));
+        if (storedSeq != seq || event[size - 1] != static_cast<char>(seq + size - 1))
+            break;
+
+        bytes += size;
+    }
+
+    if (seq != EVENT_COUNT || bytes != expectedBytes || fgetc(f) != EOF)
+    {
+        cout << what << ": event " << seq << " is missing or damaged" << endl;
+        failures++;
+    }
+
+    fclose(f);
+}
+
+static double
+RunPerEvent(unsigned long long &bytes)
+{
+    FileHandle file = OpenFile();
+    double start = GetSeconds();
+
+    bytes = 0;
+    for (unsigned int seq = 0; seq < EVENT_COUNT; seq++)
+    {
+        unsigned int size = EventSize(seq);
+
+        string event(size, '\0');
+        SerializeEvent(&event[0], seq, size);
+
+        if (!WriteToFile(file, event.data(), size))
+            failures++;
+
+        bytes += size;
+    }
+
+    CloseFile(file);
+
+    return GetSeconds() - start;
+}
+
+static double
+RunCoalesced(unsigned long long &bytes)
+{
+    FileHandle file = OpenFile();
+    double start = GetSeconds();
+
+    // Room for one more event past the threshold, so appending never
+    // has to grow it
+    string buf;
+    buf.reserve(WRITE_BUFFER_SIZE + MAX_EVENT_SIZE);
+
+    bytes = 0;
+    for (unsigned int seq = 0; seq < EVENT_COUNT; seq++)
+    {
+        unsigned int size = EventSize(seq);
+
+        size_t offset = buf.size();
+        buf.resize(offset + size);
+        SerializeEvent(&buf[offset], seq, size);
+
+        if (buf.size() >= WRITE_BUFFER_SIZE)
+        {
+            if (!WriteToFile(file, buf.data(), static_cast<unsigned int>(buf.size())))
+                failures++;
+            buf.erase();
+        }
+
+        bytes += size;
+    }
+
+    if (!buf.empty() && !WriteToFile(file, buf.data(), static_cast<unsigned int>(buf.size())))
+        failures++;
+
+    CloseFile(file);
+
+    return GetSeconds() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long long perEventBytes, coalescedBytes;
+
+    double perEventTime = RunPerEvent(perEventBytes);
+    CheckFile("per event", perEventBytes);
+
+    double coalescedTime = RunCoalesced(coalescedBytes);
+    CheckFile("coalesced", coalescedBytes);
+
+    remove(fileName);
+
+    double mb = perEventBytes / (1024.0 * 1024.0);
+    cout << EVENT_COUNT << " events, " << mb << " MB: "
+         << EVENT_COUNT / perEventTime / 1000000.0 << " M events/s, " << mb / perEventTime
+         << " MB/s with a write per event, "
+         << EVENT_COUNT / coalescedTime / 1000000.0 << " M events/s, " << mb / coalescedTime
+         << " MB/s with a write per " << WRITE_BUFFER_SIZE / 1024 << " KB ("
+         << perEventTime / coalescedTime << "x)" << endl;
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
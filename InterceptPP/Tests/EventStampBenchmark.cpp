@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <InterceptPP/Core.h>
+#include <InterceptPP/BinaryWriter.h>
+#include <InterceptPP/Clock.h>
+#include <iostream>
+
+using namespace std;
+using namespace InterceptPP;
+
+#define ITERATIONS 1000000
+
+//
+// Times what stamping an event costs.  Builds the start of a FunctionCall
+// event with a BinaryWriter, once for a logger that wants the timestamp
+// and thread id as text fields, the way every logger used to, and once
+// for one that takes the EventStamp instead, and reports the time and
+// bytes per event of each.  Also times the clocks on their own.
+//
+
+class CountingLogger : public Logging::Logger
+{
+public:
+    CountingLogger(bool stamped)
+        : m_stamped(stamped), m_events(0), m_bytes(0)
+    {}
+
+    virtual Logging::Event *NewEvent(const OString &eventType) { return NULL; }
+    virtual void SubmitEvent(Logging::Event *ev) {}
+
+    virtual bool SubmitRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size)
+    {
+        m_events++;
+        m_bytes += size;
+        if (m_stamped)
+            m_bytes += sizeof(stamp);
+        return true;
+    }
+
+    virtual bool UsesEventStamps() const { return m_stamped; }
+
+    unsigned int GetEvents() const { return m_events; }
+    unsigned __int64 GetBytes() const { return m_bytes; }
+
+protected:
+    bool m_stamped;
+    unsigned int m_events;
+    unsigned __int64 m_bytes;
+};
+
+static double
+GetSeconds(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return static_cast<double>(end.QuadPart - start.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+static double
+RunWriter(bool stamped, double &bytesPerEvent)
+{
+    CountingLogger logger(stamped);
+    LARGE_INTEGER start, end;
+
+    QueryPerformanceCounter(&start);
+
+    for (unsigned int i = 0; i < ITERATIONS; i++)
+    {
+        Logging::BinaryWriter w(&logger, i, "FunctionCall");
+        w.Field("function", "ws2_32.dll::send");
+        w.Field("returnAddress", 0x71a21234u);
+        w.Submit();
+    }
+
+    QueryPerformanceCounter(&end);
+
+    bytesPerEvent = static_cast<double>(logger.GetBytes()) / logger.GetEvents();
+    return GetSeconds(start, end) * 1000000000.0 / ITERATIONS;
+}
+
+int
+main(int argc, char *argv[])
+{
+    LARGE_INTEGER start, end;
+    volatile unsigned __int64 sink = 0;
+
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ITERATIONS; i++)
+        sink += Clock::GetTicks();
+    QueryPerformanceCounter(&end);
+    cout << "Clock::GetTicks(): " << GetSeconds(start, end) * 1000000000.0 / ITERATIONS << " ns" << endl;
+
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        sink += now.QuadPart;
+    }
+    QueryPerformanceCounter(&end);
+    cout << "QueryPerformanceCounter(): " << GetSeconds(start, end) * 1000000000.0 / ITERATIONS << " ns" << endl;
+
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        FILETIME ft;
+        GetSystemTimeAsFileTime(&ft);
+        sink += ft.dwLowDateTime;
+    }
+    QueryPerformanceCounter(&end);
+    cout << "GetSystemTimeAsFileTime(): " << GetSeconds(start, end) * 1000000000.0 / ITERATIONS << " ns" << endl;
+
+    unsigned __int64 ticksPerSecond, ticks, fileTime;
+    Clock::GetCalibration(ticksPerSecond, ticks, fileTime);
+    cout << "Calibrated at " << ticksPerSecond << " ticks/s, " << Clock::MeasureTicksPerSecond()
+         << " measured since" << endl;
+
+    // Once to warm up the thread's buffer and the symbol table
+    double textBytes, stampBytes;
+    RunWriter(false, textBytes);
+
+    double textTime = RunWriter(false, textBytes);
+    double stampTime = RunWriter(true, stampBytes);
+
+    cout << "Text fields: " << textTime << " ns, " << textBytes << " bytes per event" << endl;
+    cout << "EventStamp: " << stampTime << " ns, " << stampBytes << " bytes per event" << endl;
+
+    return 0;
+}
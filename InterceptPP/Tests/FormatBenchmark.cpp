@@ -0,0 +1,295 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/Core.h>
+#include <InterceptPP/Format.h>
+#include <InterceptPP/Marshallers.h>
+#include <iostream>
+
+using namespace std;
+using namespace InterceptPP;
+
+#define ITERATIONS 100000
+
+//
+// Checks that Format produces the same text as the OOStringStream code it
+// replaced, then times building the event a typical FunctionCall logs on
+// enter (cpu context, four arguments and a backtrace), once with streams,
+// once with the library's own code and once more allocating from an Arena.
+//
+
+static OString
+StreamDecimal(__int64 value)
+{
+    OOStringStream ss;
+    ss << value;
+    return ss.str();
+}
+
+static OString
+StreamHex(unsigned int value)
+{
+    OOStringStream ss;
+    if (value != 0)
+        ss << "0x" << hex;
+    ss << value;
+    return ss.str();
+}
+
+static OString
+StreamPointer(void *ptr)
+{
+    OOStringStream ss;
+    ss << hex << "0x" << ptr;
+    return ss.str();
+}
+
+static bool
+Check(const char *what, const OString &expected, const OString &actual)
+{
+    if (expected == actual)
+        return true;
+
+    cout << what << ": expected '" << expected << "', got '" << actual << "'" << endl;
+    return false;
+}
+
+static bool
+CheckFormat()
+{
+    bool success = true;
+
+    const __int64 values[] = {
+        0, 1, 9, 10, 99, 100, 12345, 65535, -1, -10, -12345,
+        2147483647, -2147483647 - 1, 4294967295, 9223372036854775807,
+    };
+
+    for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        __int64 v = values[i];
+
+        success &= Check("int64", StreamDecimal(v), Format::ToString(v));
+        success &= Check("int", StreamDecimal(static_cast<int>(v)), Format::ToString(static_cast<int>(v)));
+        success &= Check("uint", StreamDecimal(static_cast<unsigned int>(v)), Format::ToString(static_cast<unsigned int>(v)));
+        success &= Check("hex", StreamHex(static_cast<unsigned int>(v)), Format::ToHexString(static_cast<unsigned int>(v)));
+        success &= Check("pointer", StreamPointer(reinterpret_cast<void *>(static_cast<DWORD_PTR>(v))),
+                         Format::ToPointerString(reinterpret_cast<void *>(static_cast<DWORD_PTR>(v))));
+    }
+
+    return success;
+}
+
+static Logging::Element *
+BuildStreamEvent(CpuContext *ctx, DWORD *args, DWORD *backtrace, unsigned int backtraceLen)
+{
+    Logging::Element *ev = new Logging::Element("event");
+
+    Logging::Element *ctxEl = new Logging::Element("cpuContext");
+    ev->AppendChild(ctxEl);
+
+    DWORD *regs = reinterpret_cast<DWORD *>(ctx);
+    for (int i = 0; i < 8; i++)
+    {
+        Logging::Element *regEl = new Logging::Element("register");
+        ctxEl->AppendChild(regEl);
+        regEl->AddField("value", StreamHex(regs[i]));
+    }
+
+    Logging::Element *argsEl = new Logging::Element("arguments");
+    ev->AppendChild(argsEl);
+
+    for (int i = 0; i < 4; i++)
+    {
+        OOStringStream ss;
+        ss << "arg" << (i + 1);
+
+        Logging::Element *argEl = new Logging::Element("argument");
+        argsEl->AppendChild(argEl);
+        argEl->AddField("name", ss.str());
+
+        Logging::Element *valueEl = new Logging::Element("value");
+        argEl->AppendChild(valueEl);
+        valueEl->AddField("value", (i == 1) ? StreamPointer(reinterpret_cast<void *>(args[i])) : StreamDecimal(static_cast<int>(args[i])));
+    }
+
+    Logging::Element *btEl = new Logging::Element("backtrace");
+    ev->AppendChild(btEl);
+
+    for (unsigned int i = 0; i < backtraceLen; i++)
+    {
+        OOStringStream ss;
+        ss << "0x" << hex << backtrace[i];
+        btEl->AppendChild(new Logging::TextNode("entry", ss.str()));
+    }
+
+    return ev;
+}
+
+static Logging::Element *
+BuildFormatEvent(CpuContext *ctx, DWORD *args, DWORD *backtrace, unsigned int backtraceLen)
+{
+    Logging::Element *ev = new Logging::Element("event");
+
+    Logging::Element *ctxEl = new Logging::Element("cpuContext");
+    ev->AppendChild(ctxEl);
+
+    DWORD *regs = reinterpret_cast<DWORD *>(ctx);
+    for (int i = 0; i < 8; i++)
+    {
+        Logging::Element *regEl = new Logging::Element("register");
+        ctxEl->AppendChild(regEl);
+        regEl->AddField("value", Format::ToHexString(regs[i]));
+    }
+
+    Logging::Element *argsEl = new Logging::Element("arguments");
+    ev->AppendChild(argsEl);
+
+    Marshaller::Int32 intMarshaller;
+    Marshaller::Pointer ptrMarshaller;
+
+    for (int i = 0; i < 4; i++)
+    {
+        char buf[3 + FORMAT_MAX_LENGTH] = "arg";
+
+        Logging::Element *argEl = new Logging::Element("argument");
+        argsEl->AppendChild(argEl);
+        argEl->AddField("name", OString(buf, Format::Decimal(buf + 3, i + 1)));
+
+        Logging::Element *valueEl = new Logging::Element("value");
+        argEl->AppendChild(valueEl);
+        if (i == 1)
+            valueEl->AddField("value", ptrMarshaller.ToString(&args[i], false, NULL));
+        else
+            valueEl->AddField("value", intMarshaller.ToString(&args[i], false, NULL));
+    }
+
+    Logging::Element *btEl = new Logging::Element("backtrace");
+    ev->AppendChild(btEl);
+
+    for (unsigned int i = 0; i < backtraceLen; i++)
+    {
+        char buf[FORMAT_MAX_LENGTH];
+        btEl->AppendChild(new Logging::TextNode("entry", OString(buf, Format::HexPrefixed(buf, backtrace[i]))));
+    }
+
+    return ev;
+}
+
+static void
+DumpNode(const Logging::Node *node, OString &result)
+{
+    result += "<";
+    result += node->GetName();
+
+    for (const Logging::NodeField *field = node->GetFirstField(); field != NULL; field = field->next)
+    {
+        result += " ";
+        result += field->name;
+        result += "=\"";
+        result += field->value;
+        result += "\"";
+    }
+
+    result += ">";
+    result.append(node->GetContent(), node->GetContentSize());
+
+    for (const Logging::Node *child = node->GetFirstChild(); child != NULL; child = child->GetNextSibling())
+    {
+        DumpNode(child, result);
+    }
+
+    result += "</";
+    result += node->GetName();
+    result += ">";
+}
+
+static double
+GetSeconds(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return static_cast<double>(end.QuadPart - start.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+int main(int argc, char *argv[])
+{
+    InterceptPP::Initialize();
+
+    bool success = CheckFormat();
+
+    // send(s, buf, len, flags) as seen on enter
+    char payload[] = "GET / HTTP/1.0\r\n\r\n";
+    CpuContext ctx = { 0x0012FF60, 0, 0x7C90E4F4, 0x00000124, 0x0012FE48, 0x00000001, 0x0012FF80, 0x0012FF40 };
+    DWORD args[4] = { 0x124, reinterpret_cast<DWORD>(payload), sizeof(payload) - 1, 0 };
+    DWORD backtrace[5] = { 0x71AB4C27, 0x004012A3, 0x00401F10, 0x7C816FD7, 0 };
+
+    OString streamDump, formatDump;
+
+    Logging::Element *ev = BuildStreamEvent(&ctx, args, backtrace, 5);
+    DumpNode(ev, streamDump);
+    delete ev;
+
+    ev = BuildFormatEvent(&ctx, args, backtrace, 5);
+    DumpNode(ev, formatDump);
+    delete ev;
+
+    success &= Check("event", streamDump, formatDump);
+
+    LARGE_INTEGER start, end;
+
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ITERATIONS; i++)
+        delete BuildStreamEvent(&ctx, args, backtrace, 5);
+    QueryPerformanceCounter(&end);
+    double streamTime = GetSeconds(start, end);
+
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ITERATIONS; i++)
+        delete BuildFormatEvent(&ctx, args, backtrace, 5);
+    QueryPerformanceCounter(&end);
+    double formatTime = GetSeconds(start, end);
+
+    // The same again with each event built in an arena of its own, as
+    // Logging::Event does
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        Arena *arena = new Arena();
+        Arena::SetCurrent(arena);
+        arena->Release();
+
+        delete BuildFormatEvent(&ctx, args, backtrace, 5);
+
+        Arena::SetCurrent(NULL);
+    }
+    QueryPerformanceCounter(&end);
+    double arenaTime = GetSeconds(start, end);
+
+    cout << "event construction: "
+         << (streamTime * 1000000.0 / ITERATIONS) << " us/event with OOStringStream, "
+         << (formatTime * 1000000.0 / ITERATIONS) << " us/event with Format ("
+         << (streamTime / formatTime) << "x), "
+         << (arenaTime * 1000000.0 / ITERATIONS) << " us/event with Format and an arena ("
+         << (streamTime / arenaTime) << "x)" << endl;
+
+    cout << (success ? "success" : "FAILED") << endl;
+    OString str;
+    cin >> str;
+
+    return (success) ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/FormatScanner.h>
+#include <iostream>
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks the argument kinds FormatScanner finds in a few format strings.
+// Besides MSVC this builds on Linux:
+//
+//   g++ -I../.. FormatScannerTest.cpp ../FormatScanner.cpp
+//
+
+static int failures = 0;
+
+static const char *kindNames[] = { "INT32", "INT64", "DOUBLE", "POINTER", "STRING", "WIDE_STRING", "NULL_STRING" };
+
+static void
+Compare(const char *what, const FormatArgKind *actual, unsigned int actualCount, const char *expected)
+{
+    string got;
+    for (unsigned int i = 0; i < actualCount; i++)
+    {
+        if (i > 0)
+            got += ' ';
+        got += kindNames[actual[i]];
+    }
+
+    if (got != expected)
+    {
+        cout << what << ": expected \"" << expected << "\", got \"" << got << "\"" << endl;
+        failures++;
+    }
+}
+
+static void
+Check(const char *format, const char *expected)
+{
+    FormatArgKind kinds[FORMAT_MAX_ARGS];
+    Compare(format, kinds, FormatScanner::Scan(format, kinds), expected);
+}
+
+static void
+CheckWide(const char *what, const wchar_t *format, const char *expected)
+{
+    FormatArgKind kinds[FORMAT_MAX_ARGS];
+    Compare(what, kinds, FormatScanner::Scan(format, kinds), expected);
+}
+
+int main(int argc, char *argv[])
+{
+    Check("", "");
+    Check("no conversions", "");
+    Check("100%% done", "");
+    Check("%d %i %u %o %x %X %c", "INT32 INT32 INT32 INT32 INT32 INT32 INT32");
+    Check("%hd %hhu %ld %lu %I32x", "INT32 INT32 INT32 INT32 INT32");
+    Check("%lld %I64u %I64X", "INT64 INT64 INT64");
+    Check("%f %.3e %g %LG %a", "DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE");
+    Check("%p %n %Z", "POINTER POINTER POINTER");
+    Check("%-08.3f|%+d|% d|%#x", "DOUBLE INT32 INT32 INT32");
+    Check("%*d %.*s %*.*f", "INT32 INT32 INT32 STRING INT32 INT32 DOUBLE");
+    Check("%s %hs %S %ls %ws", "STRING STRING WIDE_STRING WIDE_STRING WIDE_STRING");
+    Check("%C %lc", "INT32 INT32");
+
+    // Size of size_t depends on the target
+    Check("%Iu", (sizeof(void *) == 8) ? "INT64" : "INT32");
+
+    // Scanning stops at what it doesn't know
+    Check("%d %k %d", "INT32");
+    Check("trailing %", "");
+
+    // In wide format strings %s is wide and %S is narrow
+    CheckWide("wide %s %S %hs %ls", L"%s %S %hs %ls", "WIDE_STRING STRING STRING WIDE_STRING");
+    CheckWide("wide %d %f", L"%d %f", "INT32 DOUBLE");
+
+    // At most FORMAT_MAX_ARGS arguments
+    string many;
+    for (int i = 0; i < FORMAT_MAX_ARGS + 10; i++)
+        many += "%d";
+    FormatArgKind kinds[FORMAT_MAX_ARGS];
+    unsigned int count = FormatScanner::Scan(many.c_str(), kinds);
+    if (count != FORMAT_MAX_ARGS)
+    {
+        cout << "too many arguments: expected " << FORMAT_MAX_ARGS << ", got " << count << endl;
+        failures++;
+    }
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,719 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/LogFormat.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks the varints, that every kind of field value comes back as the
+// same text, that events with an EventStamp read back as if they had the
+// timestamp and threadId fields, that random events encoded and decoded
+// again, block by block, are what went in, that corrupt input is rejected
+// on both sides without anything being left behind, and that an encoder
+// that's Reset() starts over as a new one would.  Besides MSVC this builds
+// on Linux:
+//
+//   g++ -O2 -I../.. LogFormatTest.cpp ../LogFormat.cpp
+//
+
+#define EVENT_COUNT  20000
+#define BLOCK_EVENTS 100
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static const char *symbolNames[] = {
+    "event", "id", "type", "timestamp", "Send", "Recv",
+    "data", "size", "handle", "result", "flags", "name", "socket", "ret",
+    "threadId",
+};
+#define SYMBOL_COUNT (sizeof(symbolNames) / sizeof(symbolNames[0]))
+
+// Symbols come from the table above, as they would from SymbolTable
+class TestEncoder : public LogEncoder
+{
+public:
+    TestEncoder() : definitions(0) {}
+
+    virtual const char *GetSymbolName(unsigned int id, unsigned int &length)
+    {
+        if (id == 0 || id > SYMBOL_COUNT)
+            return NULL;
+
+        length = static_cast<unsigned int>(strlen(symbolNames[id - 1]));
+        return symbolNames[id - 1];
+    }
+
+    unsigned int definitions;
+
+protected:
+    virtual unsigned int InternSymbol(const char *name, unsigned int length)
+    {
+        for (unsigned int i = 0; i < SYMBOL_COUNT; i++)
+        {
+            if (strlen(symbolNames[i]) == length && memcmp(symbolNames[i], name, length) == 0)
+                return i + 1;
+        }
+
+        return 0;
+    }
+
+    virtual void OnSymbolDefinition(unsigned int id, const char *name, unsigned int length)
+    {
+        definitions++;
+    }
+};
+
+// Builds events in the version 1 format, as BinaryWriter does
+class V1Writer
+{
+public:
+    void Begin(unsigned int name, unsigned int fieldCount)
+    {
+        Symbol(name);
+        DWord(fieldCount);
+    }
+
+    void Field(unsigned int key, const string &value)
+    {
+        Symbol(key);
+        String(value);
+    }
+
+    void Content(bool raw, const string &content, unsigned int childCount)
+    {
+        DWord(raw ? 1 : 0);
+        String(content);
+        DWord(childCount);
+    }
+
+    void Symbol(unsigned int id, bool define=false)
+    {
+        if (define)
+        {
+            DWord(0xC0000000 | id);
+            String(symbolNames[id - 1]);
+        }
+        else
+        {
+            DWord(0x80000000 | id);
+        }
+    }
+
+    void DWord(unsigned int value)
+    {
+        data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void String(const string &s)
+    {
+        DWord(static_cast<unsigned int>(s.size()));
+        data += s;
+    }
+
+    string data;
+};
+
+// Turns either version into the same text
+static void
+Quote(string &text, const char *data, unsigned int length)
+{
+    text += '"';
+    for (unsigned int i = 0; i < length; i++)
+    {
+        char buf[8];
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c < 32 || c >= 127 || c == '"' || c == '\\')
+        {
+            sprintf(buf, "\\%02x", c);
+            text += buf;
+        }
+        else
+        {
+            text += static_cast<char>(c);
+        }
+    }
+    text += '"';
+}
+
+class TextVisitor : public LogVisitor
+{
+public:
+    TextVisitor() : events(0) {}
+
+    virtual void BeginEvent(const LogRecordFrame &frame)
+    {
+        lastFrame = frame;
+        events++;
+    }
+
+    virtual void BeginElement(const char *name, unsigned int length)
+    {
+        text += '<';
+        text.append(name, length);
+    }
+
+    virtual void Field(const char *key, unsigned int keyLength, const LogValue &value)
+    {
+        char buf[LOG_MAX_VALUE_TEXT];
+        unsigned int length;
+        const char *s = LogFormat::GetText(value, buf, length);
+
+        text += ' ';
+        text.append(key, keyLength);
+        text += '=';
+        Quote(text, s, length);
+        types.push_back(value.type);
+    }
+
+    virtual void Content(bool raw, const char *data, unsigned int length)
+    {
+        text += raw ? " raw>" : ">";
+        Quote(text, data, length);
+    }
+
+    virtual void EndElement()
+    {
+        text += "</>";
+    }
+
+    string text;
+    vector<unsigned int> types;
+    LogRecordFrame lastFrame;
+    unsigned int events;
+};
+
+static unsigned int
+ReadDWord(const char *&p)
+{
+    unsigned int value;
+    memcpy(&value, p, sizeof(value));
+    p += sizeof(value);
+    return value;
+}
+
+static void
+V1ToText(const char *&p, string &text)
+{
+    unsigned int name = ReadDWord(p);
+    if ((name & 0xC0000000) == 0xC0000000)
+        p += ReadDWord(p);
+    name &= 0x3FFFFFFF;
+
+    text += '<';
+    text += symbolNames[name - 1];
+
+    unsigned int fieldCount = ReadDWord(p);
+    for (unsigned int i = 0; i < fieldCount; i++)
+    {
+        unsigned int key = ReadDWord(p);
+        if ((key & 0xC0000000) == 0xC0000000)
+            p += ReadDWord(p);
+        key &= 0x3FFFFFFF;
+
+        unsigned int length = ReadDWord(p);
+        text += ' ';
+        text += symbolNames[key - 1];
+        text += '=';
+        Quote(text, p, length);
+        p += length;
+    }
+
+    bool raw = ReadDWord(p) != 0;
+    unsigned int length = ReadDWord(p);
+    text += raw ? " raw>" : ">";
+    Quote(text, p, length);
+    p += length;
+
+    unsigned int childCount = ReadDWord(p);
+    for (unsigned int i = 0; i < childCount; i++)
+        V1ToText(p, text);
+
+    text += "</>";
+}
+
+static string
+V1ToText(const string &data)
+{
+    string text;
+    const char *p = data.data();
+    V1ToText(p, text);
+    return text;
+}
+
+static void
+TestVarints()
+{
+    static const unsigned long long values[] = {
+        0, 1, 127, 128, 300, 16383, 16384, 0xFFFFFFFFULL, 0x100000000ULL,
+        0x7FFFFFFFFFFFFFFFULL, 0x8000000000000000ULL, 0xFFFFFFFFFFFFFFFFULL,
+    };
+
+    bool ok = true;
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        char buf[LOG_MAX_VARINT_SIZE];
+        unsigned int size = LogFormat::PutVarint(buf, values[i]);
+
+        const char *p = buf;
+        unsigned long long value;
+        ok &= size == LogFormat::GetVarintSize(values[i]);
+        ok &= LogFormat::GetVarint(p, buf + size, value) && value == values[i] && p == buf + size;
+
+        // Cut short
+        p = buf;
+        ok &= !LogFormat::GetVarint(p, buf + size - 1, value);
+    }
+    Check("varints", true, ok);
+
+    char buf[16];
+    unsigned int size = LogFormat::PutVarint(buf, 300);
+    Check("size", true, size == 2 && buf[0] == static_cast<char>(0xAC) && buf[1] == 2);
+
+    // Too long, or more than 64 bits
+    memset(buf, 0x80, sizeof(buf));
+    buf[10] = 0;
+    const char *p = buf;
+    unsigned long long value;
+    Check("too long", false, LogFormat::GetVarint(p, buf + sizeof(buf), value));
+
+    memset(buf, 0xFF, 9);
+    buf[9] = 2;
+    p = buf;
+    Check("too big", false, LogFormat::GetVarint(p, buf + sizeof(buf), value));
+
+    unsigned int small;
+    size = LogFormat::PutVarint(buf, 0x100000000ULL);
+    p = buf;
+    Check("too big for 32 bits", false, LogFormat::GetVarint(p, buf + size, small));
+}
+
+// Encodes an event with one field of each value and decodes it again
+static void
+TestValues()
+{
+    static const struct {
+        const char *text;
+        unsigned int type;
+    } values[] = {
+        { "0", LOG_VALUE_DECIMAL },
+        { "1234", LOG_VALUE_DECIMAL },
+        { "18446744073709551615", LOG_VALUE_DECIMAL },
+        { "18446744073709551616", LOG_VALUE_STRING_DEFINITION },
+        { "007", LOG_VALUE_STRING_DEFINITION },
+        { "-5", LOG_VALUE_NEGATIVE_DECIMAL },
+        { "-9223372036854775808", LOG_VALUE_NEGATIVE_DECIMAL },
+        { "-9223372036854775809", LOG_VALUE_STRING_DEFINITION },
+        { "-0", LOG_VALUE_STRING_DEFINITION },
+        { "-", LOG_VALUE_STRING_DEFINITION },
+        { "0x0", LOG_VALUE_HEX },
+        { "0x1f", LOG_VALUE_HEX },
+        { "0xffffffffffffffff", LOG_VALUE_HEX },
+        { "0x01f", LOG_VALUE_STRING_DEFINITION },
+        { "0x1F", LOG_VALUE_STRING_DEFINITION },
+        { "0x0012ABCD", LOG_VALUE_POINTER },
+        { "0x00000000", LOG_VALUE_POINTER },
+        { "0x0012abcd", LOG_VALUE_STRING_DEFINITION },
+        { "0x", LOG_VALUE_STRING_DEFINITION },
+        { "true", LOG_VALUE_BOOLEAN },
+        { "false", LOG_VALUE_BOOLEAN },
+        { "True", LOG_VALUE_STRING_DEFINITION },
+        { "", LOG_VALUE_STRING },
+        { "WSAEWOULDBLOCK", LOG_VALUE_STRING_DEFINITION },
+        { "WSAEWOULDBLOCK", LOG_VALUE_STRING_REFERENCE },
+        { "0x1F", LOG_VALUE_STRING_REFERENCE },
+    };
+    const unsigned int count = sizeof(values) / sizeof(values[0]);
+
+    string longString(LOG_MAX_TABLE_STRING + 1, 'x');
+    string binary("a\0b", 3);
+
+    V1Writer v1;
+    v1.Begin(1, count + 5);
+    v1.Field(2, "1");
+    v1.Field(3, "Send");
+    v1.Field(4, "128000000000000000");
+    for (unsigned int i = 0; i < count; i++)
+        v1.Field(7 + i % 8, values[i].text);
+    v1.Field(7, longString);
+    v1.Field(8, binary);
+    v1.Content(false, "", 0);
+
+    TestEncoder encoder;
+    Check("encoded", true, encoder.EncodeEvent(v1.data.data(), static_cast<unsigned int>(v1.data.size())));
+    Check("fields in frame", true, (encoder.GetFrame().flags & LOG_RECORD_FLAG_FIELDS_IN_FRAME) != 0);
+
+    LogDecoder decoder;
+    TextVisitor visitor;
+    Check("decoded", true, decoder.DecodeBlock(encoder.GetData(), encoder.GetSize(), visitor));
+    Check("same text", true, visitor.text == V1ToText(v1.data));
+
+    // The three that went into the frame, then the values
+    bool ok = visitor.types.size() == count + 5;
+    for (unsigned int i = 0; ok && i < count; i++)
+    {
+        if (visitor.types[3 + i] != values[i].type)
+        {
+            cout << values[i].text << ": type " << visitor.types[3 + i] << endl;
+            ok = false;
+        }
+    }
+    ok &= visitor.types[3 + count] == LOG_VALUE_STRING;
+    Check("types", true, ok);
+
+    Check("frame id", true, visitor.lastFrame.id == 1 && visitor.lastFrame.timestamp == 128000000000000000ULL);
+}
+
+// Events the agent logs have their timestamp in clock ticks, and their
+// thread id, in the frame
+static void
+TestStamps()
+{
+    LogFileHeader header;
+    LogFormat::InitHeader(header, 0, 0);
+    Check("identity", true, LogFormat::GetFileTime(header, 128000000000000000ULL) == 128000000000000000ULL);
+
+    header.ticksPerSecond = 3000000000ULL;
+    header.startTicks = 1000000000000ULL;
+    header.startTime = 130000000000000000ULL;
+
+    // A day and a half second later, which doesn't fit if multiplied first
+    unsigned long long later = header.startTicks + 86400ULL * header.ticksPerSecond + header.ticksPerSecond / 2;
+    Check("later", true, LogFormat::GetFileTime(header, later) == header.startTime + 864005000000ULL);
+    Check("earlier", true,
+          LogFormat::GetFileTime(header, header.startTicks - header.ticksPerSecond) == header.startTime - 10000000);
+
+    TestEncoder encoder;
+    string expected;
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        unsigned long long ticks = later + i * 3000;
+        char buf[32];
+
+        V1Writer stamped;
+        stamped.Begin(1, 3);
+        sprintf(buf, "%u", 7 + i);
+        stamped.Field(2, buf);
+        stamped.Field(3, "Recv");
+        stamped.Field(9, "0x1f");
+        stamped.Content(true, "abc", 0);
+        Check("stamped encoded", true, encoder.EncodeEvent(stamped.data.data(),
+              static_cast<unsigned int>(stamped.data.size()), ticks, 1234 + i));
+
+        const LogRecordFrame &frame = encoder.GetFrame();
+        Check("stamped frame", true, (frame.flags & LOG_RECORD_FLAG_FIELDS_IN_FRAME) != 0 && frame.id == 7 + i &&
+              frame.timestamp == ticks && frame.threadId == 1234 + i);
+
+        V1Writer v1;
+        v1.Begin(1, 5);
+        v1.Field(2, buf);
+        v1.Field(3, "Recv");
+        sprintf(buf, "%llu", LogFormat::GetFileTime(header, ticks));
+        v1.Field(4, buf);
+        sprintf(buf, "%u", 1234 + i);
+        v1.Field(15, buf);
+        v1.Field(9, "0x1f");
+        v1.Content(true, "abc", 0);
+        expected += V1ToText(v1.data);
+    }
+
+    LogRecordFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    const char *p = encoder.GetData();
+    const char *end = p + encoder.GetSize();
+    unsigned int threadIds = 0;
+    while (p < end && LogFormat::NextRecord(p, end, frame) != NULL)
+    {
+        if (frame.kind == LOG_RECORD_EVENT)
+            threadIds += frame.threadId;
+    }
+    Check("thread ids", true, p == end && threadIds == 1234 + 1235 && frame.timestamp == later + 3000);
+
+    LogDecoder decoder;
+    decoder.SetHeader(header);
+    TextVisitor visitor;
+    Check("stamped decoded", true, decoder.DecodeBlock(encoder.GetData(), encoder.GetSize(), visitor));
+    Check("stamped text", true, visitor.text == expected);
+}
+
+static string
+RandomString(unsigned int maxLength)
+{
+    static const char *common[] = { "0", "42", "-1", "0x1f", "0x0040A000", "true", "false", "WSAEWOULDBLOCK", "" };
+
+    if (rand() % 2 == 0)
+        return common[rand() % (sizeof(common) / sizeof(common[0]))];
+
+    string s(rand() % (maxLength + 1), ' ');
+    for (size_t i = 0; i < s.size(); i++)
+        s[i] = static_cast<char>((rand() % 4 == 0) ? rand() : 'a' + rand() % 26);
+    return s;
+}
+
+static void
+RandomElement(V1Writer &v1, int depth)
+{
+    unsigned int fieldCount = rand() % 4;
+    unsigned int childCount = (depth < 3) ? rand() % 3 : 0;
+
+    v1.Begin(7 + rand() % 8, fieldCount);
+    for (unsigned int i = 0; i < fieldCount; i++)
+        v1.Field(7 + rand() % 8, RandomString(80));
+    v1.Content(rand() % 2 == 0, RandomString(300), childCount);
+
+    for (unsigned int i = 0; i < childCount; i++)
+        RandomElement(v1, depth + 1);
+}
+
+// Sometimes with the frame fields out of place, sometimes defining the
+// symbols inline as a version 1 log does
+static string
+RandomEvent(unsigned int id, unsigned long long stamp, bool &inFrame)
+{
+    char text[32];
+    V1Writer v1;
+
+    inFrame = rand() % 10 != 0;
+    bool define = rand() % 10 == 0;
+
+    unsigned int extra = rand() % 3;
+    unsigned int childCount = rand() % 3;
+    v1.Symbol(1, define);
+    v1.DWord(3 + extra);
+
+    sprintf(text, "%u", id);
+    if (inFrame)
+    {
+        v1.Symbol(2, define);
+        v1.String(text);
+    }
+    v1.Symbol(3, define);
+    v1.String(symbolNames[4 + id % 2]);
+    sprintf(text, "%llu", stamp);
+    v1.Symbol(4, define);
+    v1.String(text);
+    if (!inFrame)
+        v1.Field(2, "x");
+
+    for (unsigned int i = 0; i < extra; i++)
+        v1.Field(7 + rand() % 8, RandomString(40));
+    v1.Content(false, "", childCount);
+
+    for (unsigned int i = 0; i < childCount; i++)
+        RandomElement(v1, 1);
+
+    return v1.data;
+}
+
+class BlockVisitor : public TextVisitor
+{
+public:
+    virtual void EndEvent()
+    {
+        texts.push_back(text);
+        text.clear();
+    }
+
+    vector<string> texts;
+};
+
+static void
+TestRoundTrip()
+{
+    srand(1);
+
+    TestEncoder encoder;
+    LogDecoder decoder;
+    vector<string> blocks;
+    vector<string> texts;
+    size_t v1Size = 0, v2Size = 0;
+    unsigned int inFrameCount = 0;
+
+    unsigned long long stamp = 128000000000000000ULL;
+    for (unsigned int i = 0; i < EVENT_COUNT; i++)
+    {
+        stamp += rand() % 20000;
+
+        // Now and then the clock goes back a little, as threads race
+        unsigned long long eventStamp = (rand() % 5 == 0) ? stamp - rand() % 1000 : stamp;
+
+        bool inFrame;
+        string event = RandomEvent(i + 1, eventStamp, inFrame);
+        texts.push_back(V1ToText(event));
+        v1Size += event.size();
+
+        if (!encoder.EncodeEvent(event.data(), static_cast<unsigned int>(event.size())))
+        {
+            Check("encoded", true, false);
+            return;
+        }
+        if ((encoder.GetFrame().flags & LOG_RECORD_FLAG_FIELDS_IN_FRAME) != 0)
+        {
+            inFrameCount++;
+            if (encoder.GetFrame().id != i + 1 || encoder.GetFrame().timestamp != eventStamp)
+                Check("frame", true, false);
+        }
+
+        if ((i + 1) % BLOCK_EVENTS == 0 || i + 1 == EVENT_COUNT)
+        {
+            blocks.push_back(string(encoder.GetData(), encoder.GetSize()));
+            v2Size += encoder.GetSize();
+            encoder.Clear();
+            encoder.StartBlock();
+        }
+    }
+    Check("some in frame", true, inFrameCount > EVENT_COUNT / 2 && inFrameCount < EVENT_COUNT);
+    Check("definitions seen", true, encoder.definitions > 0);
+
+    BlockVisitor visitor;
+    bool decoded = true;
+    for (size_t i = 0; i < blocks.size(); i++)
+        decoded &= decoder.DecodeBlock(blocks[i].data(), static_cast<unsigned int>(blocks[i].size()), visitor);
+    Check("decoded all", true, decoded);
+    Check("same events", true, visitor.texts == texts);
+
+    // A block on its own, given the symbols
+    LogDecoder late;
+    for (unsigned int id = 0; id < encoder.GetSymbolLimit(); id++)
+    {
+        unsigned int length;
+        const char *name;
+        if (encoder.IsSymbolDefined(id) && (name = encoder.GetSymbolName(id, length)) != NULL)
+            late.AddSymbol(id, name, length);
+    }
+    BlockVisitor lastVisitor;
+    const string &last = blocks[blocks.size() / 2];
+    Check("decoded alone", true, late.DecodeBlock(last.data(), static_cast<unsigned int>(last.size()), lastVisitor));
+    Check("same alone", true, lastVisitor.texts.size() == BLOCK_EVENTS &&
+          equal(lastVisitor.texts.begin(), lastVisitor.texts.end(), texts.begin() + BLOCK_EVENTS * (blocks.size() / 2)));
+
+    cout << EVENT_COUNT << " events: " << v1Size << " bytes in version 1, " << v2Size << " in version 2, "
+         << 100.0 * v2Size / v1Size << "%" << endl;
+}
+
+static void
+TestCorrupt()
+{
+    srand(2);
+
+    bool inFrame;
+    string good = RandomEvent(1, 1000, inFrame);
+
+    // Cut short anywhere, nothing is written and nothing gets defined
+    TestEncoder encoder;
+    bool rejected = true;
+    for (size_t size = 0; size < good.size(); size++)
+    {
+        rejected &= !encoder.EncodeEvent(good.data(), static_cast<unsigned int>(size));
+        rejected &= encoder.GetSize() == 0 && !encoder.IsSymbolDefined(1);
+    }
+    Check("truncated rejected", true, rejected);
+
+    Check("good accepted", true, encoder.EncodeEvent(good.data(), static_cast<unsigned int>(good.size())));
+    string block(encoder.GetData(), encoder.GetSize());
+
+    LogDecoder decoder;
+    TextVisitor visitor;
+    Check("good decoded", true, decoder.DecodeBlock(block.data(), static_cast<unsigned int>(block.size()), visitor));
+    Check("good text", true, visitor.text == V1ToText(good));
+
+    // As for the next segment of a log, which has to define every symbol
+    // again
+    encoder.Clear();
+    encoder.Reset();
+    Check("reset", false, encoder.IsSymbolDefined(1));
+    Check("good again", true, encoder.EncodeEvent(good.data(), static_cast<unsigned int>(good.size())));
+    Check("same as new", true, string(encoder.GetData(), encoder.GetSize()) == block);
+
+    V1Writer bad;
+    bad.Begin(1, 0);
+    bad.Content(false, "", 0);
+    bad.DWord(0);
+    Check("trailing bytes", false, encoder.EncodeEvent(bad.data.data(), static_cast<unsigned int>(bad.data.size())));
+
+    V1Writer unknown;
+    unknown.Begin(99, 0);
+    unknown.Content(false, "", 0);
+    Check("unknown symbol", false, encoder.EncodeEvent(unknown.data.data(), static_cast<unsigned int>(unknown.data.size())));
+
+    V1Writer deep;
+    for (int i = 0; i < 100; i++)
+    {
+        deep.Begin(7, 0);
+        deep.Content(false, "", 1);
+    }
+    Check("too deep", false, encoder.EncodeEvent(deep.data.data(), static_cast<unsigned int>(deep.data.size())));
+
+    // Cut short or scribbled over, the decoder stops without reading past
+    // the end of the block.  Cut after a symbol record, what's left is
+    // fine, but the event is gone.
+    bool stopped = true;
+    for (size_t size = 0; size < block.size(); size++)
+    {
+        LogDecoder fresh;
+        TextVisitor partial;
+        char *copy = new char[size];
+        memcpy(copy, block.data(), size);
+        stopped &= !fresh.DecodeBlock(copy, static_cast<unsigned int>(size), partial) || partial.events == 0;
+        delete[] copy;
+    }
+    Check("truncated stopped", true, stopped);
+
+    for (int i = 0; i < 10000; i++)
+    {
+        string scribbled = block;
+        for (int j = 0; j < 3; j++)
+            scribbled[rand() % scribbled.size()] = static_cast<char>(rand());
+
+        LogDecoder fresh;
+        TextVisitor ignored;
+        fresh.DecodeBlock(scribbled.data(), static_cast<unsigned int>(scribbled.size()), ignored);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    TestVarints();
+    TestValues();
+    TestStamps();
+    TestRoundTrip();
+    TestCorrupt();
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return failures;
+}
@@ -0,0 +1,388 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/LogFile.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Writes logs with LogFileWriter, which lays them out the way BinaryLogger
+// does, records cut into blocks with an index record every so often and
+// the final one and the trailer at the end, both as is and compressed.
+// Ids and timestamps are a little out of order, as they are when threads
+// race to submit.  Checks that LogIndexReader finds every event by id and
+// time, also once the trailer is gone, and compares the time a lookup
+// takes to a scan of the file.  Besides MSVC this builds on Linux:
+//
+//   g++ -O2 -I../.. LogIndexTest.cpp ../LogFile.cpp ../LogFormat.cpp ../LogIndex.cpp ../LzCodec.cpp ../MappedFile.cpp
+//
+
+#define EVENT_COUNT  200000
+#define BLOCK_SIZE   (64 * 1024)
+#define LOOKUPS      100000
+#define SCANS        20
+
+#ifdef _WIN32
+
+static const MappedFileChar *fileName = L"LogIndexTest.tmp";
+
+static double
+GetSeconds()
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+static void
+RemoveFile()
+{
+    DeleteFileW(fileName);
+}
+
+#else
+
+static const MappedFileChar *fileName = "LogIndexTest.tmp";
+
+static double
+GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void
+RemoveFile()
+{
+    unlink(fileName);
+}
+
+#endif
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static const char *symbolNames[] = { "event", "id", "type", "timestamp", "Send", "Recv" };
+#define SYMBOL_COUNT (sizeof(symbolNames) / sizeof(symbolNames[0]))
+
+static unsigned int ids[EVENT_COUNT];
+static unsigned long long stamps[EVENT_COUNT];
+
+// Neighbours swap places now and then
+static void
+MakeEvents()
+{
+    srand(1);
+
+    unsigned long long stamp = 128000000000000000ULL;
+    for (unsigned int i = 0; i < EVENT_COUNT; i++)
+    {
+        ids[i] = i + 1;
+        stamp += rand() % 1000;
+        stamps[i] = stamp;
+    }
+
+    for (unsigned int i = 0; i + 1 < EVENT_COUNT; i += 2 + rand() % 5)
+    {
+        unsigned int id = ids[i];
+        ids[i] = ids[i + 1];
+        ids[i + 1] = id;
+
+        unsigned long long stamp = stamps[i];
+        stamps[i] = stamps[i + 1];
+        stamps[i + 1] = stamp;
+    }
+}
+
+// Symbols come from the table above, as they would from SymbolTable
+class TestEncoder : public LogEncoder
+{
+public:
+    virtual const char *GetSymbolName(unsigned int id, unsigned int &length)
+    {
+        if (id == 0 || id > SYMBOL_COUNT)
+            return NULL;
+
+        length = static_cast<unsigned int>(strlen(symbolNames[id - 1]));
+        return symbolNames[id - 1];
+    }
+
+protected:
+    virtual unsigned int InternSymbol(const char *name, unsigned int length)
+    {
+        for (unsigned int i = 0; i < SYMBOL_COUNT; i++)
+        {
+            if (strlen(symbolNames[i]) == length && memcmp(symbolNames[i], name, length) == 0)
+                return i + 1;
+        }
+
+        return 0;
+    }
+};
+
+static void
+PutDWord(char *&p, unsigned int value)
+{
+    memcpy(p, &value, sizeof(value));
+    p += sizeof(value);
+}
+
+static void
+PutField(char *&p, unsigned int key, const char *value)
+{
+    unsigned int length = static_cast<unsigned int>(strlen(value));
+    PutDWord(p, 0x80000000 | key);
+    PutDWord(p, length);
+    memcpy(p, value, length);
+    p += length;
+}
+
+// An event element as BinaryWriter writes it, with a payload that
+// compresses a little
+static unsigned int
+BuildEvent(char *buf, unsigned int id, unsigned long long stamp)
+{
+    char text[32];
+    char *p = buf;
+
+    PutDWord(p, 0x80000000 | 1);
+    PutDWord(p, 3);
+    sprintf(text, "%u", id);
+    PutField(p, 2, text);
+    PutField(p, 3, symbolNames[4 + id % 2 - 1]);
+    sprintf(text, "%llu", stamp);
+    PutField(p, 4, text);
+
+    unsigned int size = 100 + (id * 37) % 900;
+    PutDWord(p, 1);
+    PutDWord(p, size);
+    for (unsigned int i = 0; i < size; i++)
+        p[i] = static_cast<char>((i % 16 == 0) ? rand() : i);
+    p += size;
+
+    PutDWord(p, 0);
+
+    return static_cast<unsigned int>(p - buf);
+}
+
+static void
+WriteLog(bool compressed, unsigned int count)
+{
+    TestEncoder encoder;
+    LogFileWriter writer(encoder);
+    Check("create", true, writer.Create(fileName, compressed, BLOCK_SIZE));
+
+    char event[2048];
+    bool written = true;
+    for (unsigned int i = 0; i < count; i++)
+        written &= writer.WriteEvent(event, BuildEvent(event, ids[i], stamps[i]));
+    Check("written", true, written);
+
+    Check("close", true, writer.Close());
+}
+
+// As if the process died with nothing but the trailer left to write
+static void
+RemoveTrailer()
+{
+    MappedFile file;
+    file.Open(fileName);
+    size_t size = static_cast<size_t>(file.GetSize()) - sizeof(LogTrailer);
+    char *data = new char[size];
+    void *view = file.Map(0, size);
+    memcpy(data, view, size);
+    MappedFile::Unmap(view, size);
+    file.Close();
+
+    file.Create(fileName);
+    file.SetSize(size);
+    view = file.Map(0, size);
+    memcpy(view, data, size);
+    MappedFile::Unmap(view, size);
+    file.Close();
+
+    delete[] data;
+}
+
+// Looks for the event in the blocks the index narrows it down to
+static bool
+FindEvent(LogIndexReader &reader, unsigned int id, unsigned long long &stamp, unsigned int &blocksRead)
+{
+    unsigned int first, last;
+    reader.FindId(id, first, last);
+
+    for (unsigned int i = first; i < last; i++)
+    {
+        unsigned int size;
+        const char *data = reader.ReadBlock(i, size);
+        if (data == NULL)
+            return false;
+        blocksRead++;
+
+        const char *p = data;
+        LogRecordFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        while (LogFormat::NextRecord(p, data + size, frame) != NULL)
+        {
+            if (frame.kind == LOG_RECORD_EVENT && frame.id == id)
+            {
+                stamp = frame.timestamp;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void
+CheckLog(bool compressed)
+{
+    const char *name = compressed ? "compressed" : "plain";
+
+    WriteLog(compressed, EVENT_COUNT);
+
+    LogIndexReader reader;
+    Check("open", true, reader.Open(fileName));
+    Check("complete", true, reader.IsComplete());
+    Check("compressed", compressed, reader.IsCompressed());
+
+    unsigned int length;
+    const char *symbol = reader.GetSymbolName(5, length);
+    Check("symbol", true, symbol != NULL && length == 4 && memcmp(symbol, "Send", 4) == 0);
+    Check("no symbol", true, reader.GetSymbolName(7, length) == NULL);
+
+    unsigned int missing = 0, wrongStamps = 0, blocksRead = 0;
+    double start = GetSeconds();
+    for (unsigned int i = 0; i < LOOKUPS; i++)
+    {
+        unsigned int n = (i * 7919) % EVENT_COUNT;
+        unsigned long long stamp;
+        if (!FindEvent(reader, ids[n], stamp, blocksRead))
+            missing++;
+        else if (stamp != stamps[n])
+            wrongStamps++;
+    }
+    double lookupTime = (GetSeconds() - start) / LOOKUPS;
+    Check("all found", true, missing == 0 && wrongStamps == 0);
+
+    // Every event at or after a time is in the blocks from first on
+    unsigned int early = 0;
+    for (unsigned int n = 0; n < EVENT_COUNT; n += 97)
+    {
+        unsigned int first, last;
+        reader.FindTime(stamps[n], first, last);
+
+        bool found = false;
+        for (unsigned int i = first; i < last && !found; i++)
+        {
+            const LogIndexEntry &entry = reader.GetBlock(i);
+            found = entry.minTime <= stamps[n] && entry.maxTime >= stamps[n];
+        }
+        if (!found || (first > 0 && reader.GetBlock(first - 1).maxTime >= stamps[n]))
+            early++;
+    }
+    Check("times found", true, early == 0);
+
+    unsigned int first, last;
+    reader.FindId(EVENT_COUNT + 1, first, last);
+    Check("past the end", true, first == reader.GetBlockCount() && last == first);
+    reader.FindId(0, first, last);
+    Check("before the start", true, first == 0 && last == 0);
+
+    // What it takes without the index
+    start = GetSeconds();
+    for (unsigned int i = 0; i < SCANS; i++)
+    {
+        unsigned int target = ids[EVENT_COUNT - 1 - i];
+        bool found = false;
+
+        for (unsigned int b = 0; b < reader.GetBlockCount() && !found; b++)
+        {
+            unsigned int size;
+            const char *data = reader.ReadBlock(b, size);
+            const char *p = data;
+            LogRecordFrame frame;
+            memset(&frame, 0, sizeof(frame));
+            while (!found && LogFormat::NextRecord(p, data + size, frame) != NULL)
+                found = frame.kind == LOG_RECORD_EVENT && frame.id == target;
+        }
+    }
+    double scanTime = (GetSeconds() - start) / SCANS;
+
+    cout << name << ": " << reader.GetBlockCount() << " blocks, "
+         << static_cast<double>(blocksRead) / LOOKUPS << " read per lookup, "
+         << lookupTime * 1000000.0 << " us per lookup, "
+         << scanTime * 1000000.0 << " us per scan" << endl;
+
+    reader.Close();
+
+    // The index is built from the records when there's no trailer
+    WriteLog(compressed, EVENT_COUNT / 2);
+    RemoveTrailer();
+
+    Check("open crashed", true, reader.Open(fileName));
+    Check("not complete", false, reader.IsComplete());
+    Check("crashed symbol", true, reader.GetSymbolName(5, length) != NULL);
+
+    missing = 0;
+    for (unsigned int n = 0; n < EVENT_COUNT / 2; n += 13)
+    {
+        unsigned long long stamp;
+        if (!FindEvent(reader, ids[n], stamp, blocksRead) || stamp != stamps[n])
+            missing++;
+    }
+    Check("crashed found", true, missing == 0);
+
+    reader.Close();
+    RemoveFile();
+}
+
+int
+main(int argc, char *argv[])
+{
+    MakeEvents();
+
+    CheckLog(false);
+    CheckLog(true);
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return failures;
+}
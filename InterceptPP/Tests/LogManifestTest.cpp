@@ -0,0 +1,443 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+#include <InterceptPP/LogManifest.h>
+#include <InterceptPP/LogFormat.h>
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Lists segments the way BinaryLogger does as it goes from one to the
+// next, with the totals of each one's index, the oldest ones deleted to
+// keep a window and the last one still open.  Checks the manifest after a
+// trip through a file, that lookups by id and time find the segments that
+// hold what's looked for, and that a damaged one isn't taken for good.
+// Also checks that a later segment can be read without the ones before
+// it, with the payloads it refers to written out again.  Besides MSVC
+// this builds on Linux:
+//
+//   g++ -O2 -I../.. LogManifestTest.cpp ../LogManifest.cpp ../LogIndex.cpp ../LogFormat.cpp ../LzCodec.cpp ../MappedFile.cpp
+//
+
+#define SEGMENT_COUNT       10
+#define DELETED_COUNT       4
+#define BLOCKS_PER_SEGMENT  50
+#define EVENTS_PER_BLOCK    200
+
+// Of the clock, as in a log's header
+#define TICKS_PER_SECOND    3000000000ULL
+#define START_TICKS         5000000000000ULL
+#define START_TIME          128000000000000000ULL
+
+#ifdef _WIN32
+
+static const MappedFileChar *fileName = L"LogManifestTest.tmp";
+
+static void
+RemoveFile()
+{
+    DeleteFileW(fileName);
+}
+
+#else
+
+static const MappedFileChar *fileName = "LogManifestTest.tmp";
+
+static void
+RemoveFile()
+{
+    unlink(fileName);
+}
+
+#endif
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+// Of the events in a block, which overlap a little with the next one's
+static void
+GetBlockRanges(unsigned int block, LogIndexEntry &entry)
+{
+    LogIndexWriter::InitEntry(entry, 0);
+
+    entry.minId = block * EVENTS_PER_BLOCK + 1;
+    entry.maxId = entry.minId + EVENTS_PER_BLOCK + 2;
+    entry.minTime = START_TICKS + block * 30000000ULL;
+    entry.maxTime = entry.minTime + 30000000ULL + 1000;
+    entry.events = EVENTS_PER_BLOCK;
+    entry.size = 65536;
+}
+
+static void
+BuildManifest(LogManifest &manifest, LogFileHeader &header)
+{
+    LogFormat::InitHeader(header, 65536, 0);
+    header.ticksPerSecond = TICKS_PER_SECOND;
+    header.startTicks = START_TICKS;
+    header.startTime = START_TIME;
+
+    LogIndexWriter index;
+
+    for (unsigned int s = 0; s < SEGMENT_COUNT; s++)
+    {
+        index.Reset();
+
+        LogSegmentEntry &segment = manifest.AddSegment(s + 1, START_TIME + s);
+        Check("open", true, (segment.flags & LOG_SEGMENT_OPEN) != 0);
+
+        unsigned long long offset = sizeof(LogFileHeader);
+        for (unsigned int b = 0; b < BLOCKS_PER_SEGMENT; b++)
+        {
+            LogIndexEntry entry;
+            GetBlockRanges(s * BLOCKS_PER_SEGMENT + b, entry);
+            entry.offset = offset;
+            offset += entry.size;
+
+            index.AddEntry(entry);
+        }
+
+        LogIndexEntry totals;
+        index.GetTotals(totals);
+
+        LogIndexEntry first, last;
+        GetBlockRanges(s * BLOCKS_PER_SEGMENT, first);
+        GetBlockRanges(s * BLOCKS_PER_SEGMENT + BLOCKS_PER_SEGMENT - 1, last);
+        Check("totals", true, totals.offset == sizeof(LogFileHeader) && totals.minId == first.minId &&
+              totals.maxId == last.maxId && totals.minTime == first.minTime && totals.maxTime == last.maxTime &&
+              totals.events == BLOCKS_PER_SEGMENT * EVENTS_PER_BLOCK &&
+              totals.size == BLOCKS_PER_SEGMENT * 65536U);
+
+        // The last one is left open, as if the process died
+        if (s + 1 < SEGMENT_COUNT)
+            LogManifest::CloseSegment(manifest.GetSegment(s), totals, header, offset);
+    }
+
+    // Nothing left over for the next file
+    index.Reset();
+
+    LogIndexEntry totals;
+    index.GetTotals(totals);
+    Check("reset totals", true, totals.events == 0 && totals.minId > totals.maxId);
+
+    LogTrailer trailer;
+    index.BuildTrailer(trailer);
+    Check("reset trailer", true, trailer.indexOffset == LOG_INDEX_NONE);
+
+    for (unsigned int s = 0; s < DELETED_COUNT; s++)
+        manifest.GetSegment(s).flags |= LOG_SEGMENT_DELETED;
+}
+
+static void
+CheckLookups(const LogManifest &manifest, const LogFileHeader &header)
+{
+    unsigned int open = SEGMENT_COUNT - 1;
+
+    for (unsigned int s = 0; s < SEGMENT_COUNT; s++)
+    {
+        for (unsigned int b = 0; b < BLOCKS_PER_SEGMENT; b += 7)
+        {
+            LogIndexEntry entry;
+            GetBlockRanges(s * BLOCKS_PER_SEGMENT + b, entry);
+
+            unsigned int id = entry.minId + EVENTS_PER_BLOCK / 2;
+            unsigned long long fileTime = LogFormat::GetFileTime(header, entry.minTime + 1000000);
+
+            unsigned int idFirst, idLast, timeFirst, timeLast;
+            manifest.FindId(id, idFirst, idLast);
+            manifest.FindTime(fileTime, timeFirst, timeLast);
+
+            if (s < DELETED_COUNT)
+            {
+                // Only the open one could hold it
+                Check("deleted id", true, idFirst == open && idLast == open + 1);
+                Check("deleted time", true, timeFirst == open && timeLast == open + 1);
+            }
+            else
+            {
+                Check("id", true, idFirst == s && idLast == SEGMENT_COUNT);
+                Check("time", true, timeFirst == s && timeLast == SEGMENT_COUNT);
+            }
+        }
+    }
+
+    // Between the ends of two segments, both of them
+    LogIndexEntry entry;
+    GetBlockRanges(6 * BLOCKS_PER_SEGMENT, entry);
+
+    unsigned int first, last;
+    manifest.FindId(entry.minId, first, last);
+    Check("overlap", true, first == 5 && last == SEGMENT_COUNT);
+
+    // Past the end, only the open one
+    manifest.FindId(~0U, first, last);
+    Check("past the end", true, first == open && last == open + 1);
+
+    LogManifest empty;
+    empty.FindTime(START_TIME, first, last);
+    Check("empty", true, first == last);
+}
+
+static void
+CheckFile(LogManifest &manifest, const LogFileHeader &header)
+{
+    unsigned int size;
+    const char *data = manifest.Build(size);
+    Check("size", true, size == sizeof(LogManifestHeader) + SEGMENT_COUNT * sizeof(LogSegmentEntry));
+
+    string expected(data, size);
+
+    FILE *f = fopen("LogManifestTest.tmp", "wb");
+    fwrite(data, 1, size, f);
+    fclose(f);
+
+    LogManifest loaded;
+    Check("load", true, loaded.Load(fileName));
+    RemoveFile();
+
+    Check("segment count", true, loaded.GetSegmentCount() == SEGMENT_COUNT);
+    data = loaded.Build(size);
+    Check("same", true, string(data, size) == expected);
+
+    const LogSegmentEntry &segment = loaded.GetSegment(5);
+    Check("ranges", true, segment.sequence == 6 && segment.flags == 0 && segment.openTime == START_TIME + 5 &&
+          segment.events == BLOCKS_PER_SEGMENT * EVENTS_PER_BLOCK &&
+          segment.size == sizeof(LogFileHeader) + BLOCKS_PER_SEGMENT * 65536ULL);
+
+    LogIndexEntry entry;
+    GetBlockRanges(5 * BLOCKS_PER_SEGMENT, entry);
+    Check("min time", true, segment.minTime == LogFormat::GetFileTime(header, entry.minTime));
+
+    CheckLookups(loaded, header);
+
+    // Damaged
+    Check("truncated", false, loaded.Parse(expected.data(), size - 1));
+    Check("header only", false, loaded.Parse(expected.data(), sizeof(LogManifestHeader) - 1));
+    Check("cleared", true, loaded.GetSegmentCount() == 0);
+
+    string bad = expected;
+    bad[0] ^= 1;
+    Check("magic", false, loaded.Parse(bad.data(), size));
+
+    bad = expected;
+    bad[2 * sizeof(unsigned int)]++;
+    Check("count", false, loaded.Parse(bad.data(), size));
+
+    Check("missing", false, loaded.Load(fileName));
+}
+
+static const char *symbolNames[] = {
+    "event", "id", "type", "timestamp", "Send", "data", "payloadId", "payloadRef",
+};
+#define SYMBOL_COUNT (sizeof(symbolNames) / sizeof(symbolNames[0]))
+
+enum { SYM_EVENT = 1, SYM_ID, SYM_TYPE, SYM_TIMESTAMP, SYM_SEND, SYM_DATA, SYM_PAYLOAD_ID, SYM_PAYLOAD_REF };
+
+static const char *payloads[] = {
+    "GET / HTTP/1.0\r\n\r\n",
+    "POST / HTTP/1.0\r\n\r\n",
+};
+
+// With the symbols above, as they would come from SymbolTable, and the
+// payloads above as those PayloadTable knows of
+class SegmentEncoder : public LogEncoder
+{
+public:
+    SegmentEncoder()
+    {
+        SetPayloadKeys(SYM_PAYLOAD_ID, SYM_PAYLOAD_REF);
+    }
+
+    virtual const char *GetSymbolName(unsigned int id, unsigned int &length)
+    {
+        if (id == 0 || id > SYMBOL_COUNT)
+            return NULL;
+
+        length = static_cast<unsigned int>(strlen(symbolNames[id - 1]));
+        return symbolNames[id - 1];
+    }
+
+protected:
+    virtual unsigned int InternSymbol(const char *name, unsigned int length)
+    {
+        for (unsigned int i = 0; i < SYMBOL_COUNT; i++)
+        {
+            if (strlen(symbolNames[i]) == length && memcmp(symbolNames[i], name, length) == 0)
+                return i + 1;
+        }
+
+        return 0;
+    }
+
+    virtual const char *ResolvePayload(unsigned int id, unsigned int &length)
+    {
+        if (id == 0 || id > sizeof(payloads) / sizeof(payloads[0]))
+            return NULL;
+
+        length = static_cast<unsigned int>(strlen(payloads[id - 1]));
+        return payloads[id - 1];
+    }
+};
+
+static void
+AppendDWord(string &data, unsigned int value)
+{
+    data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void
+AppendString(string &data, const string &s)
+{
+    AppendDWord(data, static_cast<unsigned int>(s.size()));
+    data += s;
+}
+
+// A Send event as BinaryWriter writes it, its data carrying the payload
+// with a payloadId, or without content and with a payloadRef
+static string
+BuildSendEvent(unsigned int id, unsigned int payload, bool reference)
+{
+    char buf[16];
+    string data;
+
+    AppendDWord(data, 0x80000000 | SYM_EVENT);
+    AppendDWord(data, 3);
+    sprintf(buf, "%u", id);
+    AppendDWord(data, 0x80000000 | SYM_ID);
+    AppendString(data, buf);
+    AppendDWord(data, 0x80000000 | SYM_TYPE);
+    AppendString(data, "Send");
+    AppendDWord(data, 0x80000000 | SYM_TIMESTAMP);
+    AppendString(data, "128000000000000000");
+    AppendDWord(data, 0);
+    AppendString(data, "");
+    AppendDWord(data, 1);
+
+    AppendDWord(data, 0x80000000 | SYM_DATA);
+    AppendDWord(data, 1);
+    sprintf(buf, "%u", payload);
+    AppendDWord(data, 0x80000000 | (reference ? SYM_PAYLOAD_REF : SYM_PAYLOAD_ID));
+    AppendString(data, buf);
+    AppendDWord(data, 1);
+    AppendString(data, reference ? "" : payloads[payload - 1]);
+    AppendDWord(data, 0);
+
+    return data;
+}
+
+// The payload fields of the data elements, and their content
+class PayloadVisitor : public LogVisitor
+{
+public:
+    virtual void BeginElement(const char *name, unsigned int length) {}
+
+    virtual void Field(const char *key, unsigned int keyLength, const LogValue &value)
+    {
+        string k(key, keyLength);
+        if (k != "payloadId" && k != "payloadRef")
+            return;
+
+        char buf[LOG_MAX_VALUE_TEXT];
+        unsigned int length;
+        const char *s = LogFormat::GetText(value, buf, length);
+
+        text += k + "=" + string(s, length) + " ";
+    }
+
+    virtual void Content(bool raw, const char *data, unsigned int length)
+    {
+        if (length > 0)
+            text += "\"" + string(data, length) + "\" ";
+    }
+
+    virtual void EndElement() {}
+
+    string text;
+};
+
+static void
+CheckSegmentOnItsOwn()
+{
+    SegmentEncoder encoder;
+    LogFileHeader header;
+    LogFormat::InitHeader(header, 65536, 0);
+
+    // The first segment defines both payloads
+    string first[2] = {
+        BuildSendEvent(1, 1, false),
+        BuildSendEvent(2, 2, false),
+    };
+    for (unsigned int i = 0; i < 2; i++)
+        Check("first segment", true, encoder.EncodeEvent(first[i].data(), static_cast<unsigned int>(first[i].size())));
+
+    // As BinaryLogger does when it opens the next one
+    encoder.Reset();
+    encoder.Clear();
+
+    string second[3] = {
+        BuildSendEvent(3, 1, true),
+        BuildSendEvent(4, 1, true),
+        BuildSendEvent(5, 3, true),
+    };
+    for (unsigned int i = 0; i < 3; i++)
+        Check("second segment", true, encoder.EncodeEvent(second[i].data(), static_cast<unsigned int>(second[i].size())));
+
+    // Read with a decoder that has seen nothing else
+    LogDecoder decoder;
+    decoder.SetHeader(header);
+    PayloadVisitor visitor;
+    Check("decode on its own", true, decoder.DecodeBlock(encoder.GetData(), encoder.GetSize(), visitor));
+
+    // The first reference carries the payload again, the second can refer
+    // to it, and one that's nowhere to be found stays as it is
+    Check("payloads written again", true, visitor.text == string("payloadId=1 \"") + payloads[0] + "\" payloadRef=1 payloadRef=3 ");
+}
+
+int
+main(int argc, char *argv[])
+{
+    LogManifest manifest;
+    LogFileHeader header;
+
+    BuildManifest(manifest, header);
+    CheckLookups(manifest, header);
+    CheckFile(manifest, header);
+    CheckSegmentOnItsOwn();
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return failures;
+}
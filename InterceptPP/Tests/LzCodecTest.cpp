@@ -0,0 +1,249 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/LzCodec.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks that LzCodec gets back what it compressed, whether that
+// compresses or not, and that it rejects corrupt data without writing
+// past the end of the buffer.  Then compresses a few MB that look like
+// what the agent logs, block by block, to see how small and how fast.
+// Besides MSVC this builds on Linux:
+//
+//   g++ -O2 -I../.. LzCodecTest.cpp ../LzCodec.cpp
+//
+
+#define SAMPLE_SIZE (8 * 1024 * 1024)
+#define ROUNDS      5
+
+#ifdef _WIN32
+
+static double
+GetSeconds()
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+#else
+
+static double
+GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+#endif
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static LzCodec codec;
+
+static bool
+RoundTrip(const char *data, unsigned int size)
+{
+    char *block = new char[LzCodec::GetMaxBlockSize(size)];
+    char *back = new char[size + 1];
+
+    unsigned int blockSize = codec.CompressBlock(data, size, block);
+    const LzBlockHeader *header = reinterpret_cast<const LzBlockHeader *>(block);
+
+    bool ok = blockSize == LzCodec::GetBlockSize(header->storedSize) && header->rawSize == size &&
+              LzCodec::DecompressBlock(header, header + 1, back, size) == static_cast<int>(size) &&
+              memcmp(back, data, size) == 0;
+
+    delete[] block;
+    delete[] back;
+
+    return ok;
+}
+
+// Text fields and payloads that repeat with small differences
+static unsigned int
+MakeLogLike(char *buf, unsigned int size)
+{
+    static const char *functions[] = { "send", "recv", "WSASend", "WSARecv", "connect", "DeviceIoControl" };
+    unsigned int pos = 0;
+    unsigned int id = 1000;
+
+    while (pos + 1024 < size)
+    {
+        pos += sprintf(buf + pos,
+                       "<event id=\"%u\" type=\"FunctionCall\" timestamp=\"%u\" processName=\"msnmsgr.exe\" "
+                       "processId=\"3412\" threadId=\"%u\"><name>ws2_32.dll::%s</name><arguments>"
+                       "<argument direction=\"in\"><value type=\"Pointer\" value=\"0x%08x\"/></argument>",
+                       id, 1200000 + id * 3, 1500 + id % 4, functions[id % 6], 0x12f000 + (id % 64) * 16);
+
+        if (id % 3 == 0)
+        {
+            pos += sprintf(buf + pos, "MSG %u U %u\r\nMIME-Version: 1.0\r\nContent-Type: text/plain; "
+                           "charset=UTF-8\r\n\r\nhello %u", id % 97, 120 + id % 50, id);
+        }
+        else if (id % 7 == 0)
+        {
+            // Something that doesn't compress
+            for (unsigned int i = 0; i < 200; i++)
+                buf[pos++] = static_cast<char>(rand());
+        }
+
+        pos += sprintf(buf + pos, "</arguments><returnValue value=\"%u\"/></event>", id % 5);
+        id++;
+    }
+
+    return pos;
+}
+
+static void
+CheckCodec()
+{
+    static char data[300 * 1024];
+
+    Check("empty", true, RoundTrip(data, 0));
+    Check("one byte", true, RoundTrip("x", 1));
+
+    memset(data, 'a', sizeof(data));
+    Check("repeated", true, RoundTrip(data, sizeof(data)));
+
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = static_cast<char>(rand());
+    Check("random", true, RoundTrip(data, sizeof(data)));
+
+    char block[LZ_MAX_BLOCK_SIZE + 1024];
+    codec.CompressBlock(data, 1000, block);
+    Check("random stored as is", true, reinterpret_cast<LzBlockHeader *>(block)->storedSize == 1000);
+
+    unsigned int size = MakeLogLike(data, LZ_MAX_BLOCK_SIZE);
+    Check("log-like", true, RoundTrip(data, size));
+
+    unsigned int blockSize = codec.CompressBlock(data, size, block);
+    const LzBlockHeader *header = reinterpret_cast<const LzBlockHeader *>(block);
+    Check("log-like compressed", true, header->storedSize < size / 2);
+
+    static char back[LZ_MAX_BLOCK_SIZE];
+    Check("too small", true, LzCodec::Decompress(header + 1, header->storedSize, back, size - 1) == -1);
+    Check("truncated", true, LzCodec::Decompress(header + 1, header->storedSize - 1, back, size) != static_cast<int>(size));
+
+    // Whatever garbage it's given, it stays within the buffer
+    for (unsigned int round = 0; round < 1000; round++)
+    {
+        char corrupt[LZ_MAX_BLOCK_SIZE + 1024];
+        memcpy(corrupt, block, blockSize);
+        for (unsigned int i = 0; i < 8; i++)
+            corrupt[sizeof(LzBlockHeader) + rand() % header->storedSize] = static_cast<char>(rand());
+
+        LzCodec::Decompress(corrupt + sizeof(LzBlockHeader), header->storedSize, back, sizeof(back));
+    }
+}
+
+static void
+Benchmark(unsigned int blockSize)
+{
+    static char *sample = NULL;
+    static unsigned int sampleSize;
+    if (sample == NULL)
+    {
+        sample = new char[SAMPLE_SIZE];
+        sampleSize = MakeLogLike(sample, SAMPLE_SIZE);
+    }
+
+    char *compressed = new char[sampleSize + (sampleSize / blockSize + 1) * (sizeof(LzBlockHeader) + LZ_BLOCK_ALIGNMENT)];
+    char *back = new char[sampleSize];
+
+    unsigned int compressedSize = 0;
+    double start = GetSeconds();
+    for (unsigned int round = 0; round < ROUNDS; round++)
+    {
+        compressedSize = 0;
+        for (unsigned int pos = 0; pos < sampleSize; pos += blockSize)
+        {
+            unsigned int size = (sampleSize - pos < blockSize) ? sampleSize - pos : blockSize;
+            compressedSize += codec.CompressBlock(sample + pos, size, compressed + compressedSize);
+        }
+    }
+    double compressTime = (GetSeconds() - start) / ROUNDS;
+
+    bool intact = true;
+    start = GetSeconds();
+    for (unsigned int round = 0; round < ROUNDS; round++)
+    {
+        unsigned int pos = 0, backSize = 0;
+        while (pos < compressedSize)
+        {
+            const LzBlockHeader *header = reinterpret_cast<const LzBlockHeader *>(compressed + pos);
+            int size = LzCodec::DecompressBlock(header, header + 1, back + backSize, sampleSize - backSize);
+            if (size < 0)
+            {
+                intact = false;
+                break;
+            }
+
+            pos += LzCodec::GetBlockSize(header->storedSize);
+            backSize += size;
+        }
+
+        intact = intact && backSize == sampleSize;
+    }
+    double decompressTime = (GetSeconds() - start) / ROUNDS;
+
+    Check("benchmark intact", true, intact && memcmp(back, sample, sampleSize) == 0);
+
+    double mb = sampleSize / (1024.0 * 1024.0);
+    cout << blockSize / 1024 << " KB blocks: " << 100.0 * compressedSize / sampleSize << "% of "
+         << static_cast<unsigned int>(mb) << " MB, compressing at " << static_cast<unsigned int>(mb / compressTime)
+         << " MB/s, decompressing at " << static_cast<unsigned int>(mb / decompressTime) << " MB/s" << endl;
+
+    delete[] compressed;
+    delete[] back;
+}
+
+int main(int argc, char *argv[])
+{
+    CheckCodec();
+
+    for (unsigned int blockSize = LZ_MIN_BLOCK_SIZE; blockSize <= LZ_MAX_BLOCK_SIZE; blockSize *= 2)
+        Benchmark(blockSize);
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
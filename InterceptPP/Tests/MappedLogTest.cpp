@@ -0,0 +1,345 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/MappedLog.h>
+#include <iostream>
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks MappedLog and MappedLogReader, including a log left behind by a
+// process that died with records reserved and not committed, then has
+// several threads write records of the sizes events usually come in
+// straight into a log, and reads them back to check that each one is
+// there, intact and in the order its thread wrote it.  Besides MSVC this
+// builds on Linux:
+//
+//   g++ -O2 -I../.. MappedLogTest.cpp ../MappedLog.cpp ../MappedFile.cpp -lpthread
+//
+
+#define MAX_PRODUCERS        8
+#define RECORDS_PER_PRODUCER 100000
+#define EXTENT_SIZE          (1024 * 1024)
+
+#ifdef _WIN32
+
+static const MappedFileChar *fileName = L"MappedLogTest.tmp";
+
+typedef HANDLE ThreadHandle;
+
+static ThreadHandle
+StartThread(LPTHREAD_START_ROUTINE func, void *param)
+{
+    return CreateThread(NULL, 0, func, param, 0, NULL);
+}
+
+static void
+JoinThread(ThreadHandle thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static double
+GetSeconds()
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+static void
+RemoveFile()
+{
+    DeleteFileW(fileName);
+}
+
+#define THREAD_FUNC DWORD WINAPI
+
+#else
+
+static const MappedFileChar *fileName = "MappedLogTest.tmp";
+
+typedef pthread_t ThreadHandle;
+typedef void *(*ThreadFunc)(void *);
+
+static ThreadHandle
+StartThread(ThreadFunc func, void *param)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, func, param);
+    return thread;
+}
+
+static void
+JoinThread(ThreadHandle thread)
+{
+    pthread_join(thread, NULL);
+}
+
+static double
+GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void
+RemoveFile()
+{
+    unlink(fileName);
+}
+
+#define THREAD_FUNC void *
+
+#endif
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static bool
+Write(MappedLog &log, const char *data, unsigned int size)
+{
+    MappedLogReservation res;
+    void *p = log.Reserve(size, res);
+    if (p == NULL)
+        return false;
+
+    memcpy(p, data, size);
+    log.Commit(res);
+
+    return true;
+}
+
+static bool
+ReadBack(MappedLogReader &reader, const char *data, unsigned int size)
+{
+    unsigned int readSize;
+    const void *p = reader.Next(readSize);
+
+    return p != NULL && readSize == size && memcmp(p, data, size) == 0;
+}
+
+static void
+CheckLog()
+{
+    static char data[256 * 1024];
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = static_cast<char>(i * 7);
+
+    MappedLog log;
+    Check("create", true, log.Create(fileName, 1));
+
+    unsigned int extentSize = log.GetExtentSize();
+    Check("rounded up", true, extentSize == MappedFile::GetGranularity());
+    Check("max size", true, log.GetMaxRecordSize() == extentSize - 24);
+
+    MappedLogReservation res;
+    Check("too big", true, log.Reserve(log.GetMaxRecordSize() + 1, res) == NULL);
+
+    Check("first", true, Write(log, data, 100));
+    Check("empty record", true, Write(log, data, 0));
+    // Doesn't fit after the others, so it starts the second extent
+    Check("biggest", true, Write(log, data + 1, log.GetMaxRecordSize()));
+    // Fills the rest of it, which leaves nothing to pad
+    Check("exact fit", true, Write(log, data + 6, 8));
+    Check("last", true, Write(log, data + 2, 100));
+
+    log.Close();
+
+    MappedLogReader reader;
+    Check("open", true, reader.Open(fileName));
+    Check("first back", true, ReadBack(reader, data, 100));
+    Check("empty record back", true, ReadBack(reader, data, 0));
+    Check("biggest back", true, ReadBack(reader, data + 1, log.GetMaxRecordSize()));
+    Check("exact fit back", true, ReadBack(reader, data + 6, 8));
+    Check("last back", true, ReadBack(reader, data + 2, 100));
+
+    unsigned int size;
+    Check("end", true, reader.Next(size) == NULL);
+    Check("nothing torn", true, reader.GetTornRecords() == 0 && reader.GetHoles() == 0);
+    reader.Close();
+
+    Check("create again", true, log.Create(fileName, 1));
+    Check("before", true, Write(log, data, 100));
+
+    // Died between reserving and committing...
+    MappedLogReservation torn;
+    char *p = static_cast<char *>(log.Reserve(200, torn));
+    Check("torn", true, p != NULL);
+    memcpy(p, data + 3, 50);
+
+    Check("between", true, Write(log, data + 4, 100));
+
+    // ...and before writing the size
+    MappedLogReservation hole;
+    Check("hole", true, log.Reserve(300, hole) != NULL);
+    hole.header->size = 0;
+
+    Check("after", true, Write(log, data + 5, 100));
+
+    // Read without closing, which is what is in the file when the process
+    // dies there
+    Check("open crashed", true, reader.Open(fileName));
+    Check("before back", true, ReadBack(reader, data, 100));
+    Check("between back", true, ReadBack(reader, data + 4, 100));
+    Check("after back", true, ReadBack(reader, data + 5, 100));
+    Check("crashed end", true, reader.Next(size) == NULL);
+    Check("torn counted", true, reader.GetTornRecords() == 1);
+    Check("hole counted", true, reader.GetHoles() == 1);
+    reader.Close();
+
+    log.Close();
+}
+
+static const unsigned int recordSizes[] = { 48, 96, 160, 200, 320, 640, 1200, 4000 };
+#define RECORD_SIZE_COUNT (sizeof(recordSizes) / sizeof(recordSizes[0]))
+
+typedef struct {
+    unsigned int producer;
+    unsigned int seq;
+} RecordStart;
+
+static MappedLog sharedLog;
+
+static THREAD_FUNC
+ProducerThread(void *param)
+{
+    unsigned int producer = static_cast<unsigned int>(reinterpret_cast<size_t>(param));
+
+    for (unsigned int seq = 0; seq < RECORDS_PER_PRODUCER; seq++)
+    {
+        unsigned int size = recordSizes[(seq + producer) % RECORD_SIZE_COUNT];
+
+        MappedLogReservation res;
+        char *p = static_cast<char *>(sharedLog.Reserve(size, res));
+        if (p == NULL)
+        {
+            cout << "reserve failed" << endl;
+            break;
+        }
+
+        RecordStart *start = reinterpret_cast<RecordStart *>(p);
+        start->producer = producer;
+        start->seq = seq;
+        for (unsigned int i = sizeof(RecordStart); i < size; i++)
+            p[i] = static_cast<char>(seq + i);
+
+        sharedLog.Commit(res);
+    }
+
+    return 0;
+}
+
+static bool
+CheckRecord(const char *p, unsigned int size, unsigned int *nextSeq)
+{
+    const RecordStart *start = reinterpret_cast<const RecordStart *>(p);
+    if (size < sizeof(RecordStart) || start->producer >= MAX_PRODUCERS)
+        return false;
+
+    unsigned int seq = start->seq;
+    if (seq != nextSeq[start->producer]++ || size != recordSizes[(seq + start->producer) % RECORD_SIZE_COUNT])
+        return false;
+
+    for (unsigned int i = sizeof(RecordStart); i < size; i++)
+    {
+        if (p[i] != static_cast<char>(seq + i))
+            return false;
+    }
+
+    return true;
+}
+
+static void
+RunProducers(unsigned int producers)
+{
+    Check("create shared", true, sharedLog.Create(fileName, EXTENT_SIZE));
+
+    double start = GetSeconds();
+
+    ThreadHandle threads[MAX_PRODUCERS];
+    for (unsigned int i = 0; i < producers; i++)
+        threads[i] = StartThread(ProducerThread, reinterpret_cast<void *>(static_cast<size_t>(i)));
+    for (unsigned int i = 0; i < producers; i++)
+        JoinThread(threads[i]);
+
+    double elapsed = GetSeconds() - start;
+
+    sharedLog.Close();
+
+    unsigned int nextSeq[MAX_PRODUCERS];
+    memset(nextSeq, 0, sizeof(nextSeq));
+
+    MappedLogReader reader;
+    Check("open shared", true, reader.Open(fileName));
+
+    unsigned int count = 0, bad = 0;
+    unsigned long long bytes = 0;
+    const void *rec;
+    unsigned int size;
+    while ((rec = reader.Next(size)) != NULL)
+    {
+        if (!CheckRecord(static_cast<const char *>(rec), size, nextSeq))
+            bad++;
+        count++;
+        bytes += size;
+    }
+
+    Check("all there", true, count == producers * RECORDS_PER_PRODUCER && bad == 0);
+    Check("none torn", true, reader.GetTornRecords() == 0 && reader.GetHoles() == 0);
+    reader.Close();
+
+    cout << producers << " producers: " << count << " records, "
+         << static_cast<unsigned int>(count / elapsed) << " records/s, "
+         << static_cast<unsigned int>(bytes / elapsed / (1024 * 1024)) << " MB/s" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    CheckLog();
+
+    for (unsigned int producers = 1; producers <= MAX_PRODUCERS; producers *= 2)
+        RunProducers(producers);
+
+    RemoveFile();
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,420 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/Core.h>
+#include <InterceptPP/HookManager.h>
+#include <InterceptPP/ConsoleLogger.h>
+#include <InterceptPP/Marshallers.h>
+#include <InterceptPP/MarshallerProgram.h>
+#include <InterceptPP/RawCapture.h>
+#include <iostream>
+
+using namespace std;
+using namespace InterceptPP;
+using namespace InterceptPP::Marshaller;
+
+#define ITERATIONS            1000
+#define CHECK_ARGUMENT_BYTES  256
+
+#define REGION_MAX_BASE       0x00400000
+#define REGION_MAX_ELEMENT    16
+
+//
+// Loads config.xml (or the file given on the command line) through
+// HookManager and logs the arguments of every FunctionSpec in it, on the way
+// in and on the way out, once with the compiled Programs and once with the
+// tree walker that ToNode() is built on.  Checks that the resulting trees
+// are identical, first with the limits in the file and then with a small
+// per-argument budget so that truncation is covered too, and prints the time
+// spent per call under the small budget.
+//
+// The arguments, the registers and everything they point at come from one
+// region where every DWORD holds the region's own address.  Any DWORD is then
+// a valid pointer, strings are empty as the address is 64 KB aligned, and a
+// size or element count read from it is the address itself, which the region
+// is big enough to cover for elements of up to REGION_MAX_ELEMENT bytes.
+//
+// Then checks that both paths truncate buffers the same way under a
+// CaptureBudget, and that property bindings resolve to argument indexes.
+//
+
+class BudgetPropertyProvider : public IPropertyProvider
+{
+public:
+    BudgetPropertyProvider(CaptureBudget *budget)
+        : m_budget(budget)
+    {}
+
+    virtual bool QueryForProperty(const OString &query, int &result) { return false; }
+    virtual bool QueryForProperty(const OString &query, unsigned int &result) { return false; }
+    virtual bool QueryForProperty(const OString &query, void *&result) { return false; }
+    virtual bool QueryForProperty(const OString &query, va_list &result) { return false; }
+    virtual bool QueryForProperty(const OString &query, OString &result) { return false; }
+
+    virtual CaptureBudget *GetCaptureBudget() { return m_budget; }
+
+protected:
+    CaptureBudget *m_budget;
+};
+
+static void
+DumpNode(const Logging::Node *node, OString &result)
+{
+    result += "<";
+    result += node->GetName();
+
+    for (const Logging::NodeField *field = node->GetFirstField(); field != NULL; field = field->next)
+    {
+        result += " ";
+        result += field->name;
+        result += "=\"";
+        result += field->value;
+        result += "\"";
+    }
+
+    result += ">";
+    result.append(node->GetContent(), node->GetContentSize());
+
+    for (const Logging::Node *child = node->GetFirstChild(); child != NULL; child = child->GetNextSibling())
+    {
+        DumpNode(child, result);
+    }
+
+    result += "</";
+    result += node->GetName();
+    result += ">";
+}
+
+static OString
+DumpNode(const Logging::Node *node)
+{
+    OString result;
+    if (node != NULL)
+        DumpNode(node, result);
+    return result;
+}
+
+static double
+GetSeconds(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return static_cast<double>(end.QuadPart - start.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+static DWORD *
+AllocateRegion()
+{
+    for (DWORD base = 0x10000; base <= REGION_MAX_BASE; base += 0x10000)
+    {
+        SIZE_T size = (REGION_MAX_ELEMENT + 1) * static_cast<SIZE_T>(base);
+
+        DWORD *region = static_cast<DWORD *>(VirtualAlloc(reinterpret_cast<LPVOID>(base), size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+        if (region == NULL)
+            continue;
+
+        for (SIZE_T i = 0; i < size / sizeof(DWORD); i++)
+            region[i] = base;
+
+        return region;
+    }
+
+    return NULL;
+}
+
+static OString
+DumpArguments(FunctionCall &call, bool compiled)
+{
+    Marshaller::Program::SetEnabled(compiled);
+
+    Logging::TreeWriter writer;
+    call.WriteArguments(writer);
+
+    Logging::Node *root = writer.GetRoot();
+    OString result = DumpNode(root);
+    delete root;
+
+    return result;
+}
+
+static double
+TimeArguments(FunctionCall &call, bool compiled)
+{
+    Marshaller::Program::SetEnabled(compiled);
+
+    LARGE_INTEGER start, end;
+
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        Logging::TreeWriter writer;
+        call.WriteArguments(writer);
+        delete writer.GetRoot();
+    }
+    QueryPerformanceCounter(&end);
+
+    return GetSeconds(start, end);
+}
+
+static bool
+CheckFunctionSpec(const OString &name, FunctionSpec *spec, DWORD *region, bool timeIt, double &treeTotal, double &progTotal)
+{
+    ArgumentListSpec *argList = spec->GetArguments();
+    if (argList == NULL || spec->GetArgsSize() == FUNCTION_ARGS_SIZE_UNKNOWN)
+        return true;
+
+    unsigned int compiled = 0, total = 0;
+    for (unsigned int i = 0; i < argList->GetCount(); i++)
+    {
+        ArgumentSpec *argSpec = (*argList)[i];
+        ArgumentDirection dirs[2] = { ARG_DIR_IN, ARG_DIR_OUT };
+
+        for (int j = 0; j < 2; j++)
+        {
+            if (argSpec->GetMarshaller(dirs[j]) == NULL)
+                continue;
+
+            total++;
+            if (argSpec->GetProgram(dirs[j]) != NULL)
+                compiled++;
+        }
+    }
+
+    CpuContext ctx;
+    for (unsigned int i = 0; i < sizeof(ctx) / sizeof(DWORD); i++)
+        reinterpret_cast<DWORD *>(&ctx)[i] = region[0];
+
+    Function func(spec);
+    FunctionCall call(&func, region, &ctx);
+    call.SetCpuContextLive(&ctx);
+    call.SetCpuContextLeave(&ctx);
+
+    bool success = true;
+    double treeTime = 0.0, progTime = 0.0;
+
+    FunctionCallState states[2] = { FUNCTION_CALL_ENTERING, FUNCTION_CALL_LEAVING };
+    for (int i = 0; i < 2; i++)
+    {
+        call.SetState(states[i]);
+
+        OString treeDump = DumpArguments(call, false);
+        OString progDump = DumpArguments(call, true);
+
+        if (treeDump != progDump)
+        {
+            cout << name << ((i == 0) ? " (in)" : " (out)") << ": MISMATCH" << endl;
+            cout << "  tree:    " << treeDump << endl;
+            cout << "  program: " << progDump << endl;
+            success = false;
+            continue;
+        }
+
+        if (timeIt)
+        {
+            treeTime += TimeArguments(call, false);
+            progTime += TimeArguments(call, true);
+        }
+    }
+
+    Marshaller::Program::SetEnabled(true);
+
+    if (timeIt && success)
+    {
+        cout << name << ": " << compiled << "/" << total << " compiled, "
+             << (treeTime * 1000000.0 / ITERATIONS) << " us/call tree, "
+             << (progTime * 1000000.0 / ITERATIONS) << " us/call program ("
+             << (treeTime / progTime) << "x)" << endl;
+
+        treeTotal += treeTime;
+        progTotal += progTime;
+    }
+
+    return success;
+}
+
+static bool
+CheckConfig(const OWString &path)
+{
+    HookManager *mgr = HookManager::Instance();
+
+    try
+    {
+        mgr->LoadDefinitions(path);
+    }
+    catch (Error &e)
+    {
+        cout << "LoadDefinitions failed: " << e.what() << endl;
+        return false;
+    }
+
+    // The tree walker is what these are checked against, and what raw
+    // capture would use instead of either
+    RawSchema::SetEnabled(false);
+
+    HookManager::FunctionSpecList specs;
+    mgr->GetFunctionSpecs(specs);
+    if (specs.empty())
+    {
+        cout << "no function specs loaded" << endl;
+        return false;
+    }
+
+    DWORD *region = AllocateRegion();
+    if (region == NULL)
+    {
+        cout << "failed to allocate the argument region" << endl;
+        return false;
+    }
+
+    bool success = true;
+    double treeTotal = 0.0, progTotal = 0.0;
+
+    HookManager::FunctionSpecList::iterator it;
+    for (it = specs.begin(); it != specs.end(); it++)
+        success &= CheckFunctionSpec(it->first, it->second, region, false, treeTotal, progTotal);
+
+    unsigned int maxArgumentBytes = CaptureBudget::GetMaxArgumentBytes();
+    CaptureBudget::SetMaxArgumentBytes(CHECK_ARGUMENT_BYTES);
+
+    for (it = specs.begin(); it != specs.end(); it++)
+        success &= CheckFunctionSpec(it->first, it->second, region, true, treeTotal, progTotal);
+
+    CaptureBudget::SetMaxArgumentBytes(maxArgumentBytes);
+
+    cout << specs.size() << " function specs: "
+         << (treeTotal * 1000000.0 / ITERATIONS) << " us tree, "
+         << (progTotal * 1000000.0 / ITERATIONS) << " us program ("
+         << (treeTotal / progTotal) << "x)" << endl;
+
+    VirtualFree(region, 0, MEM_RELEASE);
+
+    return success;
+}
+
+static bool
+CheckTruncation(const char *name, BaseMarshaller *marshaller, void *arg, const OString &expected)
+{
+    Marshaller::Program *prog = Marshaller::Program::Compile(marshaller);
+    if (prog == NULL)
+    {
+        cout << name << ": failed to compile" << endl;
+        delete marshaller;
+        return false;
+    }
+
+    // Each call gets a budget of its own, just like a FunctionCall
+    CaptureBudget treeBudget, progBudget;
+    treeBudget.BeginArgument();
+    progBudget.BeginArgument();
+
+    BudgetPropertyProvider treePropProv(&treeBudget), progPropProv(&progBudget);
+
+    Logging::Node *treeNode = marshaller->ToNode(arg, true, &treePropProv);
+    Logging::Node *progNode = prog->Execute(arg, true, &progPropProv);
+
+    OString treeDump = DumpNode(treeNode);
+    OString progDump = DumpNode(progNode);
+
+    delete treeNode;
+    delete progNode;
+    delete prog;
+    delete marshaller;
+
+    bool success = (treeDump == progDump && treeDump.find(expected) != OString::npos);
+    if (!success)
+    {
+        cout << name << ": expected " << expected << endl;
+        cout << "  tree:    " << treeDump << endl;
+        cout << "  program: " << progDump << endl;
+    }
+
+    return success;
+}
+
+static bool
+CheckPropertyQueries()
+{
+    bool success = true;
+
+    PropertyQuery reg("&reg.ecx");
+    success &= (reg.GetKind() == PROPERTY_QUERY_REGISTER && reg.GetIndex() == PROPERTY_REG_ECX && reg.GetWantAddressOf());
+    success &= (PropertyQuery("reg.xyz").GetKind() == PROPERTY_QUERY_OTHER);
+    success &= (PropertyQuery("arg4").GetKind() == PROPERTY_QUERY_OTHER);
+    success &= !PropertyQuery("").IsSet();
+
+    // send(SOCKET s, const char *buf, int len, int flags), with buf bound
+    // to an argument that's added after it
+    ArgumentListSpec args;
+    args.AddArgument(new ArgumentSpec("s", ARG_DIR_IN, new UInt32(true), NULL));
+    args.AddArgument(new ArgumentSpec("buf", ARG_DIR_IN, new ByteArrayPtr("arg.len"), NULL));
+
+    PropertyQuery len("arg.len");
+    len.Resolve(args);
+    success &= (len.GetKind() == PROPERTY_QUERY_ARGUMENT_NAME);
+
+    args.AddArgument(new ArgumentSpec("len", ARG_DIR_IN, new Int32(), NULL));
+    len.Resolve(args);
+    success &= (len.GetKind() == PROPERTY_QUERY_ARGUMENT && len.GetIndex() == 2);
+
+    if (!success)
+        cout << "property queries: not resolved as expected" << endl;
+
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    InterceptPP::Initialize();
+    InterceptPP::SetLogger(new Logging::ConsoleLogger());
+
+    bool success = true;
+
+    OWString path = L"config.xml";
+    if (argc > 1)
+    {
+        path.clear();
+        for (const char *p = argv[1]; *p != '\0'; p++)
+            path += static_cast<wchar_t>(*p);
+    }
+
+    success &= CheckConfig(path);
+
+    // Eight bytes per argument keeps the first and the last four
+    CaptureBudget::SetMaxArgumentBytes(8);
+
+    char payload[] = "GET / HTTP/1.0\r\n\r\n";
+    char *payloadPtr = payload;
+    success &= CheckTruncation("send.buf (truncated)", new ByteArrayPtr(18), &payloadPtr,
+        "<value type=\"ByteArray\" size=\"18\" truncated=\"10\" head=\"4\">GET \r\n\r\n</value>");
+
+    unsigned int numbers[6] = { 1, 2, 3, 4, 5, 6 };
+    unsigned int *numbersPtr = numbers;
+    success &= CheckTruncation("numbers (truncated)", new ArrayPtr(new UInt32(), 6), &numbersPtr,
+        "<value type=\"Array\" elementType=\"UInt32\" elementCount=\"6\" truncated=\"4\" head=\"1\">"
+        "<value type=\"UInt32\" value=\"1\"></value><value type=\"UInt32\" value=\"6\"></value></value>");
+
+    CaptureBudget::SetMaxArgumentBytes(0);
+
+    success &= CheckPropertyQueries();
+
+    cout << (success ? "success" : "FAILED") << endl;
+    OString str;
+    cin >> str;
+
+    return (success) ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/MemoryMap.h>
+#include <iostream>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks MemoryMap against pages we allocate, protect and free ourselves.
+// Besides MSVC this builds on Linux, where the map is read from
+// /proc/self/maps:
+//
+//   g++ -I../.. MemoryMapTest.cpp ../MemoryMap.cpp -lpthread
+//
+
+#ifdef _WIN32
+
+static size_t
+GetPageSize()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+}
+
+static char *
+AllocPages(size_t size)
+{
+    return static_cast<char *>(VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+}
+
+static void
+ProtectPages(char *address, size_t size, bool readable)
+{
+    DWORD oldProtect;
+    VirtualProtect(address, size, (readable) ? PAGE_READWRITE : PAGE_NOACCESS, &oldProtect);
+}
+
+static void
+FreePages(char *address, size_t size)
+{
+    VirtualFree(address, 0, MEM_RELEASE);
+}
+
+#else
+
+static size_t
+GetPageSize()
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+static char *
+AllocPages(size_t size)
+{
+    void *address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (address != MAP_FAILED) ? static_cast<char *>(address) : NULL;
+}
+
+static void
+ProtectPages(char *address, size_t size, bool readable)
+{
+    mprotect(address, size, (readable) ? PROT_READ | PROT_WRITE : PROT_NONE);
+}
+
+static void
+FreePages(char *address, size_t size)
+{
+    munmap(address, size);
+}
+
+#endif
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (expected != actual)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static void
+CheckSize(const char *what, size_t expected, size_t actual)
+{
+    if (expected != actual)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    MemoryMap *map = MemoryMap::Instance();
+    map->Refresh();
+
+    cout << map->GetRegionCount() << " readable regions" << endl;
+
+    size_t pageSize = GetPageSize();
+    char *pages = AllocPages(4 * pageSize);
+    if (pages == NULL)
+    {
+        cout << "allocation failed" << endl;
+        return 1;
+    }
+
+    int local = 42;
+    Check("stack", true, map->IsReadable(&local, sizeof(local)));
+    Check("code", true, map->IsReadable(reinterpret_cast<void *>(&Check), 16));
+    Check("NULL", false, map->IsReadable(NULL, 1));
+    Check("empty range", true, map->IsReadable(NULL, 0));
+    Check("wrap around", false, map->IsReadable(pages, static_cast<size_t>(-1)));
+
+    // Picked up on the first lookup even though it's newer than the scan
+    Check("new pages", true, map->IsReadable(pages, 4 * pageSize));
+    Check("new pages, middle", true, map->IsReadable(pages + pageSize + 1, pageSize));
+
+    // Protection changes aren't tracked, so this one has to be reported
+    ProtectPages(pages + 2 * pageSize, pageSize, false);
+    map->Invalidate(pages + 2 * pageSize, pageSize);
+    Check("protected page", false, map->IsReadable(pages + 2 * pageSize, 1));
+    Check("span into protected page", false, map->IsReadable(pages + pageSize, pageSize + 1));
+    Check("page before protected one", true, map->IsReadable(pages + pageSize, pageSize));
+    Check("page after protected one", true, map->IsReadable(pages + 3 * pageSize, pageSize));
+    CheckSize("readable size", 2 * pageSize, map->GetReadableSize(pages, 4 * pageSize));
+    CheckSize("readable size from protected page", 0, map->GetReadableSize(pages + 2 * pageSize, pageSize));
+
+    // Found again lazily once readable
+    ProtectPages(pages + 2 * pageSize, pageSize, true);
+    Check("unprotected page", true, map->IsReadable(pages + 2 * pageSize, 1));
+    CheckSize("readable size after unprotecting", 4 * pageSize, map->GetReadableSize(pages, 4 * pageSize));
+
+    FreePages(pages, 4 * pageSize);
+    map->Invalidate(pages, 0);
+    Check("freed pages", false, map->IsReadable(pages, 1));
+    Check("freed pages, end", false, map->IsReadable(pages + 4 * pageSize - 1, 1));
+    Check("stack after free", true, map->IsReadable(&local, sizeof(local)));
+
+    map->Refresh();
+    Check("freed pages after refresh", false, map->IsReadable(pages, 1));
+    Check("stack after refresh", true, map->IsReadable(&local, sizeof(local)));
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/PayloadTable.h>
+#include <iostream>
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks PayloadTable's hash against reference values and walks a few
+// payloads through the threshold, the table limit, deduplication and the
+// records they first appear in being logged or not.
+//
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static void
+CheckHash(const char *data, unsigned int size, unsigned __int64 expected)
+{
+    unsigned __int64 hash = PayloadTable::Hash(data, size);
+    if (hash != expected)
+    {
+        cout << "hash of " << size << " bytes: expected " << hex << expected << ", got " << hash << dec << endl;
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // MurmurHash64B with our seed
+    CheckHash("", 0, 0x053e2018f75660a9ULL);
+    CheckHash("abc", 3, 0x98c163daabd1e077ULL);
+    CheckHash("GET / HTTP/1.0\r\n\r\n", 18, 0x36d2b9b5ba32bb0bULL);
+
+    OString keepAlive("GET / HTTP/1.0\r\n\r\n");
+    OString other("POST / HTTP/1.0\r\n\r\n");
+    OString small("ping");
+
+    PayloadTable table;
+    unsigned int id = 0, firstId = 0, otherId = 0;
+
+    Check("disabled", true, table.Lookup(keepAlive, id) == PAYLOAD_INLINE);
+
+    PayloadTable::SetThreshold(8);
+
+    Check("below threshold", true, table.Lookup(small, id) == PAYLOAD_INLINE);
+    Check("first", true, table.Lookup(keepAlive, firstId) == PAYLOAD_FIRST);
+    Check("first not logged yet", true, table.Lookup(keepAlive, id) == PAYLOAD_INLINE);
+    table.Commit(&firstId, 1);
+    Check("duplicate", true, table.Lookup(keepAlive, id) == PAYLOAD_DUPLICATE);
+    Check("duplicate id", true, id == firstId);
+    Check("other", true, table.Lookup(other, otherId) == PAYLOAD_FIRST);
+    Check("other id", true, otherId != firstId);
+
+    // Its record got dropped, so the next one has to carry it in full
+    table.Discard(&otherId, 1);
+    Check("other again", true, table.Lookup(other, id) == PAYLOAD_FIRST);
+    Check("other again id", true, id != otherId);
+    table.Commit(&id, 1);
+
+    // Full table: new payloads stay inline, known ones are still found
+    PayloadTable::SetMaxTableBytes(static_cast<unsigned int>(keepAlive.size() + other.size()));
+    Check("table full", true, table.Lookup(OString("0123456789abcdef"), id) == PAYLOAD_INLINE);
+    Check("duplicate with table full", true, table.Lookup(keepAlive, id) == PAYLOAD_DUPLICATE);
+
+    PayloadTableStats stats;
+    table.GetStats(stats);
+    Check("payloads", true, stats.payloads == 7);
+    Check("duplicates", true, stats.duplicates == 2);
+    Check("duplicate bytes", true, stats.duplicateBytes == 2 * keepAlive.size());
+    Check("table entries", true, stats.tableEntries == 2);
+
+    PayloadTable::SetThreshold(0);
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,530 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/PrivateHeap.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks the size classes, the PrivateHeap API and its accounting, then
+// times a mix of allocation sizes like the one the agent produces (mostly
+// nodes, fields and strings, now and then a buffer) on several threads at
+// once, against the system heap and with accounting turned off.  Two workloads: every thread churning through blocks
+// of its own, and every thread freeing what its neighbour allocated, as
+// happens when the logging thread gets rid of submitted events.
+// Besides MSVC this builds on Linux, where malloc() stands in for
+// HeapAlloc():
+//
+//   g++ -O2 -I../.. PrivateHeapBenchmark.cpp ../PrivateHeap.cpp -lpthread
+//
+
+#define MAX_THREADS      8
+#define CHURN_SLOTS   1024
+#define CHURN_OPS   400000
+#define HANDOFF_BATCH 4096
+#define HANDOFF_ROUNDS  50
+
+#ifdef _WIN32
+
+typedef HANDLE ThreadHandle;
+
+static ThreadHandle
+StartThread(LPTHREAD_START_ROUTINE func, void *param)
+{
+    return CreateThread(NULL, 0, func, param, 0, NULL);
+}
+
+static void
+JoinThread(ThreadHandle thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static double
+GetSeconds()
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+static long
+AtomicIncrement(volatile long *value)
+{
+    return InterlockedIncrement(value);
+}
+
+static long
+AtomicRead(volatile long *value)
+{
+    return InterlockedCompareExchange(value, 0, 0);
+}
+
+static void
+Yield()
+{
+    Sleep(0);
+}
+
+static void *
+SystemAllocate(size_t size)
+{
+    return HeapAlloc(GetProcessHeap(), 0, size);
+}
+
+static void
+SystemFree(void *p)
+{
+    HeapFree(GetProcessHeap(), 0, p);
+}
+
+#define THREAD_FUNC DWORD WINAPI
+
+#else
+
+typedef pthread_t ThreadHandle;
+typedef void *(*ThreadFunc)(void *);
+
+static ThreadHandle
+StartThread(ThreadFunc func, void *param)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, func, param);
+    return thread;
+}
+
+static void
+JoinThread(ThreadHandle thread)
+{
+    pthread_join(thread, NULL);
+}
+
+static double
+GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static long
+AtomicIncrement(volatile long *value)
+{
+    return __sync_add_and_fetch(value, 1);
+}
+
+static long
+AtomicRead(volatile long *value)
+{
+    return __sync_fetch_and_add(value, 0);
+}
+
+static void
+Yield()
+{
+    sched_yield();
+}
+
+static void *
+SystemAllocate(size_t size)
+{
+    return malloc(size);
+}
+
+static void
+SystemFree(void *p)
+{
+    free(p);
+}
+
+#define THREAD_FUNC void *
+
+#endif
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static bool
+IsZero(const void *p, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(p);
+    for (size_t i = 0; i < size; i++)
+    {
+        if (bytes[i] != 0)
+            return false;
+    }
+
+    return true;
+}
+
+static void
+CheckApi()
+{
+    size_t prevSize = 0;
+    for (size_t size = 1; size <= PRIVATE_HEAP_MAX_SMALL_SIZE; size++)
+    {
+        unsigned int sizeClass = PrivateHeap::GetSizeClass(size);
+        size_t classSize = PrivateHeap::GetClassSize(sizeClass);
+
+        if (sizeClass >= PRIVATE_HEAP_CLASS_COUNT || classSize < size || (classSize != prevSize && size != prevSize + 1))
+        {
+            cout << "size " << size << ": class " << sizeClass << " of " << classSize << " bytes" << endl;
+            failures++;
+            break;
+        }
+
+        prevSize = classSize;
+    }
+    Check("largest class", true, prevSize == PRIVATE_HEAP_MAX_SMALL_SIZE);
+    Check("large", true, PrivateHeap::GetSizeClass(PRIVATE_HEAP_MAX_SMALL_SIZE + 1) == PRIVATE_HEAP_LARGE);
+
+    // Dirty a block so that it comes back dirty
+    char *p = static_cast<char *>(PrivateHeap::Allocate(100, false));
+    memset(p, 0xAB, 100);
+    PrivateHeap::Free(p);
+
+    p = static_cast<char *>(PrivateHeap::Allocate(100, true));
+    Check("zeroed", true, IsZero(p, 100));
+    Check("size", true, PrivateHeap::GetSize(p) == 100);
+
+    memset(p, 0xCD, 100);
+    p = static_cast<char *>(PrivateHeap::Reallocate(p, 104, true));
+    Check("realloc in place keeps", true, p[99] == static_cast<char>(0xCD));
+    Check("realloc in place zeroes", true, IsZero(p + 100, 4));
+
+    p = static_cast<char *>(PrivateHeap::Reallocate(p, 5000, true));
+    Check("realloc keeps", true, p[0] == static_cast<char>(0xCD) && p[99] == static_cast<char>(0xCD));
+    Check("realloc zeroes", true, IsZero(p + 104, 5000 - 104));
+
+    p = static_cast<char *>(PrivateHeap::Reallocate(p, 200000, false));
+    Check("large keeps", true, p[99] == static_cast<char>(0xCD));
+    p[199999] = 1;
+    Check("large size", true, PrivateHeap::GetSize(p) == 200000);
+
+    // Shrinking a large block moves it, and must only copy what fits
+    p = static_cast<char *>(PrivateHeap::Reallocate(p, 100000, true));
+    Check("large shrink keeps", true, p[0] == static_cast<char>(0xCD) && p[99] == static_cast<char>(0xCD));
+    Check("large shrink size", true, PrivateHeap::GetSize(p) == 100000);
+
+    p = static_cast<char *>(PrivateHeap::Reallocate(p, 1000, true));
+    Check("small shrink keeps", true, p[0] == static_cast<char>(0xCD) && p[99] == static_cast<char>(0xCD));
+    Check("small shrink size", true, PrivateHeap::GetSize(p) == 1000);
+    p[999] = 1;
+    PrivateHeap::Free(p);
+
+    PrivateHeap::Free(NULL);
+    PrivateHeap::ReleaseThreadCache();
+}
+
+static void
+CheckAccounting()
+{
+    const unsigned int tag = 3;
+    size_t header = 2 * sizeof(void *);
+    unsigned int smallClass = PrivateHeap::GetSizeClass(100 + header);
+    size_t smallBytes = PrivateHeap::GetClassSize(smallClass);
+    size_t largeBytes = (100000 + header + PRIVATE_HEAP_SPAN_SIZE - 1) / PRIVATE_HEAP_SPAN_SIZE * PRIVATE_HEAP_SPAN_SIZE;
+
+    PrivateHeapStats before, after;
+    PrivateHeap::GetStats(before);
+
+    unsigned int previous = PrivateHeap::SetThreadTag(tag);
+    void *small = PrivateHeap::Allocate(100, false);
+    void *large = PrivateHeap::Allocate(100000, false);
+    PrivateHeap::SetThreadTag(previous);
+
+    PrivateHeap::GetStats(after);
+    Check("tag live", true, after.tags[tag].liveBytes - before.tags[tag].liveBytes == smallBytes + largeBytes);
+    Check("tag allocations", true, after.tags[tag].allocations - before.tags[tag].allocations == 2);
+    Check("total live", true, after.total.liveBytes - before.total.liveBytes == smallBytes + largeBytes);
+    Check("class allocations", true, after.classes[smallClass].allocations - before.classes[smallClass].allocations == 1);
+    Check("large allocations", true,
+          after.classes[PRIVATE_HEAP_CLASS_COUNT].allocations - before.classes[PRIVATE_HEAP_CLASS_COUNT].allocations == 1);
+    Check("peak", true, after.tags[tag].peakBytes >= after.tags[tag].liveBytes);
+    Check("reserved", true, after.reservedBytes >= after.total.liveBytes);
+
+    // Blocks are charged to the tag they were allocated with
+    PrivateHeap::SetThreadTag(tag + 1);
+    PrivateHeap::Free(small);
+    PrivateHeap::Free(large);
+    PrivateHeap::SetThreadTag(previous);
+
+    PrivateHeap::GetStats(after);
+    Check("tag freed", true, after.tags[tag].liveBytes == before.tags[tag].liveBytes);
+    Check("other tag", true, after.tags[tag + 1].liveBytes == before.tags[tag + 1].liveBytes);
+    Check("class frees", true, after.classes[smallClass].frees - before.classes[smallClass].frees == 1);
+    Check("peak kept", true, after.tags[tag].peakBytes - before.tags[tag].liveBytes >= smallBytes + largeBytes);
+
+    // Nor is a block counted when it's freed if it wasn't when allocated
+    PrivateHeap::GetStats(before);
+    PrivateHeap::SetAccounting(false);
+    small = PrivateHeap::Allocate(100, false);
+    PrivateHeap::SetAccounting(true);
+    PrivateHeap::Free(small);
+
+    PrivateHeap::GetStats(after);
+    Check("untracked", true, after.total.liveBytes == before.total.liveBytes &&
+          after.total.allocations == before.total.allocations);
+
+    PrivateHeap::ReleaseThreadCache();
+}
+
+//
+// The workloads
+//
+
+typedef struct {
+    bool privateHeap;
+    unsigned int seed;
+    int thread;
+    int threadCount;
+    bool corrupt;
+} ThreadParams;
+
+static void *handoffBlocks[MAX_THREADS][HANDOFF_BATCH];
+static volatile long barrierCount;
+
+static void
+WaitForAll(long &generation, int threadCount)
+{
+    generation += threadCount;
+    AtomicIncrement(&barrierCount);
+    while (AtomicRead(&barrierCount) < generation)
+        Yield();
+}
+
+static inline unsigned int
+NextRandom(unsigned int &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static inline size_t
+RandomSize(unsigned int &state)
+{
+    unsigned int r = NextRandom(state);
+    unsigned int pick = r % 1000;
+
+    if (pick < 800)
+        return 8 + (r >> 10) % 120;
+    else if (pick < 950)
+        return 128 + (r >> 10) % 896;
+    else if (pick < 999)
+        return 1024 + (r >> 10) % 7168;
+    else
+        return 8192 + (r >> 10) % 57344;
+}
+
+static inline void *
+Allocate(bool privateHeap, size_t size)
+{
+    unsigned char *p = static_cast<unsigned char *>((privateHeap) ? PrivateHeap::Allocate(size, false) : SystemAllocate(size));
+
+    // Touch both ends, and remember the size for the check on free
+    p[0] = static_cast<unsigned char>(size);
+    p[size - 1] = static_cast<unsigned char>(size);
+
+    return p;
+}
+
+static inline bool
+Free(bool privateHeap, void *p, size_t size)
+{
+    unsigned char *bytes = static_cast<unsigned char *>(p);
+    bool intact = (bytes[0] == static_cast<unsigned char>(size) && bytes[size - 1] == static_cast<unsigned char>(size));
+
+    if (privateHeap)
+        PrivateHeap::Free(p);
+    else
+        SystemFree(p);
+
+    return intact;
+}
+
+static THREAD_FUNC
+ChurnThreadFunc(void *param)
+{
+    ThreadParams *params = static_cast<ThreadParams *>(param);
+    unsigned int state = params->seed;
+
+    void *blocks[CHURN_SLOTS];
+    size_t sizes[CHURN_SLOTS];
+    memset(blocks, 0, sizeof(blocks));
+
+    for (int i = 0; i < CHURN_OPS; i++)
+    {
+        unsigned int slot = NextRandom(state) % CHURN_SLOTS;
+
+        if (blocks[slot] != NULL && !Free(params->privateHeap, blocks[slot], sizes[slot]))
+            params->corrupt = true;
+
+        sizes[slot] = RandomSize(state);
+        blocks[slot] = Allocate(params->privateHeap, sizes[slot]);
+    }
+
+    for (int i = 0; i < CHURN_SLOTS; i++)
+    {
+        if (blocks[i] != NULL && !Free(params->privateHeap, blocks[i], sizes[i]))
+            params->corrupt = true;
+    }
+
+    if (params->privateHeap)
+        PrivateHeap::ReleaseThreadCache();
+
+    return 0;
+}
+
+static THREAD_FUNC
+HandoffThreadFunc(void *param)
+{
+    ThreadParams *params = static_cast<ThreadParams *>(param);
+    unsigned int state = params->seed;
+    long generation = 0;
+
+    void **mine = handoffBlocks[params->thread];
+    void **theirs = handoffBlocks[(params->thread + 1) % params->threadCount];
+
+    for (int round = 0; round < HANDOFF_ROUNDS; round++)
+    {
+        // Sizes are kept in the blocks themselves here, as they're freed
+        // by another thread
+        for (int i = 0; i < HANDOFF_BATCH; i++)
+        {
+            size_t size = RandomSize(state);
+            size_t *p = static_cast<size_t *>(Allocate(params->privateHeap, size + sizeof(size_t)));
+            *p = size + sizeof(size_t);
+            mine[i] = p;
+        }
+
+        WaitForAll(generation, params->threadCount);
+
+        for (int i = 0; i < HANDOFF_BATCH; i++)
+        {
+            size_t *p = static_cast<size_t *>(theirs[i]);
+            size_t size = *p;
+
+            // Allocate() stored the low byte of the size at the start
+            *reinterpret_cast<unsigned char *>(p) = static_cast<unsigned char>(size);
+            if (!Free(params->privateHeap, p, size))
+                params->corrupt = true;
+        }
+
+        WaitForAll(generation, params->threadCount);
+    }
+
+    if (params->privateHeap)
+        PrivateHeap::ReleaseThreadCache();
+
+    return 0;
+}
+
+static double
+Run(bool handoff, bool privateHeap, int threadCount)
+{
+    ThreadParams params[MAX_THREADS];
+    ThreadHandle threads[MAX_THREADS];
+
+    barrierCount = 0;
+
+    double start = GetSeconds();
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        params[i].privateHeap = privateHeap;
+        params[i].seed = 2463534242U + i * 7919;
+        params[i].thread = i;
+        params[i].threadCount = threadCount;
+        params[i].corrupt = false;
+
+        threads[i] = StartThread((handoff) ? HandoffThreadFunc : ChurnThreadFunc, &params[i]);
+    }
+
+    for (int i = 0; i < threadCount; i++)
+        JoinThread(threads[i]);
+
+    double elapsed = GetSeconds() - start;
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (params[i].corrupt)
+        {
+            cout << ((handoff) ? "handoff" : "churn") << ": thread " << i << " found a block overwritten" << endl;
+            failures++;
+        }
+    }
+
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    CheckApi();
+    CheckAccounting();
+
+    for (int handoff = 0; handoff < 2; handoff++)
+    {
+        double opsPerThread = (handoff) ? 2.0 * HANDOFF_BATCH * HANDOFF_ROUNDS : 2.0 * CHURN_OPS;
+
+        for (int threadCount = 1; threadCount <= MAX_THREADS; threadCount *= 2)
+        {
+            double systemTime = Run(handoff != 0, false, threadCount);
+            double privateTime = Run(handoff != 0, true, threadCount);
+
+            PrivateHeap::SetAccounting(false);
+            double uncountedTime = Run(handoff != 0, true, threadCount);
+            PrivateHeap::SetAccounting(true);
+
+            double ops = opsPerThread * threadCount;
+
+            cout << ((handoff) ? "handoff" : "churn") << ", " << threadCount << " thread(s): "
+                 << (ops / systemTime / 1000000.0) << " M ops/s with the system heap, "
+                 << (ops / privateTime / 1000000.0) << " M ops/s with PrivateHeap ("
+                 << (systemTime / privateTime) << "x), "
+                 << (ops / uncountedTime / 1000000.0) << " M ops/s without accounting ("
+                 << ((privateTime / uncountedTime - 1.0) * 100.0) << "% for it)" << endl;
+        }
+    }
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,554 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/RecordRing.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks RecordRing, then has several threads submit records of the sizes
+// events usually come in to a logging thread that checks them, once with
+// a ring per producer, the way BinaryLogger works now, and once with an
+// allocation per record pushed onto one shared list, the way it used to.
+// Besides MSVC this builds on Linux, where a compare-and-swap loop stands
+// in for the SLIST and malloc() for new:
+//
+//   g++ -O2 -I../.. RecordRingBenchmark.cpp ../RecordRing.cpp -lpthread
+//
+
+#define MAX_PRODUCERS        8
+#define RECORDS_PER_PRODUCER 200000
+#define RING_SIZE            (128 * 1024)
+
+#ifdef _WIN32
+
+typedef HANDLE ThreadHandle;
+
+static ThreadHandle
+StartThread(LPTHREAD_START_ROUTINE func, void *param)
+{
+    return CreateThread(NULL, 0, func, param, 0, NULL);
+}
+
+static void
+JoinThread(ThreadHandle thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static double
+GetSeconds()
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+static long
+AtomicIncrement(volatile long *value)
+{
+    return InterlockedIncrement(value);
+}
+
+static long
+AtomicRead(volatile long *value)
+{
+    return InterlockedCompareExchange(value, 0, 0);
+}
+
+static void
+Yield()
+{
+    Sleep(0);
+}
+
+typedef struct {
+    SLIST_ENTRY entry;
+    unsigned int size;
+} ListRecord;
+
+static SLIST_HEADER sharedList;
+
+static void
+InitList()
+{
+    InitializeSListHead(&sharedList);
+}
+
+static void
+PushRecord(ListRecord *rec)
+{
+    InterlockedPushEntrySList(&sharedList, &rec->entry);
+}
+
+static ListRecord *
+TakeRecords()
+{
+    return reinterpret_cast<ListRecord *>(InterlockedFlushSList(&sharedList));
+}
+
+static ListRecord *
+NextRecord(ListRecord *rec)
+{
+    return reinterpret_cast<ListRecord *>(rec->entry.Next);
+}
+
+static void
+SetNextRecord(ListRecord *rec, ListRecord *next)
+{
+    rec->entry.Next = &next->entry;
+}
+
+static ListRecord *
+AllocateRecord(unsigned int size)
+{
+    return static_cast<ListRecord *>(_aligned_malloc(sizeof(ListRecord) + size, MEMORY_ALLOCATION_ALIGNMENT));
+}
+
+static void
+FreeRecord(ListRecord *rec)
+{
+    _aligned_free(rec);
+}
+
+#define THREAD_FUNC DWORD WINAPI
+
+#else
+
+typedef pthread_t ThreadHandle;
+typedef void *(*ThreadFunc)(void *);
+
+static ThreadHandle
+StartThread(ThreadFunc func, void *param)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, func, param);
+    return thread;
+}
+
+static void
+JoinThread(ThreadHandle thread)
+{
+    pthread_join(thread, NULL);
+}
+
+static double
+GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static long
+AtomicIncrement(volatile long *value)
+{
+    return __sync_add_and_fetch(value, 1);
+}
+
+static long
+AtomicRead(volatile long *value)
+{
+    return __sync_fetch_and_add(value, 0);
+}
+
+static void
+Yield()
+{
+    sched_yield();
+}
+
+typedef struct ListRecordTag {
+    struct ListRecordTag *next;
+    unsigned int size;
+} ListRecord;
+
+static ListRecord *volatile sharedList;
+
+static void
+InitList()
+{
+    sharedList = NULL;
+}
+
+static void
+PushRecord(ListRecord *rec)
+{
+    ListRecord *head;
+    do
+    {
+        head = __atomic_load_n(&sharedList, __ATOMIC_RELAXED);
+        rec->next = head;
+    }
+    while (!__sync_bool_compare_and_swap(&sharedList, head, rec));
+}
+
+static ListRecord *
+TakeRecords()
+{
+    return __sync_lock_test_and_set(&sharedList, static_cast<ListRecord *>(NULL));
+}
+
+static ListRecord *
+NextRecord(ListRecord *rec)
+{
+    return rec->next;
+}
+
+static void
+SetNextRecord(ListRecord *rec, ListRecord *next)
+{
+    rec->next = next;
+}
+
+static ListRecord *
+AllocateRecord(unsigned int size)
+{
+    return static_cast<ListRecord *>(malloc(sizeof(ListRecord) + size));
+}
+
+static void
+FreeRecord(ListRecord *rec)
+{
+    free(rec);
+}
+
+#define THREAD_FUNC void *
+
+#endif
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static void
+CheckRing()
+{
+    static unsigned int buffer[64];
+    RecordRing ring(buffer, sizeof(buffer));
+
+    unsigned int tag, size;
+    Check("empty", true, ring.Peek(tag, size) == NULL);
+    Check("max size", true, ring.GetMaxRecordSize() == sizeof(buffer) / 2 - 8);
+
+    char data[128];
+    for (int i = 0; i < 128; i++)
+        data[i] = static_cast<char>(i);
+
+    Check("too big", false, ring.Write(1, data, ring.GetMaxRecordSize() + 1));
+
+    // 100 + 8 bytes of header take up 112 of the 256, leaving room for
+    // one more, but not for a third
+    Check("first", true, ring.Write(1, data, 100));
+    Check("room", true, ring.HasRoomFor(100));
+    Check("second", true, ring.Write(2, data + 1, 100));
+    Check("no room", false, ring.HasRoomFor(100));
+    Check("full", false, ring.Write(3, data, 100));
+    Check("used", true, ring.GetUsed() == 224);
+
+    const char *p = static_cast<const char *>(ring.Peek(tag, size));
+    Check("first back", true, p != NULL && tag == 1 && size == 100 && memcmp(p, data, 100) == 0);
+    Check("peek again", true, ring.Peek(tag, size) == p);
+    ring.Consume();
+
+    // Doesn't fit in the 32 bytes before the end, so it goes to the start
+    Check("wrap", true, ring.Write(3, data + 2, 100));
+
+    p = static_cast<const char *>(ring.Peek(tag, size));
+    Check("second back", true, p != NULL && tag == 2 && memcmp(p, data + 1, 100) == 0);
+    ring.Consume();
+
+    p = static_cast<const char *>(ring.Peek(tag, size));
+    Check("wrapped back", true, p == reinterpret_cast<const char *>(buffer) + 8 && tag == 3 &&
+          memcmp(p, data + 2, 100) == 0);
+    ring.Consume();
+
+    Check("drained", true, ring.Peek(tag, size) == NULL && ring.GetUsed() == 0);
+
+    Check("empty record", true, ring.Write(4, NULL, 0));
+    Check("empty record back", true, ring.Peek(tag, size) != NULL && tag == 4 && size == 0);
+    ring.Consume();
+}
+
+//
+// The workloads.  Every record starts with its producer and its number,
+// and the rest is filled in from those, so that the consumer can tell
+// whether it got all of them, in order and intact.
+//
+
+typedef struct {
+    unsigned int producer;
+    unsigned int seq;
+} RecordStart;
+
+typedef struct {
+    RecordRing *ring;
+    unsigned int producer;
+} ProducerParams;
+
+typedef struct {
+    bool rings;
+    int producerCount;
+    unsigned long long bytes;
+    bool corrupt;
+} ConsumerParams;
+
+static RecordRing *rings[MAX_PRODUCERS];
+static volatile long producersDone;
+
+static inline unsigned int
+RecordSize(unsigned int producer, unsigned int seq)
+{
+    // Mostly small events, now and then one with a buffer in it
+    unsigned int r = (seq * 2654435761U) ^ (producer * 40503U);
+    return ((r & 15) != 0) ? 64 + (r >> 8) % 448 : 512 + (r >> 8) % 3584;
+}
+
+static inline void
+FillRecord(char *p, unsigned int producer, unsigned int seq, unsigned int size)
+{
+    RecordStart *start = reinterpret_cast<RecordStart *>(p);
+    start->producer = producer;
+    start->seq = seq;
+
+    for (unsigned int i = sizeof(RecordStart); i < size; i++)
+        p[i] = static_cast<char>(seq + i);
+}
+
+static inline bool
+CheckRecord(const char *p, unsigned int size, unsigned int *nextSeq)
+{
+    const RecordStart *start = reinterpret_cast<const RecordStart *>(p);
+    if (start->producer >= MAX_PRODUCERS)
+        return false;
+
+    unsigned int seq = start->seq;
+    if (seq != nextSeq[start->producer] || size != RecordSize(start->producer, seq))
+        return false;
+
+    nextSeq[start->producer]++;
+
+    // The ends are enough to catch records overwriting each other
+    return p[sizeof(RecordStart)] == static_cast<char>(seq + sizeof(RecordStart)) &&
+           p[size - 1] == static_cast<char>(seq + size - 1);
+}
+
+static THREAD_FUNC
+RingProducerFunc(void *param)
+{
+    ProducerParams *params = static_cast<ProducerParams *>(param);
+    char rec[4096];
+
+    for (unsigned int seq = 0; seq < RECORDS_PER_PRODUCER; seq++)
+    {
+        unsigned int size = RecordSize(params->producer, seq);
+        FillRecord(rec, params->producer, seq, size);
+
+        while (!params->ring->Write(0, rec, size))
+            Yield();
+    }
+
+    AtomicIncrement(&producersDone);
+
+    return 0;
+}
+
+static THREAD_FUNC
+ListProducerFunc(void *param)
+{
+    ProducerParams *params = static_cast<ProducerParams *>(param);
+
+    for (unsigned int seq = 0; seq < RECORDS_PER_PRODUCER; seq++)
+    {
+        unsigned int size = RecordSize(params->producer, seq);
+
+        ListRecord *rec = AllocateRecord(size);
+        rec->size = size;
+        FillRecord(reinterpret_cast<char *>(rec + 1), params->producer, seq, size);
+
+        PushRecord(rec);
+    }
+
+    AtomicIncrement(&producersDone);
+
+    return 0;
+}
+
+static THREAD_FUNC
+ConsumerFunc(void *param)
+{
+    ConsumerParams *params = static_cast<ConsumerParams *>(param);
+    unsigned int nextSeq[MAX_PRODUCERS];
+    memset(nextSeq, 0, sizeof(nextSeq));
+
+    bool done = false;
+    while (!done)
+    {
+        // Whatever is left once the producers are done is the last of it
+        done = AtomicRead(&producersDone) == params->producerCount;
+        bool idle = true;
+
+        if (params->rings)
+        {
+            for (int i = 0; i < params->producerCount; i++)
+            {
+                unsigned int tag, size;
+                const void *rec;
+
+                while ((rec = rings[i]->Peek(tag, size)) != NULL)
+                {
+                    if (!CheckRecord(static_cast<const char *>(rec), size, nextSeq))
+                        params->corrupt = true;
+                    params->bytes += size;
+
+                    rings[i]->Consume();
+                    idle = false;
+                }
+            }
+        }
+        else
+        {
+            // Newest first, so turn the batch around
+            ListRecord *rec = TakeRecords();
+            ListRecord *ordered = NULL;
+            while (rec != NULL)
+            {
+                ListRecord *next = NextRecord(rec);
+                SetNextRecord(rec, ordered);
+                ordered = rec;
+                rec = next;
+            }
+
+            for (rec = ordered; rec != NULL; rec = ordered)
+            {
+                ordered = NextRecord(rec);
+
+                if (!CheckRecord(reinterpret_cast<const char *>(rec + 1), rec->size, nextSeq))
+                    params->corrupt = true;
+                params->bytes += rec->size;
+
+                FreeRecord(rec);
+                idle = false;
+            }
+        }
+
+        if (idle && !done)
+            Yield();
+    }
+
+    for (int i = 0; i < params->producerCount; i++)
+    {
+        if (nextSeq[i] != RECORDS_PER_PRODUCER)
+            params->corrupt = true;
+    }
+
+    return 0;
+}
+
+static double
+Run(bool useRings, int producerCount, unsigned long long &bytes)
+{
+    ProducerParams params[MAX_PRODUCERS];
+    ThreadHandle producers[MAX_PRODUCERS];
+
+    ConsumerParams consumerParams;
+    consumerParams.rings = useRings;
+    consumerParams.producerCount = producerCount;
+    consumerParams.bytes = 0;
+    consumerParams.corrupt = false;
+
+    producersDone = 0;
+    InitList();
+
+    double start = GetSeconds();
+
+    ThreadHandle consumer = StartThread(ConsumerFunc, &consumerParams);
+
+    for (int i = 0; i < producerCount; i++)
+    {
+        params[i].ring = rings[i];
+        params[i].producer = i;
+
+        producers[i] = StartThread((useRings) ? RingProducerFunc : ListProducerFunc, &params[i]);
+    }
+
+    for (int i = 0; i < producerCount; i++)
+        JoinThread(producers[i]);
+    JoinThread(consumer);
+
+    double elapsed = GetSeconds() - start;
+
+    if (consumerParams.corrupt)
+    {
+        cout << ((useRings) ? "rings" : "list") << ", " << producerCount
+             << " producer(s): records missing, out of order or overwritten" << endl;
+        failures++;
+    }
+
+    bytes = consumerParams.bytes;
+
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    CheckRing();
+
+    for (int i = 0; i < MAX_PRODUCERS; i++)
+        rings[i] = new RecordRing(new unsigned long long[RING_SIZE / 8], RING_SIZE);
+
+    for (int producerCount = 1; producerCount <= MAX_PRODUCERS; producerCount *= 2)
+    {
+        unsigned long long listBytes, ringBytes;
+        double listTime = Run(false, producerCount, listBytes);
+        double ringTime = Run(true, producerCount, ringBytes);
+
+        double records = static_cast<double>(RECORDS_PER_PRODUCER) * producerCount;
+
+        cout << producerCount << " producer(s): "
+             << (records / listTime / 1000000.0) << " M records/s, "
+             << (listBytes / listTime / 1048576.0) << " MB/s with a shared list, "
+             << (records / ringTime / 1000000.0) << " M records/s, "
+             << (ringBytes / ringTime / 1048576.0) << " MB/s with rings ("
+             << (listTime / ringTime) << "x)" << endl;
+    }
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
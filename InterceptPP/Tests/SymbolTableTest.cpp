@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+#include <InterceptPP/SymbolTable.h>
+#include <iostream>
+
+using namespace std;
+using namespace InterceptPP;
+using namespace InterceptPP::Logging;
+
+//
+// Interns a few names, then has several threads intern the same set of
+// names in different orders at once and checks that they all got the same
+// ids.
+//
+
+#define THREAD_COUNT 4
+#define NAME_COUNT   1000
+
+static int failures = 0;
+static SymbolId threadIds[THREAD_COUNT][NAME_COUNT];
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static void
+MakeName(char *buf, size_t size, int i)
+{
+    _snprintf(buf, size, "name%d", i);
+    buf[size - 1] = '\0';
+}
+
+static DWORD WINAPI
+InternThreadFunc(LPVOID param)
+{
+    int thread = static_cast<int>(reinterpret_cast<INT_PTR>(param));
+    char buf[32];
+
+    for (int i = 0; i < NAME_COUNT; i++)
+    {
+        // Odd threads go backwards
+        int n = (thread % 2 == 0) ? i : NAME_COUNT - 1 - i;
+
+        MakeName(buf, sizeof(buf), n);
+        threadIds[thread][n] = SymbolTable::Intern(buf, strlen(buf));
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Check("empty", true, SymbolTable::Intern("", 0) == 0);
+    Check("empty name", true, strcmp(SymbolTable::GetName(0), "") == 0);
+
+    Symbol argument("argument");
+    Symbol value("value");
+    Check("nonzero", true, argument.GetId() != 0);
+    Check("distinct", true, argument.GetId() != value.GetId());
+    Check("same", true, Symbol("argument").GetId() == argument.GetId());
+    Check("from OString", true, Symbol(OString("value")).GetId() == value.GetId());
+    Check("prefix", true, SymbolTable::Intern("argument", 3) != argument.GetId());
+    Check("name", true, strcmp(argument.GetName(), "argument") == 0);
+    Check("length", true, argument.GetLength() == 8);
+
+    unsigned int countBefore = SymbolTable::GetCount();
+
+    HANDLE threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++)
+        threads[i] = CreateThread(NULL, 0, InternThreadFunc, reinterpret_cast<LPVOID>(static_cast<INT_PTR>(i)), 0, NULL);
+    WaitForMultipleObjects(THREAD_COUNT, threads, TRUE, INFINITE);
+    for (int i = 0; i < THREAD_COUNT; i++)
+        CloseHandle(threads[i]);
+
+    Check("count", true, SymbolTable::GetCount() == countBefore + NAME_COUNT);
+
+    char buf[32];
+    for (int n = 0; n < NAME_COUNT; n++)
+    {
+        MakeName(buf, sizeof(buf), n);
+
+        SymbolId id = threadIds[0][n];
+        for (int i = 1; i < THREAD_COUNT; i++)
+        {
+            if (threadIds[i][n] != id)
+            {
+                cout << buf << ": thread " << i << " got " << threadIds[i][n] << ", thread 0 got " << id << endl;
+                failures++;
+            }
+        }
+
+        if (strcmp(SymbolTable::GetName(id), buf) != 0)
+        {
+            cout << buf << ": id " << id << " is named " << SymbolTable::GetName(id) << endl;
+            failures++;
+        }
+    }
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/Utf8.h>
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Checks Utf8 against known encodings, then fuzzes the SIMD path against
+// FromUtf16Scalar() with strings built from runs of each code point class,
+// so that blocks of all kinds, and surrogate pairs straddling them, turn up.
+// Besides MSVC this builds on Linux:
+//
+//   g++ -msse2 -I../.. Utf8Test.cpp ../Utf8.cpp
+//   g++ -mavx2 -I../.. Utf8Test.cpp ../Utf8.cpp
+//
+
+static int failures = 0;
+
+static void
+Dump(const char *label, const char *buf, size_t len)
+{
+    cout << "  " << label << ":" << hex;
+    for (size_t i = 0; i < len; i++)
+        cout << " " << setw(2) << setfill('0') << (static_cast<unsigned int>(buf[i]) & 0xFF);
+    cout << dec << setfill(' ') << endl;
+}
+
+static void
+CheckKnown(const char *what, const Utf16Char *src, size_t count, const char *expected)
+{
+    char buf[64];
+    size_t len = Utf8::FromUtf16(src, count, buf);
+    size_t expectedLen = strlen(expected);
+
+    if (len != expectedLen || memcmp(buf, expected, len) != 0)
+    {
+        cout << what << ": mismatch" << endl;
+        Dump("expected", expected, expectedLen);
+        Dump("got", buf, len);
+        failures++;
+    }
+}
+
+static Utf16Char
+RandomUnit(int kind)
+{
+    switch (kind)
+    {
+        case 0:
+            return static_cast<Utf16Char>(rand() % 0x80);
+        case 1:
+            return static_cast<Utf16Char>(0x80 + rand() % 0x780);
+        case 2:
+            return static_cast<Utf16Char>(0x800 + rand() % 0xD000);
+        case 3:
+            return static_cast<Utf16Char>(0xD800 + rand() % 0x400);
+        default:
+            return static_cast<Utf16Char>(0xDC00 + rand() % 0x400);
+    }
+}
+
+static size_t
+MakeFuzzString(Utf16Char *str, size_t maxCount)
+{
+    size_t count = rand() % (maxCount + 1);
+    size_t i = 0;
+
+    while (i < count)
+    {
+        // Mostly well-formed pairs, now and then a lone half
+        int kind = rand() % 6;
+        size_t run = 1 + rand() % 24;
+
+        for (size_t j = 0; j < run && i < count; j++)
+        {
+            if (kind == 5)
+            {
+                str[i++] = RandomUnit(3);
+                if (i < count)
+                    str[i++] = RandomUnit(4);
+            }
+            else
+            {
+                str[i++] = RandomUnit(kind);
+            }
+        }
+    }
+
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "SIMD " << (Utf8::HaveSimd() ? "enabled" : "disabled") << endl;
+
+    const Utf16Char ascii[] = { 'H', 'e', 'l', 'l', 'o', ',', ' ', 'w', 'o', 'r', 'l', 'd', '!' };
+    CheckKnown("ascii", ascii, 13, "Hello, world!");
+
+    const Utf16Char greek[] = { 0x3B1, 0x3B2, 0x3B3, 0x3B4, 0x3B5, 0x3B6, 0x3B7, 0x3B8, 0x3B9 };
+    CheckKnown("two-byte", greek, 9, "\xCE\xB1\xCE\xB2\xCE\xB3\xCE\xB4\xCE\xB5\xCE\xB6\xCE\xB7\xCE\xB8\xCE\xB9");
+
+    const Utf16Char mixed[] = { 'a', 0xE5, 0x20AC, 0xD83D, 0xDE00, 'b', 'c', 'd', 'e' };
+    CheckKnown("mixed", mixed, 9, "a\xC3\xA5\xE2\x82\xAC\xF0\x9F\x98\x80" "bcde");
+
+    // Pair split across the first block boundary
+    const Utf16Char straddle[] = { 'x', 'x', 'x', 'x', 'x', 'x', 'x', 0xD801, 0xDC37, 'y' };
+    CheckKnown("straddling pair", straddle, 10, "xxxxxxx\xF0\x90\x90\xB7y");
+
+    const Utf16Char lone[] = { 0xDC00, 'a', 0xD800, 'b', 0xD800 };
+    CheckKnown("lone surrogates", lone, 5, "\xEF\xBF\xBD" "a\xEF\xBF\xBD" "b\xEF\xBF\xBD");
+
+    const Utf16Char edges[] = { 0x7F, 0x80, 0x7FF, 0x800, 0xFFFF, 0xDBFF, 0xDFFF };
+    CheckKnown("edges", edges, 7, "\x7F\xC2\x80\xDF\xBF\xE0\xA0\x80\xEF\xBF\xBF\xF4\x8F\xBF\xBF");
+
+    const size_t maxCount = 200;
+    Utf16Char src[maxCount];
+    char expected[maxCount * 3], actual[maxCount * 3];
+
+    srand(1234);
+
+    for (int iteration = 0; iteration < 200000 && failures < 10; iteration++)
+    {
+        size_t count = MakeFuzzString(src, maxCount);
+
+        // Also start off unaligned
+        size_t offset = (count > 0) ? rand() % 2 : 0;
+        count -= offset;
+
+        size_t expectedLen = Utf8::FromUtf16Scalar(src + offset, count, expected);
+        size_t actualLen = Utf8::FromUtf16(src + offset, count, actual);
+
+        if (expectedLen > Utf8::GetMaxLength(count) || actualLen != expectedLen ||
+            memcmp(expected, actual, expectedLen) != 0)
+        {
+            cout << "fuzz iteration " << iteration << ": mismatch for " << count << " units" << endl;
+            Dump("expected", expected, expectedLen);
+            Dump("got", actual, actualLen);
+            failures++;
+        }
+    }
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
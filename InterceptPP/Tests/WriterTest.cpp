@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/BinaryWriter.h>
+#include <InterceptPP/PayloadTable.h>
+#include <iostream>
+
+using namespace std;
+using namespace InterceptPP;
+using namespace InterceptPP::Logging;
+
+//
+// Writes the same value through a BinaryWriter and through a TreeWriter
+// whose tree is then serialized, and checks that both come out the same.
+// Also checks that a truncated payload seen twice is only written once.
+//
+
+static int failures = 0;
+
+static void
+Check(const char *what, bool expected, bool actual)
+{
+    if (actual != expected)
+    {
+        cout << what << ": expected " << expected << ", got " << actual << endl;
+        failures++;
+    }
+}
+
+static bool
+Contains(const BinaryWriter &writer, const char *s)
+{
+    size_t len = strlen(s);
+    for (unsigned int i = 0; i + len <= writer.GetSize(); i++)
+    {
+        if (memcmp(writer.GetData() + i, s, len) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static void
+WriteValue(Writer &writer)
+{
+    writer.BeginElement("value");
+    writer.Field("type", "Struct");
+    writer.Field("subType", "WSABUF");
+    writer.Field("count", 2u);
+
+    writer.BeginElement("field");
+    writer.Field("name", "buf");
+    writer.BeginElement("value");
+    writer.Field("type", "ByteArray");
+    writer.Data("abcd", 2, "wxyz", 3);
+    writer.EndElement();
+    writer.EndElement();
+
+    writer.TextElement("entry", OString("0x71a21234"));
+
+    // No fields, content or children at all
+    writer.BeginElement("empty");
+    writer.EndElement();
+
+    writer.EndElement();
+}
+
+int main(int argc, char *argv[])
+{
+    // Twice, so that the second run uses the thread's spare buffer
+    for (int i = 0; i < 2; i++)
+    {
+        BinaryWriter direct;
+        WriteValue(direct);
+        direct.Close();
+
+        TreeWriter tree;
+        WriteValue(tree);
+        Check("root", true, tree.GetRoot() != NULL);
+
+        BinaryWriter serialized;
+        serialized.AppendNode(tree.GetRoot());
+
+        Check("size", true, direct.GetSize() == serialized.GetSize());
+        Check("data", true, direct.GetSize() == serialized.GetSize() &&
+            memcmp(direct.GetData(), serialized.GetData(), direct.GetSize()) == 0);
+    }
+
+    // Enough to grow the buffer a few times
+    BinaryWriter big;
+    big.BeginElement("arguments");
+    for (int i = 0; i < 5000; i++)
+    {
+        big.BeginElement("argument");
+        big.Field("index", i);
+        big.EndElement();
+    }
+    big.Close();
+    Check("big", true, big.GetSize() > BINARY_WRITER_MAX_CACHED_SIZE);
+
+    PayloadTable::SetThreshold(4);
+    for (int i = 0; i < 2; i++)
+    {
+        BinaryWriter writer;
+        writer.BeginElement("value");
+        writer.Data("hello ", 6, "world", 5);
+        writer.Close();
+
+        Check("payload inline", i == 0, Contains(writer, "hello world"));
+    }
+
+    if (failures == 0)
+        cout << "success" << endl;
+
+    return (failures == 0) ? 0 : 1;
+}
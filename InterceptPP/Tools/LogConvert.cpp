@@ -0,0 +1,641 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <InterceptPP/LogFile.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+using namespace std;
+using namespace InterceptPP;
+
+//
+// Converts a log the agent wrote in version 1 of the binary format to
+// version 2 (see LogFormat.h), checks that every event reads back the
+// same, and compares the two for size and for how long it takes to go
+// through every element, field and content of them.  Version 1 logs come
+// in three flavours, all of which are read:
+//
+//   - events one after the other, as the agent wrote them at first
+//   - each framed by the 24-byte header that the index was built from
+//   - those, cut into LzCodec blocks behind an LzFileHeader
+//
+// Index and trailer records are left behind, the new log gets its own.
+// Besides MSVC this builds on Linux:
+//
+//   g++ -O2 -I../.. LogConvert.cpp ../LogFile.cpp ../LogFormat.cpp ../LogIndex.cpp ../LzCodec.cpp ../MappedFile.cpp
+//
+// Usage: LogConvert [-z] [-b blockSize] input.log output.log
+//
+
+// What a version 1 log is made of, see BinaryWriter.h and LogIndex.h as
+// they were
+#define V1_SYMBOL_KIND_MASK       0xC0000000
+#define V1_SYMBOL_REFERENCE       0x80000000
+#define V1_SYMBOL_DEFINITION      0xC0000000
+#define V1_SYMBOL_ID_MASK         0x3FFFFFFF
+
+#define V1_RECORD_EVENT           1
+#define V1_RECORD_TRAILER         3
+
+typedef struct {
+    unsigned int size;
+    unsigned int kind;
+    unsigned int id;
+    unsigned int type;
+    unsigned long long timestamp;
+} V1RecordFrame;
+
+#define PARSE_ROUNDS  5
+
+#ifdef _WIN32
+
+static double
+GetSeconds()
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / static_cast<double>(freq.QuadPart);
+}
+
+#else
+
+static double
+GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+#endif
+
+static bool
+ReadFile(const char *path, string &data)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.append(buf, n);
+    fclose(f);
+
+    return true;
+}
+
+static bool
+ReadDWord(const char *&p, const char *end, unsigned int &value)
+{
+    if (end - p < 4)
+        return false;
+
+    memcpy(&value, p, 4);
+    p += 4;
+    return true;
+}
+
+static bool
+ReadString(const char *&p, const char *end, const char *&s, unsigned int &length)
+{
+    if (!ReadDWord(p, end, length) || length > static_cast<size_t>(end - p))
+        return false;
+
+    s = p;
+    p += length;
+    return true;
+}
+
+//
+// The symbols of a version 1 log, by id as it defines them, and by name
+// for the event types that the new log needs as symbols as well.  Those
+// that aren't symbols already get ids after the highest one in the log.
+//
+class ConvertEncoder : public LogEncoder
+{
+public:
+    ConvertEncoder() : m_nextId(1) {}
+
+    void Define(unsigned int id, const char *name, unsigned int length)
+    {
+        if (id >= m_names.size())
+        {
+            m_names.resize(id + 1);
+            m_defined.resize(id + 1, false);
+        }
+        m_names[id] = string(name, length);
+        m_defined[id] = true;
+        m_ids[m_names[id]] = id;
+
+        if (id >= m_nextId)
+            m_nextId = id + 1;
+    }
+
+    bool IsDefined(unsigned int id) const
+    {
+        return id < m_defined.size() && m_defined[id];
+    }
+
+    virtual const char *GetSymbolName(unsigned int id, unsigned int &length)
+    {
+        if (!IsDefined(id))
+            return NULL;
+
+        length = static_cast<unsigned int>(m_names[id].size());
+        return m_names[id].data();
+    }
+
+protected:
+    virtual unsigned int InternSymbol(const char *name, unsigned int length)
+    {
+        map<string, unsigned int>::const_iterator iter = m_ids.find(string(name, length));
+        if (iter != m_ids.end())
+            return iter->second;
+
+        if (m_nextId >= LOG_MAX_SYMBOLS)
+            return 0;
+
+        unsigned int id = m_nextId;
+        Define(id, name, length);
+        return id;
+    }
+
+    vector<string> m_names;
+    vector<bool> m_defined;
+    map<string, unsigned int> m_ids;
+    unsigned int m_nextId;
+};
+
+//
+// Goes through an element of a version 1 log, and whatever it nests,
+// much as a reader would: every name and key is looked up, and every
+// value and content is turned into text.  Symbols defined on the way are
+// passed on to the encoder, if there is one.
+//
+class V1Reader
+{
+public:
+    V1Reader(ConvertEncoder *encoder) : elements(0), textBytes(0), m_encoder(encoder) {}
+
+    bool ReadElement(const char *&p, const char *end, string *text, int depth)
+    {
+        if (depth == 64)
+            return false;
+
+        const char *name;
+        unsigned int length, fieldCount;
+        if (!ReadSymbol(p, end, name, length) || !ReadDWord(p, end, fieldCount))
+            return false;
+
+        if (text != NULL)
+        {
+            *text += '<';
+            text->append(name, length);
+        }
+
+        for (unsigned int i = 0; i < fieldCount; i++)
+        {
+            const char *key, *value;
+            unsigned int keyLength, valueLength;
+            if (!ReadSymbol(p, end, key, keyLength) || !ReadString(p, end, value, valueLength))
+                return false;
+
+            textBytes += keyLength + valueLength;
+            if (text != NULL)
+            {
+                *text += ' ';
+                text->append(key, keyLength);
+                *text += "=\"";
+                text->append(value, valueLength);
+                *text += '"';
+            }
+        }
+
+        const char *content;
+        unsigned int raw, contentLength, childCount;
+        if (!ReadDWord(p, end, raw) || !ReadString(p, end, content, contentLength) ||
+            !ReadDWord(p, end, childCount))
+        {
+            return false;
+        }
+
+        textBytes += contentLength;
+        if (text != NULL)
+        {
+            *text += raw ? " raw>" : ">";
+            text->append(content, contentLength);
+        }
+
+        for (unsigned int i = 0; i < childCount; i++)
+        {
+            if (!ReadElement(p, end, text, depth + 1))
+                return false;
+        }
+
+        if (text != NULL)
+            *text += "</>";
+
+        elements++;
+        return true;
+    }
+
+    unsigned int elements;
+    unsigned long long textBytes;
+
+protected:
+    bool ReadSymbol(const char *&p, const char *end, const char *&name, unsigned int &length)
+    {
+        unsigned int value;
+        if (!ReadDWord(p, end, value))
+            return false;
+
+        unsigned int id = value & V1_SYMBOL_ID_MASK;
+        if ((value & V1_SYMBOL_KIND_MASK) == V1_SYMBOL_DEFINITION)
+        {
+            if (!ReadString(p, end, name, length))
+                return false;
+
+            if (m_encoder != NULL && !m_encoder->IsDefined(id))
+            {
+                if (id >= LOG_MAX_SYMBOLS)
+                    return false;
+                m_encoder->Define(id, name, length);
+            }
+            return true;
+        }
+
+        if ((value & V1_SYMBOL_KIND_MASK) != V1_SYMBOL_REFERENCE)
+            return false;
+
+        // Names only matter for the text
+        if (m_encoder == NULL)
+        {
+            name = NULL;
+            length = 0;
+            return true;
+        }
+
+        name = m_encoder->GetSymbolName(id, length);
+        return name != NULL;
+    }
+
+    ConvertEncoder *m_encoder;
+};
+
+typedef struct {
+    const char *data;
+    unsigned int size;
+} V1Event;
+
+//
+// Finds the events of a version 1 log, which is decompressed first if it
+// has to be, defining its symbols on the way.
+//
+static bool
+FindEvents(const string &file, string &records, ConvertEncoder &encoder, vector<V1Event> &events)
+{
+    LzFileHeader header;
+    if (file.size() >= sizeof(header))
+        memcpy(&header, file.data(), sizeof(header));
+
+    if (file.size() >= sizeof(header) && header.magic == LZ_FILE_MAGIC)
+    {
+        size_t pos = sizeof(header);
+        while (pos < file.size())
+        {
+            LzBlockHeader block;
+            if (file.size() - pos < sizeof(block))
+                return false;
+            memcpy(&block, file.data() + pos, sizeof(block));
+            if (block.storedSize > file.size() - pos - sizeof(block))
+                return false;
+
+            size_t offset = records.size();
+            records.resize(offset + block.rawSize);
+            if (LzCodec::DecompressBlock(&block, file.data() + pos + sizeof(block), &records[offset], block.rawSize) !=
+                static_cast<int>(block.rawSize))
+            {
+                return false;
+            }
+
+            pos += LzCodec::GetBlockSize(block.storedSize);
+        }
+    }
+    else
+    {
+        records = file;
+    }
+
+    const char *p = records.data();
+    const char *end = p + records.size();
+    V1Reader reader(&encoder);
+
+    // Unframed logs start with the definition of the first element's name
+    unsigned int first = 0;
+    if (records.size() >= 4)
+        memcpy(&first, p, 4);
+    bool framed = (first & V1_SYMBOL_KIND_MASK) != V1_SYMBOL_DEFINITION;
+
+    while (p < end)
+    {
+        const char *start = p;
+        const char *recordEnd = end;
+
+        if (framed)
+        {
+            V1RecordFrame frame;
+            if (static_cast<size_t>(end - p) < sizeof(frame))
+                return false;
+            memcpy(&frame, p, sizeof(frame));
+            p += sizeof(frame);
+
+            if (frame.size > static_cast<size_t>(end - p))
+                return false;
+            recordEnd = p + frame.size;
+
+            if (frame.kind != V1_RECORD_EVENT)
+            {
+                p = recordEnd;
+                continue;
+            }
+        }
+
+        // A record usually holds the one event
+        while (p < recordEnd)
+        {
+            start = p;
+            if (!reader.ReadElement(p, recordEnd, NULL, 0))
+                return false;
+
+            V1Event event;
+            event.data = start;
+            event.size = static_cast<unsigned int>(p - start);
+            events.push_back(event);
+        }
+    }
+
+    return true;
+}
+
+// Turns version 2 events into the same text as V1Reader
+class TextVisitor : public LogVisitor
+{
+public:
+    TextVisitor(ConvertEncoder &encoder, const vector<V1Event> &events)
+        : count(0), mismatches(0), m_encoder(encoder), m_events(events)
+    {}
+
+    virtual void BeginElement(const char *name, unsigned int length)
+    {
+        m_text += '<';
+        m_text.append(name, length);
+    }
+
+    virtual void Field(const char *key, unsigned int keyLength, const LogValue &value)
+    {
+        char buf[LOG_MAX_VALUE_TEXT];
+        unsigned int length;
+        const char *s = LogFormat::GetText(value, buf, length);
+
+        m_text += ' ';
+        m_text.append(key, keyLength);
+        m_text += "=\"";
+        m_text.append(s, length);
+        m_text += '"';
+    }
+
+    virtual void Content(bool raw, const char *data, unsigned int length)
+    {
+        m_text += raw ? " raw>" : ">";
+        m_text.append(data, length);
+    }
+
+    virtual void EndElement()
+    {
+        m_text += "</>";
+    }
+
+    virtual void EndEvent()
+    {
+        string expected;
+        if (count < m_events.size())
+        {
+            const char *p = m_events[count].data;
+            V1Reader reader(&m_encoder);
+            reader.ReadElement(p, p + m_events[count].size, &expected, 0);
+        }
+
+        if (m_text != expected)
+            mismatches++;
+
+        count++;
+        m_text.clear();
+    }
+
+    size_t count;
+    size_t mismatches;
+
+protected:
+    ConvertEncoder &m_encoder;
+    const vector<V1Event> &m_events;
+    string m_text;
+};
+
+// Touches what V1Reader does
+class CountingVisitor : public LogVisitor
+{
+public:
+    CountingVisitor() : elements(0), textBytes(0) {}
+
+    virtual void BeginElement(const char *name, unsigned int length) {}
+
+    virtual void Field(const char *key, unsigned int keyLength, const LogValue &value)
+    {
+        char buf[LOG_MAX_VALUE_TEXT];
+        unsigned int length;
+        LogFormat::GetText(value, buf, length);
+        textBytes += keyLength + length;
+    }
+
+    virtual void Content(bool raw, const char *data, unsigned int length)
+    {
+        textBytes += length;
+    }
+
+    virtual void EndElement()
+    {
+        elements++;
+    }
+
+    unsigned int elements;
+    unsigned long long textBytes;
+};
+
+#ifdef _WIN32
+typedef wstring PathString;
+#else
+typedef string PathString;
+#endif
+
+static PathString
+ToPath(const char *path)
+{
+#ifdef _WIN32
+    wchar_t buf[MAX_PATH];
+    MultiByteToWideChar(CP_ACP, 0, path, -1, buf, MAX_PATH);
+    return buf;
+#else
+    return path;
+#endif
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool compressed = false;
+    unsigned int blockSize = LZ_DEFAULT_BLOCK_SIZE;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (strcmp(argv[arg], "-z") == 0)
+            compressed = true;
+        else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+            blockSize = atoi(argv[++arg]);
+        else
+            break;
+    }
+
+    if (argc - arg != 2 || blockSize < LZ_MIN_BLOCK_SIZE || blockSize > LZ_MAX_BLOCK_SIZE)
+    {
+        cerr << "usage: LogConvert [-z] [-b blockSize] input.log output.log" << endl;
+        return 2;
+    }
+
+    string file, records;
+    if (!ReadFile(argv[arg], file))
+    {
+        cerr << "can't read " << argv[arg] << endl;
+        return 1;
+    }
+
+    ConvertEncoder encoder;
+    vector<V1Event> events;
+    if (!FindEvents(file, records, encoder, events))
+        cerr << "the log is corrupt after " << events.size() << " events, converting those" << endl;
+
+    PathString output = ToPath(argv[arg + 1]);
+    LogFileWriter writer(encoder);
+    if (!writer.Create(output.c_str(), compressed, blockSize))
+    {
+        cerr << "can't create " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    size_t rejected = 0;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        if (!writer.WriteEvent(events[i].data, events[i].size))
+            rejected++;
+    }
+
+    if (!writer.Close())
+    {
+        cerr << "can't write " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    // Read it back, every event has to be what it was
+    LogIndexReader reader;
+    if (!reader.Open(output.c_str()) || !reader.IsComplete())
+    {
+        cerr << "can't read back " << argv[arg + 1] << endl;
+        return 1;
+    }
+
+    TextVisitor check(encoder, events);
+    bool decoded = true;
+    for (unsigned int i = 0; i < reader.GetBlockCount() && decoded; i++)
+    {
+        unsigned int size;
+        const char *data = reader.ReadBlock(i, size);
+        decoded = data != NULL && reader.GetDecoder().DecodeBlock(data, size, check);
+    }
+
+    if (!decoded || rejected > 0 || check.count != events.size() || check.mismatches > 0)
+    {
+        cerr << "verification failed: " << rejected << " events rejected, " << check.count << " of "
+             << events.size() << " read back, " << check.mismatches << " different" << endl;
+        return 1;
+    }
+
+    // Going through everything, as a reader would
+    double start = GetSeconds();
+    unsigned long long v1Bytes = 0;
+    for (int round = 0; round < PARSE_ROUNDS; round++)
+    {
+        V1Reader v1(&encoder);
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            const char *p = events[i].data;
+            v1.ReadElement(p, p + events[i].size, NULL, 0);
+        }
+        v1Bytes = v1.textBytes;
+    }
+    double v1Time = (GetSeconds() - start) / PARSE_ROUNDS;
+
+    start = GetSeconds();
+    unsigned long long v2Bytes = 0;
+    for (int round = 0; round < PARSE_ROUNDS; round++)
+    {
+        CountingVisitor v2;
+        for (unsigned int i = 0; i < reader.GetBlockCount(); i++)
+        {
+            unsigned int size;
+            const char *data = reader.ReadBlock(i, size);
+            reader.GetDecoder().DecodeBlock(data, size, v2);
+        }
+        v2Bytes = v2.textBytes;
+    }
+    double v2Time = (GetSeconds() - start) / PARSE_ROUNDS;
+
+    if (v1Bytes != v2Bytes)
+        cerr << "the two parses saw " << v1Bytes << " and " << v2Bytes << " bytes of text" << endl;
+
+    cout << events.size() << " events, " << reader.GetBlockCount() << " blocks" << endl;
+    cout << "version 1: " << file.size() << " bytes";
+    if (records.size() != file.size())
+        cout << " (" << records.size() << " uncompressed)";
+    cout << ", parsed in " << v1Time * 1000.0 << " ms" << endl;
+    cout << "version 2: " << writer.GetOffset() << " bytes" << (compressed ? " compressed" : "")
+         << ", " << 100.0 * writer.GetOffset() / file.size() << "%, parsed in " << v2Time * 1000.0 << " ms"
+         << (compressed ? " including decompression" : "") << endl;
+
+    reader.Close();
+    return 0;
+}
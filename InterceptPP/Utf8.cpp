@@ -0,0 +1,177 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "Utf8.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define UTF8_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace InterceptPP {
+
+static inline size_t
+EncodeCodePoint(const Utf16Char *src, size_t count, size_t &i, unsigned char *out)
+{
+    unsigned int c = src[i++];
+
+    if (c < 0x80)
+    {
+        out[0] = static_cast<unsigned char>(c);
+        return 1;
+    }
+    else if (c < 0x800)
+    {
+        out[0] = static_cast<unsigned char>(0xC0 | (c >> 6));
+        out[1] = static_cast<unsigned char>(0x80 | (c & 0x3F));
+        return 2;
+    }
+    else if (c >= 0xD800 && c <= 0xDFFF)
+    {
+        if (c <= 0xDBFF && i < count && src[i] >= 0xDC00 && src[i] <= 0xDFFF)
+        {
+            unsigned int cp = 0x10000 + ((c - 0xD800) << 10) + (src[i++] - 0xDC00);
+
+            out[0] = static_cast<unsigned char>(0xF0 | (cp >> 18));
+            out[1] = static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3F));
+            out[2] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
+            out[3] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+            return 4;
+        }
+
+        // Unpaired surrogate, emit U+FFFD
+        c = 0xFFFD;
+    }
+
+    out[0] = static_cast<unsigned char>(0xE0 | (c >> 12));
+    out[1] = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3F));
+    out[2] = static_cast<unsigned char>(0x80 | (c & 0x3F));
+    return 3;
+}
+
+size_t
+Utf8::FromUtf16Scalar(const Utf16Char *src, size_t count, char *dst)
+{
+    unsigned char *out = reinterpret_cast<unsigned char *>(dst);
+    size_t i = 0;
+
+    while (i < count)
+        out += EncodeCodePoint(src, count, i, out);
+
+    return out - reinterpret_cast<unsigned char *>(dst);
+}
+
+bool
+Utf8::HaveSimd()
+{
+#if defined(UTF8_USE_SSE2) && defined(_M_IX86) && !defined(__SSE2__)
+    // 32-bit MSVC doesn't assume SSE2 unless built with /arch:SSE2
+    static int haveSse2 = -1;
+
+    if (haveSse2 < 0)
+        haveSse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? 1 : 0;
+
+    return haveSse2 != 0;
+#elif defined(UTF8_USE_SSE2)
+    return true;
+#else
+    return false;
+#endif
+}
+
+size_t
+Utf8::FromUtf16(const Utf16Char *src, size_t count, char *dst)
+{
+#ifdef UTF8_USE_SSE2
+    if (count < 8 || !HaveSimd())
+        return FromUtf16Scalar(src, count, dst);
+
+    unsigned char *out = reinterpret_cast<unsigned char *>(dst);
+    size_t i = 0;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i asciiMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const __m128i twoByteMask = _mm_set1_epi16(static_cast<short>(0xF800));
+    const __m128i leadBits = _mm_set1_epi16(0x00C0);
+    const __m128i trailBits = _mm_set1_epi16(0x0080);
+    const __m128i lowSix = _mm_set1_epi16(0x003F);
+
+    while (i + 8 <= count)
+    {
+#ifdef __AVX2__
+        if (i + 16 <= count)
+        {
+            __m256i wide = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+
+            if (_mm256_testz_si256(wide, _mm256_set1_epi16(static_cast<short>(0xFF80))))
+            {
+                __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(wide),
+                                                  _mm256_extracti128_si256(wide, 1));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out), packed);
+                out += 16;
+                i += 16;
+                continue;
+            }
+        }
+#endif
+
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+
+        int asciiLanes = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, asciiMask), zero));
+        if (asciiLanes == 0xFFFF)
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(v, v));
+            out += 8;
+            i += 8;
+            continue;
+        }
+
+        int narrowLanes = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, twoByteMask), zero));
+        if (asciiLanes == 0 && narrowLanes == 0xFFFF)
+        {
+            // U+0080..U+07FF only: every unit becomes exactly two bytes, so
+            // lead | trail << 8 per lane is already the output in order.
+            __m128i lead = _mm_or_si128(_mm_srli_epi16(v, 6), leadBits);
+            __m128i trail = _mm_or_si128(_mm_and_si128(v, lowSix), trailBits);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                             _mm_or_si128(lead, _mm_slli_epi16(trail, 8)));
+            out += 16;
+            i += 8;
+            continue;
+        }
+
+        // Mixed block, a surrogate pair may carry us one unit past it
+        size_t end = i + 8;
+        while (i < end)
+            out += EncodeCodePoint(src, count, i, out);
+    }
+
+    while (i < count)
+        out += EncodeCodePoint(src, count, i, out);
+
+    return out - reinterpret_cast<unsigned char *>(dst);
+#else
+    return FromUtf16Scalar(src, count, dst);
+#endif
+}
+
+} // namespace InterceptPP
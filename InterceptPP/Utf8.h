@@ -0,0 +1,62 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#ifdef _WIN32
+#include "InterceptPP.h"
+#else
+#include <stddef.h>
+#ifndef INTERCEPTPP_API
+#define INTERCEPTPP_API
+#endif
+#endif
+
+namespace InterceptPP {
+
+typedef unsigned short Utf16Char;
+
+//
+// UTF-16LE to UTF-8 transcoding for the string marshallers, replacing the
+// measure-then-convert pair of WideCharToMultiByte() calls with a single
+// pass into a buffer sized from GetMaxLength().
+//
+// Runs of ASCII and runs of two-byte code points (Latin-1 supplement,
+// Greek, Cyrillic, ...) are converted eight units at a time with SSE2;
+// with __AVX2__ set at compile time ASCII runs take sixteen at a time.
+// Everything else goes through FromUtf16Scalar(), which is also the
+// reference the SIMD path is checked against.  Unpaired surrogates are
+// replaced with U+FFFD, like WideCharToMultiByte() does on Vista and up.
+//
+// Builds on Linux so that the SIMD path can be fuzzed there.
+//
+
+class INTERCEPTPP_API Utf8
+{
+public:
+    static size_t GetMaxLength(size_t count) { return count * 3; }
+
+    // Both return the number of bytes written to dst, which must have room
+    // for GetMaxLength(count) bytes.  No NUL terminator is written.
+    static size_t FromUtf16(const Utf16Char *src, size_t count, char *dst);
+    static size_t FromUtf16Scalar(const Utf16Char *src, size_t count, char *dst);
+
+    static bool HaveSimd();
+};
+
+} // namespace InterceptPP
@@ -16,6 +16,8 @@
 //
 
 #include "Util.h"
+#include "Format.h"
+#include "MemoryMap.h"
 #include <psapi.h>
 #include <shlwapi.h>
 
@@ -26,13 +28,20 @@ namespace InterceptPP {
 Util::Util()
     : m_ansiFuncSpec(NULL),
       m_uniFuncSpec(NULL),
+      m_freeLibrarySpec(NULL),
+      m_virtualFreeSpec(NULL),
+      m_unmapViewSpec(NULL),
       m_mod(NULL),
       m_ansiFunc(NULL),
       m_uniFunc(NULL),
+      m_freeLibraryFunc(NULL),
+      m_virtualFreeFunc(NULL),
+      m_unmapViewFunc(NULL),
       m_lowestAddress(0xFFFFFFFF),
       m_highestAddress(0)
 {
     m_loadLibraryHandler.Initialize (this, &Util::OnLoadLibrary);
+    m_freeMemoryHandler.Initialize (this, &Util::OnFreeMemory);
 }
 
 Util *
@@ -65,12 +74,28 @@ Util::Initialize()
     m_uniFuncSpec = new FunctionSpec("LoadLibraryW");
     m_uniFuncSpec->AddHandler(&m_loadLibraryHandler);
 
+    m_freeLibrarySpec = new FunctionSpec("FreeLibrary");
+    m_freeLibrarySpec->AddHandler(&m_loadLibraryHandler);
+
+    // Freed memory must leave the MemoryMap before anybody relies on it
+    m_virtualFreeSpec = new FunctionSpec("VirtualFree", CALLING_CONV_STDCALL, 12);
+    m_virtualFreeSpec->AddHandler(&m_freeMemoryHandler);
+
+    m_unmapViewSpec = new FunctionSpec("UnmapViewOfFile", CALLING_CONV_STDCALL, 4);
+    m_unmapViewSpec->AddHandler(&m_freeMemoryHandler);
+
     m_mod = new DllModule("kernel32.dll");
     m_ansiFunc = new DllFunction(m_mod, m_ansiFuncSpec);
     m_uniFunc = new DllFunction(m_mod, m_uniFuncSpec);
+    m_freeLibraryFunc = new DllFunction(m_mod, m_freeLibrarySpec);
+    m_virtualFreeFunc = new DllFunction(m_mod, m_virtualFreeSpec);
+    m_unmapViewFunc = new DllFunction(m_mod, m_unmapViewSpec);
 
     m_ansiFunc->Hook();
     m_uniFunc->Hook();
+    m_freeLibraryFunc->Hook();
+    m_virtualFreeFunc->Hook();
+    m_unmapViewFunc->Hook();
 
     UpdateModuleList();
 }
@@ -80,6 +105,16 @@ Util::UnInitialize()
 {
     m_modules.clear();
 
+    DllFunction *funcs[] = { m_unmapViewFunc, m_virtualFreeFunc, m_freeLibraryFunc };
+    for (int i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++)
+    {
+        if (funcs[i] != NULL)
+        {
+            funcs[i]->Unhook();
+            delete funcs[i];
+        }
+    }
+
     if (m_uniFunc != NULL)
     {
         m_uniFunc->Unhook();
@@ -95,6 +130,13 @@ Util::UnInitialize()
     if (m_mod != NULL)
         delete m_mod;
 
+    FunctionSpec *specs[] = { m_unmapViewSpec, m_virtualFreeSpec, m_freeLibrarySpec };
+    for (int i = 0; i < sizeof(specs) / sizeof(specs[0]); i++)
+    {
+        if (specs[i] != NULL)
+            delete specs[i];
+    }
+
     if (m_uniFuncSpec != NULL)
         delete m_uniFuncSpec;
 
@@ -118,6 +160,21 @@ Util::OnLoadLibrary (FunctionCall * call, bool & shouldLog)
     shouldLog = false;
 }
 
+void
+Util::OnFreeMemory (FunctionCall * call, bool & shouldLog)
+{
+    if (call->GetState () == FUNCTION_CALL_LEAVING && call->GetReturnValue () != FALSE)
+    {
+        // VirtualFree (lpAddress, dwSize, dwFreeType) and UnmapViewOfFile (lpBaseAddress)
+        DWORD * args = call->GetArgumentsPtr<DWORD> ();
+        DWORD size = (call->GetArgumentsData ().size () >= 3 * sizeof (DWORD) && args[2] == MEM_DECOMMIT) ? args[1] : 0;
+
+        MemoryMap::Instance ()->Invalidate (reinterpret_cast<void *> (args[0]), size);
+    }
+
+    shouldLog = false;
+}
+
 void
 Util::UpdateModuleList()
 {
@@ -126,7 +183,8 @@ Util::UpdateModuleList()
     m_lowestAddress = 0xFFFFFFFF;
     m_highestAddress = 0;
 
-    m_modules.clear();
+    OMap<OICString, OModuleInfo>::Type previous;
+    previous.swap(m_modules);
 
     HANDLE process = GetCurrentProcess();
 
@@ -161,6 +219,12 @@ Util::UpdateModuleList()
 
                 m_modules[buf] = modInfo;
 
+                OMap<OICString, OModuleInfo>::Type::iterator prev = previous.find(buf);
+                if (prev != previous.end() && prev->second.handle == modInfo.handle)
+                    previous.erase(prev);
+                else
+                    MemoryMap::Instance()->Invalidate(mi.lpBaseOfDll, mi.SizeOfImage);
+
                 if (modInfo.startAddress < m_lowestAddress)
                     m_lowestAddress = modInfo.startAddress;
                 if (modInfo.endAddress > m_highestAddress)
@@ -169,6 +233,14 @@ Util::UpdateModuleList()
         }
     }
 
+    // Whatever is left got unloaded
+    for (OMap<OICString, OModuleInfo>::Type::iterator it = previous.begin(); it != previous.end(); it++)
+    {
+        const OModuleInfo &gone = it->second;
+        MemoryMap::Instance()->Invalidate(reinterpret_cast<void *>(gone.startAddress),
+                                          gone.endAddress - gone.startAddress + 1);
+    }
+
 DONE:
     LeaveCriticalSection(&m_cs);
 }
@@ -278,32 +350,71 @@ Util::GetDirectory(const OModuleInfo &mi)
 #define OPCODE_CALL_NEAR_RELATIVE     0xE8
 #define OPCODE_CALL_NEAR_ABS_INDIRECT 0xFF
 
-Logging::Node *
-Util::CreateBacktraceNode(void *address)
+//
+// The MemoryMap only tells us what was readable when it was last queried;
+// heap decommits and protection changes don't reach it, so a hit may be
+// stale.  Every read it lets through is therefore done here, where a fault
+// just means "not readable".  Kept free of objects that need unwinding so
+// that __try can be used.
+//
+static bool
+ReadMemory(const void *address, void *buffer, size_t size)
+{
+    __try
+    {
+        memcpy(buffer, address, size);
+    }
+    __except (GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION ||
+              GetExceptionCode() == EXCEPTION_GUARD_PAGE
+              ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void
+Util::WriteBacktrace(Logging::Writer &writer, void *address)
 {
-    Logging::Element *btNode = NULL;
+    bool started = false;
+
+    MemoryMap *map = MemoryMap::Instance();
+
+    // Nothing above the base of our own stack belongs to the backtrace, and
+    // it may be a neighbouring allocation that was freed behind our back
+    size_t maxSize = 16384;
+    NT_TIB *tib = reinterpret_cast<NT_TIB *>(NtCurrentTeb());
+    if (address >= tib->StackLimit && address < tib->StackBase)
+    {
+        size_t stackSize = (char *) tib->StackBase - (char *) address;
+        if (stackSize < maxSize)
+            maxSize = stackSize;
+    }
 
     int count = 0;
     DWORD *p = (DWORD *) address;
+    DWORD *end = (DWORD *) ((char *) address + (map->GetReadableSize(address, maxSize) & ~(sizeof(DWORD) - 1)));
 
-    for (; count < 8 && (char *) p < (char *) address + 16384; p++)
+    for (; count < 8 && p < end; p++)
     {
-        if (IsBadReadPtr(p, 4))
+        DWORD value;
+        if (!ReadMemory(p, &value, sizeof(value)))
             break;
 
-        DWORD value = *p;
-
         if (value < m_lowestAddress || value > m_highestAddress)
             continue;
 
+        // The six bytes before the return address, code[6 - n] being *(codeAddr - n)
         unsigned char *codeAddr = (unsigned char *) value;
-        if (IsBadReadPtr(reinterpret_cast<FARPROC>(codeAddr - 6), 6))
+        unsigned char code[6];
+        if (!map->IsReadable(codeAddr - 6, 6) || !ReadMemory(codeAddr - 6, code, sizeof(code)))
             continue;
 
-        if (*(codeAddr - 5) == OPCODE_CALL_NEAR_RELATIVE ||
-            *(codeAddr - 6) == OPCODE_CALL_NEAR_ABS_INDIRECT ||
-            *(codeAddr - 3) == OPCODE_CALL_NEAR_ABS_INDIRECT ||
-            *(codeAddr - 2) == OPCODE_CALL_NEAR_ABS_INDIRECT)
+        if (code[1] == OPCODE_CALL_NEAR_RELATIVE ||
+            code[0] == OPCODE_CALL_NEAR_ABS_INDIRECT ||
+            code[3] == OPCODE_CALL_NEAR_ABS_INDIRECT ||
+            code[4] == OPCODE_CALL_NEAR_ABS_INDIRECT)
         {
             EnterCriticalSection(&m_cs);
 
@@ -313,17 +424,19 @@ Util::CreateBacktraceNode(void *address)
             {
                 DWORD canonicalAddress = mi->preferredStartAddress + (value - mi->startAddress);
 
-                Logging::TextNode *entry = new Logging::TextNode("entry");
-                entry->AddField("moduleName", mi->name.c_str());
+                if (!started)
+                {
+                    writer.BeginElement("backtrace");
+                    started = true;
+                }
 
-                OOStringStream ss;
-                ss << "0x" << hex << canonicalAddress;
+                writer.BeginElement("entry");
+                writer.Field("moduleName", mi->name.c_str());
 
-                entry->SetText(ss.str());
+                char buf[FORMAT_MAX_LENGTH];
+                writer.Text(buf, Format::HexPrefixed(buf, canonicalAddress) - buf);
 
-                if (btNode == NULL)
-                    btNode = new Logging::Element("backtrace");
-                btNode->AppendChild(entry);
+                writer.EndElement();
 
                 count++;
             }
@@ -332,7 +445,17 @@ Util::CreateBacktraceNode(void *address)
         }
     }
 
-    return btNode;
+    if (started)
+        writer.EndElement();
+}
+
+Logging::Node *
+Util::CreateBacktraceNode(void *address)
+{
+    Logging::TreeWriter writer;
+    WriteBacktrace(writer, address);
+
+    return writer.GetRoot();
 }
 
 DWORD
@@ -19,7 +19,7 @@
 
 #include "Core.h"
 #include "DLL.h"
-#include "Logging.h"
+#include "Writer.h"
 
 namespace InterceptPP {
 
@@ -55,10 +55,12 @@ public:
 
     OString GetDirectory(const OModuleInfo &mi);
 
+    void WriteBacktrace(Logging::Writer &writer, void *address);
     Logging::Node *CreateBacktraceNode(void *address);
 
 private:
     void OnLoadLibrary (FunctionCall * call, bool & shouldLog);
+    void OnFreeMemory (FunctionCall * call, bool & shouldLog);
 
     DWORD GetModulePreferredStartAddress(HMODULE mod);
     OModuleInfo *GetModuleInfoForAddress(DWORD address);
@@ -68,10 +70,17 @@ private:
 
     FunctionSpec *m_ansiFuncSpec;
     FunctionSpec *m_uniFuncSpec;
+    FunctionSpec *m_freeLibrarySpec;
+    FunctionSpec *m_virtualFreeSpec;
+    FunctionSpec *m_unmapViewSpec;
     FunctionCallHandler<Util> m_loadLibraryHandler;
+    FunctionCallHandler<Util> m_freeMemoryHandler;
     DllModule *m_mod;
     DllFunction *m_ansiFunc;
     DllFunction *m_uniFunc;
+    DllFunction *m_freeLibraryFunc;
+    DllFunction *m_virtualFreeFunc;
+    DllFunction *m_unmapViewFunc;
 
     OMap<OICString, OModuleInfo>::Type m_modules;
     volatile DWORD m_lowestAddress;
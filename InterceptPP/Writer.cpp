@@ -0,0 +1,155 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "Writer.h"
+#include "Format.h"
+
+namespace InterceptPP {
+
+namespace Logging {
+
+void
+Writer::Field(Symbol name, int value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    WriteField(name, buf, Format::Decimal(buf, value) - buf);
+}
+
+void
+Writer::Field(Symbol name, unsigned int value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    WriteField(name, buf, Format::Decimal(buf, value) - buf);
+}
+
+void
+Writer::Field(Symbol name, unsigned long value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    WriteField(name, buf, Format::Decimal(buf, static_cast<unsigned int>(value)) - buf);
+}
+
+void
+Writer::Field(Symbol name, unsigned long long value)
+{
+    char buf[FORMAT_MAX_LENGTH];
+    WriteField(name, buf, Format::Decimal(buf, static_cast<unsigned __int64>(value)) - buf);
+}
+
+void
+Writer::TextElement(Symbol name, const char *text, size_t length)
+{
+    BeginElement(name);
+    WriteContent(false, text, length, NULL, 0);
+    EndElement();
+}
+
+TreeWriter::TreeWriter(Element *parent)
+    : m_parent(parent), m_event(NULL), m_root(NULL)
+{
+}
+
+TreeWriter::TreeWriter(Event *ev)
+    : m_parent(ev), m_event(ev), m_root(NULL)
+{
+}
+
+TreeWriter::~TreeWriter()
+{
+    // Never submitted
+    if (m_event != NULL)
+        delete m_event;
+}
+
+unsigned int
+TreeWriter::GetId() const
+{
+    return (m_event != NULL) ? m_event->GetId() : 0;
+}
+
+void
+TreeWriter::Submit()
+{
+    if (m_event == NULL)
+        return;
+
+    m_stack.clear();
+
+    Event *ev = m_event;
+    m_event = NULL;
+    m_parent = NULL;
+    ev->Submit();
+}
+
+void
+TreeWriter::BeginElement(Symbol name)
+{
+    Element *el = new Element(name);
+    Attach(el);
+    m_stack.push_back(el);
+}
+
+void
+TreeWriter::EndElement()
+{
+    if (!m_stack.empty())
+        m_stack.pop_back();
+}
+
+void
+TreeWriter::AppendNode(Node *node)
+{
+    Attach(node);
+}
+
+void
+TreeWriter::WriteField(Symbol name, const char *value, size_t length)
+{
+    if (!m_stack.empty())
+        m_stack.back()->AddField(name, value, length);
+    else if (m_parent != NULL)
+        m_parent->AddField(name, value, length);
+}
+
+void
+TreeWriter::WriteContent(bool raw, const void *head, size_t headSize, const void *tail, size_t tailSize)
+{
+    Node *node = (!m_stack.empty()) ? m_stack.back() : m_parent;
+    if (node == NULL)
+        return;
+
+    node->m_contentIsRaw = raw;
+    node->SetContent(head, headSize, tail, tailSize, !raw);
+}
+
+void
+TreeWriter::Attach(Node *node)
+{
+    if (!m_stack.empty())
+        m_stack.back()->AppendChildNode(node);
+    else if (m_parent != NULL)
+        m_parent->AppendChild(node);
+    else if (m_root == NULL)
+        m_root = node;
+    else
+        delete node;    // GetRoot() only has room for one
+}
+
+} // namespace Logging
+
+} // namespace InterceptPP
@@ -0,0 +1,127 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include "Logging.h"
+
+namespace InterceptPP {
+
+namespace Logging {
+
+#pragma warning (push)
+#pragma warning (disable: 4251)
+
+//
+// Streaming, SAX-style interface for logging a tree without building it
+// first.  An element is written as
+//
+//   BeginElement(name)
+//     Field(key, value)         any fields come first,
+//     Text() or Data()          then at most one of these,
+//     BeginElement() ...        then the children
+//   EndElement()
+//
+// Trees built with the Node API, like the ones plugins pass around, can be
+// written as a child with AppendNode().
+//
+// Logger::NewEventWriter() hands out a writer for a new event, whose
+// "event" element is already open.  Submit() closes whatever is still open
+// and passes the event on to the logger; deleting the writer is still up
+// to the caller.
+//
+class INTERCEPTPP_API Writer : public BaseObject
+{
+public:
+    virtual ~Writer() {}
+
+    // The id of the event being written, if any
+    virtual unsigned int GetId() const { return 0; }
+    virtual void Submit() {}
+
+    virtual void BeginElement(Symbol name) = 0;
+    virtual void EndElement() = 0;
+
+    // Takes ownership of node
+    virtual void AppendNode(Node *node) = 0;
+
+    void Field(Symbol name, const char *value, size_t length) { WriteField(name, value, length); }
+    void Field(Symbol name, const char *value) { WriteField(name, value, strlen(value)); }
+    void Field(Symbol name, const OString &value) { WriteField(name, value.data(), value.size()); }
+    void Field(Symbol name, int value);
+    void Field(Symbol name, unsigned int value);
+    void Field(Symbol name, unsigned long value);
+    void Field(Symbol name, unsigned long long value);
+
+    void Text(const char *text, size_t length) { WriteContent(false, text, length, NULL, 0); }
+    void Text(const char *text) { WriteContent(false, text, strlen(text), NULL, 0); }
+    void Text(const OString &text) { WriteContent(false, text.data(), text.size(), NULL, 0); }
+
+    void Data(const void *buf, size_t size) { WriteContent(true, buf, size, NULL, 0); }
+    void Data(const void *head, size_t headSize, const void *tail, size_t tailSize) { WriteContent(true, head, headSize, tail, tailSize); }
+
+    // An element with nothing but text, the equivalent of a TextNode
+    void TextElement(Symbol name, const char *text, size_t length);
+    void TextElement(Symbol name, const OString &text) { TextElement(name, text.data(), text.size()); }
+
+protected:
+    virtual void WriteField(Symbol name, const char *value, size_t length) = 0;
+    virtual void WriteContent(bool raw, const void *head, size_t headSize, const void *tail, size_t tailSize) = 0;
+};
+
+//
+// Builds Nodes out of what's written, either as children of an existing
+// element or as a new tree returned by GetRoot().  Given an Event it
+// writes into that event and submits it on Submit(), which is how loggers
+// that deal in trees implement NewEventWriter().
+//
+class INTERCEPTPP_API TreeWriter : public Writer
+{
+public:
+    TreeWriter(Element *parent=NULL);
+    TreeWriter(Event *ev);
+    virtual ~TreeWriter();
+
+    // The first node written at the top level when there's no parent, it's
+    // up to the caller to delete it
+    Node *GetRoot() const { return m_root; }
+
+    virtual unsigned int GetId() const;
+    virtual void Submit();
+
+    virtual void BeginElement(Symbol name);
+    virtual void EndElement();
+    virtual void AppendNode(Node *node);
+
+protected:
+    virtual void WriteField(Symbol name, const char *value, size_t length);
+    virtual void WriteContent(bool raw, const void *head, size_t headSize, const void *tail, size_t tailSize);
+
+    Element *m_parent;
+    Event *m_event;
+    Node *m_root;
+    OVector<Node *>::Type m_stack;
+
+    void Attach(Node *node);
+};
+
+#pragma warning (pop)
+
+} // namespace Logging
+
+} // namespace InterceptPP
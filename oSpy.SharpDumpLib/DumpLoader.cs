@@ -1,5 +1,5 @@
 //
-// Copyright (c) 2009 Ole André Vadla Ravnås <oleavr@gmail.com>
+// Copyright (c) 2009 Ole Andr Vadla Ravns <oleavr@gmail.com>
 //
 // This library is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -16,6 +16,7 @@
 //
 
 using System;
+using System.Collections.Generic;
 using System.ComponentModel;
 using System.IO;
 using System.Threading;
@@ -171,6 +172,11 @@ namespace oSpy.SharpDumpLib
 
             XmlTextReader xmlReader = new XmlTextReader(stream);
 
+            // Schema events are logged after the first event using their
+            // types, and payloads may be referenced before the event that
+            // carries them, so collect them all before creating any events
+            List<EventInformation> infos = new List<EventInformation>((int)numEvents);
+
             uint eventCount;
             uint prevId = 0;
 
@@ -185,14 +191,18 @@ namespace oSpy.SharpDumpLib
                         asyncOp.Post(m_onProgressReportDelegate, e);
                     }
 
-                    Event ev;
+                    EventInformation info;
 
                     try
                     {
-                        XmlReader rdr = xmlReader.ReadSubtree();
-                        ev = m_eventFactory.CreateEvent(rdr);
-                        m_tagBuilder.Process(ev);
-                        dump.AddEvent(ev);
+                        XmlDocument doc = new XmlDocument();
+                        doc.Load(xmlReader.ReadSubtree());
+                        info = m_eventFactory.ParseEventInformation(doc.DocumentElement);
+                        if (info.Type == EventType.Schema)
+                            m_eventFactory.RawSchema.AddTypes(info.ProcessId, doc.DocumentElement);
+                        else if (PayloadTable.HasPayloads(info.RawData))
+                            m_eventFactory.PayloadTable.AddPayloads(info.ProcessId, doc.DocumentElement);
+                        infos.Add(info);
                     }
                     catch (Exception ex)
                     {
@@ -201,13 +211,28 @@ namespace oSpy.SharpDumpLib
                     }
 
                     eventCount++;
-                    prevId = ev.Id;
+                    prevId = info.Id;
                 }
             }
 
             if (eventCount != numEvents)
                 throw new InvalidDataException(String.Format("expected {0} events, read {1}", numEvents, eventCount));
 
+            foreach (EventInformation info in infos)
+            {
+                try
+                {
+                    Event ev = m_eventFactory.CreateEvent(info);
+                    m_tagBuilder.Process(ev);
+                    dump.AddEvent(ev);
+                }
+                catch (Exception ex)
+                {
+                    Exception outerEx = new Exception("Error processing event with id " + info.Id, ex);
+                    throw outerEx;
+                }
+            }
+
             return dump;
         }
 
@@ -29,6 +29,7 @@ namespace oSpy.SharpDumpLib
         FunctionCall,
         AsyncResult,
         IOCTL_INTERNAL_USB_SUBMIT_URB,
+        Schema,
     }
 
     public class Event
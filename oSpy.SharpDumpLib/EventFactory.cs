@@ -1,5 +1,5 @@
 //
-// Copyright (c) 2009 Ole André Vadla Ravnås <oleavr@gmail.com>
+// Copyright (c) 2009 Ole Andr Vadla Ravns <oleavr@gmail.com>
 //
 // This library is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -26,6 +26,24 @@ namespace oSpy.SharpDumpLib
     public class EventFactory
     {
         private Dictionary<string, ISpecificEventFactory> m_funcCallFactories = new Dictionary<string, ISpecificEventFactory>();
+        private RawSchema m_rawSchema = new RawSchema();
+        private PayloadTable m_payloadTable = new PayloadTable();
+
+        public RawSchema RawSchema
+        {
+            get
+            {
+                return m_rawSchema;
+            }
+        }
+
+        public PayloadTable PayloadTable
+        {
+            get
+            {
+                return m_payloadTable;
+            }
+        }
 
         public EventFactory()
         {
@@ -57,6 +75,11 @@ namespace oSpy.SharpDumpLib
         }
 
         public Event CreateEvent(XmlElement element)
+        {
+            return CreateEvent(ParseEventInformation(element));
+        }
+
+        public EventInformation ParseEventInformation(XmlElement element)
         {
             XmlAttributeCollection attrs = element.Attributes;
 
@@ -69,7 +92,7 @@ namespace oSpy.SharpDumpLib
             info.ThreadId = Convert.ToUInt32(attrs["threadId"].Value);
             info.RawData = element.OuterXml;
 
-            return CreateEvent(info);
+            return info;
         }
 
         public Event CreateEvent(EventInformation eventInfo)
@@ -83,10 +106,27 @@ namespace oSpy.SharpDumpLib
                 doc.LoadXml(eventInfo.RawData);
                 eventData = doc.DocumentElement;
 
+                bool expanded = m_payloadTable.ExpandReferences(eventInfo.ProcessId, eventData);
+                if (m_rawSchema.ExpandValues(eventInfo.ProcessId, eventData) || expanded)
+                    eventInfo.RawData = eventData.OuterXml;
+
                 string fullFunctionName = eventData.SelectSingleNode("/event/name").InnerText.Trim();
                 string functionName = fullFunctionName.Split(new string[] { "::" }, StringSplitOptions.None)[1];
                 m_funcCallFactories.TryGetValue(functionName, out specificFactory);
             }
+            else if (eventInfo.Type == EventType.Schema)
+            {
+                XmlDocument doc = new XmlDocument();
+                doc.LoadXml(eventInfo.RawData);
+                m_rawSchema.AddTypes(eventInfo.ProcessId, doc.DocumentElement);
+            }
+            else if (PayloadTable.HasPayloads(eventInfo.RawData))
+            {
+                XmlDocument doc = new XmlDocument();
+                doc.LoadXml(eventInfo.RawData);
+                m_payloadTable.ExpandReferences(eventInfo.ProcessId, doc.DocumentElement);
+                eventInfo.RawData = doc.DocumentElement.OuterXml;
+            }
 
             if (specificFactory != null)
                 return specificFactory.CreateEvent(eventInfo, eventData);
@@ -0,0 +1,367 @@
+//
+// Copyright (c) 2009 Ole André Vadla Ravnås <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.Text;
+
+namespace oSpy.SharpDumpLib
+{
+    //
+    // Renders the format strings that agents in raw capture mode log along
+    // with their arguments instead of calling vsprintf() in-process.  The
+    // arguments come in the order FormatScanner found them, so the format
+    // string is walked the same way, following the MSVC CRT conventions.
+    // A conversion without an argument left is copied through untouched.
+    //
+    public static class FormatRenderer
+    {
+        private static readonly IFormatProvider Invariant = CultureInfo.InvariantCulture;
+
+        // Arguments are int, long, double, ulong for pointers, and string
+        // (null for a NULL string)
+        public static string Render(string format, IList<object> args)
+        {
+            StringBuilder result = new StringBuilder(format.Length);
+            int argIndex = 0;
+            int i = 0;
+
+            while (i < format.Length)
+            {
+                char ch = format[i];
+                if (ch != '%' || i + 1 >= format.Length)
+                {
+                    result.Append(ch);
+                    i++;
+                    continue;
+                }
+
+                if (format[i + 1] == '%')
+                {
+                    result.Append('%');
+                    i += 2;
+                    continue;
+                }
+
+                int specStart = i;
+                i++;
+
+                bool leftAlign = false, plus = false, space = false, alternate = false, zeroPad = false;
+                for (; i < format.Length; i++)
+                {
+                    char flag = format[i];
+                    if (flag == '-')
+                        leftAlign = true;
+                    else if (flag == '+')
+                        plus = true;
+                    else if (flag == ' ')
+                        space = true;
+                    else if (flag == '#')
+                        alternate = true;
+                    else if (flag == '0')
+                        zeroPad = true;
+                    else
+                        break;
+                }
+
+                int width = 0;
+                bool ok = true;
+                if (i < format.Length && format[i] == '*')
+                {
+                    ok = NextArgument(args, ref argIndex, out width);
+                    if (width < 0)
+                    {
+                        leftAlign = true;
+                        width = -width;
+                    }
+                    i++;
+                }
+                else
+                {
+                    width = ReadNumber(format, ref i);
+                }
+
+                int precision = -1;
+                if (ok && i < format.Length && format[i] == '.')
+                {
+                    i++;
+                    if (i < format.Length && format[i] == '*')
+                    {
+                        ok = NextArgument(args, ref argIndex, out precision);
+                        i++;
+                    }
+                    else
+                    {
+                        precision = ReadNumber(format, ref i);
+                    }
+                }
+
+                // The size prefix is implied by the argument's kind
+                if (String.CompareOrdinal(format, i, "I64", 0, 3) == 0 || String.CompareOrdinal(format, i, "I32", 0, 3) == 0)
+                {
+                    i += 3;
+                }
+                else
+                {
+                    while (i < format.Length && "hlwLI".IndexOf(format[i]) >= 0)
+                        i++;
+                }
+
+                string text = null;
+                if (ok && i < format.Length && argIndex < args.Count)
+                {
+                    text = FormatConversion(format[i], args[argIndex], precision, plus, space, alternate, ref zeroPad);
+                    if (text != null)
+                        argIndex++;
+                }
+
+                if (text == null)
+                {
+                    // Nothing to format it with, so leave it and everything
+                    // after it as is
+                    result.Append(format, specStart, format.Length - specStart);
+                    break;
+                }
+
+                i++;
+
+                if (text.Length < width)
+                {
+                    if (leftAlign)
+                        text = text.PadRight(width);
+                    else if (zeroPad)
+                        text = ZeroPad(text, width);
+                    else
+                        text = text.PadLeft(width);
+                }
+
+                result.Append(text);
+            }
+
+            return result.ToString();
+        }
+
+        private static bool NextArgument(IList<object> args, ref int argIndex, out int value)
+        {
+            value = 0;
+            if (argIndex >= args.Count || !(args[argIndex] is int))
+                return false;
+
+            value = (int)args[argIndex++];
+            return true;
+        }
+
+        private static int ReadNumber(string format, ref int i)
+        {
+            int value = 0;
+            while (i < format.Length && format[i] >= '0' && format[i] <= '9')
+                value = value * 10 + (format[i++] - '0');
+            return value;
+        }
+
+        // Zeros go after the sign or the 0x prefix
+        private static string ZeroPad(string text, int width)
+        {
+            int prefix = 0;
+            if (text.Length > 0 && (text[0] == '-' || text[0] == '+' || text[0] == ' '))
+                prefix = 1;
+            else if (text.StartsWith("0x") || text.StartsWith("0X"))
+                prefix = 2;
+
+            return text.Substring(0, prefix) + new string('0', width - text.Length) + text.Substring(prefix);
+        }
+
+        // Returns null if arg isn't what the conversion takes
+        private static string FormatConversion(char conversion, object arg, int precision,
+                                               bool plus, bool space, bool alternate, ref bool zeroPad)
+        {
+            switch (conversion)
+            {
+                case 'd':
+                case 'i':
+                    {
+                        long value;
+                        if (arg is int)
+                            value = (int)arg;
+                        else if (arg is long)
+                            value = (long)arg;
+                        else
+                            return null;
+
+                        string digits = ApplyPrecision(Math.Abs((decimal)value).ToString(Invariant), precision, ref zeroPad);
+                        if (value < 0)
+                            return "-" + digits;
+                        else if (plus)
+                            return "+" + digits;
+                        else if (space)
+                            return " " + digits;
+                        return digits;
+                    }
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                    {
+                        ulong value;
+                        if (arg is int)
+                            value = (uint)(int)arg;
+                        else if (arg is long)
+                            value = (ulong)(long)arg;
+                        else
+                            return null;
+
+                        string digits;
+                        if (conversion == 'u')
+                            digits = value.ToString(Invariant);
+                        else if (conversion == 'o')
+                            digits = ToOctal(value);
+                        else
+                            digits = value.ToString((conversion == 'x') ? "x" : "X");
+
+                        digits = ApplyPrecision(digits, precision, ref zeroPad);
+
+                        if (alternate && value != 0)
+                        {
+                            if (conversion == 'o')
+                                digits = "0" + digits;
+                            else
+                                digits = ((conversion == 'x') ? "0x" : "0X") + digits;
+                        }
+
+                        return digits;
+                    }
+                case 'c':
+                case 'C':
+                    if (!(arg is int))
+                        return null;
+                    zeroPad = false;
+                    return ((char)((int)arg & 0xFFFF)).ToString();
+                case 'e':
+                case 'E':
+                case 'f':
+                case 'g':
+                case 'G':
+                case 'a':
+                case 'A':
+                    if (!(arg is double))
+                        return null;
+                    return FormatDouble(conversion, (double)arg, precision, plus, space);
+                case 'p':
+                    if (!(arg is ulong))
+                        return null;
+                    return ((ulong)arg).ToString("X8");
+                case 'Z':
+                    if (!(arg is ulong))
+                        return null;
+                    return "0x" + ((ulong)arg).ToString("X8");
+                case 'n':
+                    if (!(arg is ulong))
+                        return null;
+                    return "";
+                case 's':
+                case 'S':
+                    {
+                        if (arg != null && !(arg is string))
+                            return null;
+
+                        zeroPad = false;
+
+                        string s = (arg != null) ? (string)arg : "(null)";
+                        if (precision >= 0 && precision < s.Length)
+                            s = s.Substring(0, precision);
+                        return s;
+                    }
+                default:
+                    return null;
+            }
+        }
+
+        private static string ApplyPrecision(string digits, int precision, ref bool zeroPad)
+        {
+            if (precision < 0)
+                return digits;
+
+            // An explicit precision turns off zero padding for integers
+            zeroPad = false;
+
+            if (precision == 0 && digits == "0")
+                return "";
+            return digits.PadLeft(precision, '0');
+        }
+
+        private static string ToOctal(ulong value)
+        {
+            if (value == 0)
+                return "0";
+
+            StringBuilder sb = new StringBuilder();
+            while (value != 0)
+            {
+                sb.Insert(0, (char)('0' + (int)(value & 7)));
+                value >>= 3;
+            }
+            return sb.ToString();
+        }
+
+        private static string FormatDouble(char conversion, double value, int precision, bool plus, bool space)
+        {
+            if (precision < 0)
+                precision = 6;
+
+            string text;
+            if (Double.IsNaN(value))
+                text = "1.#QNAN0";
+            else if (Double.IsInfinity(value))
+                text = (value < 0) ? "-1.#INF00" : "1.#INF00";
+            else
+            {
+                switch (conversion)
+                {
+                    case 'f':
+                        text = value.ToString("F" + precision, Invariant);
+                        break;
+                    case 'e':
+                    case 'E':
+                        // Like the CRT, with a three digit exponent
+                        text = value.ToString(((conversion == 'e') ? "0." + new string('0', precision) + "e+000" : "0." + new string('0', precision) + "E+000"), Invariant);
+                        if (precision == 0)
+                            text = text.Replace(".", "");
+                        break;
+                    case 'g':
+                    case 'G':
+                        text = value.ToString("G" + ((precision == 0) ? 1 : precision), Invariant);
+                        if (conversion == 'g')
+                            text = text.Replace('E', 'e');
+                        break;
+                    default:
+                        text = value.ToString("R", Invariant);
+                        break;
+                }
+            }
+
+            if (!text.StartsWith("-"))
+            {
+                if (plus)
+                    text = "+" + text;
+                else if (space)
+                    text = " " + text;
+            }
+
+            return text;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+//
+// Copyright (c) 2009 Ole André Vadla Ravnås <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+using System;
+using System.Collections.Generic;
+using System.Xml;
+
+namespace oSpy.SharpDumpLib
+{
+    //
+    // Expands the payloadRef references logged by agents that deduplicate
+    // payloads, see InterceptPP/PayloadTable.h.  The first occurrence of a
+    // payload carries its content and a payloadId, and as events aren't
+    // necessarily logged in order all of them are collected before any
+    // event is created.  Every process numbers its payloads from 1, so they
+    // are kept per process.  A reference to a payload that isn't in the log,
+    // like one whose first event was lost with a truncated file, leaves the
+    // element empty and marked with payloadMissing instead.
+    //
+    public class PayloadTable
+    {
+        private Dictionary<ulong, string> m_payloads = new Dictionary<ulong, string>();
+
+        public int Count
+        {
+            get
+            {
+                return m_payloads.Count;
+            }
+        }
+
+        public static bool HasPayloads(string rawData)
+        {
+            return rawData.IndexOf(" payloadId=") >= 0 || rawData.IndexOf(" payloadRef=") >= 0;
+        }
+
+        public void AddPayloads(uint processId, XmlElement eventElement)
+        {
+            foreach (XmlElement element in eventElement.SelectNodes("//*[@payloadId]"))
+            {
+                m_payloads[MakeKey(processId, element.GetAttribute("payloadId"))] = element.InnerText;
+            }
+        }
+
+        // Returns false if there was nothing to expand
+        public bool ExpandReferences(uint processId, XmlElement eventElement)
+        {
+            XmlNodeList nodes = eventElement.SelectNodes("//*[@payloadId or @payloadRef]");
+            if (nodes.Count == 0)
+                return false;
+
+            foreach (XmlElement element in nodes)
+            {
+                if (element.HasAttribute("payloadRef"))
+                {
+                    string id = element.GetAttribute("payloadRef");
+
+                    string content;
+                    if (m_payloads.TryGetValue(MakeKey(processId, id), out content))
+                        element.InnerText = content;
+                    else
+                        element.SetAttribute("payloadMissing", id);
+
+                    element.RemoveAttribute("payloadRef");
+                }
+                else
+                {
+                    m_payloads[MakeKey(processId, element.GetAttribute("payloadId"))] = element.InnerText;
+                    element.RemoveAttribute("payloadId");
+                }
+            }
+
+            return true;
+        }
+
+        private static ulong MakeKey(uint processId, string payloadId)
+        {
+            return ((ulong)processId << 32) | Convert.ToUInt32(payloadId);
+        }
+    }
+}
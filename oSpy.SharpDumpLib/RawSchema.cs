@@ -0,0 +1,579 @@
+//
+// Copyright (c) 2009 Ole André Vadla Ravnås <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Text;
+using System.Xml;
+
+namespace oSpy.SharpDumpLib
+{
+    //
+    // Expands the rawValue elements logged by agents running in raw capture
+    // mode into the same value trees that the agent would otherwise have
+    // formatted in-process.  The types are described by Schema events, see
+    // InterceptPP/RawCapture.h for the record layout.
+    //
+    public class RawSchema
+    {
+        private enum Kind
+        {
+            Text = 0,
+            Integer,
+            Boolean,
+            Enum,
+            Ipv4Addr,
+            Pointer,
+            Array,
+            ByteArray,
+            Struct,
+            String,
+            Dynamic,
+            Format,
+        }
+
+        [Flags]
+        private enum TypeFlags
+        {
+            Inline = 1,
+            SignExtend = 2,
+            Signed = 4,
+            Hex = 8,
+            ByteSwap = 16,
+        }
+
+        private class TypeField
+        {
+            public string Name;
+            public uint Offset;
+            public ushort TypeId;
+        }
+
+        private class TypeDescription
+        {
+            public Kind Kind;
+            public string Name;
+            public uint Size;
+            public TypeFlags Flags;
+            public ushort ElementTypeId;
+            public List<TypeField> Fields = new List<TypeField>();
+            public Dictionary<uint, string> Members = new Dictionary<uint, string>();
+            public string TrueString;
+            public string FalseString;
+
+            public bool IsInline
+            {
+                get
+                {
+                    return (Flags & TypeFlags.Inline) != 0;
+                }
+            }
+        }
+
+        private const uint MinimumVersion = 2;
+        private const uint SupportedVersion = 3;
+
+        // Types registered at runtime get ids that differ from one process to
+        // the next, so a merged dump keeps a set of them per process
+        private Dictionary<ulong, TypeDescription> m_types = new Dictionary<ulong, TypeDescription>();
+        private uint m_processId;
+
+        public int TypeCount
+        {
+            get
+            {
+                return m_types.Count;
+            }
+        }
+
+        public void AddTypes(uint processId, XmlElement eventElement)
+        {
+            XmlElement schemaElement = eventElement.SelectSingleNode("/event/schema") as XmlElement;
+            if (schemaElement == null)
+                throw new InvalidDataException("schema element missing");
+
+            uint version = Convert.ToUInt32(schemaElement.GetAttribute("version"));
+            if (version < MinimumVersion || version > SupportedVersion)
+                throw new InvalidDataException("unsupported schema version " + version);
+
+            foreach (XmlElement typeElement in schemaElement.SelectNodes("type"))
+            {
+                TypeDescription type = new TypeDescription();
+                type.Kind = (Kind)Convert.ToInt32(typeElement.GetAttribute("kind"));
+                type.Name = typeElement.GetAttribute("name");
+                type.Size = Convert.ToUInt32(typeElement.GetAttribute("size"));
+                type.Flags = (TypeFlags)Convert.ToInt32(typeElement.GetAttribute("flags"));
+                if (typeElement.HasAttribute("elementType"))
+                    type.ElementTypeId = Convert.ToUInt16(typeElement.GetAttribute("elementType"));
+                type.TrueString = typeElement.GetAttribute("true");
+                type.FalseString = typeElement.GetAttribute("false");
+
+                foreach (XmlElement fieldElement in typeElement.SelectNodes("field"))
+                {
+                    TypeField field = new TypeField();
+                    field.Name = fieldElement.GetAttribute("name");
+                    field.Offset = Convert.ToUInt32(fieldElement.GetAttribute("offset"));
+                    field.TypeId = Convert.ToUInt16(fieldElement.GetAttribute("type"));
+                    type.Fields.Add(field);
+                }
+
+                foreach (XmlElement memberElement in typeElement.SelectNodes("member"))
+                {
+                    type.Members[Convert.ToUInt32(memberElement.GetAttribute("value"))] = memberElement.GetAttribute("name");
+                }
+
+                m_types[MakeKey(processId, Convert.ToUInt16(typeElement.GetAttribute("id")))] = type;
+            }
+        }
+
+        // Returns false if there was nothing to expand
+        public bool ExpandValues(uint processId, XmlElement eventElement)
+        {
+            XmlNodeList rawNodes = eventElement.SelectNodes("//rawValue");
+            if (rawNodes.Count == 0)
+                return false;
+
+            m_processId = processId;
+
+            foreach (XmlElement rawElement in rawNodes)
+            {
+                byte[] record = Convert.FromBase64String(rawElement.InnerText.Trim());
+                BinaryReader reader = new BinaryReader(new MemoryStream(record));
+
+                XmlElement valueElement = ReadValue(reader, eventElement.OwnerDocument);
+                if (valueElement != null)
+                    rawElement.ParentNode.ReplaceChild(valueElement, rawElement);
+                else
+                    rawElement.ParentNode.RemoveChild(rawElement);
+            }
+
+            return true;
+        }
+
+        private static ulong MakeKey(uint processId, ushort typeId)
+        {
+            return ((ulong)processId << 16) | typeId;
+        }
+
+        // Looks the type up among those of the process being expanded
+        private TypeDescription GetType(ushort id)
+        {
+            TypeDescription type;
+            if (!m_types.TryGetValue(MakeKey(m_processId, id), out type))
+                throw new InvalidDataException("unknown raw type id " + id + " in process " + m_processId);
+            return type;
+        }
+
+        private XmlElement ReadValue(BinaryReader reader, XmlDocument doc)
+        {
+            ushort typeId = reader.ReadUInt16();
+
+            // The agent ran out of type ids and formatted the value itself
+            if (typeId == 0)
+                return CreateValueElement(doc, null, "Text", ReadText(reader));
+
+            TypeDescription type = GetType(typeId);
+
+            switch (type.Kind)
+            {
+                case Kind.Text:
+                    return CreateValueElement(doc, null, type.Name, ReadText(reader));
+                case Kind.Integer:
+                case Kind.Boolean:
+                case Kind.Enum:
+                case Kind.Ipv4Addr:
+                    return CreateInlineValue(doc, type, reader.ReadBytes((int)type.Size), 0);
+                case Kind.Pointer:
+                    return ReadPointer(reader, doc, type);
+                case Kind.Array:
+                    return ReadArray(reader, doc, type);
+                case Kind.ByteArray:
+                    return ReadByteArray(reader, doc);
+                case Kind.Struct:
+                    return ReadStruct(reader, doc, type);
+                case Kind.String:
+                    return ReadString(reader, doc, type);
+                case Kind.Dynamic:
+                    return ReadDynamic(reader, doc, type);
+                case Kind.Format:
+                    return ReadFormat(reader, doc, type);
+                default:
+                    throw new InvalidDataException("unknown raw type kind " + type.Kind);
+            }
+        }
+
+        private XmlElement ReadPointer(BinaryReader reader, XmlDocument doc, TypeDescription type)
+        {
+            ulong address = ReadUnsigned(reader.ReadBytes((int)type.Size), 0, type.Size);
+            bool hasPointee = reader.ReadByte() != 0;
+
+            string value = (address != 0) ? "0x" + address.ToString("X8") : "NULL";
+            XmlElement el = CreateValueElement(doc, null, type.Name, value);
+
+            if (hasPointee)
+            {
+                XmlElement pointee = ReadValue(reader, doc);
+                if (pointee != null)
+                    el.AppendChild(pointee);
+            }
+
+            return el;
+        }
+
+        private XmlElement ReadArray(BinaryReader reader, XmlDocument doc, TypeDescription type)
+        {
+            BufferCount count = ReadCount(reader);
+            if (count.Total == 0)
+                return null;
+
+            TypeDescription elType = GetType(type.ElementTypeId);
+
+            XmlElement el = doc.CreateElement("value");
+            el.SetAttribute("elementCount", count.Total.ToString());
+            el.SetAttribute("elementType", elType.Name);
+            count.SetMarkers(el);
+            el.SetAttribute("type", "Array");
+
+            if (elType.IsInline)
+            {
+                byte[] data = reader.ReadBytes((int)(count.Present * type.Size));
+
+                for (uint i = 0; i < count.Present; i++)
+                    el.AppendChild(CreateInlineValue(doc, elType, data, i * type.Size));
+            }
+            else
+            {
+                for (uint i = 0; i < count.Present; i++)
+                {
+                    XmlElement child = ReadValue(reader, doc);
+                    if (child != null)
+                        el.AppendChild(child);
+                }
+            }
+
+            return el;
+        }
+
+        private XmlElement ReadByteArray(BinaryReader reader, XmlDocument doc)
+        {
+            BufferCount count = ReadCount(reader);
+            if (count.Total == 0)
+                return null;
+
+            XmlElement el = doc.CreateElement("value");
+            if (count.Truncated)
+                el.SetAttribute("head", count.Head.ToString());
+            if (count.Sampled)
+                el.SetAttribute("sampled", "true");
+            el.SetAttribute("size", count.Total.ToString());
+            if (count.Truncated)
+                el.SetAttribute("truncated", (count.Total - count.Present).ToString());
+            el.SetAttribute("type", "ByteArray");
+            el.InnerText = Convert.ToBase64String(reader.ReadBytes((int)count.Present));
+
+            return el;
+        }
+
+        // Element count of an Array or ByteArray record, of which only
+        // Present made it into the log if the agent's capture budget ran out
+        private class BufferCount
+        {
+            public uint Total;
+            public uint Head;
+            public uint Present;
+            public bool Truncated;
+            public bool Sampled;
+
+            public void SetMarkers(XmlElement el)
+            {
+                if (Truncated)
+                    el.SetAttribute("head", Head.ToString());
+                if (Sampled)
+                    el.SetAttribute("sampled", "true");
+                if (Truncated)
+                    el.SetAttribute("truncated", (Total - Present).ToString());
+            }
+        }
+
+        private const uint CountTruncated = 0x80000000;
+        private const uint CountSampled = 0x40000000;
+        private const uint CountMask = 0x3FFFFFFF;
+
+        private static BufferCount ReadCount(BinaryReader reader)
+        {
+            uint value = reader.ReadUInt32();
+
+            BufferCount count = new BufferCount();
+            count.Total = value & CountMask;
+            count.Present = count.Total;
+            count.Head = count.Total;
+
+            if ((value & CountSampled) != 0)
+            {
+                count.Sampled = true;
+                count.Head = 0;
+                count.Present = 0;
+            }
+            else if ((value & CountTruncated) != 0)
+            {
+                count.Truncated = true;
+                count.Head = reader.ReadUInt32();
+                count.Present = count.Head + reader.ReadUInt32();
+            }
+
+            return count;
+        }
+
+        private XmlElement ReadStruct(BinaryReader reader, XmlDocument doc, TypeDescription type)
+        {
+            byte[] data = reader.ReadBytes((int)type.Size);
+
+            XmlElement el = doc.CreateElement("value");
+            el.SetAttribute("subType", type.Name);
+            el.SetAttribute("type", "Struct");
+
+            // Inline fields are decoded from the structure's bytes, the
+            // others follow as records of their own
+            foreach (TypeField field in type.Fields)
+            {
+                TypeDescription fieldType = GetType(field.TypeId);
+
+                XmlElement fieldEl = doc.CreateElement("field");
+                fieldEl.SetAttribute("name", field.Name);
+                el.AppendChild(fieldEl);
+
+                XmlElement valueEl;
+                if (fieldType.IsInline)
+                    valueEl = CreateInlineValue(doc, fieldType, data, field.Offset);
+                else
+                    valueEl = ReadValue(reader, doc);
+
+                if (valueEl != null)
+                    fieldEl.AppendChild(valueEl);
+            }
+
+            return el;
+        }
+
+        private XmlElement ReadString(BinaryReader reader, XmlDocument doc, TypeDescription type)
+        {
+            uint size = reader.ReadUInt32();
+            byte[] data = reader.ReadBytes((int)size);
+
+            Encoding encoding = (type.Size == 2) ? Encoding.Unicode : Encoding.Default;
+            return CreateValueElement(doc, null, type.Name, encoding.GetString(data));
+        }
+
+        private XmlElement ReadDynamic(BinaryReader reader, XmlDocument doc, TypeDescription type)
+        {
+            TypeDescription subType = GetType(reader.ReadUInt16());
+
+            string value;
+            if (subType.IsInline)
+                value = FormatInline(subType, reader.ReadBytes((int)subType.Size), 0);
+            else
+                value = ReadText(reader);
+
+            return CreateValueElement(doc, subType.Name, type.Name, value);
+        }
+
+        private enum FormatArgKind
+        {
+            Int32 = 0,
+            Int64,
+            Double,
+            Pointer,
+            String,
+            WideString,
+            NullString,
+        }
+
+        private const byte FormatNoArgs = 0xFF;
+
+        private XmlElement ReadFormat(BinaryReader reader, XmlDocument doc, TypeDescription type)
+        {
+            uint size = reader.ReadUInt32();
+            Encoding encoding = (type.Size == 2) ? Encoding.Unicode : Encoding.Default;
+            string format = encoding.GetString(reader.ReadBytes((int)size));
+
+            byte count = reader.ReadByte();
+
+            // The agent couldn't find the arguments and logged the format
+            // string on its own
+            if (count == FormatNoArgs)
+                return CreateValueElement(doc, null, type.Name, format);
+
+            List<object> args = new List<object>(count);
+            for (int i = 0; i < count; i++)
+            {
+                FormatArgKind kind = (FormatArgKind)reader.ReadByte();
+
+                switch (kind)
+                {
+                    case FormatArgKind.Int32:
+                        args.Add(reader.ReadInt32());
+                        break;
+                    case FormatArgKind.Int64:
+                        args.Add(reader.ReadInt64());
+                        break;
+                    case FormatArgKind.Double:
+                        args.Add(reader.ReadDouble());
+                        break;
+                    case FormatArgKind.Pointer:
+                        args.Add(reader.ReadUInt64());
+                        break;
+                    case FormatArgKind.String:
+                        args.Add(ReadFormatString(reader, Encoding.Default, 1));
+                        break;
+                    case FormatArgKind.WideString:
+                        args.Add(ReadFormatString(reader, Encoding.Unicode, 2));
+                        break;
+                    case FormatArgKind.NullString:
+                        args.Add(null);
+                        break;
+                    default:
+                        throw new InvalidDataException("unknown format argument kind " + kind);
+                }
+            }
+
+            return CreateValueElement(doc, null, type.Name, FormatRenderer.Render(format, args));
+        }
+
+        // A string argument cut short by the capture budget keeps its head
+        // and tail with a marker in between
+        private static string ReadFormatString(BinaryReader reader, Encoding encoding, int charSize)
+        {
+            BufferCount count = ReadCount(reader);
+
+            string head = encoding.GetString(reader.ReadBytes((int)count.Head * charSize));
+            if (!count.Truncated)
+                return head;
+
+            string tail = encoding.GetString(reader.ReadBytes((int)(count.Present - count.Head) * charSize));
+            return head + "[...]" + tail;
+        }
+
+        private XmlElement CreateInlineValue(XmlDocument doc, TypeDescription type, byte[] data, uint offset)
+        {
+            if (type.Kind == Kind.Enum)
+                return CreateValueElement(doc, type.Name, "Enum", FormatInline(type, data, offset));
+
+            if (type.Kind != Kind.Struct)
+                return CreateValueElement(doc, null, type.Name, FormatInline(type, data, offset));
+
+            XmlElement el = doc.CreateElement("value");
+            el.SetAttribute("subType", type.Name);
+            el.SetAttribute("type", "Struct");
+
+            foreach (TypeField field in type.Fields)
+            {
+                XmlElement fieldEl = doc.CreateElement("field");
+                fieldEl.SetAttribute("name", field.Name);
+                fieldEl.AppendChild(CreateInlineValue(doc, GetType(field.TypeId), data, offset + field.Offset));
+                el.AppendChild(fieldEl);
+            }
+
+            return el;
+        }
+
+        // What the marshaller's ToString() would have returned
+        private string FormatInline(TypeDescription type, byte[] data, uint offset)
+        {
+            switch (type.Kind)
+            {
+                case Kind.Integer:
+                    return FormatInteger(type, ReadInteger(type, data, offset));
+                case Kind.Boolean:
+                    return (ReadUnsigned(data, offset, type.Size) != 0) ? type.TrueString : type.FalseString;
+                case Kind.Enum:
+                    {
+                        TypeDescription intType = GetType(type.ElementTypeId);
+                        int value = ReadInteger(intType, data, offset);
+
+                        string name;
+                        if (type.Members.TryGetValue((uint)value, out name))
+                            return name;
+                        return FormatInline(intType, data, offset);
+                    }
+                case Kind.Ipv4Addr:
+                    return String.Format("{0}.{1}.{2}.{3}", data[offset], data[offset + 1], data[offset + 2], data[offset + 3]);
+                case Kind.Struct:
+                    return "[Structure]";
+                default:
+                    throw new InvalidDataException("raw type " + type.Name + " can't be inline");
+            }
+        }
+
+        private int ReadInteger(TypeDescription type, byte[] data, uint offset)
+        {
+            if (type.Kind != Kind.Integer)
+                return (int)ReadUnsigned(data, offset, type.Size);
+
+            ulong raw = ReadUnsigned(data, offset, type.Size);
+
+            if ((type.Flags & TypeFlags.ByteSwap) != 0)
+            {
+                ulong swapped = 0;
+                for (uint i = 0; i < type.Size; i++)
+                    swapped |= ((raw >> (int)(i * 8)) & 0xFF) << (int)((type.Size - 1 - i) * 8);
+                raw = swapped;
+            }
+
+            if ((type.Flags & TypeFlags.SignExtend) != 0 && type.Size < 4)
+            {
+                int shift = 64 - (int)type.Size * 8;
+                return (int)((long)(raw << shift) >> shift);
+            }
+
+            return (int)(uint)raw;
+        }
+
+        private static string FormatInteger(TypeDescription type, int value)
+        {
+            if ((type.Flags & TypeFlags.Hex) != 0 && value != 0)
+                return "0x" + ((uint)value).ToString("x");
+            else if ((type.Flags & TypeFlags.Signed) != 0)
+                return value.ToString();
+            else
+                return ((uint)value).ToString();
+        }
+
+        private static ulong ReadUnsigned(byte[] data, uint offset, uint size)
+        {
+            ulong value = 0;
+            for (uint i = 0; i < size && i < 8; i++)
+                value |= (ulong)data[offset + i] << (int)(i * 8);
+            return value;
+        }
+
+        private static string ReadText(BinaryReader reader)
+        {
+            uint length = reader.ReadUInt32();
+            return Encoding.UTF8.GetString(reader.ReadBytes((int)length));
+        }
+
+        private static XmlElement CreateValueElement(XmlDocument doc, string subType, string type, string value)
+        {
+            XmlElement el = doc.CreateElement("value");
+            if (subType != null)
+                el.SetAttribute("subType", subType);
+            el.SetAttribute("type", type);
+            el.SetAttribute("value", value);
+            return el;
+        }
+    }
+}
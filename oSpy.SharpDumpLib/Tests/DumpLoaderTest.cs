@@ -80,6 +80,17 @@ namespace oSpy.SharpDumpLib.Tests
             Assert.That(dump.Events[83].Tags.Count, Is.AtLeast(1));
         }
 
+        [Test()]
+        public void LoadRawValues()
+        {
+            // The agent logs the schema after the event that needed it
+            Stream stream = TestOsdStream.GenerateUncompressedFrom(TestEventXml.E084_ConnectRaw, TestEventXml.E085_Schema);
+            DumpLoader loader = new DumpLoader();
+            Dump dump = loader.Load(stream);
+            Assert.That(dump.Events[84], Is.TypeOf(typeof(Socket.ConnectEvent)));
+            Assert.That(dump.Events[84].RawData, Is.EqualTo(XmlString.Canonicalize(TestEventXml.E084_Connect)));
+        }
+
         private void LoadAndVerifyEvents(Stream stream)
         {
             DumpLoader loader = new DumpLoader();
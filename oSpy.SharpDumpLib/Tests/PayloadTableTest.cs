@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2009 Ole André Vadla Ravnås <oleavr@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+using System;
+using System.Text;
+using System.Xml;
+using NUnit.Framework;
+using NUnit.Framework.SyntaxHelpers;
+
+namespace oSpy.SharpDumpLib.Tests
+{
+    [TestFixture()]
+    public class PayloadTableTest
+    {
+        private const string SendPayload = "VkVSIDEgTVNOUDE4IE1TTlAxNyBDVlIwDQo=";
+
+        private static string SendWithPayloadId
+        {
+            get
+            {
+                return TestEventXml.E096_Send.Replace("<value size=\"26\" type=\"ByteArray\">",
+                                                      "<value payloadId=\"1\" size=\"26\" type=\"ByteArray\">");
+            }
+        }
+
+        private static string SendWithPayloadRef
+        {
+            get
+            {
+                return TestEventXml.E096_Send.Replace("<value size=\"26\" type=\"ByteArray\">" + SendPayload + "</value>",
+                                                      "<value payloadRef=\"1\" size=\"26\" type=\"ByteArray\"></value>");
+            }
+        }
+
+        [Test()]
+        public void HasPayloads()
+        {
+            Assert.That(PayloadTable.HasPayloads(SendWithPayloadId), Is.True);
+            Assert.That(PayloadTable.HasPayloads(SendWithPayloadRef), Is.True);
+            Assert.That(PayloadTable.HasPayloads(TestEventXml.E096_Send), Is.False);
+        }
+
+        [Test()]
+        public void ExpandReferenceLoggedFirst()
+        {
+            // The reference may come first, so the loader collects payloads up front
+            XmlDocument doc = new XmlDocument();
+            doc.LoadXml(SendWithPayloadId);
+
+            EventFactory factory = new EventFactory();
+            factory.PayloadTable.AddPayloads(2684, doc.DocumentElement);
+            Assert.That(factory.PayloadTable.Count, Is.EqualTo(1));
+
+            Socket.SendEvent ev = factory.CreateEvent(SendWithPayloadRef) as Socket.SendEvent;
+            Assert.That(ev, Is.Not.Null);
+            Assert.That(ev.RawData, Is.EqualTo(XmlString.Canonicalize(TestEventXml.E096_Send)));
+            Assert.That(ev.Buffer, Is.EqualTo(Convert.FromBase64String(SendPayload)));
+        }
+
+        [Test()]
+        public void ExpandInOrder()
+        {
+            EventFactory factory = new EventFactory();
+
+            Event first = factory.CreateEvent(SendWithPayloadId);
+            Assert.That(first.RawData, Is.EqualTo(XmlString.Canonicalize(TestEventXml.E096_Send)));
+
+            Event second = factory.CreateEvent(SendWithPayloadRef);
+            Assert.That(second.RawData, Is.EqualTo(XmlString.Canonicalize(TestEventXml.E096_Send)));
+        }
+
+        [Test()]
+        public void PayloadsPerProcess()
+        {
+            // Both processes number their payloads from 1
+            const string otherPayload = "T1VUIDENCg==";
+
+            string otherWithPayloadId = SendWithPayloadId.Replace("processId=\"2684\"", "processId=\"3000\"")
+                                                         .Replace(SendPayload, otherPayload);
+            string otherWithPayloadRef = SendWithPayloadRef.Replace("processId=\"2684\"", "processId=\"3000\"");
+
+            EventFactory factory = new EventFactory();
+            factory.CreateEvent(SendWithPayloadId);
+            factory.CreateEvent(otherWithPayloadId);
+            Assert.That(factory.PayloadTable.Count, Is.EqualTo(2));
+
+            Socket.SendEvent ev = factory.CreateEvent(SendWithPayloadRef) as Socket.SendEvent;
+            Assert.That(ev.Buffer, Is.EqualTo(Convert.FromBase64String(SendPayload)));
+
+            ev = factory.CreateEvent(otherWithPayloadRef) as Socket.SendEvent;
+            Assert.That(ev.Buffer, Is.EqualTo(Convert.FromBase64String(otherPayload)));
+        }
+
+        [Test()]
+        public void UnknownReference()
+        {
+            XmlDocument doc = new XmlDocument();
+            doc.LoadXml(SendWithPayloadRef);
+
+            PayloadTable table = new PayloadTable();
+            Assert.That(table.ExpandReferences(2684, doc.DocumentElement), Is.True);
+
+            XmlElement value = doc.DocumentElement.SelectSingleNode("//value[@payloadMissing]") as XmlElement;
+            Assert.That(value, Is.Not.Null);
+            Assert.That(value.GetAttribute("payloadMissing"), Is.EqualTo("1"));
+            Assert.That(value.HasAttribute("payloadRef"), Is.False);
+            Assert.That(value.InnerText, Is.EqualTo(""));
+
+            EventFactory factory = new EventFactory();
+            Socket.SendEvent ev = factory.CreateEvent(SendWithPayloadRef) as Socket.SendEvent;
+            Assert.That(ev, Is.Not.Null);
+            Assert.That(ev.Buffer.Length, Is.EqualTo(0));
+        }
+
+        [Test()]
+        public void NothingToExpand()
+        {
+            XmlDocument doc = new XmlDocument();
+            doc.LoadXml(TestEventXml.E096_Send);
+
+            PayloadTable table = new PayloadTable();
+            Assert.That(table.ExpandReferences(2684, doc.DocumentElement), Is.False);
+        }
+    }
+}
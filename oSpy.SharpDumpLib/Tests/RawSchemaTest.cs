@@ -0,0 +1,268 @@
+//
+// Copyright (c) 2009 Ole André Vadla Ravnås <oleavr@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+using System;
+using System.IO;
+using System.Text;
+using System.Xml;
+using NUnit.Framework;
+using NUnit.Framework.SyntaxHelpers;
+
+namespace oSpy.SharpDumpLib.Tests
+{
+    [TestFixture()]
+    public class RawSchemaTest
+    {
+        [Test()]
+        public void AddTypes()
+        {
+            EventFactory factory = new EventFactory();
+            Event ev = factory.CreateEvent(TestEventXml.E085_Schema);
+            Assert.That(ev.Type, Is.EqualTo(EventType.Schema));
+            Assert.That(factory.RawSchema.TypeCount, Is.EqualTo(8));
+        }
+
+        [Test()]
+        public void ExpandValues()
+        {
+            EventFactory factory = new EventFactory();
+            factory.CreateEvent(TestEventXml.E085_Schema);
+
+            Socket.ConnectEvent ev = factory.CreateEvent(TestEventXml.E084_ConnectRaw) as Socket.ConnectEvent;
+            Assert.That(ev, Is.Not.Null);
+            Assert.That(ev.RawData, Is.EqualTo(XmlString.Canonicalize(TestEventXml.E084_Connect)));
+        }
+
+        [Test()]
+        public void NothingToExpand()
+        {
+            XmlDocument doc = new XmlDocument();
+            doc.LoadXml(TestEventXml.E084_Connect);
+
+            RawSchema schema = new RawSchema();
+            Assert.That(schema.ExpandValues(1, doc.DocumentElement), Is.False);
+        }
+
+        [Test()]
+        public void TypesPerProcess()
+        {
+            // Two processes that registered different types under the same id
+            RawSchema schema = new RawSchema();
+
+            XmlDocument schemaDoc = new XmlDocument();
+            schemaDoc.LoadXml("<event id=\"1\" type=\"Schema\">"
+                             +    "<schema version=\"2\">"
+                             +        "<type flags=\"1\" id=\"1\" kind=\"1\" name=\"UInt32\" size=\"4\"/>"
+                             +    "</schema>"
+                             +"</event>");
+            schema.AddTypes(100, schemaDoc.DocumentElement);
+
+            schemaDoc.LoadXml("<event id=\"2\" type=\"Schema\">"
+                             +    "<schema version=\"2\">"
+                             +        "<type flags=\"1\" id=\"1\" kind=\"1\" name=\"UInt16\" size=\"2\"/>"
+                             +    "</schema>"
+                             +"</event>");
+            schema.AddTypes(200, schemaDoc.DocumentElement);
+
+            Assert.That(schema.TypeCount, Is.EqualTo(2));
+
+            MemoryStream record = new MemoryStream();
+            BinaryWriter writer = new BinaryWriter(record);
+            writer.Write((ushort)1);
+            writer.Write(0x00020001u);
+
+            string eventXml = "<event id=\"3\" type=\"FunctionCall\"><arguments direction=\"in\">"
+                            + "<argument name=\"a\"><rawValue>" + Convert.ToBase64String(record.ToArray()) + "</rawValue></argument>"
+                            + "</arguments></event>";
+
+            XmlDocument doc = new XmlDocument();
+            doc.LoadXml(eventXml);
+            Assert.That(schema.ExpandValues(100, doc.DocumentElement), Is.True);
+            Assert.That(doc.SelectSingleNode("/event/arguments/argument/value").OuterXml,
+                        Is.EqualTo("<value type=\"UInt32\" value=\"131073\" />"));
+
+            doc.LoadXml(eventXml);
+            Assert.That(schema.ExpandValues(200, doc.DocumentElement), Is.True);
+            Assert.That(doc.SelectSingleNode("/event/arguments/argument/value").OuterXml,
+                        Is.EqualTo("<value type=\"UInt16\" value=\"1\" />"));
+
+            doc.LoadXml(eventXml);
+            try
+            {
+                schema.ExpandValues(300, doc.DocumentElement);
+                Assert.Fail("expected InvalidDataException");
+            }
+            catch (InvalidDataException)
+            {
+            }
+        }
+
+        [Test()]
+        public void TruncatedValues()
+        {
+            XmlDocument schemaDoc = new XmlDocument();
+            schemaDoc.LoadXml("<event id=\"1\" type=\"Schema\">"
+                             +    "<schema version=\"2\">"
+                             +        "<type flags=\"1\" id=\"1\" kind=\"1\" name=\"UInt32\" size=\"4\"/>"
+                             +        "<type elementType=\"1\" flags=\"0\" id=\"2\" kind=\"6\" name=\"Array\" size=\"4\"/>"
+                             +        "<type flags=\"0\" id=\"3\" kind=\"7\" name=\"ByteArray\" size=\"0\"/>"
+                             +    "</schema>"
+                             +"</event>");
+
+            RawSchema schema = new RawSchema();
+            schema.AddTypes(1, schemaDoc.DocumentElement);
+
+            // Six numbers keeping one at each end, 18 bytes keeping four at
+            // each end, and a sampled out buffer
+            MemoryStream array = new MemoryStream();
+            BinaryWriter writer = new BinaryWriter(array);
+            writer.Write((ushort)2);
+            writer.Write(6u | 0x80000000);
+            writer.Write(1u);
+            writer.Write(1u);
+            writer.Write(1u);
+            writer.Write(6u);
+
+            MemoryStream bytes = new MemoryStream();
+            writer = new BinaryWriter(bytes);
+            writer.Write((ushort)3);
+            writer.Write(18u | 0x80000000);
+            writer.Write(4u);
+            writer.Write(4u);
+            writer.Write(Encoding.ASCII.GetBytes("GET \r\n\r\n"));
+
+            MemoryStream sampled = new MemoryStream();
+            writer = new BinaryWriter(sampled);
+            writer.Write((ushort)3);
+            writer.Write(65536u | 0x40000000);
+
+            XmlDocument doc = new XmlDocument();
+            doc.LoadXml("<event id=\"2\" type=\"FunctionCall\"><arguments direction=\"in\">"
+                       + "<argument name=\"a\"><rawValue>" + Convert.ToBase64String(array.ToArray()) + "</rawValue></argument>"
+                       + "<argument name=\"b\"><rawValue>" + Convert.ToBase64String(bytes.ToArray()) + "</rawValue></argument>"
+                       + "<argument name=\"c\"><rawValue>" + Convert.ToBase64String(sampled.ToArray()) + "</rawValue></argument>"
+                       + "</arguments></event>");
+            Assert.That(schema.ExpandValues(1, doc.DocumentElement), Is.True);
+
+            XmlNodeList values = doc.SelectNodes("/event/arguments/argument/value");
+            Assert.That(values.Count, Is.EqualTo(3));
+
+            Assert.That(values[0].OuterXml, Is.EqualTo("<value elementCount=\"6\" elementType=\"UInt32\" head=\"1\" truncated=\"4\" type=\"Array\">"
+                                                      + "<value type=\"UInt32\" value=\"1\" /><value type=\"UInt32\" value=\"6\" /></value>"));
+            Assert.That(values[1].OuterXml, Is.EqualTo("<value head=\"4\" size=\"18\" truncated=\"10\" type=\"ByteArray\">"
+                                                      + Convert.ToBase64String(Encoding.ASCII.GetBytes("GET \r\n\r\n")) + "</value>"));
+            Assert.That(values[2].OuterXml, Is.EqualTo("<value sampled=\"true\" size=\"65536\" type=\"ByteArray\"></value>"));
+        }
+
+        [Test()]
+        public void FormatValues()
+        {
+            XmlDocument schemaDoc = new XmlDocument();
+            schemaDoc.LoadXml("<event id=\"1\" type=\"Schema\">"
+                             +    "<schema version=\"3\">"
+                             +        "<type flags=\"0\" id=\"1\" kind=\"11\" name=\"AsciiFormatString\" size=\"1\"/>"
+                             +        "<type flags=\"0\" id=\"2\" kind=\"11\" name=\"UnicodeFormatString\" size=\"2\"/>"
+                             +    "</schema>"
+                             +"</event>");
+
+            RawSchema schema = new RawSchema();
+            schema.AddTypes(1, schemaDoc.DocumentElement);
+
+            MemoryStream numbers = new MemoryStream();
+            BinaryWriter writer = new BinaryWriter(numbers);
+            WriteFormat(writer, 1, Encoding.ASCII, "%s=%d (%5.2f) [%-4x] %08.3e %I64u%%");
+            writer.Write((byte)6);
+            writer.Write((byte)4);
+            writer.Write(3u);
+            writer.Write(Encoding.ASCII.GetBytes("len"));
+            writer.Write((byte)0);
+            writer.Write(-42);
+            writer.Write((byte)2);
+            writer.Write(3.14159);
+            writer.Write((byte)0);
+            writer.Write(0xab);
+            writer.Write((byte)2);
+            writer.Write(1234.5);
+            writer.Write((byte)1);
+            writer.Write(10000000000L);
+
+            // Arguments the agent couldn't find, a NULL and a truncated
+            // string, and a conversion the agent's scanner stopped at
+            MemoryStream noArgs = new MemoryStream();
+            writer = new BinaryWriter(noArgs);
+            WriteFormat(writer, 1, Encoding.ASCII, "%d items");
+            writer.Write((byte)0xFF);
+
+            MemoryStream strings = new MemoryStream();
+            writer = new BinaryWriter(strings);
+            WriteFormat(writer, 1, Encoding.ASCII, "%s %.3s %*s %k %d");
+            writer.Write((byte)4);
+            writer.Write((byte)4);
+            writer.Write(10u | 0x80000000);
+            writer.Write(2u);
+            writer.Write(2u);
+            writer.Write(Encoding.ASCII.GetBytes("ABij"));
+            writer.Write((byte)6);
+            writer.Write((byte)0);
+            writer.Write(4);
+            writer.Write((byte)4);
+            writer.Write(1u);
+            writer.Write(Encoding.ASCII.GetBytes("x"));
+
+            MemoryStream wide = new MemoryStream();
+            writer = new BinaryWriter(wide);
+            WriteFormat(writer, 2, Encoding.Unicode, "%s: %S %c %p");
+            writer.Write((byte)4);
+            writer.Write((byte)5);
+            writer.Write(4u);
+            writer.Write(Encoding.Unicode.GetBytes("\u00e5pen"));
+            writer.Write((byte)4);
+            writer.Write(2u);
+            writer.Write(Encoding.ASCII.GetBytes("ok"));
+            writer.Write((byte)0);
+            writer.Write((int)'!');
+            writer.Write((byte)3);
+            writer.Write(0x12ff7cUL);
+
+            XmlDocument doc = new XmlDocument();
+            doc.LoadXml("<event id=\"2\" type=\"FunctionCall\"><arguments direction=\"in\">"
+                       + "<argument name=\"a\"><rawValue>" + Convert.ToBase64String(numbers.ToArray()) + "</rawValue></argument>"
+                       + "<argument name=\"b\"><rawValue>" + Convert.ToBase64String(noArgs.ToArray()) + "</rawValue></argument>"
+                       + "<argument name=\"c\"><rawValue>" + Convert.ToBase64String(strings.ToArray()) + "</rawValue></argument>"
+                       + "<argument name=\"d\"><rawValue>" + Convert.ToBase64String(wide.ToArray()) + "</rawValue></argument>"
+                       + "</arguments></event>");
+            Assert.That(schema.ExpandValues(1, doc.DocumentElement), Is.True);
+
+            XmlNodeList values = doc.SelectNodes("/event/arguments/argument/value");
+            Assert.That(values.Count, Is.EqualTo(4));
+
+            Assert.That(values[0].Attributes["type"].Value, Is.EqualTo("AsciiFormatString"));
+            Assert.That(values[0].Attributes["value"].Value, Is.EqualTo("len=-42 ( 3.14) [ab  ] 1.235e+003 10000000000%"));
+            Assert.That(values[1].Attributes["value"].Value, Is.EqualTo("%d items"));
+            Assert.That(values[2].Attributes["value"].Value, Is.EqualTo("AB[...]ij (nu    x %k %d"));
+            Assert.That(values[3].Attributes["type"].Value, Is.EqualTo("UnicodeFormatString"));
+            Assert.That(values[3].Attributes["value"].Value, Is.EqualTo("\u00e5pen: ok ! 0012FF7C"));
+        }
+
+        private static void WriteFormat(BinaryWriter writer, ushort typeId, Encoding encoding, string format)
+        {
+            byte[] bytes = encoding.GetBytes(format);
+            writer.Write(typeId);
+            writer.Write((uint)bytes.Length);
+            writer.Write(bytes);
+        }
+    }
+}
@@ -291,5 +291,58 @@ namespace oSpy.SharpDumpLib.Tests
                       +"</event>";
             }
         }
+
+        public static string E084_ConnectRaw
+        {
+            get
+            {
+                return "<event id=\"84\" processId=\"2684\" processName=\"msnmsgr.exe\" threadId=\"544\" timestamp=\"128837553521454336\" type=\"FunctionCall\">"
+                      +    "<name>"
+                      +        "WS2_32.dll::connect"
+                      +    "</name>"
+                      +    "<arguments direction=\"in\">"
+                      +        "<argument name=\"s\">"
+                      +            "<rawValue>AQCsCAAA</rawValue>"
+                      +        "</argument>"
+                      +        "<argument name=\"name\">"
+                      +            "<rawValue>BwDs/AYAAQYAAgAHR0E27xQ=</rawValue>"
+                      +        "</argument>"
+                      +        "<argument name=\"namelen\">"
+                      +            "<rawValue>CAAQAAAA</rawValue>"
+                      +        "</argument>"
+                      +    "</arguments>"
+                      +    "<returnValue>"
+                      +        "<rawValue>CAD/////</rawValue>"
+                      +    "</returnValue>"
+                      +    "<lastError value=\"10035\"/>"
+                      +"</event>";
+            }
+        }
+
+        public static string E085_Schema
+        {
+            get
+            {
+                return "<event id=\"85\" processId=\"2684\" processName=\"msnmsgr.exe\" threadId=\"544\" timestamp=\"128837553521454336\" type=\"Schema\">"
+                      +    "<schema version=\"2\">"
+                      +        "<type flags=\"9\" id=\"1\" kind=\"1\" name=\"UInt32\" size=\"4\"/>"
+                      +        "<type flags=\"1\" id=\"2\" kind=\"1\" name=\"UInt16\" size=\"2\"/>"
+                      +        "<type elementType=\"2\" flags=\"1\" id=\"3\" kind=\"3\" name=\"SockAddrFamily\" size=\"2\">"
+                      +            "<member name=\"AF_INET\" value=\"2\"/>"
+                      +            "<member name=\"AF_INET6\" value=\"23\"/>"
+                      +        "</type>"
+                      +        "<type flags=\"17\" id=\"4\" kind=\"1\" name=\"UInt16\" size=\"2\"/>"
+                      +        "<type flags=\"1\" id=\"5\" kind=\"4\" name=\"Ipv4InAddr\" size=\"4\"/>"
+                      +        "<type flags=\"1\" id=\"6\" kind=\"8\" name=\"Ipv4Sockaddr\" size=\"8\">"
+                      +            "<field name=\"sin_family\" offset=\"0\" type=\"3\"/>"
+                      +            "<field name=\"sin_port\" offset=\"2\" type=\"4\"/>"
+                      +            "<field name=\"sin_addr\" offset=\"4\" type=\"5\"/>"
+                      +        "</type>"
+                      +        "<type elementType=\"6\" flags=\"0\" id=\"7\" kind=\"5\" name=\"Ipv4SockaddrPtr\" size=\"4\"/>"
+                      +        "<type flags=\"7\" id=\"8\" kind=\"1\" name=\"Int32\" size=\"4\"/>"
+                      +    "</schema>"
+                      +"</event>";
+            }
+        }
     }
 }
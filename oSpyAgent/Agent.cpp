@@ -27,6 +27,8 @@
 
 #define OSPY_CAPTURE_FILE_NAME      L"Global\\oSpyCapture"
 
+#define OSPY_AGENT_STATS_INTERVAL   30000
+
 #ifdef _MANAGED
 #pragma managed(push, off)
 #endif
@@ -48,7 +50,7 @@ public:
 Agent::Agent()
     : m_map(INVALID_HANDLE_VALUE),
       m_capture (NULL),
-      m_binaryLogger (NULL)
+      m_logger (NULL)
 {
     m_socketConnectHandler.Initialize (this, &Agent::OnSocketConnect);
 }
@@ -69,24 +71,38 @@ Agent::Initialize()
     // Let the UI know about us
     InterlockedIncrement (&m_capture->ActiveAgentCount);
 
+    OOWStringStream configPath;
+    configPath << m_capture->LogPath << "\\" << "config.xml";
+
+    // The settings say which logger to create.  Anything wrong with them
+    // is reported by LoadDefinitions() below, once there is a logger.
+    HookManager *mgr = HookManager::Instance();
+    try
+    {
+        mgr->LoadSettings(configPath.str());
+    }
+    catch (...)
+    {
+    }
+
     // Create the logger and tell Intercept++ to use it
     {
         OOWStringStream ss;
         ss << m_capture->LogPath << "\\" << GetProcessId(GetCurrentProcess()) << ".log";
-        m_binaryLogger = new BinaryLogger (this, ss.str ());
+        if (Logging::Logger::GetSink() == Logging::LOG_SINK_MAPPED)
+            m_logger = new MappedLogger (this, ss.str ());
+        else
+            m_logger = new BinaryLogger (this, ss.str ());
 
-        InterceptPP::SetLogger (m_binaryLogger);
+        InterceptPP::SetLogger (m_logger);
     }
 
     m_processName = Util::Instance()->GetProcessName().c_str();
 
     // Load hook definitions from XML
-    HookManager *mgr = HookManager::Instance();
     try
     {
-        OOWStringStream ss;
-        ss << m_capture->LogPath << "\\" << "config.xml";
-        mgr->LoadDefinitions(ss.str());
+        mgr->LoadDefinitions(configPath.str());
     }
     catch (Error &e)
     {
@@ -119,6 +135,10 @@ Agent::Initialize()
         return;
     }
 
+    // Types seen later on are logged as they show up
+    if (RawSchema::GetEnabled ())
+        RawSchema::Instance ()->LogPendingTypes ();
+
     mgr->HookFunctions ();
 }
 
@@ -135,12 +155,14 @@ Agent::UnInitialize()
 
     hookManager->UnhookFunctions ();
 
+    LogStats ();
+
     UnloadPlugins ();
 
     InterceptPP::UnInitialize ();
 
-    delete m_binaryLogger;
-    m_binaryLogger = NULL;
+    delete m_logger;
+    m_logger = NULL;
 
     // Let the UI know that we're no longer active
     InterlockedDecrement (&m_capture->ActiveAgentCount);
@@ -162,6 +184,8 @@ Agent::UnInitialize()
 void
 Agent::LoadPlugins ()
 {
+    AllocTagScope allocTag (ALLOC_TAG_PLUGINS);
+
     OWString pluginDir = GetBinPath ();
     pluginDir.append (L"\\Plugins\\");
 
@@ -358,6 +382,17 @@ Agent::HaveMatchingSoftwallRule(const OString &functionName,
     return false;
 }
 
+void
+Agent::LogStats ()
+{
+    if (!Stats::GetEnabled ())
+        return;
+
+    Logging::Event * ev = GetLogger ()->NewEvent ("AgentStats");
+    Stats::AppendToElement (ev);
+    ev->Submit ();
+}
+
 ULONG
 Agent::GetNextLogIndex ()
 {
@@ -441,7 +476,8 @@ AgentWorkerFunc (void * arg)
         MessageBoxA (NULL, "Unknown error", "oSpyAgent Error", MB_OK | MB_ICONERROR);
     }
 
-    WaitForSingleObject (stopReqEvent, INFINITE);
+    while (WaitForSingleObject (stopReqEvent, OSPY_AGENT_STATS_INTERVAL) == WAIT_TIMEOUT)
+        agent->LogStats ();
 
 beach:
     if (agent != NULL)
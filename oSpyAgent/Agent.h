@@ -19,6 +19,7 @@
 
 #include "AgentPlugin.h"
 #include "BinaryLogger.h"
+#include "MappedLogger.h"
 
 namespace oSpy {
 
@@ -73,6 +74,8 @@ public:
     ULONG GetNextLogIndex ();
     ULONG AddBytesLogged (ULONG n);
 
+    void LogStats ();
+
 private:
     void LoadPlugins ();
     void UnloadPlugins ();
@@ -82,7 +85,7 @@ private:
 protected:
     HANDLE m_map;
     Capture * m_capture;
-    oSpy::BinaryLogger * m_binaryLogger;
+    Logging::Logger * m_logger;
     OICString m_processName;
 
     typedef OMap<const AgentPluginDesc *, AgentPlugin *>::Type PluginMap;
@@ -21,21 +21,195 @@
 
 namespace oSpy {
 
+#define RING_SIZE               (128 * 1024)
+#define RING_WAKE_THRESHOLD     (RING_SIZE / 4)
+#define FLUSH_INTERVAL          100
+#define WRITE_BUFFER_SIZE       (1024 * 1024)
+#define GAP_TIMEOUT             50
+#define COMPRESSED_FLUSH_INTERVAL 1000
+
+// The tag of a record in a ring is its number shifted left by one, with
+// this bit set if the ring only has a pointer to it
+#define RECORD_INDIRECT         1
+#define RECORD_NUMBER(tag)      ((tag) >> 1)
+
+// Negative if a was submitted before b.  Numbers are 31 bits wide and
+// wrap around.
+static inline int
+CompareRecordNumbers(unsigned int a, unsigned int b)
+{
+    return static_cast<int>((a - b) << 1);
+}
+
+static inline DWORD
+ReadDWord(const char *&p, const char *end)
+{
+    if (end - p < static_cast<int>(sizeof(DWORD)))
+        throw Error("truncated record");
+
+    DWORD dw;
+    memcpy(&dw, p, sizeof(dw));
+    p += sizeof(dw);
+
+    return dw;
+}
+
+static inline void
+AppendDWord(OString &s, DWORD dw)
+{
+    s.append(reinterpret_cast<const char *>(&dw), sizeof(dw));
+}
+
+// Waits for the write to be done
+static bool
+WriteAt(HANDLE file, HANDLE event, unsigned __int64 offset, const void *data, DWORD size)
+{
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(OVERLAPPED));
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    overlapped.hEvent = event;
+
+    if (!WriteFile(file, data, size, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+        return false;
+
+    DWORD bytesWritten;
+    return GetOverlappedResult(file, &overlapped, &bytesWritten, TRUE) && bytesWritten == size;
+}
+
+// With the clock's calibration, or with its rate measured again since
+static void
+BuildHeader(LogFileHeader &header, unsigned int blockSize, unsigned int flags, bool remeasure)
+{
+    LogFormat::InitHeader(header, blockSize, flags);
+    Clock::GetCalibration(header.ticksPerSecond, header.startTicks, header.startTime);
+
+    if (remeasure)
+        header.ticksPerSecond = Clock::MeasureTicksPerSecond();
+}
+
+// With every symbol there is, so that a block can be read on its own
+static const char *
+BuildIndex(LogIndexWriter &index, bool final, unsigned __int64 offset, unsigned int &size)
+{
+    index.BeginIndex(final);
+
+    unsigned int count = Logging::SymbolTable::GetCount();
+    for (Logging::SymbolId id = 1; id < count; id++)
+        index.AddSymbol(id, Logging::SymbolTable::GetName(id), Logging::SymbolTable::GetLength(id));
+
+    return index.EndIndex(offset, size);
+}
+
+// What's in the ring, after the EventStamp, for a record too big for it
 typedef struct {
-    SLIST_ENTRY entry;
-    Logging::Event *ev;
-} PendingEvent;
+    char *data;
+    unsigned int size;
+} IndirectRecord;
+
+class ProducerRing : public BaseObject
+{
+public:
+    ProducerRing(void *buffer, unsigned int capacity)
+        : ring(buffer, capacity), thread(NULL), threadId(GetCurrentThreadId()),
+          droppedEvents(0), droppedBytes(0), summarizedEvents(0), next(NULL)
+    {}
+
+    RecordRing ring;
+    HANDLE thread;
+    DWORD threadId;
+
+    // What the thread lost since the last LogGap event
+    volatile LONG droppedEvents;
+    volatile LONG droppedBytes;
+    volatile LONG summarizedEvents;
+
+    ProducerRing *next;
+};
+
+//
+// Cuts a record down to the event element's name and fields, adding
+// summary="true".  Field values are small, unlike content and children.
+//
+static void
+SummarizeRecord(const char *data, unsigned int size, Logging::SymbolId summaryKey, OString &summary)
+{
+    const char *end = data + size;
+    const char *p = data;
+
+    ReadDWord(p, end);
+
+    DWORD fieldCount = ReadDWord(p, end);
+    for (DWORD i = 0; i < fieldCount; i++)
+    {
+        ReadDWord(p, end);
+
+        DWORD length = ReadDWord(p, end);
+        if (static_cast<DWORD>(end - p) < length)
+            throw Error("truncated record");
+        p += length;
+    }
+
+    summary.assign(data, p - data);
+
+    fieldCount++;
+    memcpy(&summary[sizeof(DWORD)], &fieldCount, sizeof(DWORD));
+
+    AppendDWord(summary, SYMBOL_REFERENCE | summaryKey);
+    AppendDWord(summary, 4);
+    summary.append("true", 4);
+
+    // No content and no children
+    AppendDWord(summary, FALSE);
+    AppendDWord(summary, 0);
+    AppendDWord(summary, 0);
+}
 
 BinaryLogger::BinaryLogger(Agent *agent, const OWString &filename)
-    : m_agent(agent)
+    : m_agent(agent), m_filename(filename), m_handle(NULL), m_wakePending(0), m_rings(NULL), m_ringsLock(0),
+      m_submitted(0), m_nextRecord(1), m_queuedBytes(0), m_summarizing(0),
+      m_currentBuffer(0), m_fileOffset(0), m_compressor(NULL), m_lastWrite(GetTickCount()),
+      m_sequence(0), m_segmentStart(0), m_segmentUsed(false), m_nextHandle(NULL)
 {
-    m_handle = CreateFileW(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (m_handle == INVALID_HANDLE_VALUE)
+    m_segmented = Logging::Logger::GetSegmentSize() != 0 || Logging::Logger::GetSegmentInterval() != 0;
+
+    size_t dot = filename.rfind(L'.');
+    size_t separator = filename.find_last_of(L"\\/");
+    if (dot == OWString::npos || (separator != OWString::npos && dot < separator))
+        dot = filename.size();
+    m_stem = filename.substr(0, dot);
+    m_extension = filename.substr(dot);
+
+    HANDLE handle = CreateSegment(1);
+    if (handle == NULL)
         throw runtime_error("CreateFile failed");
 
+    m_tlsIdx = TlsAlloc();
+    if (m_tlsIdx == TLS_OUT_OF_INDEXES)
+        throw runtime_error("TlsAlloc failed");
+
     m_destroyEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    m_summaryKey = Logging::SymbolTable::Intern("summary", 7);
+
+    for (int i = 0; i < 2; i++)
+    {
+        // Room for one more record once it's full
+        m_buffers[i] = new BinarySerializer(m_encoder);
+        m_buffers[i]->Reserve(WRITE_BUFFER_SIZE + RING_SIZE);
+
+        memset(&m_writes[i], 0, sizeof(PendingWrite));
+        m_writes[i].event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
 
-    InitializeSListHead(&m_pendingEvents);
+    unsigned int blockSize = Logging::Logger::GetBlockSize();
+    for (int i = 0; i < 2; i++)
+        m_buffers[i]->SetBlockSize(blockSize);
+
+    OpenSegment(handle);
+    if (m_segmented)
+        WriteManifest();
 
     m_loggingThreadHandle = CreateThread(NULL, 0, LoggingThreadFuncWrapper, this, 0, NULL);
 }
@@ -43,8 +217,46 @@ BinaryLogger::BinaryLogger(Agent *agent, const OWString &filename)
 BinaryLogger::~BinaryLogger()
 {
     SetEvent(m_destroyEvent);
+
+    // Only one thread may drain the rings
+    WaitForSingleObject(m_loggingThreadHandle, INFINITE);
+    CloseHandle(m_loggingThreadHandle);
+
     FlushPending();
-    CloseHandle(m_handle);
+    CloseSegment();
+
+    if (m_segmented)
+    {
+        // Opened ahead of time for nothing
+        if (m_nextHandle != NULL)
+        {
+            CloseHandle(m_nextHandle);
+            DeleteFileW(GetSegmentName(m_sequence + 1).c_str());
+        }
+
+        WriteManifest();
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        delete m_buffers[i];
+        CloseHandle(m_writes[i].event);
+    }
+
+    while (m_rings != NULL)
+    {
+        ProducerRing *pr = m_rings;
+        m_rings = pr->next;
+
+        if (pr->thread != NULL)
+            CloseHandle(pr->thread);
+        AllocUtils::Free(pr->ring.GetBuffer());
+        delete pr;
+    }
+
+    TlsFree(m_tlsIdx);
+    CloseHandle(m_wakeEvent);
+    CloseHandle(m_destroyEvent);
 }
 
 Logging::Event *
@@ -56,50 +268,692 @@ BinaryLogger::NewEvent(const OString &eventType)
 void
 BinaryLogger::SubmitEvent(Logging::Event *ev)
 {
-    if (WaitForSingleObject(m_destroyEvent, 0) != WAIT_OBJECT_0)
+    Logging::BinaryWriter writer;
+    writer.AppendNode(ev);
+
+    writer.CommitPayloads(SubmitRecord(ev->GetStamp(), writer.GetData(), writer.GetSize()));
+}
+
+Logging::Writer *
+BinaryLogger::NewEventWriter(const OString &eventType)
+{
+    return new Logging::BinaryWriter(this, m_agent->GetNextLogIndex(), eventType);
+}
+
+bool
+BinaryLogger::SubmitRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size)
+{
+    if (WaitForSingleObject(m_destroyEvent, 0) == WAIT_OBJECT_0)
+        return false;
+
+    ProducerRing *pr = GetProducerRing();
+    if (pr == NULL)
+        throw Error("out of memory");
+
+    Logging::QueueFullPolicy policy = Logging::Logger::GetQueueFullPolicy();
+    bool summarize = policy == Logging::QUEUE_FULL_SUMMARIZE && m_summarizing != 0;
+
+    if (!summarize && MakeRoom(pr, size))
     {
-        PendingEvent *pe = new PendingEvent;
-        pe->ev = ev;
-        InterlockedPushEntrySList(&m_pendingEvents, &pe->entry);
+        WriteToRing(pr, stamp, data, size);
+        return true;
     }
-    else
+
+    if (policy == Logging::QUEUE_FULL_SUMMARIZE)
+    {
+        InterlockedExchange(&m_summarizing, 1);
+
+        OString summary;
+        SummarizeRecord(data, size, m_summaryKey, summary);
+
+        unsigned int summarySize = static_cast<unsigned int>(summary.size());
+        if (MakeRoom(pr, summarySize))
+        {
+            WriteToRing(pr, stamp, summary.data(), summarySize);
+            InterlockedIncrement(&pr->summarizedEvents);
+            return false;
+        }
+    }
+
+    InterlockedIncrement(&pr->droppedEvents);
+    InterlockedExchangeAdd(&pr->droppedBytes, static_cast<LONG>(size));
+
+    return false;
+}
+
+ProducerRing *
+BinaryLogger::GetProducerRing()
+{
+    ProducerRing *pr = static_cast<ProducerRing *>(TlsGetValue(m_tlsIdx));
+    if (pr != NULL)
+        return pr;
+
+    void *buffer = AllocUtils::Malloc(RING_SIZE, false);
+    if (buffer == NULL)
+        return NULL;
+
+    pr = new ProducerRing(buffer, RING_SIZE);
+
+    // So that the ring can go once the thread is gone
+    pr->thread = OpenThread(SYNCHRONIZE, FALSE, GetCurrentThreadId());
+
+    while (InterlockedCompareExchange(&m_ringsLock, 1, 0) != 0)
+        Sleep(0);
+
+    pr->next = m_rings;
+    m_rings = pr;
+
+    InterlockedExchange(&m_ringsLock, 0);
+
+    TlsSetValue(m_tlsIdx, pr);
+
+    return pr;
+}
+
+//
+// Makes sure that a record of size bytes fits both in the ring and in what
+// may be queued, and charges it to the latter.  Under QUEUE_FULL_BLOCK it
+// waits as long as the timeout allows, otherwise it doesn't wait at all.
+//
+bool
+BinaryLogger::MakeRoom(ProducerRing *pr, unsigned int size)
+{
+    RecordRing &ring = pr->ring;
+    unsigned int ringSize = sizeof(Logging::EventStamp);
+    ringSize += (ringSize + size <= ring.GetMaxRecordSize()) ? size : sizeof(IndirectRecord);
+
+    DWORD timeout = 0;
+    if (Logging::Logger::GetQueueFullPolicy() == Logging::QUEUE_FULL_BLOCK)
+        timeout = Logging::Logger::GetQueueTimeout();
+
+    DWORD start = GetTickCount();
+
+    while (!ring.HasRoomFor(ringSize) || !ReserveQueued(size))
     {
-        delete ev;
+        // Full, so hurry the logging thread along and wait for it
+        Wake();
+
+        if (timeout != INFINITE && GetTickCount() - start >= timeout)
+            return false;
+
+        if (WaitForSingleObject(m_destroyEvent, 1) == WAIT_OBJECT_0)
+            return false;
     }
+
+    return true;
+}
+
+bool
+BinaryLogger::ReserveQueued(unsigned int size)
+{
+    LONG maxQueued = static_cast<LONG>(Logging::Logger::GetMaxQueuedBytes());
+
+    for (;;)
+    {
+        LONG queued = m_queuedBytes;
+
+        // One bigger than the limit still goes through on its own
+        if (queued != 0 && queued + static_cast<LONG>(size) > maxQueued)
+            return false;
+
+        if (InterlockedCompareExchange(&m_queuedBytes, queued + static_cast<LONG>(size), queued) == queued)
+            return true;
+    }
+}
+
+void
+BinaryLogger::WriteToRing(ProducerRing *pr, const Logging::EventStamp &stamp, const char *data, unsigned int size)
+{
+    RecordRing &ring = pr->ring;
+
+    bool indirect = sizeof(stamp) + size > ring.GetMaxRecordSize();
+
+    IndirectRecord rec;
+    if (indirect)
+    {
+        rec.data = static_cast<char *>(AllocUtils::Malloc(size, false));
+        if (rec.data == NULL)
+        {
+            InterlockedExchangeAdd(&m_queuedBytes, -static_cast<LONG>(size));
+            throw Error("out of memory");
+        }
+        memcpy(rec.data, data, size);
+        rec.size = size;
+    }
+
+    // Numbered only once it's sure to go in, as the logging thread waits
+    // for every number it hasn't seen yet
+    unsigned int number = static_cast<unsigned int>(InterlockedIncrement(&m_submitted));
+    if (indirect)
+        ring.Write((number << 1) | RECORD_INDIRECT, &stamp, sizeof(stamp), &rec, sizeof(rec));
+    else
+        ring.Write(number << 1, &stamp, sizeof(stamp), data, size);
+
+    if (ring.GetUsed() >= RING_WAKE_THRESHOLD)
+        Wake();
+}
+
+void
+BinaryLogger::Wake()
+{
+    if (InterlockedExchange(&m_wakePending, 1) == 0)
+        SetEvent(m_wakeEvent);
 }
 
 void
 BinaryLogger::FlushPending()
 {
-    PendingEvent *pe;
-    while ((pe = reinterpret_cast<PendingEvent *>(InterlockedFlushSList(&m_pendingEvents))) != NULL)
+    ProducerRingVector rings;
+    GetActiveRings(rings);
+
+    DWORD gapStart = 0;
+    unsigned int linked = 0;
+
+    // No more than a few buffers at a time, so that the logging thread
+    // gets to look after the rings of threads that have exited
+    while (!rings.empty() && linked < 4 * WRITE_BUFFER_SIZE)
     {
-        PendingEvent *cur = pe;
+        // The oldest record at the front of any of the rings
+        ProducerRing *oldest = NULL;
+        unsigned int oldestTag = 0;
 
-        do
+        for (size_t i = 0; i < rings.size();)
         {
-            BinarySerializer serializer;
-            serializer.AppendNode(cur->ev);
+            unsigned int tag, size;
+            if (rings[i]->ring.Peek(tag, size) == NULL)
+            {
+                rings[i] = rings.back();
+                rings.pop_back();
+                continue;
+            }
 
-            PendingEvent *next = reinterpret_cast<PendingEvent *>(cur->entry.Next);
-            delete cur->ev;
-            delete cur;
+            if (oldest == NULL || CompareRecordNumbers(RECORD_NUMBER(tag), RECORD_NUMBER(oldestTag)) < 0)
+            {
+                oldest = rings[i];
+                oldestTag = tag;
+            }
 
-            const OString &buf = serializer.GetData();
+            i++;
+        }
+
+        if (oldest == NULL)
+            break;
 
-            DWORD bytesWritten;
-            if (!WriteFile(m_handle, buf.data(), static_cast<DWORD>(buf.size()), &bytesWritten, NULL))
-                throw Error("WriteFile failed");
+        unsigned int number = RECORD_NUMBER(oldestTag);
 
-            if (bytesWritten != buf.size())
-                throw Error("short write");
+        // A thread may have numbered a record and not put it in its ring
+        // yet.  Wait for it, but not forever, in case the thread died.
+        if (CompareRecordNumbers(number, m_nextRecord) > 0)
+        {
+            if (gapStart == 0)
+                gapStart = GetTickCount();
 
-            m_agent->AddBytesLogged(static_cast<LONG>(buf.size()));
+            if (GetTickCount() - gapStart < GAP_TIMEOUT)
+            {
+                Sleep(0);
 
-            cur = next;
+                // The record may be in a ring that was empty before
+                GetActiveRings(rings);
+                continue;
+            }
         }
-        while (cur != NULL);
+
+        gapStart = 0;
+
+        unsigned int tag, size;
+        const void *rec = oldest->ring.Peek(tag, size);
+        unsigned int recordSize = LinkRecord(rec, tag, size);
+        oldest->ring.Consume();
+
+        InterlockedExchangeAdd(&m_queuedBytes, -static_cast<LONG>(recordSize));
+        linked += recordSize;
+
+        // One that turns up late is written as soon as it does
+        if (CompareRecordNumbers(number, m_nextRecord) >= 0)
+            m_nextRecord = (number + 1) & 0x7FFFFFFF;
+    }
+
+    LogGaps();
+
+    // Back to full events once the backlog is down to half of the limit
+    if (m_summarizing != 0 &&
+        static_cast<unsigned int>(m_queuedBytes) <= Logging::Logger::GetMaxQueuedBytes() / 2)
+    {
+        InterlockedExchange(&m_summarizing, 0);
+    }
+
+    if (m_compressor == NULL || GetTickCount() - m_lastWrite >= COMPRESSED_FLUSH_INTERVAL)
+        WriteBuffer();
+
+    CheckSegment();
+
+    ReleaseExitedRings();
+}
+
+void
+BinaryLogger::GetActiveRings(ProducerRingVector &rings)
+{
+    rings.clear();
+
+    for (ProducerRing *pr = m_rings; pr != NULL; pr = pr->next)
+    {
+        if (pr->ring.GetUsed() != 0)
+            rings.push_back(pr);
+    }
+}
+
+// Returns the size of the record itself, which is what was charged for it
+unsigned int
+BinaryLogger::LinkRecord(const void *rec, unsigned int tag, unsigned int size)
+{
+    const Logging::EventStamp *stamp = static_cast<const Logging::EventStamp *>(rec);
+    const char *data = reinterpret_cast<const char *>(stamp + 1);
+    size -= sizeof(Logging::EventStamp);
+
+    if ((tag & RECORD_INDIRECT) != 0)
+    {
+        const IndirectRecord *ir = reinterpret_cast<const IndirectRecord *>(data);
+        LinkRecord(*stamp, ir->data, ir->size);
+        AllocUtils::Free(ir->data);
+
+        size = ir->size;
+    }
+    else
+    {
+        LinkRecord(*stamp, data, size);
+    }
+
+    return size;
+}
+
+void
+BinaryLogger::LinkRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size)
+{
+    m_buffers[m_currentBuffer]->AppendRecord(stamp, data, size);
+    m_segmentUsed = true;
+
+    if (m_buffers[m_currentBuffer]->GetSize() >= WRITE_BUFFER_SIZE)
+        WriteBuffer();
+
+    CheckSegment();
+}
+
+void
+BinaryLogger::LogGaps()
+{
+    for (ProducerRing *pr = m_rings; pr != NULL; pr = pr->next)
+    {
+        if (pr->droppedEvents == 0 && pr->summarizedEvents == 0)
+            continue;
+
+        LONG dropped = InterlockedExchange(&pr->droppedEvents, 0);
+        LONG droppedBytes = InterlockedExchange(&pr->droppedBytes, 0);
+        LONG summarized = InterlockedExchange(&pr->summarizedEvents, 0);
+
+        // Straight into the file, as it's not for the limit to hold it up
+        Logging::BinaryWriter writer(this, m_agent->GetNextLogIndex(), "LogGap");
+        writer.Field("sourceThreadId", pr->threadId);
+        writer.Field("droppedEvents", static_cast<unsigned int>(dropped));
+        writer.Field("droppedBytes", static_cast<unsigned int>(droppedBytes));
+        writer.Field("summarizedEvents", static_cast<unsigned int>(summarized));
+        writer.Close();
+
+        LinkRecord(writer.GetStamp(), writer.GetData(), writer.GetSize());
+    }
+}
+
+void
+BinaryLogger::ReleaseExitedRings()
+{
+    ProducerRing *pr = m_rings;
+
+    while (pr != NULL)
+    {
+        ProducerRing *next = pr->next;
+
+        // Nothing more is coming once the thread is gone
+        if (pr->thread != NULL && WaitForSingleObject(pr->thread, 0) == WAIT_OBJECT_0 &&
+            pr->ring.GetUsed() == 0 && pr->droppedEvents == 0 && pr->summarizedEvents == 0)
+        {
+            while (InterlockedCompareExchange(&m_ringsLock, 1, 0) != 0)
+                Sleep(0);
+
+            // Rings are added in front, so it may not be the first anymore
+            ProducerRing **link = &m_rings;
+            while (*link != pr)
+                link = &(*link)->next;
+            *link = next;
+
+            InterlockedExchange(&m_ringsLock, 0);
+
+            CloseHandle(pr->thread);
+            AllocUtils::Free(pr->ring.GetBuffer());
+            delete pr;
+        }
+
+        pr = next;
+    }
+}
+
+void
+BinaryLogger::WriteBuffer()
+{
+    BinarySerializer *buf = m_buffers[m_currentBuffer];
+    m_lastWrite = GetTickCount();
+
+    if (buf->GetSize() == 0)
+        return;
+
+    buf->EndBlock();
+
+    if (m_compressor != NULL)
+    {
+        m_compressor->Submit(m_currentBuffer, buf);
+
+        m_currentBuffer ^= 1;
+        CompleteWrite(m_currentBuffer);
+        m_buffers[m_currentBuffer]->Clear();
+
+        return;
+    }
+
+    PendingWrite &write = m_writes[m_currentBuffer];
+    DWORD size = static_cast<DWORD>(buf->GetSize());
+
+    HANDLE event = write.event;
+    memset(&write.overlapped, 0, sizeof(OVERLAPPED));
+    write.overlapped.Offset = static_cast<DWORD>(m_fileOffset);
+    write.overlapped.OffsetHigh = static_cast<DWORD>(m_fileOffset >> 32);
+    write.overlapped.hEvent = event;
+
+    if (!WriteFile(m_handle, buf->GetData().data(), size, NULL, &write.overlapped) &&
+        GetLastError() != ERROR_IO_PENDING)
+    {
+        throw Error("WriteFile failed");
+    }
+
+    write.size = size;
+    write.pending = true;
+
+    const LogIndexEntryVector &blocks = buf->GetBlocks();
+    for (LogIndexEntryVector::const_iterator iter = blocks.begin(); iter != blocks.end(); iter++)
+    {
+        LogIndexEntry entry = *iter;
+        entry.offset += m_fileOffset;
+        m_index.AddEntry(entry);
+    }
+
+    m_fileOffset += size;
+    m_agent->AddBytesLogged(static_cast<LONG>(size));
+
+    // Carry on with the other buffer while this one is being written,
+    // once it's done with whatever was written from it before
+    m_currentBuffer ^= 1;
+    CompleteWrite(m_currentBuffer);
+    m_buffers[m_currentBuffer]->Clear();
+
+    if (m_index.GetPendingEntries() >= LOG_INDEX_INTERVAL)
+        AppendIndex(false);
+}
+
+void
+BinaryLogger::CompleteWrite(int index)
+{
+    if (m_compressor != NULL)
+    {
+        m_compressor->Wait(index);
+        return;
+    }
+
+    PendingWrite &write = m_writes[index];
+    if (!write.pending)
+        return;
+
+    write.pending = false;
+
+    DWORD bytesWritten;
+    if (!GetOverlappedResult(m_handle, &write.overlapped, &bytesWritten, TRUE))
+        throw Error("WriteFile failed");
+
+    if (bytesWritten != write.size)
+        throw Error("short write");
+}
+
+void
+BinaryLogger::AppendIndex(bool final)
+{
+    BinarySerializer *buf = m_buffers[m_currentBuffer];
+
+    unsigned int size;
+    const char *index = BuildIndex(m_index, final, m_fileOffset + buf->GetSize(), size);
+    buf->AppendRaw(index, size);
+}
+
+OWString
+BinaryLogger::GetSegmentName(unsigned int sequence) const
+{
+    if (!m_segmented)
+        return m_filename;
+
+    OOWStringStream ss;
+    ss << m_stem << "." << setw(5) << setfill(L'0') << sequence << m_extension;
+    return ss.str();
+}
+
+// Returns NULL on failure
+HANDLE
+BinaryLogger::CreateSegment(unsigned int sequence)
+{
+    HANDLE handle = CreateFileW(GetSegmentName(sequence).c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+    return (handle != INVALID_HANDLE_VALUE) ? handle : NULL;
+}
+
+// Starts writing the next segment, or the log if it isn't segmented, to
+// handle.  Nothing may be left to write.
+void
+BinaryLogger::OpenSegment(HANDLE handle)
+{
+    m_handle = handle;
+    m_sequence++;
+    m_segmentStart = GetTickCount();
+    m_segmentUsed = false;
+
+    // A new BlockCompressor takes the buffers in turn from the first
+    m_currentBuffer = 0;
+    m_buffers[0]->Clear();
+
+    m_index.Reset();
+    m_encoder.Reset();
+
+    unsigned int blockSize = Logging::Logger::GetBlockSize();
+
+    if (Logging::Logger::GetCompression() == Logging::LOG_COMPRESSION_LZ)
+    {
+        m_compressor = new BlockCompressor(m_agent, m_handle, blockSize);
+        m_fileOffset = 0;
     }
+    else
+    {
+        LogFileHeader header;
+        BuildHeader(header, blockSize, 0, false);
+
+        if (!WriteAt(m_handle, m_writes[0].event, 0, &header, sizeof(header)))
+            throw Error("WriteFile failed");
+        m_fileOffset = sizeof(header);
+    }
+
+    if (m_segmented)
+    {
+        FILETIME ft;
+        GetSystemTimeAsFileTime(&ft);
+        m_manifest.AddSegment(m_sequence, (static_cast<unsigned __int64>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+    }
+}
+
+// Writes out what's linked, the final index and the trailer, and closes
+// the file
+void
+BinaryLogger::CloseSegment()
+{
+    // What was held back for the compressor to get a full block
+    WriteBuffer();
+
+    CompleteWrite(0);
+    CompleteWrite(1);
+
+    unsigned int blockSize = Logging::Logger::GetBlockSize();
+    LogFileHeader header;
+    LogIndexEntry totals;
+    unsigned __int64 size;
+
+    // The final index, and the trailer pointing at it
+    if (m_compressor != NULL)
+    {
+        BuildHeader(header, blockSize, LOG_FILE_COMPRESSED, true);
+        m_compressor->Finish(header);
+
+        m_compressor->GetIndex().GetTotals(totals);
+        size = m_compressor->GetFileSize();
+
+        delete m_compressor;
+        m_compressor = NULL;
+    }
+    else
+    {
+        AppendIndex(true);
+
+        LogTrailer trailer;
+        m_index.BuildTrailer(trailer);
+        m_buffers[m_currentBuffer]->AppendRaw(&trailer, sizeof(trailer));
+
+        WriteBuffer();
+        CompleteWrite(m_currentBuffer ^ 1);
+
+        BuildHeader(header, blockSize, 0, true);
+        WriteAt(m_handle, m_writes[0].event, 0, &header, sizeof(header));
+
+        m_index.GetTotals(totals);
+        size = m_fileOffset;
+    }
+
+    CloseHandle(m_handle);
+    m_handle = NULL;
+
+    if (m_segmented)
+        LogManifest::CloseSegment(m_manifest.GetSegment(m_manifest.GetSegmentCount() - 1), totals, header, size);
+}
+
+// Goes on to the next segment once this one is at a limit.  A compressed
+// one's size is only known for what the compressor is done with.
+void
+BinaryLogger::CheckSegment()
+{
+    if (!m_segmented || !m_segmentUsed)
+        return;
+
+    unsigned __int64 size;
+    if (m_compressor != NULL)
+        size = m_compressor->GetFileSize();
+    else
+        size = m_fileOffset + m_buffers[m_currentBuffer]->GetSize();
+
+    unsigned __int64 maxSize = Logging::Logger::GetSegmentSize();
+    DWORD elapsed = GetTickCount() - m_segmentStart;
+    unsigned __int64 interval = static_cast<unsigned __int64>(Logging::Logger::GetSegmentInterval()) * 1000;
+
+    if ((maxSize != 0 && size >= maxSize) || (interval != 0 && elapsed >= interval))
+    {
+        RotateSegment();
+    }
+    else if (m_nextHandle == NULL &&
+             ((maxSize != 0 && size >= maxSize / 4 * 3) || (interval != 0 && elapsed >= interval / 4 * 3)))
+    {
+        m_nextHandle = CreateSegment(m_sequence + 1);
+    }
+}
+
+void
+BinaryLogger::RotateSegment()
+{
+    HANDLE handle = m_nextHandle;
+    if (handle == NULL)
+        handle = CreateSegment(m_sequence + 1);
+
+    // Carries on with this one, and tries again the next time around
+    if (handle == NULL)
+        return;
+    m_nextHandle = NULL;
+
+    CloseSegment();
+    OpenSegment(handle);
+    LogSchema();
+
+    TrimSegments();
+    WriteManifest();
+}
+
+// Every type registered so far, so that the segment's raw values can be
+// read without the ones before it.  Types that come after get logged as
+// usual.  This alone doesn't make the segment used.
+void
+BinaryLogger::LogSchema()
+{
+    if (!RawSchema::GetEnabled() || RawSchema::Instance()->GetTypeCount() == 0)
+        return;
+
+    Logging::BinaryWriter writer(this, m_agent->GetNextLogIndex(), "Schema");
+    writer.AppendNode(RawSchema::Instance()->ToElement());
+    writer.Close();
+
+    m_buffers[m_currentBuffer]->AppendRecord(writer.GetStamp(), writer.GetData(), writer.GetSize());
+}
+
+// Keeps the newest of the segments, this one included, and lists the
+// others as deleted, so that readers know what's missing
+void
+BinaryLogger::TrimSegments()
+{
+    unsigned int kept = Logging::Logger::GetSegmentCount();
+    if (kept == 0)
+        return;
+
+    unsigned int count = m_manifest.GetSegmentCount();
+    for (unsigned int i = 0; i + kept < count; i++)
+    {
+        LogSegmentEntry &segment = m_manifest.GetSegment(i);
+        if ((segment.flags & LOG_SEGMENT_DELETED) != 0)
+            continue;
+
+        // One that's being read may have to wait for the next time around
+        if (DeleteFileW(GetSegmentName(segment.sequence).c_str()))
+            segment.flags |= LOG_SEGMENT_DELETED;
+    }
+}
+
+// Replaced as a whole, so that it's never seen half written.  The segments
+// can be read without it, so it's not worth failing over.
+void
+BinaryLogger::WriteManifest()
+{
+    unsigned int size;
+    const char *data = m_manifest.Build(size);
+
+    OWString path = m_stem + L".manifest";
+    OWString tempPath = path + L".tmp";
+
+    HANDLE file = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+
+    DWORD bytesWritten;
+    BOOL success = WriteFile(file, data, size, &bytesWritten, NULL) && bytesWritten == size;
+    CloseHandle(file);
+
+    if (success)
+        MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+    else
+        DeleteFileW(tempPath.c_str());
 }
 
 DWORD WINAPI
@@ -114,59 +968,279 @@ void
 BinaryLogger::LoggingThreadFunc()
 {
     ReentranceProtector protector;
+    AllocTagScope allocTag(ALLOC_TAG_EVENTS);
+
+    HANDLE events[2] = { m_destroyEvent, m_wakeEvent };
 
-    while (WaitForSingleObject(m_destroyEvent, 5000) != WAIT_OBJECT_0)
+    while (WaitForMultipleObjects(2, events, FALSE, FLUSH_INTERVAL) != WAIT_OBJECT_0)
     {
+        InterlockedExchange(&m_wakePending, 0);
         FlushPending();
     }
 }
 
+SymbolEncoder::SymbolEncoder()
+{
+    SetPayloadKeys(Logging::SymbolTable::Intern("payloadId", 9), Logging::SymbolTable::Intern("payloadRef", 10));
+}
+
+const char *
+SymbolEncoder::GetSymbolName(unsigned int id, unsigned int &length)
+{
+    if (id == 0 || id >= Logging::SymbolTable::GetCount())
+        return NULL;
+
+    length = Logging::SymbolTable::GetLength(id);
+    return Logging::SymbolTable::GetName(id);
+}
+
+unsigned int
+SymbolEncoder::InternSymbol(const char *name, unsigned int length)
+{
+    return Logging::SymbolTable::Intern(name, length);
+}
+
+// A payload first logged in an earlier segment
+const char *
+SymbolEncoder::ResolvePayload(unsigned int id, unsigned int &length)
+{
+    if (!PayloadTable::Instance()->GetPayload(id, m_payload))
+        return NULL;
+
+    length = static_cast<unsigned int>(m_payload.size());
+    return m_payload.data();
+}
+
+BinarySerializer::BinarySerializer(LogEncoder &encoder)
+    : m_encoder(encoder), m_blockSize(0)
+{
+    LogIndexWriter::InitEntry(m_block, 0);
+}
+
+void
+BinarySerializer::Clear()
+{
+    m_buf.erase();
+    m_blocks.clear();
+    LogIndexWriter::InitEntry(m_block, 0);
+}
+
+void
+BinarySerializer::EndBlock()
+{
+    if (m_buf.size() == m_block.offset)
+        return;
+
+    m_block.size = static_cast<unsigned int>(m_buf.size() - m_block.offset);
+    m_blocks.push_back(m_block);
+
+    LogIndexWriter::InitEntry(m_block, m_buf.size());
+    m_encoder.StartBlock();
+}
+
 void
-BinarySerializer::AppendNode(Logging::Node *node)
+BinarySerializer::AppendRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size)
 {
-    // Name
-    AppendString(node->GetName());
+    if (!m_encoder.EncodeEvent(data, size, stamp.timestamp, stamp.threadId))
+        throw Error("malformed record");
 
-    // Fields
+    m_buf.append(m_encoder.GetData(), m_encoder.GetSize());
+    LogIndexWriter::AddToEntry(m_block, m_encoder.GetFrame());
+    m_encoder.Clear();
+
+    if (m_blockSize != 0 && m_buf.size() - m_block.offset >= m_blockSize)
+        EndBlock();
+}
+
+void
+BinarySerializer::AppendRaw(const void *data, unsigned int size)
+{
+    m_buf.append(static_cast<const char *>(data), size);
+
+    if (m_blockSize != 0 && m_buf.size() - m_block.offset >= m_blockSize)
+        EndBlock();
+}
+
+BlockCompressor::BlockCompressor(Agent *agent, HANDLE file, unsigned int blockSize)
+    : m_agent(agent), m_file(file), m_fileOffset(0), m_fileSize(0), m_failed(false)
+{
+    m_writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    for (int i = 0; i < 2; i++)
     {
-        AppendDWord(node->GetFieldCount());
-        Logging::Node::FieldListConstIter iter, endIter = node->FieldsIterEnd();
+        m_jobs[i] = NULL;
+        m_pending[i] = false;
+        m_submittedEvents[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_doneEvents[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
 
-        for (iter = node->FieldsIterBegin(); iter != endIter; iter++)
-        {
-            AppendString(iter->first);
-            AppendString(iter->second);
-        }
+    LogFileHeader header;
+    BuildHeader(header, blockSize, LOG_FILE_COMPRESSED, false);
+
+    if (!Write(&header, sizeof(header)))
+        throw Error("WriteFile failed");
+    m_written[0] = m_written[1] = m_fileSize = m_fileOffset;
+
+    m_thread = CreateThread(NULL, 0, ThreadFuncWrapper, this, 0, NULL);
+}
+
+BlockCompressor::~BlockCompressor()
+{
+    Wait(0);
+    Wait(1);
+
+    SetEvent(m_stopEvent);
+    WaitForSingleObject(m_thread, INFINITE);
+    CloseHandle(m_thread);
+
+    for (int i = 0; i < 2; i++)
+    {
+        CloseHandle(m_submittedEvents[i]);
+        CloseHandle(m_doneEvents[i]);
     }
 
-    // Content
-    AppendDWord(node->GetContentIsRaw());
-    AppendString(node->GetContent());
+    CloseHandle(m_stopEvent);
+    CloseHandle(m_writeEvent);
+}
+
+void
+BlockCompressor::Submit(int index, BinarySerializer *buf)
+{
+    m_jobs[index] = buf;
+    m_pending[index] = true;
+
+    ResetEvent(m_doneEvents[index]);
+    SetEvent(m_submittedEvents[index]);
+}
+
+void
+BlockCompressor::Wait(int index)
+{
+    if (!m_pending[index])
+        return;
+
+    WaitForSingleObject(m_doneEvents[index], INFINITE);
+    m_pending[index] = false;
+
+    if (m_written[index] > m_fileSize)
+        m_fileSize = m_written[index];
+
+    if (m_failed)
+        throw Error("WriteFile failed");
+}
+
+void
+BlockCompressor::Finish(const LogFileHeader &header)
+{
+    CompressIndex(true);
+
+    // Outside of any block, so that it's what the file ends with
+    LogTrailer trailer;
+    m_index.BuildTrailer(trailer);
+
+    if (!Write(&trailer, sizeof(trailer)))
+        m_failed = true;
+    m_fileSize = m_fileOffset;
+
+    if (!WriteAt(m_file, m_writeEvent, 0, &header, sizeof(header)))
+        m_failed = true;
+
+    if (m_failed)
+        throw Error("WriteFile failed");
+}
+
+void
+BlockCompressor::Compress(BinarySerializer *buf)
+{
+    const char *data = buf->GetData().data();
+    unsigned int size = static_cast<unsigned int>(buf->GetSize());
+    const LogIndexEntryVector &blocks = buf->GetBlocks();
+
+    size_t maxSize = size + blocks.size() * LzCodec::GetMaxBlockSize(LZ_BLOCK_ALIGNMENT);
+    if (m_output.size() < maxSize)
+        m_output.resize(maxSize);
+
+    unsigned int outSize = 0;
 
-    // Children
+    for (LogIndexEntryVector::const_iterator iter = blocks.begin(); iter != blocks.end(); iter++)
     {
-        AppendDWord(node->GetChildCount());
-        Logging::Node::ChildListConstIter iter, endIter = node->ChildrenIterEnd();
+        LogIndexEntry entry = *iter;
+        const char *start = data + static_cast<size_t>(entry.offset);
 
-        for (iter = node->ChildrenIterBegin(); iter != endIter; iter++)
-        {
-            AppendNode(*iter);
-        }
+        entry.offset = m_fileOffset + outSize;
+        m_index.AddEntry(entry);
+
+        outSize += m_codec.CompressBlock(start, entry.size, &m_output[outSize]);
     }
+
+    if (!Write(m_output.data(), outSize))
+        m_failed = true;
+
+    m_agent->AddBytesLogged(static_cast<LONG>(outSize));
+
+    if (m_index.GetPendingEntries() >= LOG_INDEX_INTERVAL)
+        CompressIndex(false);
 }
 
+// In a block of its own
 void
-BinarySerializer::AppendString(const OString &s)
+BlockCompressor::CompressIndex(bool final)
+{
+    unsigned int size;
+    const char *index = BuildIndex(m_index, final, m_fileOffset, size);
+
+    size_t maxSize = LzCodec::GetMaxBlockSize(size);
+    if (m_output.size() < maxSize)
+        m_output.resize(maxSize);
+
+    unsigned int outSize = m_codec.CompressBlock(index, size, &m_output[0]);
+    if (!Write(m_output.data(), outSize))
+        m_failed = true;
+
+    m_agent->AddBytesLogged(static_cast<LONG>(outSize));
+}
+
+bool
+BlockCompressor::Write(const void *data, DWORD size)
+{
+    if (!WriteAt(m_file, m_writeEvent, m_fileOffset, data, size))
+        return false;
+
+    m_fileOffset += size;
+
+    return true;
+}
+
+DWORD WINAPI
+BlockCompressor::ThreadFuncWrapper(LPVOID param)
 {
-    AppendDWord(static_cast<DWORD>(s.size()));
-    if (s.size() > 0)
-        m_buf.append(s.data(), s.size());
+    BlockCompressor *instance = reinterpret_cast<BlockCompressor *>(param);
+    instance->ThreadFunc();
+    return 0;
 }
 
 void
-BinarySerializer::AppendDWord(DWORD dw)
+BlockCompressor::ThreadFunc()
 {
-    m_buf.append(reinterpret_cast<const char *>(&dw), sizeof(dw));
+    ReentranceProtector protector;
+    AllocTagScope allocTag(ALLOC_TAG_EVENTS);
+
+    // The buffers come in turn
+    int index = 0;
+
+    while (true)
+    {
+        HANDLE events[2] = { m_stopEvent, m_submittedEvents[index] };
+        if (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0)
+            break;
+
+        Compress(m_jobs[index]);
+        m_written[index] = m_fileOffset;
+
+        SetEvent(m_doneEvents[index]);
+        index ^= 1;
+    }
 }
 
 } // namespace oSpy
@@ -20,6 +20,87 @@
 namespace oSpy {
 
 class Agent;
+class ProducerRing;
+class BinarySerializer;
+class BlockCompressor;
+
+typedef vector<ProducerRing *, MyAlloc<ProducerRing *> > ProducerRingVector;
+typedef vector<LogIndexEntry, MyAlloc<LogIndexEntry> > LogIndexEntryVector;
+
+//
+// Records are submitted to a ring of the calling thread's own, which the
+// logging thread drains into the file.  Submitting doesn't allocate,
+// except for a thread's first record and for records too big for a ring,
+// and only waits if the thread's ring is full.  The logging thread is
+// woken once a ring is a quarter full, and otherwise goes through them
+// every FLUSH_INTERVAL milliseconds.
+//
+// Records are numbered as they're submitted, and the logging thread
+// merges the rings by number so that they end up in the file in that
+// order.  They're linked into one of two buffers, which is written out
+// in one go once it holds WRITE_BUFFER_SIZE bytes, or when there's
+// nothing more to link.  The file is written to asynchronously, so the
+// other buffer fills up in the meantime.
+//
+// Records waiting in the rings are charged against Logger's
+// maxQueuedBytes, and a record that doesn't fit, either there or in its
+// ring, is handled as the QueueFullPolicy says.  Each ring counts what
+// its thread lost, which the logging thread writes out as a LogGap event.
+//
+// With Logger's LOG_COMPRESSION_LZ, a full buffer is handed to a
+// BlockCompressor instead, and the file holds LzCodec blocks that start
+// and end on record boundaries.  As the blocks are better off full,
+// buffers are written out when they're full, or every
+// COMPRESSED_FLUSH_INTERVAL milliseconds otherwise.
+//
+// Records are written in version 2 of the format (see LogFormat.h),
+// encoded by the logging thread as they're linked, and indexed as
+// LogIndex.h describes, by the logging thread, or by the BlockCompressor
+// in a compressed log as it's the one that knows where the blocks end
+// up.  Index records start a buffer, or a block of their own when
+// compressed.  The rings still hold records as BinaryWriter wrote them,
+// each after its EventStamp, which goes into the record's frame: events
+// for this logger have no timestamp or threadId field.  The header has the
+// Clock calibration, which is measured again once the log is closed.
+//
+// With Logger's segment limits the log is written in segments listed in a
+// manifest, as LogManifest.h describes.  The logging thread looks at the
+// current segment after every record it links and once more after each
+// pass through the rings.  It opens the next file once the segment is
+// three quarters of the way to a limit, and goes on to it as soon as the
+// limit is reached, which may well be in the middle of a pass, closing
+// the segment with a final index and trailer of its own.  Threads keep
+// submitting to their rings meanwhile.  The encoder starts over with each
+// segment, so that it defines every symbol it uses and writes payloads
+// first logged in an earlier segment in full again, and the segment starts
+// with all of RawSchema's types, so that it can be read on its own.
+//
+
+typedef struct {
+    OVERLAPPED overlapped;
+    HANDLE event;
+    DWORD size;
+    bool pending;
+} PendingWrite;
+
+//
+// Encodes records with the names of SymbolTable, for everything written
+// to one log, and the payloads of PayloadTable.
+//
+
+class SymbolEncoder : public LogEncoder
+{
+public:
+    SymbolEncoder();
+
+    virtual const char *GetSymbolName(unsigned int id, unsigned int &length);
+
+protected:
+    virtual unsigned int InternSymbol(const char *name, unsigned int length);
+    virtual const char *ResolvePayload(unsigned int id, unsigned int &length);
+
+    OString m_payload;
+};
 
 class BinaryLogger : public Logging::Logger
 {
@@ -30,31 +111,173 @@ public:
     virtual Logging::Event *NewEvent(const OString &eventType);
     virtual void SubmitEvent(Logging::Event *ev);
 
+    virtual Logging::Writer *NewEventWriter(const OString &eventType);
+    virtual bool SubmitRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size);
+
+    virtual bool UsesEventStamps() const { return true; }
+
 protected:
     Agent *m_agent;
 
+    OWString m_filename;
+    // Of the file name, which the segments' names are made of
+    OWString m_stem;
+    OWString m_extension;
+
     HANDLE m_handle;
     HANDLE m_destroyEvent;
+    HANDLE m_wakeEvent;
+    volatile LONG m_wakePending;
     HANDLE m_loggingThreadHandle;
-    SLIST_HEADER m_pendingEvents;
+
+    DWORD m_tlsIdx;
+    ProducerRing *m_rings;
+    volatile LONG m_ringsLock;
+    volatile LONG m_submitted;
+    unsigned int m_nextRecord;
+
+    volatile LONG m_queuedBytes;
+    volatile LONG m_summarizing;
+    Logging::SymbolId m_summaryKey;
+
+    BinarySerializer *m_buffers[2];
+    PendingWrite m_writes[2];
+    int m_currentBuffer;
+    unsigned __int64 m_fileOffset;
+    BlockCompressor *m_compressor;
+    DWORD m_lastWrite;
+    LogIndexWriter m_index;
+    SymbolEncoder m_encoder;
+
+    bool m_segmented;
+    unsigned int m_sequence;
+    DWORD m_segmentStart;
+    bool m_segmentUsed;
+    // The next segment's file, once it's opened ahead of time
+    HANDLE m_nextHandle;
+    LogManifest m_manifest;
+
+    ProducerRing *GetProducerRing();
+    bool MakeRoom(ProducerRing *pr, unsigned int size);
+    bool ReserveQueued(unsigned int size);
+    void WriteToRing(ProducerRing *pr, const Logging::EventStamp &stamp, const char *data, unsigned int size);
+    void Wake();
 
     void FlushPending();
+    void GetActiveRings(ProducerRingVector &rings);
+    unsigned int LinkRecord(const void *rec, unsigned int tag, unsigned int size);
+    void LinkRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size);
+    void LogGaps();
+    void ReleaseExitedRings();
+    void WriteBuffer();
+    void CompleteWrite(int index);
+    void AppendIndex(bool final);
+
+    OWString GetSegmentName(unsigned int sequence) const;
+    HANDLE CreateSegment(unsigned int sequence);
+    void OpenSegment(HANDLE handle);
+    void CloseSegment();
+    void CheckSegment();
+    void RotateSegment();
+    void LogSchema();
+    void TrimSegments();
+    void WriteManifest();
 
     static DWORD WINAPI LoggingThreadFuncWrapper(LPVOID param);
     void LoggingThreadFunc();
 };
 
+//
+// Links records made by Logging::BinaryWriter for writing to the log,
+// encoding them with the caller's encoder, which has to be the same for
+// everything written to the file, so that it knows which symbols have
+// been defined already.  Each record is accounted for in the block it
+// ends up in.
+//
+
 class BinarySerializer : public BaseObject
 {
 public:
+    BinarySerializer(LogEncoder &encoder);
+
     const OString &GetData() { return m_buf; }
+    size_t GetSize() const { return m_buf.size(); }
 
-    void AppendNode(Logging::Node *node);
-    void AppendString(const OString &s);
-    void AppendDWord(DWORD dw);
+    void Reserve(size_t size) { m_buf.reserve(size); }
+    // Keeps the memory around for reuse
+    void Clear();
+
+    // Ends a block with the record that takes it to blockSize bytes or
+    // more.  The offsets of the blocks are relative to the buffer.
+    void SetBlockSize(unsigned int blockSize) { m_blockSize = blockSize; }
+    // Ends the last block, if there's anything in it
+    void EndBlock();
+    const LogIndexEntryVector &GetBlocks() const { return m_blocks; }
+
+    void AppendRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size);
+    // An index record or the trailer, which go in as they are
+    void AppendRaw(const void *data, unsigned int size);
 
 protected:
     OString m_buf;
+    LogEncoder &m_encoder;
+
+    unsigned int m_blockSize;
+    LogIndexEntry m_block;
+    LogIndexEntryVector m_blocks;
+};
+
+//
+// Compresses buffers of linked records and writes them to the file on a
+// thread of its own, so that the logging thread gets on with the rings
+// meanwhile.  Buffers are cut into blocks where BinarySerializer did, and
+// are indexed here.  The two buffers are handed over in turn, and each
+// stays the logging thread's until Wait() returns for it.
+//
+
+class BlockCompressor : public BaseObject
+{
+public:
+    BlockCompressor(Agent *agent, HANDLE file, unsigned int blockSize);
+    ~BlockCompressor();
+
+    void Submit(int index, BinarySerializer *buf);
+    void Wait(int index);
+    // Writes the final index and the trailer, once both buffers are done,
+    // and the header again
+    void Finish(const LogFileHeader &header);
+
+    // As of the last buffer waited for
+    unsigned __int64 GetFileSize() const { return m_fileSize; }
+    const LogIndexWriter &GetIndex() const { return m_index; }
+
+protected:
+    Agent *m_agent;
+    HANDLE m_file;
+    unsigned __int64 m_fileOffset;
+    // Where each buffer left off, and the furthest of those waited for
+    unsigned __int64 m_written[2];
+    unsigned __int64 m_fileSize;
+    HANDLE m_writeEvent;
+    volatile bool m_failed;
+
+    LzCodec m_codec;
+    OString m_output;
+    LogIndexWriter m_index;
+
+    BinarySerializer *m_jobs[2];
+    bool m_pending[2];
+    HANDLE m_submittedEvents[2];
+    HANDLE m_doneEvents[2];
+    HANDLE m_stopEvent;
+    HANDLE m_thread;
+
+    void Compress(BinarySerializer *buf);
+    void CompressIndex(bool final);
+    bool Write(const void *data, DWORD size);
+
+    static DWORD WINAPI ThreadFuncWrapper(LPVOID param);
+    void ThreadFunc();
 };
 
 } // namespace oSpy
@@ -0,0 +1,312 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stdafx.h"
+#include "MappedLogger.h"
+#include "Agent.h"
+
+namespace oSpy {
+
+// Symbols a record can define before it has to define every symbol it uses
+#define MAX_PENDING_SYMBOLS 64
+
+static inline DWORD
+ReadDWord(const char *&p, const char *end)
+{
+    if (end - p < static_cast<int>(sizeof(DWORD)))
+        throw Error("truncated record");
+
+    DWORD dw;
+    memcpy(&dw, p, sizeof(dw));
+    p += sizeof(dw);
+
+    return dw;
+}
+
+static inline bool
+IsSymbolWritten(const volatile LONG *symbolsWritten, Logging::SymbolId id)
+{
+    return (symbolsWritten[id >> 5] & (1 << (id & 31))) != 0;
+}
+
+static void
+SetSymbolWritten(volatile LONG *symbolsWritten, Logging::SymbolId id)
+{
+    volatile LONG *word = &symbolsWritten[id >> 5];
+    LONG mask = 1 << (id & 31);
+
+    LONG old;
+    do
+    {
+        old = *word;
+        if ((old & mask) != 0)
+            return;
+    }
+    while (InterlockedCompareExchange(word, old | mask, old) != old);
+}
+
+//
+// Links a record made by Logging::BinaryWriter in two passes, like
+// BinarySerializer does in one: Measure() works out how big it gets and
+// which symbols it defines, Link() writes it out the same way even if
+// other threads have marked symbols since.
+//
+class RecordLinker
+{
+public:
+    RecordLinker(volatile LONG *symbolsWritten)
+        : m_symbolsWritten(symbolsWritten), m_pendingCount(0), m_selfContained(false),
+          m_linking(false), m_out(NULL), m_size(0)
+    {}
+
+    unsigned int Measure(const char *data, unsigned int size);
+    void Link(const char *data, unsigned int size, char *out);
+    // Once the record has its place in the log
+    void MarkSymbolsWritten();
+
+protected:
+    volatile LONG *m_symbolsWritten;
+
+    Logging::SymbolId m_pending[MAX_PENDING_SYMBOLS];
+    bool m_pendingDefined[MAX_PENDING_SYMBOLS];
+    unsigned int m_pendingCount;
+    // Too many new symbols to keep track of, so all of them are defined
+    bool m_selfContained;
+
+    bool m_linking;
+    char *m_out;
+    unsigned int m_size;
+
+    void Walk(const char *data, unsigned int size);
+    const char *LinkNode(const char *p, const char *end);
+    void LinkSymbol(Logging::SymbolId id);
+    void Append(const void *data, unsigned int size);
+    void AppendDWord(DWORD dw) { Append(&dw, sizeof(dw)); }
+};
+
+unsigned int
+RecordLinker::Measure(const char *data, unsigned int size)
+{
+    Walk(data, size);
+
+    if (m_pendingCount > MAX_PENDING_SYMBOLS)
+    {
+        m_selfContained = true;
+        m_pendingCount = 0;
+        Walk(data, size);
+    }
+
+    return m_size;
+}
+
+void
+RecordLinker::Link(const char *data, unsigned int size, char *out)
+{
+    memset(m_pendingDefined, 0, sizeof(m_pendingDefined));
+
+    m_linking = true;
+    m_out = out;
+    Walk(data, size);
+}
+
+void
+RecordLinker::MarkSymbolsWritten()
+{
+    for (unsigned int i = 0; i < m_pendingCount; i++)
+        SetSymbolWritten(m_symbolsWritten, m_pending[i]);
+}
+
+void
+RecordLinker::Walk(const char *data, unsigned int size)
+{
+    m_size = 0;
+
+    const char *end = data + size;
+    const char *p = data;
+    while (p < end)
+        p = LinkNode(p, end);
+}
+
+const char *
+RecordLinker::LinkNode(const char *p, const char *end)
+{
+    // Everything but the symbols is copied over as is
+    LinkSymbol(ReadDWord(p, end) & ~SYMBOL_DEFINITION);
+
+    DWORD fieldCount = ReadDWord(p, end);
+    AppendDWord(fieldCount);
+
+    for (DWORD i = 0; i < fieldCount; i++)
+    {
+        LinkSymbol(ReadDWord(p, end) & ~SYMBOL_DEFINITION);
+
+        DWORD length = ReadDWord(p, end);
+        if (static_cast<DWORD>(end - p) < length)
+            throw Error("truncated record");
+        AppendDWord(length);
+        Append(p, length);
+        p += length;
+    }
+
+    AppendDWord(ReadDWord(p, end));
+
+    DWORD contentSize = ReadDWord(p, end);
+    if (static_cast<DWORD>(end - p) < contentSize)
+        throw Error("truncated record");
+    AppendDWord(contentSize);
+    Append(p, contentSize);
+    p += contentSize;
+
+    DWORD childCount = ReadDWord(p, end);
+    AppendDWord(childCount);
+
+    for (DWORD i = 0; i < childCount; i++)
+        p = LinkNode(p, end);
+
+    return p;
+}
+
+void
+RecordLinker::LinkSymbol(Logging::SymbolId id)
+{
+    bool define = m_selfContained;
+
+    if (!define)
+    {
+        unsigned int i;
+        for (i = 0; i < m_pendingCount && i < MAX_PENDING_SYMBOLS; i++)
+        {
+            if (m_pending[i] == id)
+                break;
+        }
+
+        if (m_linking)
+        {
+            // Only what was decided while measuring counts from here on
+            if (i < m_pendingCount && !m_pendingDefined[i])
+            {
+                m_pendingDefined[i] = true;
+                define = true;
+            }
+        }
+        else if (i == m_pendingCount && !IsSymbolWritten(m_symbolsWritten, id))
+        {
+            if (m_pendingCount < MAX_PENDING_SYMBOLS)
+                m_pending[m_pendingCount] = id;
+            m_pendingCount++;
+            define = true;
+        }
+    }
+
+    if (define)
+    {
+        unsigned int length = Logging::SymbolTable::GetLength(id);
+
+        AppendDWord(SYMBOL_DEFINITION | id);
+        AppendDWord(length);
+        Append(Logging::SymbolTable::GetName(id), length);
+    }
+    else
+    {
+        AppendDWord(SYMBOL_REFERENCE | id);
+    }
+}
+
+void
+RecordLinker::Append(const void *data, unsigned int size)
+{
+    if (m_out != NULL && size > 0)
+        memcpy(m_out + m_size, data, size);
+    m_size += size;
+}
+
+MappedLogger::MappedLogger(Agent *agent, const OWString &filename)
+    : m_agent(agent)
+{
+    memset(const_cast<LONG *>(m_symbolsWritten), 0, sizeof(m_symbolsWritten));
+
+    if (!m_log.Create(filename.c_str()))
+        throw runtime_error("MappedLog::Create failed");
+}
+
+MappedLogger::~MappedLogger()
+{
+    m_log.Close();
+}
+
+Logging::Event *
+MappedLogger::NewEvent(const OString &eventType)
+{
+    return new Logging::Event(this, m_agent->GetNextLogIndex(), eventType);
+}
+
+void
+MappedLogger::SubmitEvent(Logging::Event *ev)
+{
+    Logging::BinaryWriter writer;
+    writer.AppendNode(ev);
+
+    writer.CommitPayloads(SubmitRecord(ev->GetStamp(), writer.GetData(), writer.GetSize()));
+}
+
+Logging::Writer *
+MappedLogger::NewEventWriter(const OString &eventType)
+{
+    return new Logging::BinaryWriter(this, m_agent->GetNextLogIndex(), eventType);
+}
+
+bool
+MappedLogger::SubmitRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size)
+{
+    RecordLinker linker(m_symbolsWritten);
+    unsigned int linkedSize = linker.Measure(data, size);
+
+    MappedLogReservation res;
+    char *p = static_cast<char *>(m_log.Reserve(linkedSize, res));
+    if (p == NULL)
+    {
+        // Nothing more can be written if the file couldn't grow
+        if (linkedSize > m_log.GetMaxRecordSize())
+            LogGap(size);
+        return false;
+    }
+
+    linker.MarkSymbolsWritten();
+    linker.Link(data, size, p);
+
+    m_log.Commit(res);
+
+    m_agent->AddBytesLogged(linkedSize);
+
+    return true;
+}
+
+void
+MappedLogger::LogGap(unsigned int droppedBytes)
+{
+    Logging::BinaryWriter writer(this, m_agent->GetNextLogIndex(), "LogGap");
+    writer.Field("sourceThreadId", GetCurrentThreadId());
+    writer.Field("droppedEvents", 1U);
+    writer.Field("droppedBytes", droppedBytes);
+    writer.Field("summarizedEvents", 0U);
+    writer.Close();
+
+    SubmitRecord(writer.GetStamp(), writer.GetData(), writer.GetSize());
+}
+
+} // namespace oSpy
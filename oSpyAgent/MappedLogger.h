@@ -0,0 +1,63 @@
+//
+// Copyright (c) 2007 Ole Andr Vadla Ravns <oleavr@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+namespace oSpy {
+
+class Agent;
+
+//
+// Has each thread write its records straight into the file, through a
+// MappedLog, instead of handing them to a logging thread.  A record is
+// linked as BinaryLogger does it, right into the room reserved for it.
+//
+// Whether a symbol has been defined is decided by a bitmap shared by all
+// threads: a record defines those that weren't marked at the time it was
+// measured, and marks them once it has its place in the file, so every
+// record that only refers to them comes after it.  Two threads may both
+// define a symbol, which is harmless.
+//
+// Records live in a MappedLog container rather than being back to back,
+// and as nothing is queued Logger's maxQueuedBytes doesn't apply.  A
+// record too big for an extent is dropped and logged as a LogGap event.
+//
+
+class MappedLogger : public Logging::Logger
+{
+public:
+    MappedLogger(Agent *agent, const OWString &filename);
+    virtual ~MappedLogger();
+
+    virtual Logging::Event *NewEvent(const OString &eventType);
+    virtual void SubmitEvent(Logging::Event *ev);
+
+    virtual Logging::Writer *NewEventWriter(const OString &eventType);
+    virtual bool SubmitRecord(const Logging::EventStamp &stamp, const char *data, unsigned int size);
+
+protected:
+    Agent *m_agent;
+    MappedLog m_log;
+
+    // One bit per symbol that has been defined in the log so far
+    volatile LONG m_symbolsWritten[SYMBOL_TABLE_MAX_SYMBOLS / 32];
+
+    void LogGap(unsigned int droppedBytes);
+};
+
+} // namespace oSpy
@@ -1,4 +1,5 @@
 #include <oSpyAgent/AgentPlugin.h>
+#include <InterceptPP/Format.h>
 
 #include <ks.h>
 #include <ksmedia.h>
@@ -110,7 +111,7 @@ private:
 
                 TrackedIoControl * ctx = new TrackedIoControl (
                     origArgs->dwIoControlCode, origArgs->lpOutBuffer, origArgs->nOutBufferSize,
-                    origArgs->lpBytesReturned, overlapped, call->GetLogEvent ()->GetId ());
+                    origArgs->lpBytesReturned, overlapped, call->GetLogWriter ()->GetId ());
 
                 this->Lock ();
                 if (Event::IsValidHandle (overlapped->hEvent))
@@ -130,9 +131,8 @@ private:
 
         Logging::Element * ptrNode = new Logging::Element ("value");
         ptrNode->AddField ("type", "Pointer");
-        OOStringStream ss;
-        ss << "0x" << hex << (DWORD) streamHdr;
-        ptrNode->AddField ("value", ss.str ());
+        char buf[FORMAT_MAX_LENGTH];
+        ptrNode->AddField ("value", OString (buf, Format::HexPrefixed (buf, (DWORD) streamHdr)));
         el->AppendChild (ptrNode);
 
         Logging::DataNode * streamHdrNode = new Logging::DataNode ("value");
@@ -194,9 +194,7 @@ private:
                 Logging::Event * ev = m_logger->NewEvent ("AsyncResult");
 
                 Logging::TextNode * reqIdNode = new Logging::TextNode ("requestId");
-                OOStringStream ss;
-                ss << ctx->m_logEventId;
-                reqIdNode->SetText (ss.str ());
+                reqIdNode->SetText (Format::ToString (ctx->m_logEventId));
                 ev->AppendChild (reqIdNode);
 
                 Logging::Element * dataEl = new Logging::Element ("data");
@@ -231,9 +229,8 @@ private:
 
         Logging::Element * ptrNode = new Logging::Element ("value");
         ptrNode->AddField ("type", "Pointer");
-        OOStringStream ss;
-        ss << "0x" << hex << (DWORD) conn;
-        ptrNode->AddField ("value", ss.str ());
+        char buf[FORMAT_MAX_LENGTH];
+        ptrNode->AddField ("value", OString (buf, Format::HexPrefixed (buf, (DWORD) conn)));
         argElement->AppendChild (ptrNode);
 
         if (conn != NULL)
@@ -20,6 +20,16 @@
 #include <InterceptPP/Core.h>
 #include <InterceptPP/Util.h>
 #include <InterceptPP/HookManager.h>
+#include <InterceptPP/RawCapture.h>
+#include <InterceptPP/PayloadTable.h>
+#include <InterceptPP/BinaryWriter.h>
+#include <InterceptPP/Clock.h>
+#include <InterceptPP/RecordRing.h>
+#include <InterceptPP/Format.h>
+#include <InterceptPP/MappedLog.h>
+#include <InterceptPP/LzCodec.h>
+#include <InterceptPP/LogIndex.h>
+#include <InterceptPP/LogManifest.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
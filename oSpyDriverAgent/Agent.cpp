@@ -33,7 +33,8 @@ typedef struct {
 } AgentDeviceData;
 
 void
-Agent::Initialize (DRIVER_OBJECT * driverObject)
+Agent::Initialize (DRIVER_OBJECT * driverObject,
+                   UNICODE_STRING * registryPath)
 {
   KdPrint (("oSpyDriverAgent snapshot (" __DATE__ " " __TIME__ ") initializing\n"));
 
@@ -52,7 +53,7 @@ Agent::Initialize (DRIVER_OBJECT * driverObject)
   driverObject->MajorFunction[IRP_MJ_INTERNAL_DEVICE_CONTROL] =
     Agent::OnInternalIoctlIrp;
 
-  Logger::Initialize ();
+  Logger::Initialize (registryPath);
 }
 
 void
@@ -262,19 +263,35 @@ Agent::OnInternalIoctlIrp (DEVICE_OBJECT * filterDeviceObject,
   if (!NT_SUCCESS (status))
     return CompleteRequest (irp, status);
 
+  // The completion routine releases the remove lock, if it gets set
+  bool completionSet = false;
+
+  URB * urb = NULL;
+  Event * ev = NULL;
   if (controlCode == IOCTL_INTERNAL_USB_SUBMIT_URB)
   {
-    URB * urb = static_cast <URB *>
-      (stackLocation->Parameters.Others.Argument1);
+    urb = static_cast <URB *> (stackLocation->Parameters.Others.Argument1);
 
-    Event * ev = priv->logger.NewEvent ("IOCTL_INTERNAL_USB_SUBMIT_URB", 3, urb);
+    // NULL if the logger is full, see Logger.h
+    ev = priv->logger.NewEvent ("IOCTL_INTERNAL_USB_SUBMIT_URB", 3, urb);
+  }
+  else
+  {
+    KdPrint (("Agent::OnInternalIoctlIrp: controlCode=0x%08x\n", controlCode));
+  }
 
+  if (ev != NULL)
+  {
     Urb::AppendToNode (urb, ev, ev, true);
 
     IoCopyCurrentIrpStackLocationToNext (irp);
     status = IoSetCompletionRoutineEx (priv->filterDeviceObject, irp,
       OnUrbIoctlCompletion, ev, TRUE, TRUE, TRUE);
-    if (!NT_SUCCESS (status))
+    if (NT_SUCCESS (status))
+    {
+      completionSet = true;
+    }
+    else
     {
       KdPrint (("Agent::OnInternalIoctlIrp: IoSetCompletionRoutineEx "
         "failed\n"));
@@ -283,13 +300,12 @@ Agent::OnInternalIoctlIrp (DEVICE_OBJECT * filterDeviceObject,
   }
   else
   {
-    KdPrint (("Agent::OnInternalIoctlIrp: controlCode=0x%08x\n", controlCode));
     IoSkipCurrentIrpStackLocation (irp);
   }
 
   status = IoCallDriver (priv->funcDeviceObject, irp);
 
-  if (controlCode != IOCTL_INTERNAL_USB_SUBMIT_URB)
+  if (!completionSet)
     IoReleaseRemoveLock (&priv->removeLock, irp);
 
   return status;
@@ -25,7 +25,7 @@ namespace oSpy {
 class Agent
 {
 public:
-  static void Initialize (DRIVER_OBJECT * driverObject);
+  static void Initialize (DRIVER_OBJECT * driverObject, UNICODE_STRING * registryPath);
 
 private:
   // Handlers
@@ -21,6 +21,6 @@ extern "C" NTSTATUS
 DriverEntry (DRIVER_OBJECT * driverObject,
              UNICODE_STRING * registryPath)
 {
-  oSpy::Agent::Initialize (driverObject);
+  oSpy::Agent::Initialize (driverObject, registryPath);
   return STATUS_SUCCESS;
 }
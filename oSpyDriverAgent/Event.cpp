@@ -87,7 +87,8 @@ void
 Event::Initialize (ULONG id,
                    LARGE_INTEGER timestamp,
                    const char * eventType,
-                   int childCapacity)
+                   int childCapacity,
+                   int extraFieldCapacity)
 {
   Node::Initialize ();
 
@@ -99,7 +100,7 @@ Event::Initialize (ULONG id,
 
   m_name = CreateString ("Event");
 
-  CreateFieldStorage (this, 6);
+  CreateFieldStorage (this, 6 + extraFieldCapacity);
   AddFieldToNodePrintf (this, "id", "%lu", id);
   AddFieldToNodePrintf (this, "timestamp", "%lld", timestamp.QuadPart);
   AddFieldToNode (this, "type", eventType);
@@ -59,7 +59,7 @@ typedef struct
 class Event : public Node
 {
 public:
-  void Initialize (ULONG id, LARGE_INTEGER timestamp, const char * eventType, int childCapacity);
+  void Initialize (ULONG id, LARGE_INTEGER timestamp, const char * eventType, int childCapacity, int extraFieldCapacity=0);
   void Destroy ();
 
   void AddFieldToNode (Node * node, const char * key, const char * value);
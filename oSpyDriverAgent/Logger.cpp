@@ -21,23 +21,67 @@
 
 namespace oSpy {
 
+#define DEFAULT_MAX_QUEUED_BYTES (8 * 1024 * 1024)
+
 HANDLE Logger::m_captureSection = NULL;
 Capture * Logger::m_capture = NULL;
 volatile ULONG Logger::m_index = 0;
 
+ULONG Logger::m_maxQueuedBytes = DEFAULT_MAX_QUEUED_BYTES;
+ULONG Logger::m_queuePolicy = QUEUE_FULL_DROP;
+ULONG Logger::m_queueTimeout = 0;
+volatile LONG Logger::m_queuedBytes = 0;
+
+//
+// Takes a registry value only if it really is a DWORD, so that a value of
+// some other type can't be copied over the ULONG it was meant for.
+//
+static NTSTATUS NTAPI
+QueryDwordValue (PWSTR valueName, ULONG valueType, PVOID valueData,
+                 ULONG valueLength, PVOID context, PVOID entryContext)
+{
+  if (valueType == REG_DWORD && valueLength == sizeof (ULONG))
+    *static_cast <ULONG *> (entryContext) = *static_cast <ULONG *> (valueData);
+  else
+    KdPrint (("Ignoring %ws: not a REG_DWORD\n", valueName));
+
+  return STATUS_SUCCESS;
+}
+
 void
-Logger::Initialize ()
+Logger::Initialize (const UNICODE_STRING * registryPath)
 {
   m_captureSection = NULL;
   m_capture = NULL;
 
+  // Values that aren't there keep their defaults
+  RTL_QUERY_REGISTRY_TABLE query[4];
+  RtlZeroMemory (query, sizeof (query));
+
+  query[0].QueryRoutine = QueryDwordValue;
+  query[0].Name = L"LogQueueBytes";
+  query[0].EntryContext = &m_maxQueuedBytes;
+
+  query[1].QueryRoutine = QueryDwordValue;
+  query[1].Name = L"LogQueuePolicy";
+  query[1].EntryContext = &m_queuePolicy;
+
+  query[2].QueryRoutine = QueryDwordValue;
+  query[2].Name = L"LogQueueTimeout";
+  query[2].EntryContext = &m_queueTimeout;
+
+  NTSTATUS status = RtlQueryRegistryValues (
+    RTL_REGISTRY_ABSOLUTE | RTL_REGISTRY_OPTIONAL, registryPath->Buffer,
+    query, NULL, NULL);
+  if (!NT_SUCCESS (status))
+    KdPrint (("RtlQueryRegistryValues failed: 0x%08x", status));
+
   UNICODE_STRING objName;
   RtlInitUnicodeString (&objName, L"\\BaseNamedObjects\\oSpyCapture");
 
   OBJECT_ATTRIBUTES attrs;
   InitializeObjectAttributes (&attrs, &objName, 0, NULL, NULL);
 
-  NTSTATUS status;
   status = ZwOpenSection (&m_captureSection, SECTION_ALL_ACCESS, &attrs);
   if (NT_SUCCESS (status))
   {
@@ -58,6 +102,7 @@ Logger::Initialize ()
   }
 
   m_index = 0;
+  m_queuedBytes = 0;
 }
 
 void
@@ -116,6 +161,8 @@ Logger::Start (const WCHAR * fnSuffix)
     ExInitializeSListHead (&m_items);
     KeInitializeSpinLock (&m_itemsLock);
 
+    m_droppedEvents = 0;
+
     OBJECT_ATTRIBUTES attrs;
     InitializeObjectAttributes (&attrs, &logfilePath, 0, NULL, NULL);
 
@@ -228,26 +275,63 @@ Logger::ProcessItems ()
 
     DestroyEntry (entry);
   }
+
+  if (m_droppedEvents != 0)
+    LogGap ();
 }
 
 void
-Logger::DestroyEntry (LogEntry * entry)
+Logger::LogGap ()
 {
-  entry->event.Destroy ();
+  LONG dropped = InterlockedExchange (&m_droppedEvents, 0);
 
-  ExFreePoolWithTag (entry, 'SpSo');
+  // Not held up by the limit, it's what tells about it
+  InterlockedExchangeAdd (&m_queuedBytes, static_cast <LONG> (sizeof (LogEntry)));
+
+  LogEntry * entry = CreateEntry ("LogGap", 0, 1);
+  if (entry == NULL)
+  {
+    InterlockedExchangeAdd (&m_droppedEvents, dropped);
+    return;
+  }
+
+  entry->event.AddFieldToNodePrintf (&entry->event, "droppedEvents", "%ld",
+    dropped);
+
+  WriteNode (&entry->event);
+
+  DestroyEntry (entry);
 }
 
-Event *
-Logger::NewEvent (const char * eventType,
-                  int childCapacity,
-                  void * userData)
+bool
+Logger::ReserveEntry ()
+{
+  for (;;)
+  {
+    LONG queued = m_queuedBytes;
+
+    if (queued + sizeof (LogEntry) > m_maxQueuedBytes)
+      return false;
+
+    if (InterlockedCompareExchange (&m_queuedBytes,
+      queued + static_cast <LONG> (sizeof (LogEntry)), queued) == queued)
+    {
+      return true;
+    }
+  }
+}
+
+LogEntry *
+Logger::CreateEntry (const char * eventType,
+                     int childCapacity,
+                     int extraFieldCapacity)
 {
   LogEntry * logEntry = static_cast <LogEntry *> (
     ExAllocatePoolWithTag (NonPagedPool, sizeof (LogEntry), 'SpSo'));
   if (logEntry == NULL)
   {
     KdPrint (("ExAllocatePoolWithTag failed\n"));
+    InterlockedExchangeAdd (&m_queuedBytes, -static_cast <LONG> (sizeof (LogEntry)));
     return NULL;
   }
 
@@ -255,8 +339,67 @@ Logger::NewEvent (const char * eventType,
   LARGE_INTEGER timestamp;
   KeQuerySystemTime (&timestamp);
 
+  logEntry->event.Initialize (id, timestamp, eventType, childCapacity,
+    extraFieldCapacity);
+
+  return logEntry;
+}
+
+void
+Logger::DestroyEntry (LogEntry * entry)
+{
+  entry->event.Destroy ();
+
+  ExFreePoolWithTag (entry, 'SpSo');
+
+  InterlockedExchangeAdd (&m_queuedBytes, -static_cast <LONG> (sizeof (LogEntry)));
+}
+
+Event *
+Logger::NewEvent (const char * eventType,
+                  int childCapacity,
+                  void * userData)
+{
+  if (!ReserveEntry ())
+  {
+    // Waiting is only allowed below DISPATCH_LEVEL
+    bool reserved = false;
+
+    if (m_queuePolicy == QUEUE_FULL_BLOCK && KeGetCurrentIrql () < DISPATCH_LEVEL)
+    {
+      // In units of 100 nanoseconds
+      ULONGLONG start = KeQueryInterruptTime ();
+      ULONGLONG timeout = static_cast <ULONGLONG> (m_queueTimeout) * 10000;
+
+      LARGE_INTEGER interval;
+      interval.QuadPart = -10000; // 1 ms from now
+
+      while (!reserved && KeQueryInterruptTime () - start < timeout)
+      {
+        KeSetEvent (&m_workEvent, IO_NO_INCREMENT, FALSE);
+
+        if (KeWaitForSingleObject (&m_stopEvent, Executive, KernelMode,
+          FALSE, &interval) == STATUS_SUCCESS)
+        {
+          break;
+        }
+
+        reserved = ReserveEntry ();
+      }
+    }
+
+    if (!reserved)
+    {
+      InterlockedIncrement (&m_droppedEvents);
+      return NULL;
+    }
+  }
+
+  LogEntry * logEntry = CreateEntry (eventType, childCapacity, 0);
+  if (logEntry == NULL)
+    return NULL;
+
   Event * ev = &logEntry->event;
-  ev->Initialize (id, timestamp, eventType, childCapacity);
   ev->m_userData = userData;
 
   //KdPrint (("Logger::NewEvent: ev=%p, id=%d\n", ev, id));
@@ -43,10 +43,32 @@ typedef struct {
   Event event;
 } LogEntry;
 
+//
+// Entries waiting to be written, or still being filled in, are charged
+// against LogQueueBytes, shared by all devices as they all come out of
+// the non-paged pool.  What happens to an event that doesn't fit is up
+// to LogQueuePolicy:
+//
+//   0  block   NewEvent () waits up to LogQueueTimeout milliseconds for
+//              room, when called below DISPATCH_LEVEL, then gives up
+//   1  drop    NewEvent () gives up right away
+//   2  summarize  same as drop, an entry is as small as an event gets
+//
+// NewEvent () returns NULL when it gives up, and the events lost are
+// logged as a LogGap event.  The settings are REG_DWORD values of the
+// driver's service key, and default to 8 MB and dropping.
+//
+
+typedef enum {
+  QUEUE_FULL_BLOCK = 0,
+  QUEUE_FULL_DROP,
+  QUEUE_FULL_SUMMARIZE
+} QueueFullPolicy;
+
 class Logger
 {
 public:
-  static void Initialize ();
+  static void Initialize (const UNICODE_STRING * registryPath);
   static void Shutdown ();
 
   NTSTATUS Start (const WCHAR * fnSuffix);
@@ -60,7 +82,10 @@ private:
   static void LogThreadFuncWrapper (void * parameter) { static_cast <Logger *> (parameter)->LogThreadFunc (); }
   void LogThreadFunc ();
   void ProcessItems ();
+  void LogGap ();
 
+  bool ReserveEntry ();
+  LogEntry * CreateEntry (const char * eventType, int childCapacity, int extraFieldCapacity);
   void DestroyEntry (LogEntry * entry);
 
   void WriteNode (const Node * node);
@@ -73,6 +98,11 @@ private:
   static Capture * m_capture;
   static volatile ULONG m_index;
 
+  static ULONG m_maxQueuedBytes;
+  static ULONG m_queuePolicy;
+  static ULONG m_queueTimeout;
+  static volatile LONG m_queuedBytes;
+
   HANDLE m_fileHandle;
 
   KEVENT m_workEvent;
@@ -81,6 +111,9 @@ private:
 
   SLIST_HEADER m_items;
   KSPIN_LOCK m_itemsLock;
+
+  // Events lost since the last LogGap event
+  volatile LONG m_droppedEvents;
 };
 
 } // namespace oSpy